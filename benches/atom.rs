@@ -3,6 +3,7 @@ use std::str::FromStr;
 use criterion::Criterion;
 
 use pkgcraft::atom::Atom;
+use pkgcraft::eapi::{EAPI1, EAPI5, EAPI8};
 
 #[allow(unused_must_use)]
 pub fn bench_pkg_atoms(c: &mut Criterion) {
@@ -26,6 +27,19 @@ pub fn bench_pkg_atoms(c: &mut Criterion) {
         b.iter(|| Atom::from_str(&s));
     });
 
+    // EAPI feature checks are hit for each optional atom component
+    c.bench_function("atom-parse-eapi1-slotdep", |b| b.iter(|| EAPI1.atom("cat/pkg:0")));
+
+    c.bench_function("atom-parse-eapi5-subslot", |b| {
+        b.iter(|| EAPI5.atom("!!>=cat/pkg-4-r1:0/1=[a,b(+)=,!c(-)?]"))
+    });
+
+    c.bench_function("atom-parse-eapi8-subslot", |b| {
+        b.iter(|| EAPI8.atom("!!>=cat/pkg-4-r1:0/1=[a,b(+)=,!c(-)?]"))
+    });
+
+    c.bench_function("eapi-cmp-lt", |b| b.iter(|| *EAPI5 < *EAPI8));
+
     c.bench_function("atom-cmp-eq", |b| {
         let a1 = Atom::from_str("=cat/pkg-1.2.3").unwrap();
         let a2 = Atom::from_str("=cat/pkg-1.2.3").unwrap();
@@ -1,11 +1,17 @@
 use criterion::*;
 
 mod atom;
+mod config;
+mod pkgsh;
+mod repo;
 mod required_use;
 mod version;
 
 criterion_group!(atom, atom::bench_pkg_atoms);
+criterion_group!(config, config::bench_config_startup);
+criterion_group!(pkgsh, pkgsh::bench_pkgsh_builtins);
+criterion_group!(repo, repo::bench_repo_listing, repo::bench_repo_load);
 criterion_group!(required_use, required_use::bench_parse_required_use);
 criterion_group!(version, version::bench_pkg_versions);
 
-criterion_main!(atom, required_use, version);
+criterion_main!(atom, config, pkgsh, repo, required_use, version);
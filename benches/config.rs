@@ -0,0 +1,62 @@
+use std::{env, fs};
+
+use camino::Utf8Path;
+use criterion::Criterion;
+use tempfile::tempdir;
+
+use pkgcraft::config::Config;
+
+const REPOS: usize = 50;
+
+// Create an ebuild repo inheriting from an optional master repo.
+fn create_repo(path: &Utf8Path, name: &str, master: Option<&str>) {
+    for dir in ["metadata", "profiles", "cat/pkg"] {
+        fs::create_dir_all(path.join(dir)).unwrap();
+    }
+    fs::write(path.join("profiles/repo_name"), format!("{name}\n")).unwrap();
+    if let Some(master) = master {
+        fs::write(path.join("metadata/layout.conf"), format!("masters = {master}\n")).unwrap();
+    }
+    fs::write(path.join("cat/pkg/pkg-1.ebuild"), "EAPI=8\nSLOT=0\n").unwrap();
+}
+
+pub fn bench_config_startup(c: &mut Criterion) {
+    let dir = tempdir().unwrap();
+    let path = Utf8Path::from_path(dir.path()).unwrap();
+    let config_dir = path.join("config/pkgcraft/repos");
+    fs::create_dir_all(&config_dir).unwrap();
+
+    // configure repos that all use the first repo as their master
+    for i in 0..REPOS {
+        let name = format!("repo{i}");
+        let repo = path.join("repos").join(&name);
+        create_repo(&repo, &name, Some("repo0").filter(|_| i > 0));
+        let data = format!("location = {repo:?}\nformat = \"ebuild\"\npriority = {i}\n");
+        fs::write(config_dir.join(&name), data).unwrap();
+    }
+
+    // use the generated config instead of the user's
+    let vars = ["HOME", "XDG_CONFIG_HOME"];
+    let orig: Vec<_> = vars.iter().map(|v| env::var_os(v)).collect();
+    env::set_var("HOME", path);
+    env::set_var("XDG_CONFIG_HOME", path.join("config"));
+
+    c.bench_function("config-startup-50-repos", |b| {
+        b.iter(|| Config::new("pkgcraft", "", false).unwrap())
+    });
+
+    c.bench_function("config-startup-50-repos-single-access", |b| {
+        b.iter(|| {
+            let config = Config::new("pkgcraft", "", false).unwrap();
+            let repo = config.repos.get("repo49").unwrap();
+            assert_eq!(repo.as_ebuild().unwrap().masters().len(), 1);
+        })
+    });
+
+    for (var, val) in vars.iter().zip(orig) {
+        match val {
+            Some(val) => env::set_var(var, val),
+            None => env::remove_var(var),
+        }
+    }
+}
@@ -0,0 +1,46 @@
+use std::fs;
+
+use camino::Utf8Path;
+use criterion::Criterion;
+use indoc::formatdoc;
+use tempfile::tempdir;
+
+use pkgcraft::config::Config;
+
+// Create an ebuild repo containing a package that runs a command in a tight loop.
+fn create_repo(path: &Utf8Path, name: &str, cmd: &str) {
+    for dir in ["metadata", "profiles", "cat/pkg"] {
+        fs::create_dir_all(path.join(dir)).unwrap();
+    }
+    fs::write(path.join("profiles/repo_name"), format!("{name}\n")).unwrap();
+    let data = formatdoc! {r#"
+        EAPI=8
+        DESCRIPTION="sourcing benchmark"
+        SLOT=0
+        for ((i = 0; i < 1000; i++)); do
+            {cmd} || :
+        done
+    "#};
+    fs::write(path.join("cat/pkg/pkg-1.ebuild"), data).unwrap();
+}
+
+pub fn bench_pkgsh_builtins(c: &mut Criterion) {
+    let dir = tempdir().unwrap();
+    let path = Utf8Path::from_path(dir.path()).unwrap();
+    let mut config = Config::new("pkgcraft", "", false).unwrap();
+
+    // `use` and `usex` are only enabled in phase scope so they can't be run while sourcing
+    let cmds = [
+        ("noop", ":"),
+        ("has", "has b a b c"),
+        ("ver_cut", "ver_cut 1-2 1.2.3_alpha4"),
+        ("ver_rs", "ver_rs 1-2 _ 1.2.3_alpha4"),
+        ("ver_test", "ver_test 1.2.3 -lt 1.2.4"),
+    ];
+    for (name, cmd) in cmds {
+        let repo_path = path.join(name);
+        create_repo(&repo_path, name, cmd);
+        let repo = config.add_repo_path(name, 0, repo_path.as_str()).unwrap();
+        c.bench_function(&format!("pkgsh-source-{name}"), |b| b.iter(|| repo.iter().count()));
+    }
+}
@@ -0,0 +1,63 @@
+use std::fs;
+
+use camino::Utf8Path;
+use criterion::{BatchSize, Criterion};
+use tempfile::tempdir;
+
+use pkgcraft::config::Config;
+use pkgcraft::repo::Repository;
+
+pub fn bench_repo_listing(c: &mut Criterion) {
+    let dir = tempdir().unwrap();
+    let path = Utf8Path::from_path(dir.path()).unwrap().join("fake");
+    let mut config = Config::new("pkgcraft", "", false).unwrap();
+
+    // fake repo with 30k packages spread across 100 categories
+    let mut cpvs = vec![];
+    for cat in 0..100 {
+        for pkg in 0..300 {
+            cpvs.push(format!("cat{cat}/pkg{pkg}-1"));
+        }
+    }
+    fs::write(&path, cpvs.join("\n")).unwrap();
+    let repo = config.add_repo_path("fake", 0, path.as_str()).unwrap();
+
+    c.bench_function("repo-fake-categories", |b| b.iter(|| repo.categories().len()));
+    c.bench_function("repo-fake-category-names", |b| {
+        b.iter(|| repo.category_names().iter().count())
+    });
+
+    c.bench_function("repo-fake-packages", |b| b.iter(|| repo.packages("cat50").len()));
+    c.bench_function("repo-fake-package-names", |b| {
+        b.iter(|| repo.package_names("cat50").iter().count())
+    });
+
+    c.bench_function("repo-fake-versions", |b| b.iter(|| repo.versions("cat50", "pkg150").len()));
+    c.bench_function("repo-fake-version-names", |b| {
+        b.iter(|| repo.version_names("cat50", "pkg150").iter().count())
+    });
+}
+
+pub fn bench_repo_load(c: &mut Criterion) {
+    let dir = tempdir().unwrap();
+    let path = Utf8Path::from_path(dir.path()).unwrap().join("fake");
+
+    // fake repo with 500k versions, similar to a large binary package cache
+    let mut cpvs = vec![];
+    for cat in 0..100 {
+        for pkg in 0..500 {
+            for ver in 0..10 {
+                cpvs.push(format!("cat{cat}/pkg{pkg}-{ver}.{pkg}-r{cat}"));
+            }
+        }
+    }
+    fs::write(&path, cpvs.join("\n")).unwrap();
+
+    c.bench_function("repo-fake-load-500k", |b| {
+        b.iter_batched(
+            || Config::new("pkgcraft", "", false).unwrap(),
+            |mut config| config.add_repo_path("fake", 0, path.as_str()).unwrap(),
+            BatchSize::LargeInput,
+        )
+    });
+}
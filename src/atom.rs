@@ -120,11 +120,34 @@ pub struct Atom {
 )]
 /// Create a new Atom from a given CPV string (e.g. cat/pkg-1).
 pub fn cpv(s: &str) -> crate::Result<Atom> {
+    cpv_uncached(s)
+}
+
+/// Create a new Atom from a given CPV string, bypassing the shared parsing cache.
+///
+/// This is used when parsing large numbers of unique CPVs in parallel since the cache is
+/// guarded by a global lock and would rarely be hit.
+pub(crate) fn cpv_uncached(s: &str) -> crate::Result<Atom> {
     let mut atom = parse::cpv(s)?;
     atom.version_str = Some(s);
     atom.into_owned()
 }
 
+/// Create a new Atom from separate category, package, and version strings.
+///
+/// This avoids formatting a CPV string and the shared parsing cache when the components are
+/// already split apart, e.g. for ebuild file paths.
+pub(crate) fn cpv_from_parts(cat: &str, pkg: &str, ver: &str) -> crate::Result<Atom> {
+    ParsedAtom {
+        category: parse::category(cat)?,
+        package: parse::package(pkg)?,
+        version: Some(parse::version_str(ver)?),
+        version_str: Some(ver),
+        ..Default::default()
+    }
+    .into_owned()
+}
+
 impl Atom {
     /// Verify a string represents a valid atom.
     pub fn valid<E: IntoEapi>(s: &str, eapi: E) -> crate::Result<()> {
@@ -1,6 +1,7 @@
 use super::version::ParsedVersion;
 use super::{Blocker, ParsedAtom, SlotOperator};
 use crate::eapi::{Eapi, Feature};
+use crate::peg::PegError;
 
 peg::parser! {
     pub(crate) grammar pkg() for str {
@@ -49,7 +50,8 @@ peg::parser! {
             = op:$(("<" "="?) / "=" / "~" / (">" "="?))
                     start:position!() numbers:$(['0'..='9']+) ++ "." letter:['a'..='z']?
                     suffixes:("_" s:version_suffix() ++ "_" {s})?
-                    end_base:position!() revision:revision()? end:position!() glob:$("*")? {?
+                    end_base:position!() revision:revision()? end:position!()
+                    glob:$("*")? {?
                 let ver = ParsedVersion {
                     start,
                     end_base,
@@ -67,101 +69,6 @@ peg::parser! {
             = "-r" s:$(quiet!{['0'..='9']+} / expected!("revision"))
             { s }
 
-        // Slot names must not begin with a hyphen, dot, or plus sign.
-        rule slot_name() -> &'input str
-            = s:$(quiet!{
-                ['a'..='z' | 'A'..='Z' | '0'..='9' | '_']
-                ['a'..='z' | 'A'..='Z' | '0'..='9' | '+' | '_' | '.' | '-']*
-            } / expected!("slot name")
-            ) { s }
-
-        rule slot(eapi: &'static Eapi) -> (&'input str, Option<&'input str>)
-            = slot:slot_name() subslot:subslot(eapi)? {
-                (slot, subslot)
-            }
-
-        rule slot_str(eapi: &'static Eapi) -> (Option<&'input str>, Option<&'input str>, Option<SlotOperator>)
-            = op:$("*" / "=") {?
-                if !eapi.has(Feature::SlotOps) {
-                    return Err("slot operators are supported in >= EAPI 5");
-                }
-                let op = match op {
-                    "*" => SlotOperator::Star,
-                    "=" => SlotOperator::Equal,
-                    _ => return Err("invalid slot operator"),
-                };
-                Ok((None, None, Some(op)))
-            } / slot:slot(eapi) op:$("=")? {?
-                if op.is_some() && !eapi.has(Feature::SlotOps) {
-                    return Err("slot operators are supported in >= EAPI 5");
-                }
-                let op = op.map(|_| SlotOperator::Equal);
-                Ok((Some(slot.0), slot.1, op))
-            }
-
-        rule slot_dep(eapi: &'static Eapi) -> (Option<&'input str>, Option<&'input str>, Option<SlotOperator>)
-            = ":" slot_parts:slot_str(eapi) {?
-                if !eapi.has(Feature::SlotDeps) {
-                    return Err("slot deps are supported in >= EAPI 1");
-                }
-                Ok(slot_parts)
-            }
-
-        rule blocker(eapi: &'static Eapi) -> Blocker
-            = blocker:("!"*<1,2>) {?
-                if eapi.has(Feature::Blockers) {
-                    match blocker.len() {
-                        1 => Ok(Blocker::Weak),
-                        2 => Ok(Blocker::Strong),
-                        _ => Err("invalid blocker"),
-                    }
-                } else {
-                    Err("blockers are supported in >= EAPI 2")
-                }
-            }
-
-        rule useflag() -> &'input str
-            = s:$(quiet!{
-                ['a'..='z' | 'A'..='Z' | '0'..='9']
-                ['a'..='z' | 'A'..='Z' | '0'..='9' | '+' | '_' | '@' | '-']*
-            } / expected!("useflag name")
-            ) { s }
-
-        rule use_dep(eapi: &'static Eapi) -> &'input str
-            = s:$(quiet!{
-                (useflag() use_dep_default(eapi)? ['=' | '?']?) /
-                ("-" useflag() use_dep_default(eapi)?) /
-                ("!" useflag() use_dep_default(eapi)? ['=' | '?'])
-            } / expected!("use dep")
-            ) { s }
-
-        rule use_deps(eapi: &'static Eapi) -> Vec<&'input str>
-            = "[" use_deps:use_dep(eapi) ++ "," "]" {?
-                if eapi.has(Feature::UseDeps) {
-                    Ok(use_deps)
-                } else {
-                    Err("use deps are supported in >= EAPI 2")
-                }
-            }
-
-        rule use_dep_default(eapi: &'static Eapi) -> &'input str
-            = s:$("(+)" / "(-)") {?
-                if eapi.has(Feature::UseDepDefaults) {
-                    Ok(s)
-                } else {
-                    Err("use dep defaults are supported in >= EAPI 4")
-                }
-            }
-
-        rule subslot(eapi: &'static Eapi) -> &'input str
-            = "/" s:slot_name() {?
-                if eapi.has(Feature::Subslots) {
-                    Ok(s)
-                } else {
-                    Err("subslots are supported in >= EAPI 5")
-                }
-            }
-
         // repo must not begin with a hyphen and must also be a valid package name
         pub(super) rule repo() -> &'input str
             = s:$(quiet!{
@@ -170,14 +77,6 @@ peg::parser! {
             } / expected!("repo name")
             ) { s }
 
-        rule repo_dep(eapi: &'static Eapi) -> &'input str
-            = "::" repo:repo() {?
-                if !eapi.has(Feature::RepoIds) {
-                    return Err("repo deps aren't supported in EAPIs");
-                }
-                Ok(repo)
-            }
-
         pub(super) rule cpv() -> ParsedAtom<'input>
             = cat:category() "/" pkg:package() "-" ver:version() {
                 ParsedAtom {
@@ -194,21 +93,220 @@ peg::parser! {
             } / cat:category() "/" pkg:package() {
                 (false, cat, pkg, None)
             }
+    }
+}
 
-        pub(super) rule dep(eapi: &'static Eapi) -> (&'input str, ParsedAtom<'input>)
-            = blocker:blocker(eapi)? dep:$([^':' | '[']+) slot_dep:slot_dep(eapi)?
-                    use_deps:use_deps(eapi)? repo:repo_dep(eapi)? {
-                let (slot, subslot, slot_op) = slot_dep.unwrap_or_default();
-                (dep, ParsedAtom {
-                    blocker,
-                    slot,
-                    subslot,
-                    slot_op,
-                    use_deps,
-                    repo,
-                    ..Default::default()
-                })
+// Grammar for the EAPI dependent atom components with feature checks resolved by a `has()`
+// function in the enclosing module. EAPI independent rules are shared from the `pkg` grammar,
+// `$d` is required to pass through `$` for the grammar's slice captures.
+macro_rules! dep_grammar {
+    ($d:tt) => {
+        peg::parser! {
+            grammar atom() for str {
+                // Slot names must not begin with a hyphen, dot, or plus sign.
+                rule slot_name() -> &'input str
+                    = s:$d(quiet!{
+                        ['a'..='z' | 'A'..='Z' | '0'..='9' | '_']
+                        ['a'..='z' | 'A'..='Z' | '0'..='9' | '+' | '_' | '.' | '-']*
+                    } / expected!("slot name")
+                    ) { s }
+
+                rule slot() -> (&'input str, Option<&'input str>)
+                    = slot:slot_name() subslot:subslot()? {
+                        (slot, subslot)
+                    }
+
+                rule slot_str() -> (Option<&'input str>, Option<&'input str>, Option<SlotOperator>)
+                    = op:$d("*" / "=") {?
+                        if !has(Feature::SlotOps) {
+                            return Err("slot operators are supported in >= EAPI 5");
+                        }
+                        let op = match op {
+                            "*" => SlotOperator::Star,
+                            "=" => SlotOperator::Equal,
+                            _ => return Err("invalid slot operator"),
+                        };
+                        Ok((None, None, Some(op)))
+                    } / slot:slot() op:$d("=")? {?
+                        if op.is_some() && !has(Feature::SlotOps) {
+                            return Err("slot operators are supported in >= EAPI 5");
+                        }
+                        let op = op.map(|_| SlotOperator::Equal);
+                        Ok((Some(slot.0), slot.1, op))
+                    }
+
+                rule slot_dep() -> (Option<&'input str>, Option<&'input str>, Option<SlotOperator>)
+                    = ":" slot_parts:slot_str() {?
+                        if !has(Feature::SlotDeps) {
+                            return Err("slot deps are supported in >= EAPI 1");
+                        }
+                        Ok(slot_parts)
+                    }
+
+                rule blocker() -> Blocker
+                    = blocker:("!"*<1,2>) {?
+                        if has(Feature::Blockers) {
+                            match blocker.len() {
+                                1 => Ok(Blocker::Weak),
+                                2 => Ok(Blocker::Strong),
+                                _ => Err("invalid blocker"),
+                            }
+                        } else {
+                            Err("blockers are supported in >= EAPI 2")
+                        }
+                    }
+
+                rule useflag() -> &'input str
+                    = s:$d(quiet!{
+                        ['a'..='z' | 'A'..='Z' | '0'..='9']
+                        ['a'..='z' | 'A'..='Z' | '0'..='9' | '+' | '_' | '@' | '-']*
+                    } / expected!("useflag name")
+                    ) { s }
+
+                rule use_dep() -> &'input str
+                    = s:$d(quiet!{
+                        (useflag() use_dep_default()? ['=' | '?']?) /
+                        ("-" useflag() use_dep_default()?) /
+                        ("!" useflag() use_dep_default()? ['=' | '?'])
+                    } / expected!("use dep")
+                    ) { s }
+
+                rule use_deps() -> Vec<&'input str>
+                    = "[" use_deps:use_dep() ++ "," "]" {?
+                        if has(Feature::UseDeps) {
+                            Ok(use_deps)
+                        } else {
+                            Err("use deps are supported in >= EAPI 2")
+                        }
+                    }
+
+                rule use_dep_default() -> &'input str
+                    = s:$d("(+)" / "(-)") {?
+                        if has(Feature::UseDepDefaults) {
+                            Ok(s)
+                        } else {
+                            Err("use dep defaults are supported in >= EAPI 4")
+                        }
+                    }
+
+                rule subslot() -> &'input str
+                    = "/" s:slot_name() {?
+                        if has(Feature::Subslots) {
+                            Ok(s)
+                        } else {
+                            Err("subslots are supported in >= EAPI 5")
+                        }
+                    }
+
+                // repo deps end atoms so the remaining input is validated as a repo name
+                rule repo_dep() -> &'input str
+                    = "::" repo:$d([_]+) {?
+                        if !has(Feature::RepoIds) {
+                            return Err("repo deps aren't supported in EAPIs");
+                        }
+                        super::pkg::repo(repo).map_err(|_| "invalid repo name")
+                    }
+
+                pub(super) rule dep() -> (&'input str, ParsedAtom<'input>)
+                    = blocker:blocker()? dep:$d([^':' | '[']+) slot_dep:slot_dep()?
+                            use_deps:use_deps()? repo:repo_dep()? {
+                        let (slot, subslot, slot_op) = slot_dep.unwrap_or_default();
+                        (dep, ParsedAtom {
+                            blocker,
+                            slot,
+                            subslot,
+                            slot_op,
+                            use_deps,
+                            repo,
+                            ..Default::default()
+                        })
+                    }
+            }
+        }
+    };
+}
+
+// Generate a dep grammar per EAPI atom feature profile, using constant feature sets so
+// feature checks are folded away at compile time.
+macro_rules! specialize {
+    ($d:tt $($name:ident => $features:expr),+ $(,)?) => {$(
+        pub(crate) mod $name {
+            use super::*;
+
+            pub(crate) const FEATURES: u64 = $features;
+
+            #[inline(always)]
+            const fn has(feature: Feature) -> bool {
+                FEATURES & feature.bit() != 0
             }
+
+            /// Parse an atom's EAPI dependent components.
+            pub(super) fn dep(s: &str) -> Result<(&str, ParsedAtom), PegError> {
+                atom::dep(s)
+            }
+
+            dep_grammar!($d);
+        }
+    )+};
+}
+
+specialize! {
+    $
+    eapi0 => 0,
+    eapi1 => eapi0::FEATURES | Feature::SlotDeps.bit(),
+    eapi2 => eapi1::FEATURES | Feature::Blockers.bit() | Feature::UseDeps.bit(),
+    eapi4 => eapi2::FEATURES | Feature::UseDepDefaults.bit(),
+    eapi5 => eapi4::FEATURES | Feature::SlotOps.bit() | Feature::Subslots.bit(),
+    extended => eapi5::FEATURES | Feature::RepoIds.bit(),
+}
+
+// Grammar instance checking features at runtime against the EAPI being parsed, used for EAPIs
+// whose atom features don't match a specialized profile.
+pub(crate) mod dynamic {
+    use std::cell::Cell;
+
+    use super::*;
+
+    thread_local! {
+        static FEATURES: Cell<u64> = Cell::new(0);
+    }
+
+    fn has(feature: Feature) -> bool {
+        FEATURES.with(|f| f.get() & feature.bit() != 0)
+    }
+
+    /// Parse an atom's EAPI dependent components, checking features against the given EAPI.
+    pub(crate) fn dep<'a>(s: &'a str, eapi: &Eapi) -> Result<(&'a str, ParsedAtom<'a>), PegError> {
+        FEATURES.with(|f| f.set(eapi.features()));
+        atom::dep(s)
+    }
+
+    dep_grammar!($);
+}
+
+// all features affecting atom parsing, which the extended profile must enable
+const ATOM_FEATURES: u64 = Feature::SlotDeps.bit()
+    | Feature::Blockers.bit()
+    | Feature::UseDeps.bit()
+    | Feature::UseDepDefaults.bit()
+    | Feature::SlotOps.bit()
+    | Feature::Subslots.bit()
+    | Feature::RepoIds.bit();
+
+/// Parse an atom's EAPI dependent components using the parser specialized for an EAPI, falling
+/// back to runtime feature checks for unspecialized feature profiles.
+fn dep_components<'a>(
+    s: &'a str,
+    eapi: &'static Eapi,
+) -> Result<(&'a str, ParsedAtom<'a>), PegError> {
+    match eapi.features() & ATOM_FEATURES {
+        eapi0::FEATURES => eapi0::dep(s),
+        eapi1::FEATURES => eapi1::dep(s),
+        eapi2::FEATURES => eapi2::dep(s),
+        eapi4::FEATURES => eapi4::dep(s),
+        eapi5::FEATURES => eapi5::dep(s),
+        extended::FEATURES => extended::dep(s),
+        _ => dynamic::dep(s, eapi),
     }
 }
 
@@ -260,7 +358,7 @@ pub mod parse {
 
     pub(crate) fn dep_str<'a>(s: &'a str, eapi: &'static Eapi) -> crate::Result<ParsedAtom<'a>> {
         let (dep, mut atom) =
-            pkg::dep(s, eapi).map_err(|e| peg_error(format!("invalid atom: {s:?}"), s, e))?;
+            dep_components(s, eapi).map_err(|e| peg_error(format!("invalid atom: {s:?}"), s, e))?;
         let attrs =
             pkg::cpv_or_cp(dep).map_err(|e| peg_error(format!("invalid atom: {s:?}"), dep, e))?;
 
@@ -307,6 +405,48 @@ mod tests {
 
     use super::*;
 
+    #[test]
+    fn test_specialized_parsers() {
+        // the extended profile covers all atom features
+        assert_eq!(extended::FEATURES, ATOM_FEATURES);
+
+        // all EAPIs use a specialized parser
+        let profiles = [
+            eapi0::FEATURES,
+            eapi1::FEATURES,
+            eapi2::FEATURES,
+            eapi4::FEATURES,
+            eapi5::FEATURES,
+            extended::FEATURES,
+        ];
+        for eapi in eapi::EAPIS.values() {
+            let features = eapi.features() & ATOM_FEATURES;
+            assert!(profiles.contains(&features), "EAPI {eapi}: unspecialized atom features");
+            assert!(parse::dep("cat/pkg", eapi).is_ok(), "EAPI {eapi} failed");
+        }
+
+        // recent EAPIs share a profile
+        for eapi in [&*eapi::EAPI5, &*eapi::EAPI7, &*eapi::EAPI8] {
+            assert_eq!(eapi.features() & ATOM_FEATURES, eapi5::FEATURES);
+        }
+        assert_eq!(eapi::EAPI_PKGCRAFT.features() & ATOM_FEATURES, extended::FEATURES);
+    }
+
+    #[test]
+    fn test_dynamic_parser() {
+        // runtime feature checks match the specialized parsers
+        let atoms = Atoms::load().unwrap();
+        let valid = atoms.valid.iter().map(|a| a.atom.as_str());
+        let invalid = atoms.invalid.iter().map(|(s, _)| s.as_str());
+        for s in valid.chain(invalid) {
+            for eapi in eapi::EAPIS.values() {
+                let expected = dep_components(s, eapi).map(|(dep, _)| dep).ok();
+                let result = dynamic::dep(s, eapi).map(|(dep, _)| dep).ok();
+                assert_eq!(result, expected, "EAPI {eapi}: {s:?}");
+            }
+        }
+    }
+
     #[test]
     fn test_parse_versions() {
         let all_eapis: IndexSet<&eapi::Eapi> = eapi::EAPIS.values().cloned().collect();
@@ -6,6 +6,8 @@ use std::process::Command;
 use crate::Error;
 
 fn run_cmd(cmd: &mut Command) -> crate::Result<()> {
+    // command output goes directly to the inherited descriptors
+    crate::pkgsh::flush_output();
     match cmd.status() {
         Ok(r) => match r.success() {
             true => Ok(()),
@@ -1,7 +1,8 @@
 use std::env;
 use std::fs;
-use std::sync::{Arc, RwLock};
+use std::sync::Arc;
 
+use arc_swap::ArcSwap;
 use camino::Utf8PathBuf;
 use once_cell::sync::Lazy;
 use serde::{Deserialize, Serialize};
@@ -10,8 +11,9 @@ use crate::macros::build_from_paths;
 use crate::repo::Repo;
 use crate::Error;
 pub(crate) use repo::RepoConfig;
+pub use repo::SyncOptions;
 
-mod repo;
+pub(crate) mod repo;
 
 #[derive(Debug, Default, Clone, Deserialize, Serialize)]
 pub struct ConfigPath {
@@ -100,24 +102,29 @@ pub struct Config {
     pub repos: repo::Config,
 }
 
-static CURRENT_CONFIG: Lazy<RwLock<Arc<Config>>> = Lazy::new(|| RwLock::new(Default::default()));
+static CURRENT_CONFIG: Lazy<ArcSwap<Config>> =
+    Lazy::new(|| ArcSwap::from_pointee(Default::default()));
 
 impl Config {
     pub fn new(name: &str, prefix: &str, create: bool) -> crate::Result<Config> {
         let path = ConfigPath::new(name, prefix, create)?;
-        let repos = repo::Config::new(&path.config, &path.db, create)?;
-        repos.finalize()?;
+        let repos = repo::Config::new(&path.config, &path.db, &path.cache, create)?;
         let config = Config { path, repos };
         Config::make_current(config.clone());
         Ok(config)
     }
 
+    /// Return the current config.
+    ///
+    /// Reads are lock-free so concurrent readers don't contend with each other.
     pub fn current() -> Arc<Config> {
-        CURRENT_CONFIG.read().unwrap().clone()
+        CURRENT_CONFIG.load_full()
     }
 
+    // Publish a config, note that cloning configs is cheap since repo maps are shared and
+    // altering a config afterwards only copies the altered map's entry pointers.
     fn make_current(config: Config) {
-        *CURRENT_CONFIG.write().unwrap() = Arc::new(config);
+        CURRENT_CONFIG.store(Arc::new(config));
     }
 
     // Note that repo references can't be returned since the underlying map structure alters them
@@ -126,7 +133,7 @@ impl Config {
     /// Add local repo from a filesystem path.
     pub fn add_repo_path(&mut self, name: &str, priority: i32, path: &str) -> crate::Result<Repo> {
         let r = self.repos.add_path(name, priority, path)?;
-        r.finalize()?;
+        r.finalize(&self.repos)?;
         self.repos.insert(name, r.clone(), true);
         Config::make_current(self.clone());
         Ok(r)
@@ -135,7 +142,7 @@ impl Config {
     /// Add external repo from a URI.
     pub fn add_repo_uri(&mut self, name: &str, priority: i32, uri: &str) -> crate::Result<Repo> {
         let r = self.repos.add_uri(name, priority, uri)?;
-        r.finalize()?;
+        r.finalize(&self.repos)?;
         self.repos.insert(name, r.clone(), false);
         Config::make_current(self.clone());
         Ok(r)
@@ -144,7 +151,7 @@ impl Config {
     /// Create a new repo.
     pub fn create_repo(&mut self, name: &str, priority: i32) -> crate::Result<Repo> {
         let r = self.repos.create(name, priority)?;
-        r.finalize()?;
+        r.finalize(&self.repos)?;
         self.repos.insert(name, r.clone(), false);
         Config::make_current(self.clone());
         Ok(r)
@@ -166,7 +173,7 @@ impl Config {
         priority: i32,
     ) -> crate::Result<(crate::repo::ebuild::TempRepo, Arc<crate::repo::ebuild::Repo>)> {
         let (temp_repo, r) = self.repos.create_temp(name, priority)?;
-        r.finalize()?;
+        r.finalize(&self.repos)?;
         self.repos.insert(name, r.clone(), false);
         Config::make_current(self.clone());
         let repo = self.repos.get(name).unwrap().as_ebuild().unwrap();
@@ -179,6 +186,7 @@ mod tests {
     use std::env;
 
     use super::*;
+    use crate::test::in_subprocess;
 
     #[test]
     fn test_config() {
@@ -214,4 +222,24 @@ mod tests {
         let config = Config::new("pkgcraft", "", false).unwrap();
         assert_eq!(config.path.config, Utf8PathBuf::from("/etc/pkgcraft"));
     }
+
+    #[test]
+    fn test_current() {
+        // other tests publish configs concurrently so the global state is isolated
+        in_subprocess(concat!(module_path!(), "::test_current"), || {
+            let mut config = Config::new("pkgcraft", "", false).unwrap();
+            assert!(Config::current().repos.get("test").is_none());
+
+            // published configs share repos with their source
+            let (_t, repo) = config.temp_repo("test", 0).unwrap();
+            let current = Config::current();
+            let r = current.repos.get("test").unwrap().as_ebuild().unwrap();
+            assert!(Arc::ptr_eq(r, &repo));
+
+            // earlier snapshots are unaffected by later changes
+            config.del_repos(&["test"], false).unwrap();
+            assert!(current.repos.get("test").is_some());
+            assert!(Config::current().repos.get("test").is_none());
+        });
+    }
 }
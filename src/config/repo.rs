@@ -4,15 +4,18 @@ use std::fs;
 use std::io::Write;
 use std::path::Path;
 use std::str::FromStr;
+use std::sync::Arc;
+use std::time::Duration;
 
 use camino::{Utf8Path, Utf8PathBuf};
 use indexmap::IndexMap;
+use once_cell::sync::OnceCell;
 use serde::{Deserialize, Serialize};
 use tracing::warn;
 
 use crate::repo::ebuild::TempRepo;
 use crate::repo::{Repo, Repository};
-use crate::sync::Syncer;
+use crate::sync::{self, Changes, Syncer};
 use crate::Error;
 
 #[derive(Debug, Default, Clone, PartialEq, Eq, Deserialize, Serialize)]
@@ -21,6 +24,9 @@ pub(crate) struct RepoConfig {
     pub(crate) format: String,
     pub(crate) priority: i32,
     pub(crate) sync: Option<Syncer>,
+    // number of commits fetched by syncers supporting shallow histories
+    #[serde(default, skip_serializing_if = "Option::is_none")]
+    pub(crate) sync_depth: Option<u32>,
 }
 
 impl RepoConfig {
@@ -38,10 +44,16 @@ impl RepoConfig {
         Ok(config)
     }
 
-    pub(crate) fn sync(&self) -> crate::Result<()> {
-        match &self.sync {
+    /// Return the repo's syncer with its configured options applied.
+    pub(crate) fn syncer(&self) -> Option<Syncer> {
+        self.sync.clone().map(|s| s.depth(self.sync_depth))
+    }
+
+    /// Sync the repo, returning the modified paths when they can be determined.
+    pub(crate) fn sync(&self) -> crate::Result<Option<Changes>> {
+        match self.syncer() {
             Some(syncer) => syncer.sync(&self.location),
-            None => Ok(()),
+            None => Ok(Some(Changes::default())),
         }
     }
 }
@@ -62,20 +74,91 @@ impl Ord for RepoConfig {
     }
 }
 
+/// Options for syncing multiple repos.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct SyncOptions {
+    /// maximum number of repos synced concurrently
+    pub jobs: usize,
+    /// time limit for each repo sync
+    pub timeout: Duration,
+    /// regenerate outdated metadata for the changes from synced ebuild repos
+    pub regen: bool,
+}
+
+impl Default for SyncOptions {
+    fn default() -> Self {
+        Self {
+            jobs: 8,
+            timeout: Duration::from_secs(600),
+            regen: false,
+        }
+    }
+}
+
+/// Configured repo opened on first access.
+#[derive(Debug)]
+struct LazyRepo {
+    config: RepoConfig,
+    repo: OnceCell<Option<Repo>>,
+    // whether the opened repo was successfully finalized
+    valid: OnceCell<bool>,
+}
+
+impl LazyRepo {
+    fn new(config: RepoConfig) -> Self {
+        Self {
+            config,
+            repo: Default::default(),
+            valid: Default::default(),
+        }
+    }
+
+    fn opened(repo: Repo) -> Self {
+        Self {
+            config: repo.repo_config().clone(),
+            repo: OnceCell::with_value(Some(repo)),
+            valid: OnceCell::with_value(true),
+        }
+    }
+
+    /// Return the repo, opening it if necessary. Invalid repos are logged and ignored.
+    fn open(&self, id: &str, cache_dir: Option<&Utf8Path>) -> Option<&Repo> {
+        self.repo
+            .get_or_init(|| {
+                let c = &self.config;
+                Repo::from_format(id, c.priority, &c.location, &c.format, cache_dir)
+                    .map_err(|e| warn!("{e}"))
+                    .ok()
+            })
+            .as_ref()
+    }
+
+    /// Return the repo if it's already been opened.
+    fn get(&self) -> Option<&Repo> {
+        self.repo.get().and_then(|r| r.as_ref())
+    }
+}
+
 #[derive(Debug, Default, Clone, Deserialize, Serialize)]
 pub struct Config {
     config_dir: Utf8PathBuf,
     repo_dir: Utf8PathBuf,
     #[serde(skip)]
-    repos: IndexMap<String, Repo>,
+    cache_dir: Utf8PathBuf,
+    // Repo maps are shared between config clones and copied on write. Entries are shared as
+    // well, so altering a map shared with a published config only copies pointers while repos
+    // are opened at most once across all clones.
     #[serde(skip)]
-    pub(crate) externals: HashMap<String, Repo>,
+    repos: Arc<IndexMap<Arc<str>, Arc<LazyRepo>>>,
+    #[serde(skip)]
+    pub(crate) externals: Arc<HashMap<String, Repo>>,
 }
 
 impl Config {
     pub(super) fn new(
         config_dir: &Utf8Path,
         db_dir: &Utf8Path,
+        cache_dir: &Utf8Path,
         create: bool,
     ) -> crate::Result<Config> {
         let config_dir = config_dir.join("repos");
@@ -112,32 +195,31 @@ impl Config {
             }
         }
 
-        // create hash tables of repos ordered by priority
-        let mut repos = IndexMap::<String, Repo>::new();
+        // Repos are only opened on first access, so a command using a single repo doesn't pay
+        // for loading all of them.
+        let mut config = Config {
+            config_dir,
+            repo_dir,
+            cache_dir: cache_dir.to_path_buf(),
+            ..Default::default()
+        };
+        let repos = Arc::make_mut(&mut config.repos);
         for (name, c) in configs.into_iter() {
             // ignore unsynced or nonexistent repos
-            match Repo::from_format(&name, c.priority, &c.location, &c.format) {
-                Ok(repo) => {
-                    repos.insert(name, repo);
-                }
-                Err(err) => warn!("{err}"),
+            match c.location.exists() {
+                true => drop(repos.insert(name.into(), Arc::new(LazyRepo::new(c)))),
+                false => warn!("{name} repo: nonexistent location: {}", c.location),
             }
         }
+        config.sort();
 
-        // sort repos by priority then by name
-        repos.sort_by(|_k1, v1, _k2, v2| v1.cmp(v2));
-
-        Ok(Config {
-            config_dir,
-            repo_dir,
-            repos,
-            ..Default::default()
-        })
+        Ok(config)
     }
 
+    /// Finalize all opened repos, unopened repos are finalized on first use.
     pub(super) fn finalize(&self) -> crate::Result<()> {
-        for repo in self.repos.values() {
-            repo.finalize()?;
+        for repo in self.repos.values().filter_map(|r| r.get()) {
+            repo.finalize(self)?;
         }
         Ok(())
     }
@@ -158,7 +240,7 @@ impl Config {
             return Err(Error::Config(format!("nonexistent repo path: {path:?}")));
         }
 
-        Repo::from_path(name, priority, path)
+        Repo::from_path(name, priority, path, self.cache_dir())
     }
 
     /// Add external repo from a URI.
@@ -175,7 +257,7 @@ impl Config {
         };
         config.sync()?;
 
-        let repo = Repo::from_path(name, priority, config.location)?;
+        let repo = Repo::from_path(name, priority, config.location, self.cache_dir())?;
 
         // write repo config file to disk
         let data = toml::to_string(repo.repo_config())
@@ -228,32 +310,89 @@ impl Config {
             // physical repo files are allowed to be missing
             if let Some(repo) = self.repos.get(name) {
                 if clean {
-                    fs::remove_dir_all(repo.path()).map_err(|e| {
-                        Error::Config(format!("failed removing repo files: {:?}: {e}", repo.path()))
+                    let path = &repo.config.location;
+                    fs::remove_dir_all(path).map_err(|e| {
+                        Error::Config(format!("failed removing repo files: {path:?}: {e}"))
                     })?;
                     let path = self.config_dir.join(&name);
                     fs::remove_file(&path).map_err(|e| {
                         Error::Config(format!("failed removing repo config: {path:?}: {e}"))
                     })?;
                 }
-                self.repos.shift_remove(name as &str);
+                Arc::make_mut(&mut self.repos).shift_remove(name as &str);
             }
         }
         Ok(())
     }
 
-    // TODO: add concurrent syncing support with output progress
+    /// Sync repos using the default options, syncing all configured repos if none are passed.
     pub fn sync<S: AsRef<str>>(&self, repos: Vec<S>) -> crate::Result<()> {
+        self.sync_with(repos, SyncOptions::default())
+    }
+
+    /// Sync repos concurrently, syncing all configured repos if none are passed.
+    // TODO: add output progress support
+    pub fn sync_with<S: AsRef<str>>(
+        &self,
+        repos: Vec<S>,
+        options: SyncOptions,
+    ) -> crate::Result<()> {
         let repos: Vec<&str> = match &repos {
             names if !names.is_empty() => names.iter().map(|s| s.as_ref()).collect(),
             // sync all configured repos if none were passed
-            _ => self.repos.keys().map(|s| s.as_str()).collect(),
+            _ => self.repos.keys().map(|s| s.as_ref()).collect(),
         };
 
+        // ignore unknown and unsyncable repos
+        let syncers: Vec<_> = repos
+            .into_iter()
+            .filter_map(|name| self.get(name).map(|r| (name, r.repo_config())))
+            .filter_map(|(name, c)| c.syncer().map(|s| (name, s, c.location.as_std_path())))
+            .collect();
+        let results = sync::sync_all(
+            syncers.iter().map(|(_, syncer, path)| (syncer, *path)),
+            options.jobs,
+            options.timeout,
+        )?;
+
         let mut failed: Vec<(&str, Error)> = Vec::new();
-        for name in repos {
-            if let Some(repo) = self.repos.get(name) {
-                if let Err(e) = repo.sync() {
+        // eclass changes from synced repos, unknown changes are marked as None
+        let mut eclasses = HashMap::new();
+        for ((name, _, _), result) in syncers.iter().zip(results) {
+            // refresh caches and optionally regenerate metadata for successfully synced repos
+            let result = result.and_then(|changes| match self.get(name) {
+                Some(Repo::Ebuild(r)) => {
+                    eclasses.insert(*name, changes.as_ref().map(|c| c.eclasses.clone()));
+                    r.refresh(changes.as_ref());
+                    match options.regen {
+                        true => r.regen_metadata(changes.as_ref()),
+                        false => Ok(()),
+                    }
+                }
+                _ => Ok(()),
+            });
+            if let Err(e) = result {
+                failed.push((*name, e));
+            }
+        }
+
+        // refresh repos inheriting eclasses modified in their masters
+        eclasses.retain(|_, names| names.as_ref().map_or(true, |x| !x.is_empty()));
+        let repos = self.iter().filter(|_| !eclasses.is_empty());
+        for (name, r) in repos.filter_map(|(name, r)| r.as_ebuild().map(|r| (name, r))) {
+            let mut changes = Changes::default();
+            for master in r.masters() {
+                match eclasses.get(master.id()) {
+                    Some(Some(names)) => changes.eclasses.extend(names.iter().cloned()),
+                    // all of a master's eclasses are treated as modified when its changes are
+                    // unknown
+                    Some(None) => changes.eclasses.extend(master.eclasses().keys().cloned()),
+                    None => (),
+                }
+            }
+            r.refresh(Some(&changes));
+            if options.regen {
+                if let Err(e) = r.regen_metadata(Some(&changes)) {
                     failed.push((name, e));
                 }
             }
@@ -276,29 +415,57 @@ impl Config {
         self.into_iter()
     }
 
+    /// Return a configured repo, opening and finalizing it on first access.
+    ///
+    /// Repos that fail to finalize, e.g. due to unconfigured masters, are logged and ignored.
     pub fn get<S: AsRef<str>>(&self, key: S) -> Option<&Repo> {
-        self.repos.get(key.as_ref())
+        let key = key.as_ref();
+        let lazy = self.repos.get(key)?;
+        let repo = lazy.open(key, self.cache_dir())?;
+        let valid = lazy
+            .valid
+            .get_or_init(|| repo.finalize(self).map_err(|e| warn!("{e}")).is_ok());
+        valid.then_some(repo)
+    }
+
+    /// Return a configured repo, opening it without finalizing it.
+    pub(crate) fn open(&self, key: &str) -> Option<&Repo> {
+        self.repos
+            .get(key)
+            .and_then(|r| r.open(key, self.cache_dir()))
+    }
+
+    /// Return the dir for repo cache files if one is configured.
+    fn cache_dir(&self) -> Option<&Utf8Path> {
+        Some(self.cache_dir.as_path()).filter(|p| !p.as_str().is_empty())
     }
 
     pub(super) fn insert(&mut self, id: &str, repo: Repo, external: bool) {
         // populate external repo mapping for masters finalization
         if external {
             if let Some(r) = repo.as_ebuild() {
-                self.externals.insert(r.path().to_string(), repo.clone());
+                Arc::make_mut(&mut self.externals).insert(r.path().to_string(), repo.clone());
             }
         }
 
-        self.repos.insert(id.to_string(), repo);
+        Arc::make_mut(&mut self.repos).insert(id.into(), Arc::new(LazyRepo::opened(repo)));
         self.sort()
     }
 
+    /// Sort repos by priority then by name.
     pub(super) fn sort(&mut self) {
-        self.repos.sort_by(|_k1, v1, _k2, v2| v1.cmp(v2));
+        Arc::make_mut(&mut self.repos).sort_by(|k1, v1, k2, v2| {
+            v1.config
+                .priority
+                .cmp(&v2.config.priority)
+                .then_with(|| k1.cmp(k2))
+        });
     }
 }
 
 pub struct ReposIter<'a> {
-    iter: indexmap::map::Iter<'a, String, Repo>,
+    config: &'a Config,
+    iter: indexmap::map::Keys<'a, Arc<str>, Arc<LazyRepo>>,
 }
 
 impl<'a> IntoIterator for &'a Config {
@@ -307,7 +474,8 @@ impl<'a> IntoIterator for &'a Config {
 
     fn into_iter(self) -> Self::IntoIter {
         ReposIter {
-            iter: self.repos.iter(),
+            config: self,
+            iter: self.repos.keys(),
         }
     }
 }
@@ -316,6 +484,90 @@ impl<'a> Iterator for ReposIter<'a> {
     type Item = (&'a str, &'a Repo);
 
     fn next(&mut self) -> Option<Self::Item> {
-        self.iter.next().map(|(id, repo)| (id.as_str(), repo))
+        let config = self.config;
+        self.iter
+            .find_map(|id| config.get(id).map(|r| (id.as_ref(), r)))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_lazy_repos() {
+        let dir = tempfile::tempdir().unwrap();
+        let path = Utf8Path::from_path(dir.path()).unwrap();
+        let (config_dir, db_dir) = (path.join("config"), path.join("db"));
+        fs::create_dir_all(config_dir.join("repos")).unwrap();
+
+        let t = TempRepo::new("a", None, None).unwrap();
+        let invalid = tempfile::tempdir().unwrap();
+        let invalid = Utf8Path::from_path(invalid.path()).unwrap();
+        let nonexistent = path.join("nonexistent");
+        let overlay = TempRepo::new("d", None, None).unwrap();
+        fs::write(overlay.path.join("metadata/layout.conf"), "masters = x\n").unwrap();
+        for (name, priority, location) in [
+            ("a", 1, t.path.as_path()),
+            ("b", 0, invalid),
+            ("c", 0, nonexistent.as_path()),
+            ("d", 2, overlay.path.as_path()),
+        ] {
+            let data =
+                format!("location = {location:?}\nformat = \"ebuild\"\npriority = {priority}\n");
+            fs::write(config_dir.join("repos").join(name), data).unwrap();
+        }
+
+        // repos with nonexistent locations are ignored while others aren't opened yet
+        let config = Config::new(&config_dir, &db_dir, &path.join("cache"), false).unwrap();
+        let ids: Vec<_> = config.repos.keys().map(|s| s.as_ref()).collect();
+        assert_eq!(ids, ["b", "a", "d"]);
+        assert!(config.repos.values().all(|r| r.get().is_none()));
+
+        // repos are opened on access, skipping invalid repos
+        assert!(config.get("a").is_some());
+        assert!(config.repos["a"].get().is_some() && config.repos["b"].get().is_none());
+        assert!(config.get("b").is_none());
+        // repos with unconfigured masters are skipped
+        assert!(config.get("d").is_none());
+        assert!(config.repos["d"].get().is_some());
+        let ids: Vec<_> = config.iter().map(|(id, _)| id).collect();
+        assert_eq!(ids, ["a"]);
+
+        // opened repos are shared with config clones, including altered ones
+        let mut cloned = config.clone();
+        assert!(cloned.repos["a"].get().is_some());
+        cloned.sort();
+        assert!(Arc::ptr_eq(&cloned.repos["a"], &config.repos["a"]));
+    }
+
+    #[cfg(feature = "git")]
+    #[test]
+    fn test_sync_depth() {
+        let dir = tempfile::tempdir().unwrap();
+        let path = dir.path().join("repo");
+        let data = indoc::indoc! {r#"
+            location = "/repos/test"
+            format = "ebuild"
+            priority = 0
+            sync = "https://github.com/pkgcraft/test.git"
+            sync_depth = 1
+        "#};
+        fs::write(&path, data).unwrap();
+        let config = RepoConfig::new(&path).unwrap();
+        assert_eq!(config.sync_depth, Some(1));
+        match config.syncer() {
+            Some(Syncer::Git(repo)) => assert_eq!(repo.depth, Some(1)),
+            s => panic!("invalid syncer: {s:?}"),
+        }
+
+        // the depth is only serialized when set
+        let data = toml::to_string(&config).unwrap();
+        assert!(data.contains("sync_depth = 1"));
+        let config = RepoConfig {
+            sync_depth: None,
+            ..config
+        };
+        assert!(!toml::to_string(&config).unwrap().contains("sync_depth"));
     }
 }
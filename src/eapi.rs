@@ -11,7 +11,7 @@ use once_cell::sync::{Lazy, OnceCell};
 use regex::{escape, Regex, RegexBuilder};
 use scallop::functions;
 use scallop::variables::string_value;
-use strum::{AsRefStr, Display, EnumString};
+use strum::{AsRefStr, Display, EnumIter, EnumString, IntoEnumIterator};
 
 use crate::archive::Archive;
 use crate::atom::Atom;
@@ -100,9 +100,16 @@ pub(crate) enum Feature {
     RepoIds,
 }
 
+impl Feature {
+    /// Return the feature's bit in EAPI feature bitmasks.
+    pub(crate) const fn bit(self) -> u64 {
+        1 << self as u64
+    }
+}
+
 type EapiEconfOptions = HashMap<String, (IndexSet<String>, Option<String>)>;
 
-#[derive(AsRefStr, EnumString, Display, Debug, PartialEq, Eq, Hash, Copy, Clone)]
+#[derive(AsRefStr, EnumIter, EnumString, Display, Debug, PartialEq, Eq, Hash, Copy, Clone)]
 #[strum(serialize_all = "SCREAMING_SNAKE_CASE")]
 pub enum Key {
     Iuse,
@@ -126,6 +133,118 @@ pub enum Key {
     SrcUri,
 }
 
+// all keys ordered by discriminant for mapping set bits back to keys
+static KEYS: Lazy<Vec<Key>> = Lazy::new(|| Key::iter().collect());
+
+/// Set of metadata keys stored as a bitmask over key discriminants.
+#[derive(Default, Copy, Clone, PartialEq, Eq, Hash)]
+pub struct KeySet(u64);
+
+impl KeySet {
+    fn bit(key: &Key) -> u64 {
+        1 << *key as u64
+    }
+
+    fn insert(&mut self, key: Key) {
+        self.0 |= Self::bit(&key);
+    }
+
+    /// Determine if the set contains a given key.
+    pub fn contains(&self, key: &Key) -> bool {
+        self.0 & Self::bit(key) != 0
+    }
+
+    /// Return the keys in the set that aren't in another set.
+    pub fn difference(&self, other: &Self) -> Self {
+        Self(self.0 & !other.0)
+    }
+
+    pub fn len(&self) -> usize {
+        self.0.count_ones() as usize
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.0 == 0
+    }
+
+    /// Iterate over the keys in the set in declaration order.
+    pub fn iter(&self) -> KeySetIter {
+        KeySetIter(self.0)
+    }
+}
+
+impl fmt::Debug for KeySet {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.debug_set().entries(self.iter()).finish()
+    }
+}
+
+impl Extend<Key> for KeySet {
+    fn extend<I: IntoIterator<Item = Key>>(&mut self, iter: I) {
+        for key in iter {
+            self.insert(key);
+        }
+    }
+}
+
+impl<'a> Extend<&'a Key> for KeySet {
+    fn extend<I: IntoIterator<Item = &'a Key>>(&mut self, iter: I) {
+        self.extend(iter.into_iter().copied());
+    }
+}
+
+impl FromIterator<Key> for KeySet {
+    fn from_iter<I: IntoIterator<Item = Key>>(iter: I) -> Self {
+        let mut set = Self::default();
+        set.extend(iter);
+        set
+    }
+}
+
+impl IntoIterator for KeySet {
+    type Item = &'static Key;
+    type IntoIter = KeySetIter;
+
+    fn into_iter(self) -> Self::IntoIter {
+        self.iter()
+    }
+}
+
+impl IntoIterator for &KeySet {
+    type Item = &'static Key;
+    type IntoIter = KeySetIter;
+
+    fn into_iter(self) -> Self::IntoIter {
+        self.iter()
+    }
+}
+
+/// Iterator over the keys in a [`KeySet`].
+#[derive(Debug, Clone)]
+pub struct KeySetIter(u64);
+
+impl Iterator for KeySetIter {
+    type Item = &'static Key;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        match self.0 {
+            0 => None,
+            bits => {
+                // clear the lowest set bit
+                self.0 &= bits - 1;
+                Some(&KEYS[bits.trailing_zeros() as usize])
+            }
+        }
+    }
+
+    fn size_hint(&self) -> (usize, Option<usize>) {
+        let len = self.0.count_ones() as usize;
+        (len, Some(len))
+    }
+}
+
+impl ExactSizeIterator for KeySetIter {}
+
 use Key::*;
 impl Key {
     pub(crate) fn get(&self, eapi: &'static Eapi) -> Option<String> {
@@ -154,12 +273,15 @@ impl Key {
 pub struct Eapi {
     id: String,
     parent: Option<&'static Eapi>,
-    features: HashSet<Feature>,
+    // position in the chronological EAPI ordering
+    ordinal: usize,
+    // bitmask over feature discriminants
+    features: u64,
     phases: HashSet<Phase>,
-    dep_keys: HashSet<Key>,
-    incremental_keys: HashSet<Key>,
-    mandatory_keys: HashSet<Key>,
-    metadata_keys: HashSet<Key>,
+    dep_keys: KeySet,
+    incremental_keys: KeySet,
+    mandatory_keys: KeySet,
+    metadata_keys: KeySet,
     econf_options: EapiEconfOptions,
     archives: HashSet<String>,
     archives_regex: OnceCell<Regex>,
@@ -181,9 +303,7 @@ impl Hash for Eapi {
 
 impl PartialOrd for Eapi {
     fn partial_cmp(&self, other: &Self) -> Option<Ordering> {
-        let self_index = EAPIS.get_index_of(self.id.as_str()).unwrap();
-        let other_index = EAPIS.get_index_of(other.id.as_str()).unwrap();
-        self_index.partial_cmp(&other_index)
+        self.ordinal.partial_cmp(&other.ordinal)
     }
 }
 
@@ -249,6 +369,7 @@ impl Eapi {
         };
         eapi.id = id.to_string();
         eapi.parent = parent;
+        eapi.ordinal = parent.map_or(0, |e| e.ordinal + 1);
         eapi
     }
 
@@ -257,9 +378,20 @@ impl Eapi {
         &self.id
     }
 
+    /// Return the EAPI's position in the chronological ordering, usable as a dense index.
+    pub(crate) fn ordinal(&self) -> usize {
+        self.ordinal
+    }
+
     /// Check if an EAPI has a given feature.
+    #[inline]
     pub(crate) fn has(&self, feature: Feature) -> bool {
-        self.features.get(&feature).is_some()
+        self.features & feature.bit() != 0
+    }
+
+    /// Return the bitmask of features supported by an EAPI.
+    pub(crate) fn features(&self) -> u64 {
+        self.features
     }
 
     /// Parse a package atom using EAPI specific support.
@@ -311,22 +443,22 @@ impl Eapi {
     }
 
     /// Metadata variables for dependencies.
-    pub fn dep_keys(&self) -> &HashSet<Key> {
+    pub fn dep_keys(&self) -> &KeySet {
         &self.dep_keys
     }
 
     /// Metadata variables that are incrementally handled.
-    pub(crate) fn incremental_keys(&self) -> &HashSet<Key> {
+    pub(crate) fn incremental_keys(&self) -> &KeySet {
         &self.incremental_keys
     }
 
     /// Metadata variables that must exist.
-    pub(crate) fn mandatory_keys(&self) -> &HashSet<Key> {
+    pub(crate) fn mandatory_keys(&self) -> &KeySet {
         &self.mandatory_keys
     }
 
     /// Metadata variables that may exist.
-    pub fn metadata_keys(&self) -> &HashSet<Key> {
+    pub fn metadata_keys(&self) -> &KeySet {
         &self.metadata_keys
     }
 
@@ -336,18 +468,20 @@ impl Eapi {
 
     fn enable_features(mut self, features: &[Feature]) -> Self {
         for x in features {
-            if !self.features.insert(*x) {
+            if self.has(*x) {
                 panic!("EAPI {self}: enabling set feature: {x:?}");
             }
+            self.features |= x.bit();
         }
         self
     }
 
     fn disable_features(mut self, features: &[Feature]) -> Self {
         for x in features {
-            if !self.features.remove(x) {
+            if !self.has(*x) {
                 panic!("EAPI {self}: disabling unset feature: {x:?}");
             }
+            self.features &= !x.bit();
         }
         self
     }
@@ -638,6 +772,46 @@ mod tests {
     fn test_has() {
         assert!(!EAPI0.has(Feature::UseDeps));
         assert!(EAPI_LATEST.has(Feature::UseDeps));
+        // disabled features
+        assert!(EAPI0.has(Feature::RdependDefault));
+        assert!(!EAPI4.has(Feature::RdependDefault));
+        assert!(EAPI_PKGCRAFT.has(Feature::RepoIds));
+        assert!(!EAPI_LATEST.has(Feature::RepoIds));
+    }
+
+    #[test]
+    fn test_ordinal() {
+        // ordering matches the registered EAPI order
+        for (i, eapi) in EAPIS.values().enumerate() {
+            assert_eq!(eapi.ordinal, i);
+        }
+        assert_eq!(EAPI_LATEST.ordinal, EAPI8.ordinal);
+        assert!(*EAPI_LATEST < *EAPI_PKGCRAFT);
+    }
+
+    #[test]
+    fn test_key_set() {
+        assert!(EAPI0
+            .dep_keys()
+            .iter()
+            .eq(&[Key::Depend, Key::Rdepend, Key::Pdepend]));
+        assert!(EAPI8.dep_keys().contains(&Key::Idepend));
+        assert!(!EAPI7.dep_keys().contains(&Key::Idepend));
+        assert_eq!(EAPI8.dep_keys().len(), 5);
+        assert_eq!(EAPI8.dep_keys().iter().len(), 5);
+        assert!(KeySet::default().is_empty());
+
+        // metadata keys include all dependency and mandatory keys
+        for eapi in EAPIS.values() {
+            let keys = eapi.metadata_keys();
+            assert!(eapi.dep_keys().difference(keys).is_empty());
+            assert!(eapi.mandatory_keys().difference(keys).is_empty());
+            let optional = keys.difference(eapi.mandatory_keys());
+            assert_eq!(optional.len(), keys.len() - eapi.mandatory_keys().len());
+        }
+
+        let set: KeySet = [Key::Slot, Key::Iuse, Key::Slot].into_iter().collect();
+        assert_eq!(format!("{set:?}"), "{Iuse, Slot}");
     }
 
     #[test]
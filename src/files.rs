@@ -1,12 +1,13 @@
 use std::ops::Deref;
-use std::path::Path;
 use std::str::FromStr;
 
 use nix::{sys::stat, unistd};
-use walkdir::{DirEntry, WalkDir};
+use walkdir::DirEntry;
 
 use crate::Error;
 
+pub(crate) mod scan;
+
 #[derive(Debug)]
 pub(crate) struct Group {
     inner: unistd::Group,
@@ -87,33 +88,3 @@ impl FromStr for Mode {
 // Option-wrapped closure parameter generics.
 type WalkDirFilter = fn(&DirEntry) -> bool;
 pub(crate) const NO_WALKDIR_FILTER: Option<WalkDirFilter> = None;
-
-pub(crate) fn sorted_dir_list<P: AsRef<Path>>(path: P) -> WalkDir {
-    WalkDir::new(path.as_ref())
-        .sort_by_file_name()
-        .min_depth(1)
-        .max_depth(1)
-}
-
-pub(crate) fn is_dir(entry: &DirEntry) -> bool {
-    entry.path().is_dir()
-}
-
-pub(crate) fn is_file(entry: &DirEntry) -> bool {
-    entry.path().is_file()
-}
-
-pub(crate) fn has_ext(entry: &DirEntry, ext: &str) -> bool {
-    match entry.path().extension() {
-        Some(e) => e.to_str() == Some(ext),
-        _ => false,
-    }
-}
-
-pub(crate) fn is_hidden(entry: &DirEntry) -> bool {
-    entry
-        .file_name()
-        .to_str()
-        .map(|s| s.starts_with('.'))
-        .unwrap_or(false)
-}
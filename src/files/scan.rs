@@ -0,0 +1,288 @@
+use std::io;
+
+use camino::{Utf8Path, Utf8PathBuf};
+
+/// The type of a scanned directory entry, with symlinks resolved to their targets.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub(crate) enum FileType {
+    Dir,
+    File,
+    Other,
+}
+
+/// A directory entry returned by [`Dir::entries`].
+#[derive(Debug)]
+pub(crate) struct Entry {
+    name: String,
+    kind: FileType,
+}
+
+impl Entry {
+    pub(crate) fn name(&self) -> &str {
+        &self.name
+    }
+
+    pub(crate) fn into_name(self) -> String {
+        self.name
+    }
+
+    pub(crate) fn is_dir(&self) -> bool {
+        self.kind == FileType::Dir
+    }
+
+    pub(crate) fn is_file(&self) -> bool {
+        self.kind == FileType::File
+    }
+
+    pub(crate) fn is_hidden(&self) -> bool {
+        self.name.starts_with('.')
+    }
+}
+
+/// An open directory that can be listed and descended into without rebuilding full paths.
+///
+/// On Linux, subdirectories are opened relative to their parent's descriptor and listings are
+/// read in large getdents64() batches using the kernel's entry types to avoid stat calls.
+#[derive(Debug)]
+pub(crate) struct Dir {
+    path: Utf8PathBuf,
+    #[cfg(target_os = "linux")]
+    fd: std::fs::File,
+}
+
+impl Dir {
+    /// Open a directory.
+    pub(crate) fn open<P: AsRef<Utf8Path>>(path: P) -> io::Result<Self> {
+        let path = path.as_ref();
+        Ok(Dir {
+            #[cfg(target_os = "linux")]
+            fd: sys::open(path)?,
+            path: path.to_path_buf(),
+        })
+    }
+
+    /// Open a subdirectory.
+    pub(crate) fn open_at(&self, name: &str) -> io::Result<Self> {
+        Ok(Dir {
+            #[cfg(target_os = "linux")]
+            fd: sys::open_at(&self.fd, name)?,
+            path: self.path.join(name),
+        })
+    }
+
+    /// Return the directory's path.
+    pub(crate) fn path(&self) -> &Utf8Path {
+        &self.path
+    }
+
+    /// Return the directory's entries sorted by name.
+    ///
+    /// Entries with non-unicode names are logged and skipped.
+    pub(crate) fn entries(&self) -> io::Result<Vec<Entry>> {
+        #[cfg(target_os = "linux")]
+        let mut entries = sys::entries(&self.fd, &self.path)?;
+        #[cfg(not(target_os = "linux"))]
+        let mut entries = sys::entries(&self.path)?;
+        entries.sort_unstable_by(|a, b| a.name.cmp(&b.name));
+        Ok(entries)
+    }
+}
+
+#[cfg(target_os = "linux")]
+mod sys {
+    use std::ffi::OsStr;
+    use std::fs::File;
+    use std::io;
+    use std::os::unix::ffi::OsStrExt;
+    use std::os::unix::io::{AsRawFd, FromRawFd};
+
+    use camino::Utf8Path;
+    use nix::fcntl::{self, AtFlags, OFlag};
+    use nix::sys::stat::{self, Mode, SFlag};
+    use tracing::warn;
+
+    use super::{Entry, FileType};
+
+    // Buffer size for each getdents64() call, large enough for most package dirs in one batch.
+    const BUF_SIZE: usize = 64 * 1024;
+
+    // Byte offsets of the fields in a struct linux_dirent64 record.
+    const RECLEN_OFFSET: usize = 16;
+    const TYPE_OFFSET: usize = 18;
+    const NAME_OFFSET: usize = 19;
+
+    fn flags() -> OFlag {
+        OFlag::O_RDONLY | OFlag::O_DIRECTORY | OFlag::O_CLOEXEC
+    }
+
+    fn errno(e: nix::errno::Errno) -> io::Error {
+        io::Error::from_raw_os_error(e as i32)
+    }
+
+    pub(super) fn open(path: &Utf8Path) -> io::Result<File> {
+        let fd = fcntl::open(path.as_std_path(), flags(), Mode::empty()).map_err(errno)?;
+        Ok(unsafe { File::from_raw_fd(fd) })
+    }
+
+    pub(super) fn open_at(dir: &File, name: &str) -> io::Result<File> {
+        let fd = fcntl::openat(dir.as_raw_fd(), name, flags(), Mode::empty()).map_err(errno)?;
+        Ok(unsafe { File::from_raw_fd(fd) })
+    }
+
+    // Determine an entry's type when the kernel doesn't report it or it's a symlink.
+    fn stat_type(dir: &File, name: &str) -> FileType {
+        match stat::fstatat(dir.as_raw_fd(), name, AtFlags::empty()) {
+            Ok(st) => match SFlag::from_bits_truncate(st.st_mode) & SFlag::S_IFMT {
+                SFlag::S_IFDIR => FileType::Dir,
+                SFlag::S_IFREG => FileType::File,
+                _ => FileType::Other,
+            },
+            // dangling symlinks
+            Err(_) => FileType::Other,
+        }
+    }
+
+    pub(super) fn entries(dir: &File, path: &Utf8Path) -> io::Result<Vec<Entry>> {
+        // use a u64 buffer so records are suitably aligned for the kernel
+        let mut buf = vec![0u64; BUF_SIZE / 8];
+        let mut entries = vec![];
+        loop {
+            let n = unsafe {
+                libc::syscall(libc::SYS_getdents64, dir.as_raw_fd(), buf.as_mut_ptr(), BUF_SIZE)
+            };
+            match n {
+                0 => return Ok(entries),
+                n if n < 0 => return Err(io::Error::last_os_error()),
+                _ => (),
+            }
+
+            let data = unsafe { std::slice::from_raw_parts(buf.as_ptr() as *const u8, n as usize) };
+            let mut offset = 0;
+            while offset < data.len() {
+                let record = &data[offset..];
+                let reclen =
+                    u16::from_ne_bytes([record[RECLEN_OFFSET], record[RECLEN_OFFSET + 1]]) as usize;
+                offset += reclen;
+
+                let name = &record[NAME_OFFSET..reclen];
+                let name = &name[..name.iter().position(|&c| c == 0).unwrap_or(name.len())];
+                let name = match std::str::from_utf8(name) {
+                    Ok("." | "..") => continue,
+                    Ok(s) => s,
+                    Err(_) => {
+                        let path = path.as_std_path().join(OsStr::from_bytes(name));
+                        warn!("non-unicode path: {path:?}");
+                        continue;
+                    }
+                };
+                let kind = match record[TYPE_OFFSET] {
+                    libc::DT_DIR => FileType::Dir,
+                    libc::DT_REG => FileType::File,
+                    libc::DT_LNK | libc::DT_UNKNOWN => stat_type(dir, name),
+                    _ => FileType::Other,
+                };
+                entries.push(Entry {
+                    name: name.to_string(),
+                    kind,
+                });
+            }
+        }
+    }
+}
+
+#[cfg(not(target_os = "linux"))]
+mod sys {
+    use std::{fs, io};
+
+    use camino::Utf8Path;
+    use tracing::warn;
+
+    use super::{Entry, FileType};
+
+    pub(super) fn entries(path: &Utf8Path) -> io::Result<Vec<Entry>> {
+        let mut entries = vec![];
+        for entry in fs::read_dir(path)? {
+            let entry = entry?;
+            let name = match entry.file_name().into_string() {
+                Ok(s) => s,
+                Err(_) => {
+                    warn!("non-unicode path: {:?}", entry.path());
+                    continue;
+                }
+            };
+            // follow symlinks to match the types reported on Linux
+            let kind = match fs::metadata(entry.path()) {
+                Ok(m) if m.is_dir() => FileType::Dir,
+                Ok(m) if m.is_file() => FileType::File,
+                _ => FileType::Other,
+            };
+            entries.push(Entry { name, kind });
+        }
+        Ok(entries)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::ffi::OsStr;
+    use std::fs;
+    use std::os::unix::ffi::OsStrExt;
+
+    use tracing_test::traced_test;
+
+    use super::*;
+
+    #[test]
+    fn test_entries() {
+        let tmp = tempfile::tempdir().unwrap();
+        let path = Utf8Path::from_path(tmp.path()).unwrap();
+        fs::create_dir_all(path.join("b/c")).unwrap();
+        fs::write(path.join("a"), "").unwrap();
+        fs::write(path.join(".hidden"), "").unwrap();
+        std::os::unix::fs::symlink("b", path.join("d")).unwrap();
+        std::os::unix::fs::symlink("nonexistent", path.join("e")).unwrap();
+
+        let dir = Dir::open(path).unwrap();
+        let entries = dir.entries().unwrap();
+        let names: Vec<_> = entries.iter().map(|e| e.name()).collect();
+        assert_eq!(names, [".hidden", "a", "b", "d", "e"]);
+        let kinds: Vec<_> = entries.iter().map(|e| e.kind).collect();
+        let (dir_t, file_t, other_t) = (FileType::Dir, FileType::File, FileType::Other);
+        assert_eq!(kinds, [file_t, file_t, dir_t, dir_t, other_t]);
+        assert!(entries[0].is_hidden());
+
+        // subdirs are opened relative to their parent
+        let subdir = dir.open_at("b").unwrap();
+        assert_eq!(subdir.path(), path.join("b"));
+        let entries = subdir.entries().unwrap();
+        assert!(entries.len() == 1 && entries[0].is_dir());
+        assert!(dir.open_at("a").is_err());
+        assert!(Dir::open(path.join("nonexistent")).is_err());
+
+        // directories needing multiple batches
+        let big = path.join("big");
+        fs::create_dir(&big).unwrap();
+        for i in 0..5000 {
+            fs::write(big.join(format!("file-{i:05}")), "").unwrap();
+        }
+        let entries = Dir::open(&big).unwrap().entries().unwrap();
+        assert_eq!(entries.len(), 5000);
+        assert_eq!(entries[4999].name(), "file-04999");
+        assert!(entries.windows(2).all(|w| w[0].name() < w[1].name()));
+    }
+
+    #[traced_test]
+    #[test]
+    fn test_non_unicode() {
+        let tmp = tempfile::tempdir().unwrap();
+        let path = Utf8Path::from_path(tmp.path()).unwrap();
+        fs::write(path.join("a"), "").unwrap();
+        fs::write(tmp.path().join(OsStr::from_bytes(b"b\xff")), "").unwrap();
+
+        // non-unicode names are skipped with a warning
+        let entries = Dir::open(path).unwrap().entries().unwrap();
+        let names: Vec<_> = entries.iter().map(|e| e.name()).collect();
+        assert_eq!(names, ["a"]);
+        assert!(logs_contain("non-unicode path"));
+    }
+}
@@ -9,6 +9,7 @@ use crate::{atom, eapi, restrict};
 
 pub mod ebuild;
 pub mod fake;
+pub mod vdb;
 
 #[derive(AsRefStr, EnumIter, Debug, Copy, Clone)]
 pub enum Env {
@@ -26,6 +27,7 @@ pub enum Env {
 pub enum Pkg<'a> {
     Ebuild(ebuild::Pkg<'a>, &'a Repo),
     Fake(fake::Pkg<'a>, &'a Repo),
+    Vdb(vdb::Pkg<'a>, &'a Repo),
 }
 
 make_pkg_traits!(Pkg<'_>);
@@ -151,6 +153,7 @@ impl<'a> Package for Pkg<'a> {
         match self {
             Self::Ebuild(pkg, _) => pkg.atom(),
             Self::Fake(pkg, _) => pkg.atom(),
+            Self::Vdb(pkg, _) => pkg.atom(),
         }
     }
 
@@ -158,6 +161,7 @@ impl<'a> Package for Pkg<'a> {
         match self {
             Self::Ebuild(pkg, _) => pkg.eapi(),
             Self::Fake(pkg, _) => pkg.eapi(),
+            Self::Vdb(pkg, _) => pkg.eapi(),
         }
     }
 
@@ -165,6 +169,7 @@ impl<'a> Package for Pkg<'a> {
         match self {
             Self::Ebuild(_, repo) => repo,
             Self::Fake(_, repo) => repo,
+            Self::Vdb(_, repo) => repo,
         }
     }
 }
@@ -2,25 +2,42 @@ use std::collections::HashMap;
 use std::io::{self, prelude::*};
 use std::str::FromStr;
 use std::sync::Arc;
+use std::time::SystemTime;
 use std::{fmt, fs, ptr};
 
 use camino::{Utf8Path, Utf8PathBuf};
 use indexmap::IndexSet;
-use once_cell::sync::{Lazy, OnceCell};
-use regex::Regex;
+use once_cell::sync::OnceCell;
 use scallop::variables::string_value;
+use tempfile::NamedTempFile;
 use tracing::warn;
 
 use super::{make_pkg_traits, Package};
 use crate::eapi::Key::*;
 use crate::macros::build_from_paths;
 use crate::metadata::ebuild::{Distfile, Maintainer, Manifest, Upstream, XmlMetadata};
-use crate::pkgsh::source_ebuild;
-use crate::repo::{ebuild::Repo, Repository};
+use crate::pkgsh::{source_ebuild, BuildData};
+use crate::repo::ebuild::{self, Repo};
+use crate::repo::Repository;
 use crate::{atom, eapi, pkg, restrict, Error};
 
-static EAPI_LINE_RE: Lazy<Regex> =
-    Lazy::new(|| Regex::new("^EAPI=['\"]?(?P<EAPI>[^'\"]*)['\"]?[\t ]*(?:#.*)?").unwrap());
+// Buffer size used when scanning the head of an ebuild for its EAPI.
+const EAPI_SCAN_SIZE: usize = 4096;
+
+// Return the value of an EAPI assignment line, if the line is one.
+fn eapi_value(line: &[u8]) -> Option<&[u8]> {
+    let value = line.strip_prefix(b"EAPI=")?;
+    let (value, end) = match value.first() {
+        Some(&q @ (b'"' | b'\'')) => (&value[1..], value[1..].iter().position(|&c| c == q)),
+        _ => (
+            value,
+            value
+                .iter()
+                .position(|c| c.is_ascii_whitespace() || *c == b'#'),
+        ),
+    };
+    Some(&value[..end.unwrap_or(value.len())])
+}
 
 #[derive(Debug, Default, Clone)]
 struct Metadata<'a> {
@@ -36,36 +53,168 @@ struct Metadata<'a> {
 }
 
 impl<'a> Metadata<'a> {
-    /// Load metadata from cache.
-    fn load(atom: &atom::Atom, eapi: &'static eapi::Eapi, repo: &Repo) -> Option<Self> {
-        // TODO: validate cache entries in some fashion?
-        let path = build_from_paths!(repo.path(), "metadata", "md5-cache", atom.to_string());
-        match fs::read_to_string(&path) {
-            Ok(s) => {
-                let data = s
-                    .lines()
-                    .filter_map(|l| l.split_once('='))
-                    .filter_map(|(k, v)| eapi::Key::from_str(k).ok().map(|k| (k, v)))
+    /// Load metadata and its EAPI from a valid cache entry.
+    fn load(
+        path: &Utf8Path,
+        atom: &atom::Atom,
+        repo: &Repo,
+    ) -> Option<(&'static eapi::Eapi, Self)> {
+        let cache_path = Self::cache_path(atom, repo);
+        match Self::read_entry(&cache_path) {
+            Ok((s, mtime)) => {
+                let mut values = vec![];
+                let (mut ebuild_digest, mut eclasses, mut eapi) = (None, None, "0");
+                for (k, v) in s.lines().filter_map(|l| l.split_once('=')) {
+                    match k {
+                        "_md5_" => ebuild_digest = Some(v),
+                        "_eclasses_" => eclasses = Some(v),
+                        _ => {
+                            if let Ok(key) = eapi::Key::from_str(k) {
+                                if key == eapi::Key::Eapi && !v.is_empty() {
+                                    eapi = v;
+                                }
+                                values.push((key, v));
+                            }
+                        }
+                    }
+                }
+
+                if !(Self::fresh(path, mtime, eclasses, repo)
+                    || Self::verified(path, ebuild_digest, eclasses, repo))
+                {
+                    return None;
+                }
+
+                // unsupported EAPIs fall back to parsing the ebuild for proper errors
+                let eapi = eapi::get_eapi(eapi).ok()?;
+                let data = values
+                    .into_iter()
                     .filter(|(k, _)| eapi.metadata_keys().contains(k))
                     .map(|(k, v)| (k, v.to_string()))
                     .collect();
-                Some(Self {
+                let data = Self {
                     data,
                     ..Default::default()
-                })
+                };
+                Some((eapi, data))
             }
             Err(e) => {
                 if e.kind() != io::ErrorKind::NotFound {
-                    warn!("error loading ebuild metadata: {:?}: {e}", &path);
+                    warn!("error loading ebuild metadata: {:?}: {e}", &cache_path);
                 }
                 None
             }
         }
     }
 
+    // Return the md5-cache entry path for a package.
+    fn cache_path(atom: &atom::Atom, repo: &Repo) -> Utf8PathBuf {
+        build_from_paths!(repo.path(), "metadata", "md5-cache", atom.to_string())
+    }
+
+    // Read an md5-cache entry along with its mtime.
+    fn read_entry(path: &Utf8Path) -> io::Result<(String, Option<SystemTime>)> {
+        let mut file = fs::File::open(path)?;
+        let mtime = file.metadata()?.modified().ok();
+        let mut data = String::new();
+        file.read_to_string(&mut data)?;
+        Ok((data, mtime))
+    }
+
+    // Determine if a cache entry is at least as new as its ebuild and inherited eclasses,
+    // avoiding reading and hashing them.
+    fn fresh(
+        path: &Utf8Path,
+        mtime: Option<SystemTime>,
+        eclasses: Option<&str>,
+        repo: &Repo,
+    ) -> bool {
+        let newer = |m: Option<SystemTime>| matches!((m, mtime), (Some(m), Some(t)) if m <= t);
+        if !newer(fs::metadata(path).and_then(|m| m.modified()).ok()) {
+            return false;
+        }
+        let table = repo.eclasses();
+        eclasses
+            .unwrap_or_default()
+            .split('\t')
+            .filter(|s| !s.is_empty())
+            .step_by(2)
+            .all(|name| table.get(name).map_or(false, |e| newer(e.mtime())))
+    }
+
+    // Determine if a cache entry's digests match its ebuild and inherited eclasses.
+    fn verified(
+        path: &Utf8Path,
+        ebuild_digest: Option<&str>,
+        eclasses: Option<&str>,
+        repo: &Repo,
+    ) -> bool {
+        match (ebuild_digest, ebuild::digest(path)) {
+            (Some(cached), Ok(digest)) if cached == digest => {
+                Self::valid_eclasses(eclasses.unwrap_or_default(), repo)
+            }
+            _ => false,
+        }
+    }
+
+    // Verify inherited eclass digests from a cache entry against the repo's eclasses.
+    fn valid_eclasses(value: &str, repo: &Repo) -> bool {
+        let eclasses = repo.eclasses();
+        let mut fields = value.split('\t').filter(|s| !s.is_empty());
+        while let Some(name) = fields.next() {
+            match (eclasses.get(name), fields.next()) {
+                (Some(eclass), Some(digest)) if eclass.digest() == Some(digest) => (),
+                _ => return false,
+            }
+        }
+        true
+    }
+
+    /// Serialize metadata into md5-cache entry format for a given ebuild.
+    fn serialize(&self, path: &Utf8Path, repo: &Repo) -> crate::Result<String> {
+        let mut keys: Vec<_> = self
+            .data
+            .iter()
+            .filter(|(k, v)| **k != Inherited && !v.trim().is_empty())
+            .map(|(k, v)| (k.as_ref(), v))
+            .collect();
+        keys.sort_unstable_by_key(|(k, _)| *k);
+
+        let mut entry = String::new();
+        for (key, val) in keys {
+            let val: Vec<_> = val.split_whitespace().collect();
+            entry.push_str(&format!("{key}={}\n", val.join(" ")));
+        }
+
+        // inherited eclasses are stored with their digests to invalidate entries on changes
+        let eclasses = repo.eclasses();
+        let mut inherited = vec![];
+        let names = self
+            .data
+            .get(&Inherited)
+            .map(|s| s.as_str())
+            .unwrap_or_default();
+        for name in names.split_whitespace() {
+            match eclasses.get(name).and_then(|e| e.digest()) {
+                Some(digest) => inherited.push(format!("{name}\t{digest}")),
+                None => return Err(Error::InvalidValue(format!("nonexistent eclass: {name}"))),
+            }
+        }
+        if !inherited.is_empty() {
+            entry.push_str(&format!("_eclasses_={}\n", inherited.join("\t")));
+        }
+
+        let digest = ebuild::digest(path)
+            .map_err(|e| Error::IO(format!("failed reading ebuild: {path}: {e}")))?;
+        entry.push_str(&format!("_md5_={digest}\n"));
+        Ok(entry)
+    }
+
     /// Source ebuild to determine metadata.
     fn source(path: &Utf8Path, eapi: &'static eapi::Eapi) -> crate::Result<Self> {
         // TODO: run sourcing via an external process pool returning the requested variables
+        // clear state left over from previously sourced ebuilds
+        BuildData::reset_for_source()?;
         source_ebuild(path)?;
         let mut data = HashMap::new();
 
@@ -195,12 +344,23 @@ make_pkg_traits!(Pkg<'_>);
 
 impl<'a> Pkg<'a> {
     pub(crate) fn new(path: &Utf8Path, repo: &'a Repo) -> crate::Result<Self> {
-        let eapi = Pkg::parse_eapi(path)?;
         let atom = repo.atom_from_path(path)?;
-        // TODO: compare ebuild mtime vs cache mtime
-        let data = match Metadata::load(&atom, eapi, repo) {
-            Some(data) => data,
-            None => Metadata::source(path, eapi)?,
+        Pkg::with_atom(path, atom, repo)
+    }
+
+    /// Create a package for an ebuild whose atom was already determined from its path.
+    pub(crate) fn with_atom(
+        path: &Utf8Path,
+        atom: atom::Atom,
+        repo: &'a Repo,
+    ) -> crate::Result<Self> {
+        // only scan the ebuild for its EAPI when lacking a valid cache entry
+        let (eapi, data) = match Metadata::load(path, &atom, repo) {
+            Some(cached) => cached,
+            None => {
+                let eapi = Pkg::parse_eapi(path)?;
+                (eapi, Metadata::source(path, eapi)?)
+            }
         };
         Ok(Pkg {
             path: path.to_path_buf(),
@@ -213,24 +373,79 @@ impl<'a> Pkg<'a> {
         })
     }
 
+    /// Determine if an ebuild's md5-cache entry exists and is valid.
+    ///
+    /// Unlike loading packages, which trusts entries newer than their ebuild and eclasses,
+    /// entries are verified against their digests when they have them.
+    pub(crate) fn cache_valid(path: &Utf8Path, repo: &Repo) -> bool {
+        let atom = match repo.atom_from_path(path) {
+            Ok(atom) => atom,
+            Err(_) => return false,
+        };
+        let (data, mtime) = match Metadata::read_entry(&Metadata::cache_path(&atom, repo)) {
+            Ok(entry) => entry,
+            Err(_) => return false,
+        };
+        let (mut ebuild_digest, mut eclasses) = (None, None);
+        for (k, v) in data.lines().filter_map(|l| l.split_once('=')) {
+            match k {
+                "_md5_" => ebuild_digest = Some(v),
+                "_eclasses_" => eclasses = Some(v),
+                _ => (),
+            }
+        }
+        match ebuild_digest {
+            Some(_) => Metadata::verified(path, ebuild_digest, eclasses, repo),
+            // entries lacking digests can only be checked by mtime
+            None => Metadata::fresh(path, mtime, eclasses, repo),
+        }
+    }
+
+    /// Source an ebuild and atomically write its md5-cache entry.
+    ///
+    /// Note that the build state must already point at the ebuild's repo.
+    pub(crate) fn regen(path: &Utf8Path, repo: &Repo) -> crate::Result<()> {
+        let eapi = Pkg::parse_eapi(path)?;
+        let atom = repo.atom_from_path(path)?;
+        let entry = Metadata::source(path, eapi)?.serialize(path, repo)?;
+
+        let cache_path = Metadata::cache_path(&atom, repo);
+        let err =
+            |e: io::Error| Error::IO(format!("failed writing cache entry: {cache_path}: {e}"));
+        let dir = cache_path.parent().unwrap();
+        fs::create_dir_all(dir).map_err(err)?;
+        let mut file = NamedTempFile::new_in(dir).map_err(err)?;
+        file.write_all(entry.as_bytes()).map_err(err)?;
+        file.persist(&cache_path).map_err(|e| err(e.error))?;
+        Ok(())
+    }
+
     /// Get the parsed EAPI from a given ebuild file.
+    ///
+    /// Only the leading comment and blank lines are scanned using a single reused line buffer.
     fn parse_eapi(path: &Utf8Path) -> crate::Result<&'static eapi::Eapi> {
-        let mut eapi = &*eapi::EAPI0;
         let f = fs::File::open(path).map_err(|e| Error::IO(e.to_string()))?;
-        let reader = io::BufReader::new(f);
-        for line in reader.lines() {
-            let line = line.map_err(|e| Error::IO(e.to_string()))?;
-            match line.chars().next() {
-                None | Some('#') => continue,
+        let mut reader = io::BufReader::with_capacity(EAPI_SCAN_SIZE, f);
+        let mut buf = vec![];
+        loop {
+            buf.clear();
+            let n = reader
+                .read_until(b'\n', &mut buf)
+                .map_err(|e| Error::IO(e.to_string()))?;
+            if n == 0 {
+                return Ok(&eapi::EAPI0);
+            }
+            let line = buf.strip_suffix(b"\n").unwrap_or(&buf);
+            match line.first() {
+                None | Some(b'#') => continue,
                 _ => {
-                    if let Some(c) = EAPI_LINE_RE.captures(&line) {
-                        eapi = eapi::get_eapi(c.name("EAPI").unwrap().as_str())?;
+                    return match eapi_value(line) {
+                        Some(value) => eapi::get_eapi(String::from_utf8_lossy(value)),
+                        None => Ok(&eapi::EAPI0),
                     }
-                    break;
                 }
             }
         }
-        Ok(eapi)
     }
 
     /// Return a package's ebuild file path.
@@ -368,6 +583,9 @@ impl From<Restrict> for restrict::Restrict {
 
 #[cfg(test)]
 mod tests {
+    use filetime::FileTime;
+    use md5::{Digest, Md5};
+
     use crate::config::Config;
     use crate::macros::assert_err_re;
     use crate::pkg::Env::*;
@@ -388,6 +606,25 @@ mod tests {
         assert_err_re!(r, r"^unknown EAPI: unknown");
     }
 
+    #[test]
+    fn test_parse_eapi() {
+        let mut config = Config::new("pkgcraft", "", false).unwrap();
+        let (t, _repo) = config.temp_repo("test", 0).unwrap();
+        for (data, expected) in [
+            ("", &*eapi::EAPI0),
+            ("# comment\n\nEAPI=8\n", &*eapi::EAPI8),
+            ("EAPI='7'\n", &*eapi::EAPI7),
+            ("EAPI=\"6\" # comment\n", &*eapi::EAPI6),
+            ("EAPI=5#comment", &*eapi::EAPI5),
+            // only the first non-comment line is checked
+            ("SLOT=0\nEAPI=8\n", &*eapi::EAPI0),
+        ] {
+            let path = t.create_ebuild_raw("cat/pkg-1", data).unwrap();
+            let eapi = Pkg::parse_eapi(&path).unwrap();
+            assert_eq!(eapi, expected, "failed for data: {data:?}");
+        }
+    }
+
     #[test]
     fn test_as_ref_path() {
         fn assert_path<P: AsRef<Utf8Path>, Q: AsRef<Utf8Path>>(pkg: P, path: Q) {
@@ -658,6 +895,90 @@ mod tests {
         });
     }
 
+    #[test]
+    fn test_serial_sourcing() {
+        let mut config = Config::new("pkgcraft", "", false).unwrap();
+        let (t, repo) = config.temp_repo("test", 0).unwrap();
+        t.create_eclass("e1", "IUSE=\"use1\"\n").unwrap();
+
+        let data = indoc::indoc! {r#"
+            inherit e1
+            DESCRIPTION="testing serial sourcing"
+            SLOT=0
+            LEAKED_VAR=1
+            leaked_func() { :; }
+        "#};
+        let path1 = t.create_ebuild_raw("cat/pkg-1", data).unwrap();
+        let data = indoc::indoc! {r#"
+            DESCRIPTION="testing serial sourcing"
+            SLOT=0
+        "#};
+        let path2 = t.create_ebuild_raw("cat/pkg-2", data).unwrap();
+
+        BUILD_DATA.with(|d| d.borrow_mut().repo = repo.clone());
+        let pkg = Pkg::new(&path1, &repo).unwrap();
+        assert!(eq_sorted(pkg.iuse(), &["use1"]));
+        assert!(string_value("LEAKED_VAR").is_some());
+
+        // state from previously sourced ebuilds doesn't leak
+        let pkg = Pkg::new(&path2, &repo).unwrap();
+        assert!(pkg.iuse().is_empty());
+        assert!(pkg.inherited().is_empty());
+        assert!(string_value("LEAKED_VAR").is_none());
+        assert!(scallop::functions::find("leaked_func").is_none());
+    }
+
+    #[test]
+    fn test_md5_cache() {
+        let mut config = Config::new("pkgcraft", "", false).unwrap();
+        let (t, repo) = config.temp_repo("test", 0).unwrap();
+        let eclass = t.create_eclass("e1", "# stub eclass\n").unwrap();
+        let data = indoc::indoc! {r#"
+            inherit e1
+            DESCRIPTION="sourced"
+            SLOT=0
+        "#};
+        let path = t.create_ebuild_raw("cat/pkg-1", data).unwrap();
+        let cache_dir = t.path.join("metadata/md5-cache/cat");
+        fs::create_dir_all(&cache_dir).unwrap();
+        BUILD_DATA.with(|d| d.borrow_mut().repo = repo.clone());
+
+        let digest = |path: &Utf8Path| format!("{:x}", Md5::digest(fs::read(path).unwrap()));
+        let (ebuild_md5, eclass_md5) = (digest(&path), digest(&eclass));
+        let entry_path = cache_dir.join("pkg-1");
+        for (entry, fresh, stale) in [
+            // valid entry
+            (format!("_md5_={ebuild_md5}\n_eclasses_=e1\t{eclass_md5}\n"), "cached", "cached"),
+            // outdated ebuild
+            (format!("_md5_=0\n_eclasses_=e1\t{eclass_md5}\n"), "cached", "sourced"),
+            // outdated eclass
+            (format!("_md5_={ebuild_md5}\n_eclasses_=e1\t0\n"), "cached", "sourced"),
+            // unknown eclass
+            (format!("_md5_={ebuild_md5}\n_eclasses_=e2\t{eclass_md5}\n"), "sourced", "sourced"),
+            // missing ebuild digest
+            (format!("_eclasses_=e1\t{eclass_md5}\n"), "cached", "sourced"),
+        ] {
+            // entries newer than their ebuild and eclasses are used without checking digests
+            let data = format!("DESCRIPTION=cached\nSLOT=0\n{entry}");
+            fs::write(&entry_path, data).unwrap();
+            let pkg = Pkg::new(&path, &repo).unwrap();
+            assert_eq!(pkg.description(), fresh, "failed for fresh entry: {entry:?}");
+
+            // while older entries are verified by their digests
+            filetime::set_file_mtime(&entry_path, FileTime::zero()).unwrap();
+            let pkg = Pkg::new(&path, &repo).unwrap();
+            assert_eq!(pkg.description(), stale, "failed for stale entry: {entry:?}");
+        }
+
+        // EAPI is pulled from valid entries without scanning the ebuild
+        let entry = format!("_md5_={ebuild_md5}\n_eclasses_=e1\t{eclass_md5}\n");
+        let data = format!("DESCRIPTION=cached\nEAPI=8\nSLOT=0\n{entry}");
+        fs::write(cache_dir.join("pkg-1"), data).unwrap();
+        let pkg = Pkg::new(&path, &repo).unwrap();
+        assert_eq!(pkg.eapi(), &*eapi::EAPI8);
+        assert_eq!(pkg.description(), "cached");
+    }
+
     #[test]
     fn test_maintainers() {
         let mut config = Config::new("pkgcraft", "", false).unwrap();
@@ -0,0 +1,64 @@
+use std::fmt;
+use std::str::SplitWhitespace;
+
+use super::{make_pkg_traits, Package};
+use crate::repo::vdb::{Entry, Repo};
+use crate::{atom, eapi};
+
+#[derive(Debug, Clone)]
+pub struct Pkg<'a> {
+    atom: &'a atom::Atom,
+    entry: &'a Entry,
+    repo: &'a Repo,
+}
+
+make_pkg_traits!(Pkg<'_>);
+
+impl<'a> Pkg<'a> {
+    pub(crate) fn new(atom: &'a atom::Atom, entry: &'a Entry, repo: &'a Repo) -> Self {
+        Pkg { atom, entry, repo }
+    }
+
+    /// Return a package's slot.
+    pub fn slot(&self) -> &'a str {
+        let val = self.entry.slot();
+        val.split_once('/').map_or(val, |x| x.0)
+    }
+
+    /// Return a package's subslot.
+    pub fn subslot(&self) -> &'a str {
+        let val = self.entry.slot();
+        val.split_once('/').map_or(val, |x| x.1)
+    }
+
+    /// Return a package's enabled USE flags.
+    pub fn use_flags(&self) -> SplitWhitespace<'a> {
+        self.entry.use_flags().split_whitespace()
+    }
+
+    /// Return a package's keywords.
+    pub fn keywords(&self) -> SplitWhitespace<'a> {
+        self.entry.keywords().split_whitespace()
+    }
+
+    /// Return the paths of a package's installed files.
+    pub fn contents(&self) -> Vec<String> {
+        self.repo.contents(self.atom, self.entry)
+    }
+}
+
+impl<'a> Package for Pkg<'a> {
+    type Repo = &'a Repo;
+
+    fn atom(&self) -> &atom::Atom {
+        self.atom
+    }
+
+    fn eapi(&self) -> &'static eapi::Eapi {
+        self.entry.eapi()
+    }
+
+    fn repo(&self) -> Self::Repo {
+        self.repo
+    }
+}
@@ -1,23 +1,30 @@
 use std::cell::RefCell;
 use std::collections::{HashMap, HashSet, VecDeque};
-use std::io;
 use std::sync::Arc;
+use std::{io, mem};
 
 use camino::Utf8Path;
 use indexmap::IndexSet;
 use itertools::Itertools;
-use nix::unistd::isatty;
+use nix::unistd::{getpid, isatty, Pid};
 use scallop::builtins::{ExecStatus, ScopedOptions};
 use scallop::variables::*;
 use scallop::{functions, source, Error};
 
 use crate::eapi::{Eapi, Feature, Key};
-use crate::pkgsh::builtins::Scope;
+use crate::pkgsh::builtins::{Scope, VersionCache};
 use crate::repo::ebuild;
 
 pub mod builtins;
+mod configure;
 mod install;
+mod jobserver;
+mod log;
+mod patch;
 pub(crate) mod phase;
+pub mod profile;
+pub mod scheduler;
+mod snapshot;
 pub(crate) mod test;
 pub(crate) mod unescape;
 mod utils;
@@ -63,21 +70,30 @@ macro_rules! write_stdin {
 #[cfg(test)]
 use write_stdin;
 
+// Buffer size for build output, flushed before running commands and at phase boundaries.
+#[cfg(not(test))]
+const STDOUT_BUF_SIZE: usize = 64 * 1024;
+
 struct Stdout {
     #[cfg(not(test))]
-    inner: io::Stdout,
+    inner: io::BufWriter<io::Stdout>,
     #[cfg(test)]
     inner: io::Cursor<Vec<u8>>,
+    // process owning the buffer, forked subshells exit without flushing it
+    pid: Pid,
 }
 
 impl Default for Stdout {
     fn default() -> Self {
         #[cfg(not(test))]
-        let inner = io::stdout();
+        let inner = io::BufWriter::with_capacity(STDOUT_BUF_SIZE, io::stdout());
         #[cfg(test)]
         let inner = io::Cursor::new(vec![]);
 
-        Stdout { inner }
+        Stdout {
+            inner,
+            pid: getpid(),
+        }
     }
 }
 
@@ -179,6 +195,9 @@ pub(crate) struct BuildData {
     pub(crate) distfiles: Vec<String>,
     pub(crate) user_patches: Vec<String>,
 
+    // build log capturing all output, if enabled
+    log: Option<log::BuildLog>,
+
     pub(crate) phase: Option<phase::Phase>,
     pub(crate) scope: Scope,
     pub(crate) user_patches_applied: bool,
@@ -199,6 +218,9 @@ pub(crate) struct BuildData {
     pub(crate) strip_include: HashSet<String>,
     pub(crate) strip_exclude: HashSet<String>,
 
+    // split and parsed version strings used by builtins
+    version_cache: VersionCache,
+
     pub(crate) iuse_effective: HashSet<String>,
     pub(crate) use_: HashSet<String>,
 
@@ -237,6 +259,30 @@ impl BuildData {
         BUILD_DATA.with(|d| d.replace(BuildData::new()));
     }
 
+    /// Reset the shell and build state for sourcing another ebuild in the same process.
+    ///
+    /// Variables and functions created since the initial shell snapshot are removed and
+    /// per-package build state is reset. The EAPI and repo context, output streams, build log,
+    /// and version cache are retained.
+    pub(crate) fn reset_for_source() -> scallop::Result<()> {
+        snapshot::restore()?;
+        BUILD_DATA.with(|d| {
+            let mut d = d.borrow_mut();
+            let d = &mut *d;
+            *d = BuildData {
+                eapi: d.eapi,
+                repo: mem::take(&mut d.repo),
+                stdin: mem::take(&mut d.stdin),
+                stdout: mem::take(&mut d.stdout),
+                stderr: mem::take(&mut d.stderr),
+                log: d.log.take(),
+                version_cache: mem::take(&mut d.version_cache),
+                ..BuildData::new()
+            };
+        });
+        Ok(())
+    }
+
     fn stdin(&mut self) -> scallop::Result<&mut StdinType> {
         self.stdin.get()
     }
@@ -261,6 +307,31 @@ impl BuildData {
     }
 }
 
+/// Flush buffered build output.
+///
+/// This is required before running external commands or writing directly to the underlying
+/// file descriptors in order to keep output correctly ordered.
+pub(crate) fn flush_output() {
+    BUILD_DATA.with(|d| {
+        // skip flushing when output is being written, it'll be flushed afterwards
+        if let Ok(mut d) = d.try_borrow_mut() {
+            io::Write::flush(&mut d.stdout.inner).ok();
+        }
+    })
+}
+
+/// Flush buffered build output when running in a forked subshell, e.g. for command
+/// substitutions, since subshells exit without flushing it.
+pub(crate) fn flush_subshell_output() {
+    BUILD_DATA.with(|d| {
+        if let Ok(mut d) = d.try_borrow_mut() {
+            if d.stdout.pid != getpid() {
+                io::Write::flush(&mut d.stdout.inner).ok();
+            }
+        }
+    })
+}
+
 thread_local! {
     pub(crate) static BUILD_DATA: RefCell<BuildData> = RefCell::new(BuildData::new());
 }
@@ -276,8 +347,6 @@ fn initialize() {
     scallop::builtins::enable(&builtins).expect("failed enabling builtins");
 }
 
-// TODO: remove allow when public package building support is added
-#[allow(dead_code)]
 pub(crate) fn run_phase(phase: phase::Phase) -> scallop::Result<ExecStatus> {
     BUILD_DATA.with(|d| -> scallop::Result<ExecStatus> {
         let eapi = d.borrow().eapi;
@@ -292,6 +361,12 @@ pub(crate) fn run_phase(phase: phase::Phase) -> scallop::Result<ExecStatus> {
             phase_func_name.bind(phase, None, None)?;
         }
 
+        flush_output();
+        if let Some(log) = &d.borrow().log {
+            log.phase(phase.name())
+                .map_err(|e| Error::Base(format!("failed writing build log: {e}")))?;
+        }
+
         // run user space pre-phase hooks
         if let Some(mut func) = functions::find(format!("pre_{phase}")) {
             func.execute(&[])?;
@@ -312,16 +387,26 @@ pub(crate) fn run_phase(phase: phase::Phase) -> scallop::Result<ExecStatus> {
         }
 
         d.borrow_mut().phase = None;
+        flush_output();
 
         Ok(ExecStatus::Success)
     })
 }
 
+/// Cache the options supported by all configure scripts under the given source directories.
+///
+/// This is an opt-in bulk operation for callers preparing multiple builds, running uncached
+/// scripts in parallel as limited by the active jobserver. Returns the number of scripts cached.
+pub fn prewarm_configure<P: AsRef<std::path::Path>>(dirs: &[P]) -> usize {
+    configure::prewarm(dirs)
+}
+
 pub(crate) fn source_ebuild(path: &Utf8Path) -> scallop::Result<()> {
     if !path.exists() {
         return Err(Error::Base(format!("nonexistent ebuild: {path:?}")));
     }
 
+    let _span = profile::ebuild(path);
     BUILD_DATA.with(|d| -> scallop::Result<()> {
         let eapi = d.borrow().eapi;
         d.borrow_mut().scope = Scope::Global;
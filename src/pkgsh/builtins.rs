@@ -1,6 +1,8 @@
 use std::borrow::Borrow;
 use std::collections::HashMap;
 use std::fmt;
+use std::rc::Rc;
+use std::str::FromStr;
 use std::sync::atomic::AtomicBool;
 
 use indexmap::IndexMap;
@@ -8,7 +10,9 @@ use once_cell::sync::Lazy;
 use regex::Regex;
 use scallop::builtins::{Builtin, ExecStatus};
 
-use super::phase::Phase;
+use super::phase::{Phase, PHASE_COUNT};
+use super::BUILD_DATA;
+use crate::atom::Version;
 use crate::{eapi, eapi::Eapi};
 
 mod _default_phase_func;
@@ -135,6 +139,20 @@ impl<T: Borrow<Phase>> From<T> for Scope {
     }
 }
 
+// Total number of scopes.
+const SCOPE_COUNT: usize = 2 + PHASE_COUNT;
+
+impl Scope {
+    // Return the dense index of the scope, less than `SCOPE_COUNT`.
+    fn index(&self) -> usize {
+        match self {
+            Self::Global => 0,
+            Self::Eclass => 1,
+            Self::Phase(p) => 2 + p.index(),
+        }
+    }
+}
+
 impl AsRef<str> for Scope {
     fn as_ref(&self) -> &str {
         match self {
@@ -311,22 +329,144 @@ pub(crate) static BUILTINS_MAP: Lazy<EapiBuiltinsMap> = Lazy::new(|| {
     builtins_map
 });
 
-static NONFATAL: Lazy<AtomicBool> = Lazy::new(|| AtomicBool::new(false));
+// Number of words used by builtin bitsets, supporting up to 128 builtins.
+const BUILTIN_SET_WORDS: usize = 2;
+
+/// Set of builtins indexed by their IDs.
+#[derive(Debug, Default, Copy, Clone)]
+struct BuiltinSet([u64; BUILTIN_SET_WORDS]);
+
+impl BuiltinSet {
+    fn insert(&mut self, id: usize) {
+        self.0[id / 64] |= 1 << (id % 64);
+    }
+
+    fn contains(&self, id: usize) -> bool {
+        self.0[id / 64] & (1 << (id % 64)) != 0
+    }
+}
+
+// Dense builtin IDs assigned in name order.
+static BUILTIN_IDS: Lazy<HashMap<&'static str, usize>> = Lazy::new(|| {
+    let mut names: Vec<_> = ALL_BUILTINS.keys().copied().collect();
+    names.sort_unstable();
+    assert!(names.len() <= BUILTIN_SET_WORDS * 64, "too many builtins for bitsets");
+    names.into_iter().enumerate().map(|(i, s)| (s, i)).collect()
+});
 
-static VERSION_RE: Lazy<Regex> = Lazy::new(|| {
-    Regex::new(r"(?P<sep>[[:^alnum:]]+)?(?P<comp>[[:digit:]]+|[[:alpha:]]+)?").unwrap()
+/// Return the dense ID for a builtin.
+pub(crate) fn builtin_id(name: &str) -> usize {
+    *BUILTIN_IDS
+        .get(name)
+        .unwrap_or_else(|| panic!("unknown builtin: {name}"))
+}
+
+// Enabled builtins for each EAPI indexed by ordinal, then by scope.
+static BUILTIN_SETS: Lazy<Vec<[BuiltinSet; SCOPE_COUNT]>> = Lazy::new(|| {
+    let mut eapi_sets = vec![[BuiltinSet::default(); SCOPE_COUNT]; eapi::EAPIS.len()];
+    for (eapi, scopes) in BUILTINS_MAP.iter() {
+        let sets = &mut eapi_sets[eapi.ordinal()];
+        for (scope, builtins) in scopes {
+            for name in builtins.keys() {
+                sets[scope.index()].insert(builtin_id(name));
+            }
+        }
+    }
+    eapi_sets
 });
 
+/// Determine if a builtin ID is enabled for a given EAPI and scope.
+///
+/// This is run for every builtin call so it avoids hashing, using direct indexing by EAPI
+/// ordinal and a bitset lookup.
+pub(crate) fn enabled(eapi: &'static Eapi, scope: Scope, id: usize) -> bool {
+    BUILTIN_SETS
+        .get(eapi.ordinal())
+        .map(|sets| sets[scope.index()].contains(id))
+        .unwrap_or_default()
+}
+
+static NONFATAL: Lazy<AtomicBool> = Lazy::new(|| AtomicBool::new(false));
+
+// Maximum number of version strings cached for each builtin data type.
+const VERSION_CACHE_SIZE: usize = 16;
+
+/// Cache of split and parsed version strings recently used by builtins.
+///
+/// Eclasses commonly call version-related builtins many times using the same values, e.g.
+/// `$PV`, so results are cached, evicting the oldest entry when full.
+#[derive(Debug, Default)]
+pub(crate) struct VersionCache {
+    splits: IndexMap<String, Rc<[usize]>>,
+    versions: IndexMap<String, Rc<Version>>,
+}
+
+impl VersionCache {
+    fn insert<T: Clone>(map: &mut IndexMap<String, T>, key: &str, value: T) -> T {
+        if map.len() >= VERSION_CACHE_SIZE {
+            map.shift_remove_index(0);
+        }
+        map.insert(key.to_string(), value.clone());
+        value
+    }
+
+    /// Return the ending offsets of the separators and components for a version string.
+    fn split(&mut self, ver: &str) -> Rc<[usize]> {
+        match self.splits.get(ver) {
+            Some(ends) => ends.clone(),
+            None => Self::insert(&mut self.splits, ver, version_split_ends(ver).into()),
+        }
+    }
+
+    /// Return the parsed version for a version string.
+    fn version(&mut self, ver: &str) -> crate::Result<Rc<Version>> {
+        match self.versions.get(ver) {
+            Some(v) => Ok(v.clone()),
+            None => Ok(Self::insert(&mut self.versions, ver, Rc::new(Version::from_str(ver)?))),
+        }
+    }
+}
+
+// Scan a version string for the ending offsets of alternating separators and components,
+// where components are either all digits or all letters.
+fn version_split_ends(ver: &str) -> Vec<usize> {
+    let bytes = ver.as_bytes();
+    let len = bytes.len();
+    let mut ends = vec![];
+    let mut i = 0;
+    loop {
+        while i < len && !bytes[i].is_ascii_alphanumeric() {
+            i += 1;
+        }
+        ends.push(i);
+        let digits = i < len && bytes[i].is_ascii_digit();
+        while i < len && bytes[i].is_ascii_alphanumeric() && bytes[i].is_ascii_digit() == digits {
+            i += 1;
+        }
+        ends.push(i);
+        if i >= len {
+            break;
+        }
+    }
+    ends
+}
+
 /// Split version string into a vector of separators and components.
 fn version_split(ver: &str) -> Vec<&str> {
-    let mut version_parts = Vec::new();
-    for caps in VERSION_RE.captures_iter(ver) {
-        version_parts.extend([
-            caps.name("sep").map_or("", |m| m.as_str()),
-            caps.name("comp").map_or("", |m| m.as_str()),
-        ]);
-    }
-    version_parts
+    let ends = BUILD_DATA.with(|d| d.borrow_mut().version_cache.split(ver));
+    let mut start = 0;
+    ends.iter()
+        .map(|&end| {
+            let part = &ver[start..end];
+            start = end;
+            part
+        })
+        .collect()
+}
+
+/// Parse a version string, using cached results for recently used values.
+fn version_parse(ver: &str) -> crate::Result<Rc<Version>> {
+    BUILD_DATA.with(|d| d.borrow_mut().version_cache.version(ver))
 }
 
 peg::parser! {
@@ -382,6 +522,7 @@ macro_rules! make_builtin {
 
         #[no_mangle]
         extern "C" fn $func_name(list: *mut scallop::bash::WordList) -> c_int {
+            $crate::pkgsh::profile::builtin($name);
             let words = list.into_words(false);
             let args: Vec<_> = words.into_iter().collect();
 
@@ -391,7 +532,7 @@ macro_rules! make_builtin {
                     let scope = d.borrow().scope;
                     let eapi = d.borrow().eapi;
 
-                    if eapi.builtins(scope).contains_key(cmd) {
+                    if $crate::pkgsh::builtins::enabled(eapi, scope, *BUILTIN_ID) {
                         match $func(&args) {
                             Ok(ret) => ret,
                             Err(e) => scallop::builtins::handle_error(cmd, e),
@@ -407,7 +548,10 @@ macro_rules! make_builtin {
                 })
             };
 
-            i32::from(run_builtin())
+            let status = run_builtin();
+            // output is otherwise flushed before commands run and at phase boundaries
+            $crate::pkgsh::flush_subshell_output();
+            i32::from(status)
         }
 
         pub(super) static BUILTIN: Builtin = Builtin {
@@ -420,6 +564,8 @@ macro_rules! make_builtin {
 
         pub(super) static PKG_BUILTIN: Lazy<PkgBuiltin> =
             Lazy::new(|| PkgBuiltin::new(BUILTIN, $scope));
+
+        static BUILTIN_ID: Lazy<usize> = Lazy::new(|| $crate::pkgsh::builtins::builtin_id($name));
     };
 }
 pub(self) use make_builtin;
@@ -517,3 +663,59 @@ macro_rules! builtin_scope_tests {
 }
 #[cfg(test)]
 pub(self) use builtin_scope_tests;
+
+#[cfg(test)]
+mod tests {
+    use crate::eapi::EAPIS;
+
+    use super::*;
+
+    #[test]
+    fn version_splitting() {
+        for (ver, expected) in [
+            ("", vec!["", ""]),
+            ("1.2.3", vec!["", "1", ".", "2", ".", "3"]),
+            ("1.2.3.", vec!["", "1", ".", "2", ".", "3", ".", ""]),
+            (".1..2", vec![".", "1", "..", "2"]),
+            ("1.2.3b_alpha4", vec!["", "1", ".", "2", ".", "3", "", "b", "_", "alpha", "", "4"]),
+            ("a1-é2", vec!["", "a", "", "1", "-é", "2"]),
+        ] {
+            assert_eq!(version_split(ver), expected, "failed splitting: {ver:?}");
+            // cached results
+            assert_eq!(version_split(ver), expected, "failed splitting: {ver:?}");
+        }
+    }
+
+    #[test]
+    fn version_cache() {
+        let mut cache = VersionCache::default();
+        let v1 = cache.version("1.2.3").unwrap();
+        assert!(Rc::ptr_eq(&v1, &cache.version("1.2.3").unwrap()));
+        assert!(cache.version("1.2.3-").is_err());
+
+        // oldest entries are evicted when full
+        for i in 0..VERSION_CACHE_SIZE {
+            cache.version(&i.to_string()).unwrap();
+            cache.split(&i.to_string());
+        }
+        assert_eq!(cache.versions.len(), VERSION_CACHE_SIZE);
+        assert_eq!(cache.splits.len(), VERSION_CACHE_SIZE);
+        assert!(!Rc::ptr_eq(&v1, &cache.version("1.2.3").unwrap()));
+    }
+
+    #[test]
+    fn builtin_sets() {
+        let static_scopes = [Scope::Global, Scope::Eclass];
+        for eapi in EAPIS.values() {
+            let phase_scopes: Vec<Scope> = eapi.phases().iter().map(|p| p.into()).collect();
+            for scope in static_scopes.iter().chain(phase_scopes.iter()) {
+                let builtins = eapi.builtins(*scope);
+                for name in ALL_BUILTINS.keys() {
+                    let id = builtin_id(name);
+                    let info = format!("EAPI={eapi}, scope: {scope}, builtin: {name}");
+                    assert_eq!(enabled(eapi, *scope, id), builtins.contains_key(name), "{info}");
+                }
+            }
+        }
+    }
+}
@@ -8,6 +8,7 @@ use scallop::builtins::ExecStatus;
 use scallop::{Error, Result};
 use walkdir::{DirEntry, WalkDir};
 
+use crate::pkgsh::patch;
 use crate::pkgsh::write_stdout;
 
 use super::make_builtin;
@@ -16,6 +17,9 @@ const LONG_DOC: &str = "Apply patches to a package's source code.";
 
 type Patches = Vec<(Option<PathBuf>, Vec<PathBuf>)>;
 
+// Default options passed to `patch`.
+const PATCH_OPTIONS: &[&str] = &["-p1", "-f", "-g0", "--no-backup-if-mismatch"];
+
 // Predicate used to filter compatible patch files from an iterator.
 fn is_patch(entry: &DirEntry) -> bool {
     let path = entry.path();
@@ -84,6 +88,21 @@ pub(crate) fn run(args: &[&str]) -> Result<ExecStatus> {
     }
 
     let patches = find_patches(&files)?;
+    let options: Vec<_> = PATCH_OPTIONS
+        .iter()
+        .chain(options.iter())
+        .copied()
+        .collect();
+
+    // Patches are applied internally when possible, falling back to `patch` for unsupported
+    // options, formats, or patches requiring fuzz. Parsing runs in a separate thread so the
+    // next patch is ready as soon as the current one is applied.
+    let strip = patch::strip_level(&options);
+    let parsed = strip.map(|_| {
+        let paths = patches.iter().flat_map(|(_, files)| files.iter().cloned());
+        patch::parse_files(paths.collect())
+    });
+
     for (path, files) in patches.iter() {
         let msg_prefix = match path {
             None => "",
@@ -99,10 +118,20 @@ pub(crate) fn run(args: &[&str]) -> Result<ExecStatus> {
                 None => write_stdout!("{msg_prefix}Applying {name}...\n"),
                 _ => write_stdout!("{msg_prefix}{name}...\n"),
             }
+
+            let patch = parsed.as_ref().and_then(|rx| rx.recv().ok().flatten());
+            if let (Some(patch), Some(strip)) = (patch, strip) {
+                let applied = patch
+                    .apply(".", strip)
+                    .map_err(|e| Error::Base(format!("failed applying: {name}: {e}")))?;
+                if applied {
+                    continue;
+                }
+            }
+
             let data = File::open(f)
                 .map_err(|e| Error::Base(format!("failed reading patch {f:?}: {e}")))?;
             let output = Command::new("patch")
-                .args(["-p1", "-f", "-g0", "--no-backup-if-mismatch"])
                 .args(&options)
                 .stdin(data)
                 .output()
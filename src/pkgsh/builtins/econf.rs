@@ -1,22 +1,20 @@
 use std::io::Write;
 use std::process::Command;
-use std::str;
 
-use indexmap::{IndexMap, IndexSet};
+use indexmap::IndexMap;
 use is_executable::IsExecutable;
-use regex::Regex;
 use scallop::builtins::ExecStatus;
 use scallop::variables::{expand, string_value};
 use scallop::{Error, Result};
 
 use crate::command::RunCommand;
+use crate::pkgsh::configure::known_options;
 use crate::pkgsh::utils::{configure, get_libdir};
 use crate::pkgsh::write_stdout;
 use crate::pkgsh::BUILD_DATA;
 
 use super::make_builtin;
 
-static CONFIG_OPT_RE: Lazy<Regex> = Lazy::new(|| Regex::new(r"^(?P<opt>--[\w\+_\.-]+)").unwrap());
 const LONG_DOC: &str = "Run a package's configure script.";
 
 #[doc = stringify!(LONG_DOC)]
@@ -39,18 +37,8 @@ pub(crate) fn run(args: &[&str]) -> Result<ExecStatus> {
         })
         .collect();
 
-    // parse `./configure --help` output to determine supported options
-    let conf_help = Command::new(&configure)
-        .arg("--help")
-        .output()
-        .map_err(|e| Error::Base(format!("failed running: {e}")))?;
-    let mut known_opts = IndexSet::<String>::new();
-    let conf_help = str::from_utf8(&conf_help.stdout).expect("failed decoding configure output");
-    for line in conf_help.split('\n') {
-        for caps in CONFIG_OPT_RE.captures_iter(line.trim()) {
-            known_opts.insert(caps["opt"].to_string());
-        }
-    }
+    // determine supported options from cached `./configure --help` output
+    let known_opts = known_options(&configure)?;
 
     let mut defaults = IndexMap::<&str, Option<String>>::new();
     BUILD_DATA.with(|d| {
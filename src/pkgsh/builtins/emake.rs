@@ -1,3 +1,4 @@
+use std::env;
 use std::io::Write;
 use std::process::Command;
 
@@ -6,6 +7,7 @@ use scallop::variables::{string_value, string_vec};
 use scallop::{Error, Result};
 
 use crate::command::RunCommand;
+use crate::pkgsh::jobserver::{self, strip_jobs};
 use crate::pkgsh::utils::makefile_exists;
 use crate::pkgsh::write_stdout;
 
@@ -22,8 +24,17 @@ pub(crate) fn run(args: &[&str]) -> Result<ExecStatus> {
     let make_prog = string_value("MAKE");
     let make_prog = make_prog.as_deref().unwrap_or("make");
     let mut emake = Command::new(make_prog);
-    if let Ok(opts) = string_vec("MAKEOPTS") {
-        emake.args(&opts);
+    let opts = string_vec("MAKEOPTS").unwrap_or_default();
+    match jobserver::get() {
+        // the jobserver controls parallelism so job counts from $MAKEOPTS are ignored
+        Some(jobserver) => {
+            emake.args(strip_jobs(&opts));
+            let flags = env::var("MAKEFLAGS").ok();
+            emake.env("MAKEFLAGS", jobserver.makeflags(flags.as_deref()));
+        }
+        None => {
+            emake.args(&opts);
+        }
     }
 
     emake.args(args);
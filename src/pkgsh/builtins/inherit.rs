@@ -2,9 +2,7 @@ use scallop::builtins::{builtin_level, ExecStatus};
 use scallop::variables::{string_vec, unbind, ScopedVariable, Variable, Variables};
 use scallop::{source, Error, Result};
 
-use crate::macros::build_from_paths;
-use crate::pkgsh::BUILD_DATA;
-use crate::repo::Repository;
+use crate::pkgsh::{profile, BUILD_DATA};
 
 use super::{make_builtin, Scope, ECLASS, GLOBAL};
 
@@ -44,12 +42,19 @@ pub(crate) fn run(args: &[&str]) -> Result<ExecStatus> {
             }
 
             eclass_var.bind(&eclass, None, None)?;
-            let path =
-                build_from_paths!(d.borrow().repo.path(), "eclass", format!("{eclass}.eclass"));
+            let path = match d.borrow().repo.eclasses().get(&eclass) {
+                Some(e) => e.path().to_path_buf(),
+                None => {
+                    let msg = format!("failed loading eclass: {eclass}: nonexistent eclass");
+                    return Err(Error::Base(msg));
+                }
+            };
+            let span = profile::eclass(&eclass);
             if let Err(e) = source::file(&path) {
                 let msg = format!("failed loading eclass: {eclass}: {e}");
                 return Err(Error::Base(msg));
             }
+            drop(span);
 
             let mut d = d.borrow_mut();
             // append metadata keys that incrementally accumulate
@@ -1,12 +1,8 @@
-use std::str::FromStr;
-
 use scallop::builtins::ExecStatus;
 use scallop::variables::string_value;
 use scallop::{Error, Result};
 
-use crate::atom::Version;
-
-use super::{make_builtin, ALL};
+use super::{make_builtin, version_parse, ALL};
 
 const LONG_DOC: &str = "Perform comparisons on package version strings.";
 
@@ -21,8 +17,8 @@ pub(crate) fn run(args: &[&str]) -> Result<ExecStatus> {
         n => Err(Error::Base(format!("only accepts 2 or 3 args, got {n}"))),
     }?;
 
-    let v1 = Version::from_str(v1)?;
-    let v2 = Version::from_str(v2)?;
+    let v1 = version_parse(v1)?;
+    let v2 = version_parse(v2)?;
 
     let ret = match op {
         "-eq" => v1 == v2,
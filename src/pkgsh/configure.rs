@@ -0,0 +1,353 @@
+use std::collections::HashMap;
+use std::fs;
+use std::io::Write;
+use std::path::{Path, PathBuf};
+use std::process::Command;
+use std::sync::{Arc, Mutex};
+use std::time::SystemTime;
+
+use indexmap::IndexSet;
+use is_executable::IsExecutable;
+use itertools::Either;
+use md5::{Digest, Md5};
+use once_cell::sync::Lazy;
+use regex::Regex;
+use scallop::{Error, Result};
+use tempfile::NamedTempFile;
+use tracing::warn;
+use walkdir::WalkDir;
+
+use super::jobserver::{self, Jobserver};
+use crate::config::Config;
+
+static CONFIG_OPT_RE: Lazy<Regex> = Lazy::new(|| Regex::new(r"^(?P<opt>--[\w\+_\.-]+)").unwrap());
+
+// Maximum directory depth searched for configure scripts when pre-warming the cache.
+const PREWARM_DEPTH: usize = 3;
+
+static OPTIONS_CACHE: Lazy<OptionsCache> = Lazy::new(|| {
+    let cache = &Config::current().path.cache;
+    let dir = match cache.as_str().is_empty() {
+        true => None,
+        false => Some(cache.join("econf").into_std_path_buf()),
+    };
+    OptionsCache::new(dir)
+});
+
+/// Options supported by a configure script.
+pub(super) type KnownOptions = Arc<IndexSet<String>>;
+
+/// Return the options supported by a given configure script.
+pub(super) fn known_options<P: AsRef<Path>>(path: P) -> Result<KnownOptions> {
+    OPTIONS_CACHE.get(path.as_ref())
+}
+
+/// Cache the options for all configure scripts under the given directories.
+pub(super) fn prewarm<P: AsRef<Path>>(dirs: &[P]) -> usize {
+    OPTIONS_CACHE.prewarm(dirs, jobserver::get())
+}
+
+// Parse `configure --help` output to determine supported options.
+//
+// Failed runs are returned as errors so partial output is never cached.
+fn help(path: &Path) -> Result<IndexSet<String>> {
+    let output = Command::new(path)
+        .arg("--help")
+        .output()
+        .map_err(|e| Error::Base(format!("failed running: {e}")))?;
+    if !output.status.success() {
+        let err = String::from_utf8_lossy(&output.stderr);
+        let msg = match err.trim() {
+            "" => format!("{path:?} --help failed: {}", output.status),
+            err => format!("{path:?} --help failed: {}: {err}", output.status),
+        };
+        return Err(Error::Base(msg));
+    }
+    let output = String::from_utf8_lossy(&output.stdout);
+    let mut options = IndexSet::new();
+    for line in output.split('\n') {
+        for caps in CONFIG_OPT_RE.captures_iter(line.trim()) {
+            options.insert(caps["opt"].to_string());
+        }
+    }
+    Ok(options)
+}
+
+#[derive(Debug)]
+struct Entry {
+    size: u64,
+    modified: SystemTime,
+    options: KnownOptions,
+}
+
+// Configure script data used to validate and store cache entries.
+#[derive(Debug)]
+struct Script {
+    path: PathBuf,
+    size: u64,
+    modified: SystemTime,
+    hash: String,
+}
+
+/// Cache of options supported by configure scripts.
+///
+/// Entries are validated in memory via file size and modification time, falling back to
+/// files keyed by content hash that persist across builds.
+#[derive(Debug, Default)]
+struct OptionsCache {
+    dir: Option<PathBuf>,
+    entries: Mutex<HashMap<PathBuf, Entry>>,
+}
+
+impl OptionsCache {
+    fn new(dir: Option<PathBuf>) -> Self {
+        OptionsCache {
+            dir,
+            ..Default::default()
+        }
+    }
+
+    /// Return the options supported by a given configure script.
+    fn get(&self, path: &Path) -> Result<KnownOptions> {
+        match self.lookup(path)? {
+            Either::Left(options) => Ok(options),
+            Either::Right(script) => {
+                let options = help(&script.path)?;
+                Ok(self.insert(script, options))
+            }
+        }
+    }
+
+    /// Cache the options for all configure scripts under the given directories.
+    ///
+    /// Uncached scripts are run in parallel when a jobserver is given, limited by its available
+    /// tokens, otherwise serially. Scripts that fail to be read or run are skipped, econf
+    /// reports errors if they're used.
+    fn prewarm<P: AsRef<Path>>(&self, dirs: &[P], jobserver: Option<&'static Jobserver>) -> usize {
+        let mut scripts = vec![];
+        for dir in dirs {
+            let entries = WalkDir::new(dir).max_depth(PREWARM_DEPTH).into_iter();
+            for entry in entries.filter_map(|e| e.ok()) {
+                let path = entry.path();
+                if entry.file_name() == "configure" && path.is_executable() {
+                    if let Ok(Either::Right(script)) = self.lookup(path) {
+                        scripts.push(script);
+                    }
+                }
+            }
+        }
+
+        let paths: Vec<_> = scripts.iter().map(|s| s.path.clone()).collect();
+        let results = match jobserver {
+            Some(jobserver) => jobserver.parallel(paths, |path| help(&path)),
+            None => paths.iter().map(|path| help(path)).collect(),
+        };
+
+        let mut count = 0;
+        for (script, result) in scripts.into_iter().zip(results) {
+            if let Ok(options) = result {
+                self.insert(script, options);
+                count += 1;
+            }
+        }
+        count
+    }
+
+    // Return cached options for a script, otherwise the data required to cache them.
+    fn lookup(&self, path: &Path) -> Result<Either<KnownOptions, Script>> {
+        let failed = |e: std::io::Error| {
+            Error::Base(format!("failed reading configure script: {path:?}: {e}"))
+        };
+        let path = fs::canonicalize(path).map_err(failed)?;
+        let meta = fs::metadata(&path).map_err(failed)?;
+        let (size, modified) = (meta.len(), meta.modified().map_err(failed)?);
+
+        if let Some(entry) = self.entries.lock().unwrap().get(&path) {
+            if entry.size == size && entry.modified == modified {
+                return Ok(Either::Left(entry.options.clone()));
+            }
+        }
+
+        let data = fs::read(&path).map_err(failed)?;
+        let hash = format!("{:x}", Md5::digest(&data));
+        let script = Script {
+            path,
+            size,
+            modified,
+            hash,
+        };
+        match self.load(&script.hash) {
+            Some(options) => Ok(Either::Left(self.insert_entry(script, options))),
+            None => Ok(Either::Right(script)),
+        }
+    }
+
+    // Load options from the cache file for a given content hash.
+    fn load(&self, hash: &str) -> Option<IndexSet<String>> {
+        let path = self.dir.as_ref()?.join(hash);
+        let data = fs::read_to_string(path).ok()?;
+        Some(data.lines().map(|s| s.to_string()).collect())
+    }
+
+    // Atomically write options to the cache file for a given content hash.
+    fn store(&self, hash: &str, options: &IndexSet<String>) -> std::io::Result<()> {
+        if let Some(dir) = &self.dir {
+            fs::create_dir_all(dir)?;
+            let mut file = NamedTempFile::new_in(dir)?;
+            for opt in options {
+                writeln!(file, "{opt}")?;
+            }
+            file.persist(dir.join(hash))?;
+        }
+        Ok(())
+    }
+
+    // Cache options for a script in memory and on disk.
+    fn insert(&self, script: Script, options: IndexSet<String>) -> KnownOptions {
+        // failing to persist the cache only affects later builds
+        if let Err(e) = self.store(&script.hash, &options) {
+            warn!("failed caching configure options: {:?}: {e}", script.path);
+        }
+        self.insert_entry(script, options)
+    }
+
+    // Cache options for a script in memory.
+    fn insert_entry(&self, script: Script, options: IndexSet<String>) -> KnownOptions {
+        let options = Arc::new(options);
+        let entry = Entry {
+            size: script.size,
+            modified: script.modified,
+            options: options.clone(),
+        };
+        self.entries.lock().unwrap().insert(script.path, entry);
+        options
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::fs::Permissions;
+    use std::os::unix::fs::PermissionsExt;
+
+    use indoc::indoc;
+    use tempfile::tempdir;
+
+    use super::*;
+
+    // Create a configure script that logs each run to a file in its directory.
+    fn create_script(path: &Path, options: &[&str]) {
+        fs::create_dir_all(path.parent().unwrap()).unwrap();
+        let mut data = indoc! {r#"
+            #!/bin/sh
+            echo run >> "$(dirname "$0")/runs"
+        "#}
+        .to_string();
+        for opt in options {
+            data.push_str(&format!("echo '  {opt}  description'\n"));
+        }
+        fs::write(path, data).unwrap();
+        fs::set_permissions(path, Permissions::from_mode(0o755)).unwrap();
+    }
+
+    fn runs(path: &Path) -> usize {
+        let runs = path.parent().unwrap().join("runs");
+        fs::read_to_string(runs).unwrap_or_default().lines().count()
+    }
+
+    #[test]
+    fn get() {
+        let cache_dir = tempdir().unwrap();
+        let dir = tempdir().unwrap();
+        let script = dir.path().join("configure");
+        create_script(&script, &["--enable-foo", "--with-bar=DIR"]);
+
+        // initial run caches the options
+        let cache = OptionsCache::new(Some(cache_dir.path().to_path_buf()));
+        let options = cache.get(&script).unwrap();
+        assert_eq!(options.iter().collect::<Vec<_>>(), ["--enable-foo", "--with-bar"]);
+        assert_eq!(runs(&script), 1);
+        cache.get(&script).unwrap();
+        assert_eq!(runs(&script), 1);
+
+        // cached options persist across instances
+        let cache = OptionsCache::new(Some(cache_dir.path().to_path_buf()));
+        assert_eq!(cache.get(&script).unwrap(), options);
+        assert_eq!(runs(&script), 1);
+
+        // modified scripts are rerun
+        create_script(&script, &["--disable-foo"]);
+        let options = cache.get(&script).unwrap();
+        assert_eq!(options.iter().collect::<Vec<_>>(), ["--disable-foo"]);
+        assert_eq!(runs(&script), 2);
+
+        // memory-only cache
+        let cache = OptionsCache::new(None);
+        cache.get(&script).unwrap();
+        cache.get(&script).unwrap();
+        assert_eq!(runs(&script), 3);
+
+        // nonexistent script
+        assert!(cache.get(&dir.path().join("nonexistent")).is_err());
+    }
+
+    #[test]
+    fn failure() {
+        let cache_dir = tempdir().unwrap();
+        let dir = tempdir().unwrap();
+        let script = dir.path().join("configure");
+        create_script(&script, &["--enable-foo"]);
+        let data = fs::read_to_string(&script).unwrap();
+        fs::write(&script, format!("{data}echo broken >&2\nexit 1\n")).unwrap();
+
+        // failed runs are errors and aren't cached
+        let cache = OptionsCache::new(Some(cache_dir.path().to_path_buf()));
+        let err = cache.get(&script).unwrap_err().to_string();
+        assert!(err.contains("broken"), "{err}");
+        assert!(cache.get(&script).is_err());
+        assert_eq!(runs(&script), 2);
+        assert_eq!(cache.prewarm(&[dir.path()], None), 0);
+        assert_eq!(runs(&script), 3);
+        assert_eq!(
+            fs::read_dir(cache_dir.path())
+                .map(|d| d.count())
+                .unwrap_or(0),
+            0
+        );
+    }
+
+    #[test]
+    fn prewarm() {
+        let cache_dir = tempdir().unwrap();
+        let dir = tempdir().unwrap();
+        let scripts: Vec<_> = ["configure", "a/configure", "b/c/configure"]
+            .iter()
+            .map(|p| dir.path().join(p))
+            .collect();
+        for path in &scripts {
+            create_script(path, &["--enable-foo"]);
+        }
+        // nonexecutable scripts are ignored
+        fs::create_dir(dir.path().join("d")).unwrap();
+        fs::write(dir.path().join("d/configure"), "").unwrap();
+
+        let cache = OptionsCache::new(Some(cache_dir.path().to_path_buf()));
+        let jobserver: &'static Jobserver = Box::leak(Box::new(Jobserver::new(2).unwrap()));
+        assert_eq!(cache.prewarm(&[dir.path()], Some(jobserver)), 3);
+        assert_eq!(cache.prewarm(&[dir.path()], Some(jobserver)), 0);
+        for path in &scripts {
+            cache.get(path).unwrap();
+            assert_eq!(runs(path), 1);
+        }
+        // all job tokens are returned
+        let tokens = [jobserver.try_acquire(), jobserver.try_acquire()];
+        assert!(tokens[0].is_some() && tokens[1].is_none());
+
+        // scripts are run serially without a jobserver
+        let other = tempdir().unwrap();
+        let script = other.path().join("configure");
+        create_script(&script, &["--enable-bar"]);
+        let cache = OptionsCache::new(Some(cache_dir.path().to_path_buf()));
+        assert_eq!(cache.prewarm(&[dir.path(), other.path()], None), 1);
+        assert_eq!(runs(&script), 1);
+    }
+}
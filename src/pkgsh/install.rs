@@ -1,3 +1,4 @@
+use std::collections::HashSet;
 use std::os::unix::fs::symlink;
 use std::path::{Path, PathBuf};
 use std::process::Command;
@@ -10,7 +11,7 @@ use nix::{sys::stat, unistd};
 use scallop::{Error, Result};
 use walkdir::{DirEntry, WalkDir};
 
-use super::BuildData;
+use super::{jobserver, BuildData};
 use crate::command::RunCommand;
 use crate::files::{Group, Mode, User};
 
@@ -296,6 +297,7 @@ impl Install {
         P: AsRef<Path>,
         Q: AsRef<Path>,
     {
+        let mut files = vec![];
         for (source, dest) in paths.into_iter() {
             let source = source.as_ref();
             let dest = self.prefix(dest.as_ref());
@@ -310,15 +312,35 @@ impl Install {
                 _ => (),
             }
 
-            fs::copy(source, &dest).map_err(|e| {
+            files.push((source.to_path_buf(), dest, meta));
+        }
+
+        let copy = |(source, dest): (PathBuf, PathBuf)| -> Result<()> {
+            fs::copy(&source, &dest).map_err(|e| {
                 Error::Base(format!("failed copying file: {source:?} to {dest:?}: {e}"))
             })?;
-            if let InstallOpts::Internal(opts) = &self.file_options {
-                self.set_attributes(opts, &dest)?;
+            Ok(())
+        };
+
+        // copy files in parallel using available jobserver tokens if targets are unique
+        let copies: Vec<_> = files
+            .iter()
+            .map(|(s, d, _)| (s.clone(), d.clone()))
+            .collect();
+        let unique = copies.iter().map(|(_, d)| d).collect::<HashSet<_>>().len() == copies.len();
+        let results = match jobserver::get() {
+            Some(jobserver) if unique => jobserver.parallel(copies, copy),
+            _ => copies.into_iter().map(copy).collect(),
+        };
+        results.into_iter().collect::<Result<Vec<_>>>()?;
+
+        if let InstallOpts::Internal(opts) = &self.file_options {
+            for (_, dest, meta) in &files {
+                self.set_attributes(opts, dest)?;
                 if opts.preserve_timestamps {
-                    let atime = FileTime::from_last_access_time(&meta);
-                    let mtime = FileTime::from_last_modification_time(&meta);
-                    set_file_times(&dest, atime, mtime)
+                    let atime = FileTime::from_last_access_time(meta);
+                    let mtime = FileTime::from_last_modification_time(meta);
+                    set_file_times(dest, atime, mtime)
                         .map_err(|e| Error::Base(format!("failed setting file time: {e}")))?;
                 }
             }
@@ -0,0 +1,351 @@
+use std::fs::{File, OpenOptions};
+use std::io::{self, Read, Write};
+use std::os::unix::fs::OpenOptionsExt;
+use std::os::unix::io::{AsRawFd, FromRawFd, RawFd};
+use std::sync::{Arc, Mutex};
+use std::{env, thread};
+
+use nix::fcntl::{fcntl, FcntlArg};
+use nix::poll::{poll, PollFd, PollFlags};
+use nix::unistd::pipe;
+use once_cell::sync::OnceCell;
+
+static JOBSERVER: OnceCell<Jobserver> = OnceCell::new();
+
+/// Return the active jobserver, if any.
+pub(crate) fn get() -> Option<&'static Jobserver> {
+    JOBSERVER.get().or_else(|| {
+        // join a jobserver inherited from the environment, e.g. when run under `make -j`
+        let flags = env::var("MAKEFLAGS").ok()?;
+        let jobserver = Jobserver::from_makeflags(&flags)?;
+        Some(JOBSERVER.get_or_init(|| jobserver))
+    })
+}
+
+/// Return the active jobserver, creating one with a given number of job slots if necessary.
+pub(crate) fn init(jobs: usize) -> io::Result<&'static Jobserver> {
+    match get() {
+        Some(jobserver) => Ok(jobserver),
+        None => JOBSERVER.get_or_try_init(|| Jobserver::new(jobs)),
+    }
+}
+
+/// GNU make compatible jobserver limiting the total parallelism of builds.
+///
+/// Each client implicitly owns one job slot and must acquire a token from the shared pipe
+/// for every additional concurrent job, returning it when the job completes.
+#[derive(Debug)]
+pub(crate) struct Jobserver {
+    read: File,
+    write: File,
+    // separate nonblocking description of the read end so polling readers can't block
+    try_read: Option<File>,
+    jobs: Option<usize>,
+}
+
+// Open a nonblocking file description for the read end of a jobserver.
+//
+// The shared description can't be made nonblocking since `make` expects blocking reads.
+fn open_nonblocking(read: &File) -> Option<File> {
+    OpenOptions::new()
+        .read(true)
+        .custom_flags(libc::O_NONBLOCK | libc::O_CLOEXEC)
+        .open(format!("/proc/self/fd/{}", read.as_raw_fd()))
+        .ok()
+}
+
+impl Jobserver {
+    /// Create a jobserver with a given number of job slots.
+    pub(crate) fn new(jobs: usize) -> io::Result<Self> {
+        // pipe file descriptors are intentionally inheritable so `make` can use them
+        let (r, w) = pipe()?;
+        let (read, mut write) = unsafe { (File::from_raw_fd(r), File::from_raw_fd(w)) };
+        let tokens = vec![b'+'; jobs.max(1) - 1];
+        write.write_all(&tokens)?;
+        Ok(Jobserver {
+            try_read: open_nonblocking(&read),
+            read,
+            write,
+            jobs: Some(jobs.max(1)),
+        })
+    }
+
+    /// Join an existing jobserver defined by `MAKEFLAGS`.
+    fn from_makeflags(flags: &str) -> Option<Self> {
+        let mut jobs = None;
+        let mut auth = None;
+        for flag in flags.split_whitespace() {
+            if let Some(n) = flag.strip_prefix("-j") {
+                jobs = n.parse().ok();
+            } else if let Some(value) = flag
+                .strip_prefix("--jobserver-auth=")
+                .or_else(|| flag.strip_prefix("--jobserver-fds="))
+            {
+                auth = Some(value);
+            }
+        }
+
+        let (read, write) = match auth?.strip_prefix("fifo:") {
+            Some(path) => {
+                let file = OpenOptions::new().read(true).write(true).open(path).ok()?;
+                (file.try_clone().ok()?, file)
+            }
+            None => {
+                let (r, w) = auth?.split_once(',')?;
+                let (r, w): (RawFd, RawFd) = (r.parse().ok()?, w.parse().ok()?);
+                // verify the descriptors were actually inherited
+                for fd in [r, w] {
+                    fcntl(fd, FcntlArg::F_GETFD).ok()?;
+                }
+                unsafe { (File::from_raw_fd(r), File::from_raw_fd(w)) }
+            }
+        };
+
+        Some(Jobserver {
+            try_read: open_nonblocking(&read),
+            read,
+            write,
+            jobs,
+        })
+    }
+
+    /// Return the `MAKEFLAGS` value passing the jobserver to `make`, retaining any
+    /// non-jobserver flags from a given existing value.
+    pub(crate) fn makeflags(&self, existing: Option<&str>) -> String {
+        let (r, w) = (self.read.as_raw_fd(), self.write.as_raw_fd());
+        let mut flags: Vec<String> = existing
+            .unwrap_or_default()
+            .split_whitespace()
+            .filter(|s| !is_jobs_flag(s) && !s.starts_with("--jobserver-"))
+            .map(|s| s.to_string())
+            .collect();
+        if let Some(jobs) = self.jobs {
+            flags.push(format!("-j{jobs}"));
+        }
+        flags.push(format!("--jobserver-auth={r},{w}"));
+        flags.push(format!("--jobserver-fds={r},{w}"));
+        flags.join(" ")
+    }
+
+    /// Acquire a token for an additional job, blocking until one is available.
+    pub(crate) fn acquire(&self) -> io::Result<Token> {
+        let mut buf = [0];
+        loop {
+            match (&self.read).read(&mut buf) {
+                Ok(0) => {
+                    return Err(io::Error::new(io::ErrorKind::UnexpectedEof, "jobserver closed"))
+                }
+                Ok(_) => break,
+                Err(e) if e.kind() == io::ErrorKind::Interrupted => continue,
+                Err(e) => return Err(e),
+            }
+        }
+        Ok(Token {
+            jobserver: self,
+            byte: buf[0],
+        })
+    }
+
+    /// Acquire a token for an additional job if one is currently available.
+    pub(crate) fn try_acquire(&self) -> Option<Token> {
+        let mut file = match &self.try_read {
+            Some(file) => file,
+            None => {
+                // Without a nonblocking description, another client could take the token
+                // between polling and reading, blocking until the next token is released.
+                let mut fds = [PollFd::new(self.read.as_raw_fd(), PollFlags::POLLIN)];
+                return match poll(&mut fds, 0) {
+                    Ok(n) if n > 0 => self.acquire().ok(),
+                    _ => None,
+                };
+            }
+        };
+
+        let mut buf = [0];
+        loop {
+            match file.read(&mut buf) {
+                Ok(1) => {
+                    return Some(Token {
+                        jobserver: self,
+                        byte: buf[0],
+                    })
+                }
+                Err(e) if e.kind() == io::ErrorKind::Interrupted => continue,
+                _ => return None,
+            }
+        }
+    }
+
+    /// Return the descriptor that becomes readable when tokens are available.
+    pub(crate) fn as_raw_fd(&self) -> RawFd {
+        self.read.as_raw_fd()
+    }
+
+    /// Run a function over items in parallel, limited by the available job tokens.
+    ///
+    /// The calling thread uses its implicit job slot while each additional thread holds a
+    /// token until all items are processed. Results are returned in item order.
+    pub(crate) fn parallel<T, R, F>(&'static self, items: Vec<T>, func: F) -> Vec<R>
+    where
+        T: Send + 'static,
+        R: Send + 'static,
+        F: Fn(T) -> R + Send + Sync + 'static,
+    {
+        let len = items.len();
+        let queue = Arc::new(Mutex::new(items.into_iter().enumerate()));
+        let func = Arc::new(func);
+        let worker = move || {
+            let mut results = vec![];
+            loop {
+                // release the queue lock before running each item
+                let next = queue.lock().unwrap().next();
+                match next {
+                    Some((i, item)) => results.push((i, func(item))),
+                    None => break,
+                }
+            }
+            results
+        };
+
+        let mut handles = vec![];
+        for _ in 1..len {
+            match self.try_acquire() {
+                Some(token) => {
+                    let worker = worker.clone();
+                    handles.push(thread::spawn(move || {
+                        let _token = token;
+                        worker()
+                    }));
+                }
+                None => break,
+            }
+        }
+
+        let mut results = worker();
+        for handle in handles {
+            results.extend(handle.join().expect("jobserver thread panicked"));
+        }
+        results.sort_by_key(|(i, _)| *i);
+        results.into_iter().map(|(_, r)| r).collect()
+    }
+}
+
+/// A job token returned to its jobserver when dropped.
+#[derive(Debug)]
+pub(crate) struct Token<'a> {
+    jobserver: &'a Jobserver,
+    byte: u8,
+}
+
+impl Drop for Token<'_> {
+    fn drop(&mut self) {
+        (&self.jobserver.write).write_all(&[self.byte]).ok();
+    }
+}
+
+// Determine if a `make` flag sets the number of jobs.
+fn is_jobs_flag(flag: &str) -> bool {
+    flag.starts_with("-j") || flag == "--jobs" || flag.starts_with("--jobs=")
+}
+
+/// Remove job count options from a list of `make` options.
+pub(crate) fn strip_jobs<S: AsRef<str>>(options: &[S]) -> Vec<&str> {
+    let mut stripped = vec![];
+    let mut options = options.iter().map(|s| s.as_ref()).peekable();
+    while let Some(opt) = options.next() {
+        if is_jobs_flag(opt) {
+            // skip separate job count arguments, e.g. `-j 4`
+            if matches!(opt, "-j" | "--jobs") {
+                options.next_if(|s| s.parse::<usize>().is_ok());
+            }
+        } else {
+            stripped.push(opt);
+        }
+    }
+    stripped
+}
+
+#[cfg(test)]
+mod tests {
+    use std::sync::atomic::{AtomicUsize, Ordering};
+    use std::time::Duration;
+
+    use super::*;
+
+    #[test]
+    fn tokens() {
+        let jobserver = Jobserver::new(3).unwrap();
+        let t1 = jobserver.acquire().unwrap();
+        let t2 = jobserver.try_acquire().unwrap();
+        // the implicit slot isn't available from the pipe
+        assert!(jobserver.try_acquire().is_none());
+        drop(t1);
+        let t3 = jobserver.try_acquire().unwrap();
+        assert!(jobserver.try_acquire().is_none());
+        drop((t2, t3));
+        assert!(jobserver.try_acquire().is_some());
+
+        // single slot jobservers have no tokens
+        let jobserver = Jobserver::new(1).unwrap();
+        assert!(jobserver.try_acquire().is_none());
+
+        // tokens taken by other clients after polling don't block
+        let jobserver = Jobserver::new(2).unwrap();
+        assert!(jobserver.try_read.is_some());
+        let mut fds = [PollFd::new(jobserver.as_raw_fd(), PollFlags::POLLIN)];
+        assert_eq!(poll(&mut fds, 0).unwrap(), 1);
+        let token = jobserver.acquire().unwrap();
+        assert!(jobserver.try_acquire().is_none());
+        drop(token);
+        assert!(jobserver.try_acquire().is_some());
+    }
+
+    #[test]
+    fn makeflags() {
+        let jobserver = Jobserver::new(4).unwrap();
+        let (r, w) = (jobserver.read.as_raw_fd(), jobserver.write.as_raw_fd());
+        let auth = format!("--jobserver-auth={r},{w} --jobserver-fds={r},{w}");
+        assert_eq!(jobserver.makeflags(None), format!("-j4 {auth}"));
+        let flags = jobserver.makeflags(Some("-k -j8 --jobserver-auth=7,8"));
+        assert_eq!(flags, format!("-k -j4 {auth}"));
+
+        // join an inherited jobserver
+        let joined = Jobserver::from_makeflags(&flags).unwrap();
+        assert_eq!(joined.jobs, Some(4));
+        let token = joined.acquire().unwrap();
+        drop(token);
+        // leak the joined descriptors since they're owned by the original jobserver
+        std::mem::forget(joined);
+
+        // invalid descriptors
+        assert!(Jobserver::from_makeflags("-j4 --jobserver-auth=1000,1001").is_none());
+        assert!(Jobserver::from_makeflags("-j4").is_none());
+    }
+
+    #[test]
+    fn jobs_options() {
+        let opts = ["-j4", "-l", "4", "--jobs=2", "-j", "8", "--jobs", "-k"];
+        assert_eq!(strip_jobs(&opts), ["-l", "4", "-k"]);
+    }
+
+    #[test]
+    fn parallel() {
+        let jobserver: &'static _ = Box::leak(Box::new(Jobserver::new(3).unwrap()));
+        let running = Arc::new(AtomicUsize::new(0));
+        let max = Arc::new(AtomicUsize::new(0));
+        let items: Vec<_> = (0..20).collect();
+        let (r, m) = (running.clone(), max.clone());
+        let results = jobserver.parallel(items, move |i| {
+            let n = r.fetch_add(1, Ordering::SeqCst) + 1;
+            m.fetch_max(n, Ordering::SeqCst);
+            thread::sleep(Duration::from_millis(5));
+            r.fetch_sub(1, Ordering::SeqCst);
+            i * 2
+        });
+        assert_eq!(results, (0..20).map(|i| i * 2).collect::<Vec<_>>());
+        assert!(max.load(Ordering::SeqCst) <= 3);
+        // all tokens are returned
+        let tokens: Vec<_> = (0..2).map(|_| jobserver.try_acquire().unwrap()).collect();
+        assert_eq!(tokens.len(), 2);
+    }
+}
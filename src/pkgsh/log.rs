@@ -0,0 +1,183 @@
+use std::fs::{File, OpenOptions};
+use std::io::{self, BufWriter, Read, Write};
+use std::os::unix::io::{FromRawFd, RawFd};
+use std::path::Path;
+use std::thread::{self, JoinHandle};
+
+use nix::fcntl::{fcntl, FcntlArg, OFlag};
+use nix::unistd::{close, dup2, pipe2};
+
+// Buffer size used for reading and writing build output.
+const BUF_SIZE: usize = 64 * 1024;
+
+enum LogWriter {
+    Plain(BufWriter<File>),
+    Zstd(zstd::Encoder<'static, File>),
+}
+
+impl LogWriter {
+    fn finish(self) -> io::Result<()> {
+        match self {
+            LogWriter::Plain(mut w) => w.flush(),
+            LogWriter::Zstd(w) => w.finish()?.flush(),
+        }
+    }
+}
+
+impl Write for LogWriter {
+    fn write(&mut self, buf: &[u8]) -> io::Result<usize> {
+        match self {
+            LogWriter::Plain(w) => w.write(buf),
+            LogWriter::Zstd(w) => w.write(buf),
+        }
+    }
+
+    fn flush(&mut self) -> io::Result<()> {
+        match self {
+            LogWriter::Plain(w) => w.flush(),
+            LogWriter::Zstd(w) => w.flush(),
+        }
+    }
+}
+
+// Copy all input to the terminal and log file until the input is closed.
+fn tee(mut input: File, mut terminal: File, mut log: LogWriter) -> io::Result<()> {
+    let mut buf = vec![0; BUF_SIZE];
+    loop {
+        let n = match input.read(&mut buf) {
+            Ok(0) => break,
+            Ok(n) => n,
+            Err(e) if e.kind() == io::ErrorKind::Interrupted => continue,
+            Err(e) => return Err(e),
+        };
+        // terminal failures shouldn't stop logging
+        terminal.write_all(&buf[..n]).ok();
+        log.write_all(&buf[..n])?;
+    }
+    log.finish()
+}
+
+// Duplicate a file descriptor that isn't inherited by child processes.
+fn dup_cloexec(fd: RawFd) -> io::Result<RawFd> {
+    Ok(fcntl(fd, FcntlArg::F_DUPFD_CLOEXEC(0))?)
+}
+
+/// Build log capturing all process output.
+///
+/// Standard output and error, including that of child processes, are redirected into a pipe
+/// that is read in large chunks by a separate thread and written to both the terminal and a
+/// log file, optionally compressed using zstd. Since file descriptors are process-wide, only
+/// one log should be active per process, e.g. inside a build worker.
+pub(crate) struct BuildLog {
+    // original stdout and stderr descriptors restored when the log is closed
+    saved: [RawFd; 2],
+    thread: Option<JoinHandle<io::Result<()>>>,
+}
+
+impl BuildLog {
+    /// Start logging to a given file, appending to any existing log.
+    pub(crate) fn new<P: AsRef<Path>>(path: P, compress: bool) -> io::Result<Self> {
+        let file = OpenOptions::new().create(true).append(true).open(path)?;
+        // concatenated zstd frames decode as a single stream so appending works
+        let log = match compress {
+            true => LogWriter::Zstd(zstd::Encoder::new(file, 0)?),
+            false => LogWriter::Plain(BufWriter::with_capacity(BUF_SIZE, file)),
+        };
+
+        io::stdout().flush()?;
+        io::stderr().flush()?;
+        let saved = [dup_cloexec(1)?, dup_cloexec(2)?];
+        let terminal = unsafe { File::from_raw_fd(dup_cloexec(saved[0])?) };
+        let (r, w) = pipe2(OFlag::O_CLOEXEC)?;
+        // descriptors duplicated via dup2() are inherited by child processes
+        dup2(w, 1)?;
+        dup2(w, 2)?;
+        close(w)?;
+
+        let input = unsafe { File::from_raw_fd(r) };
+        let thread = thread::spawn(move || tee(input, terminal, log));
+        Ok(BuildLog {
+            saved,
+            thread: Some(thread),
+        })
+    }
+
+    /// Write a marker signifying the start of a phase.
+    pub(crate) fn phase(&self, phase: &str) -> io::Result<()> {
+        let mut stdout = io::stdout();
+        writeln!(stdout, ">>> {phase}")?;
+        stdout.flush()
+    }
+
+    // Restore the original output streams and wait for all output to be logged.
+    fn finish(&mut self) -> io::Result<()> {
+        match self.thread.take() {
+            None => Ok(()),
+            Some(thread) => {
+                io::stdout().flush()?;
+                io::stderr().flush()?;
+                for (fd, saved) in [(1, self.saved[0]), (2, self.saved[1])] {
+                    dup2(saved, fd)?;
+                    close(saved)?;
+                }
+                thread.join().unwrap_or_else(|_| {
+                    Err(io::Error::new(io::ErrorKind::Other, "log thread panicked"))
+                })
+            }
+        }
+    }
+
+    /// Stop logging, restoring the original output streams.
+    pub(crate) fn close(mut self) -> io::Result<()> {
+        self.finish()
+    }
+}
+
+impl Drop for BuildLog {
+    fn drop(&mut self) {
+        self.finish().ok();
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::fs;
+    use std::process::Command;
+
+    use tempfile::tempdir;
+
+    use super::*;
+    use crate::test::in_subprocess;
+
+    fn output(log: BuildLog) {
+        log.phase("src_compile").unwrap();
+        io::stdout().write_all(b"stdout\n").unwrap();
+        io::stdout().flush().unwrap();
+        Command::new("sh")
+            .args(["-c", "echo child; echo error >&2"])
+            .status()
+            .unwrap();
+        log.close().unwrap();
+    }
+
+    #[test]
+    fn plain_and_compressed() {
+        in_subprocess(concat!(module_path!(), "::plain_and_compressed"), || {
+            let dir = tempdir().unwrap();
+            let expected = ">>> src_compile\nstdout\nchild\nerror\n";
+
+            let path = dir.path().join("build.log");
+            output(BuildLog::new(&path, false).unwrap());
+            assert_eq!(fs::read_to_string(&path).unwrap(), expected);
+            // logs are appended to
+            output(BuildLog::new(&path, false).unwrap());
+            assert_eq!(fs::read_to_string(&path).unwrap(), expected.repeat(2));
+
+            let path = dir.path().join("build.log.zst");
+            output(BuildLog::new(&path, true).unwrap());
+            output(BuildLog::new(&path, true).unwrap());
+            let data = zstd::decode_all(fs::File::open(&path).unwrap()).unwrap();
+            assert_eq!(String::from_utf8(data).unwrap(), expected.repeat(2));
+        });
+    }
+}
@@ -0,0 +1,798 @@
+use std::io::{ErrorKind, Write};
+use std::ops::Range;
+use std::os::unix::fs::PermissionsExt;
+use std::path::{Component, Path, PathBuf};
+use std::{fs, io, str, thread};
+
+use clap::Parser;
+use crossbeam_channel::{bounded, Receiver};
+use indexmap::IndexMap;
+use nix::sys::stat::{umask, Mode};
+use tempfile::NamedTempFile;
+
+/// Options for `patch` that are supported internally, anything else falls back to running
+/// the `patch` command.
+#[derive(Parser, Debug, Default)]
+#[clap(name = "patch")]
+struct PatchOptions {
+    #[clap(short = 'p', long = "strip")]
+    strip: Vec<usize>,
+    #[clap(short, long)]
+    force: bool,
+    #[clap(short = 'g', long = "get")]
+    get: Vec<i32>,
+    #[clap(long)]
+    no_backup_if_mismatch: bool,
+}
+
+/// Determine the path strip level if the given `patch` options are supported internally.
+pub(super) fn strip_level(options: &[&str]) -> Option<usize> {
+    let mut to_parse = vec!["patch"];
+    to_parse.extend(options);
+    let opts = PatchOptions::try_parse_from(&to_parse).ok()?;
+    match opts.get.last() {
+        None | Some(0) => opts.strip.last().copied(),
+        _ => None,
+    }
+}
+
+/// Read and parse patch files in a separate thread, yielding the results in order.
+///
+/// Files that can't be read or use unsupported formats yield None.
+pub(super) fn parse_files(paths: Vec<PathBuf>) -> Receiver<Option<Patch>> {
+    let (tx, rx) = bounded(1);
+    thread::spawn(move || {
+        for path in paths {
+            let patch = fs::read(path).ok().and_then(Patch::parse);
+            if tx.send(patch).is_err() {
+                break;
+            }
+        }
+    });
+    rx
+}
+
+// Line prefixes for diff features that aren't supported internally.
+const UNSUPPORTED: &[&[u8]] = &[
+    b"***************",
+    b"GIT binary patch",
+    b"Binary files ",
+    b"rename from ",
+    b"rename to ",
+    b"copy from ",
+    b"copy to ",
+    b"old mode ",
+    b"new mode ",
+];
+
+fn is_unsupported(line: &[u8]) -> bool {
+    if UNSUPPORTED.iter().any(|p| line.starts_with(p)) {
+        return true;
+    }
+
+    // only regular file modes are supported for git-style file creation and removal
+    for prefix in [&b"new file mode "[..], b"deleted file mode "] {
+        if let Some(mode) = line.strip_prefix(prefix) {
+            return !mode.starts_with(b"100644");
+        }
+    }
+
+    false
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum Line {
+    Context,
+    Remove,
+    Add,
+}
+
+#[derive(Debug)]
+struct Hunk {
+    old_start: usize,
+    old_len: usize,
+    lines: Vec<(Line, Range<usize>)>,
+}
+
+// Parse a hunk header, e.g. "@@ -1,3 +1,4 @@", returning the old start and old/new lengths.
+fn parse_hunk_header(s: &str) -> Option<(usize, usize, usize)> {
+    let (old, new) = s.strip_prefix("@@ -")?.split_once(" +")?;
+    let (new, _) = new.split_once(" @@")?;
+    let range = |s: &str| -> Option<(usize, usize)> {
+        match s.split_once(',') {
+            Some((start, len)) => Some((start.parse().ok()?, len.parse().ok()?)),
+            None => Some((s.parse().ok()?, 1)),
+        }
+    };
+    let (old_start, old_len) = range(old)?;
+    let (_, new_len) = range(new)?;
+    Some((old_start, old_len, new_len))
+}
+
+impl Hunk {
+    /// Parse a hunk starting at a given line index, returning it and the index following it.
+    fn parse(data: &[u8], lines: &[Range<usize>], start: usize) -> Option<(Self, usize)> {
+        let header = str::from_utf8(&data[lines[start].clone()]).ok()?;
+        let (old_start, mut old_len, mut new_len) = parse_hunk_header(header)?;
+        let mut hunk = Hunk {
+            old_start,
+            old_len,
+            lines: vec![],
+        };
+
+        let mut i = start + 1;
+        while old_len > 0 || new_len > 0 {
+            let r = lines.get(i)?.clone();
+            i += 1;
+            if data[r.start] == b'\\' {
+                hunk.no_newline(data)?;
+                continue;
+            } else if data[r.end - 1] != b'\n' {
+                // truncated patch
+                return None;
+            }
+
+            let (kind, range) = match data[r.start] {
+                b' ' => (Line::Context, r.start + 1..r.end),
+                b'-' => (Line::Remove, r.start + 1..r.end),
+                b'+' => (Line::Add, r.start + 1..r.end),
+                // empty context lines with stripped whitespace
+                b'\n' => (Line::Context, r),
+                _ => return None,
+            };
+
+            match kind {
+                Line::Context => {
+                    old_len = old_len.checked_sub(1)?;
+                    new_len = new_len.checked_sub(1)?;
+                }
+                Line::Remove => old_len = old_len.checked_sub(1)?,
+                Line::Add => new_len = new_len.checked_sub(1)?,
+            }
+            hunk.lines.push((kind, range));
+        }
+
+        // missing newline marker for the final line
+        if let Some(r) = lines.get(i) {
+            if data[r.start] == b'\\' {
+                hunk.no_newline(data)?;
+                i += 1;
+            }
+        }
+
+        Some((hunk, i))
+    }
+
+    // Strip the newline from the previous line for "\ No newline at end of file" markers.
+    fn no_newline(&mut self, data: &[u8]) -> Option<()> {
+        let (_, r) = self.lines.last_mut()?;
+        if r.end > r.start && data[r.end - 1] == b'\n' {
+            r.end -= 1;
+        }
+        Some(())
+    }
+
+    // Return the lines expected to exist before applying the hunk.
+    fn old<'a>(&self, data: &'a [u8]) -> Vec<&'a [u8]> {
+        self.lines
+            .iter()
+            .filter(|(kind, _)| *kind != Line::Add)
+            .map(|(_, r)| &data[r.clone()])
+            .collect()
+    }
+
+    // Return the lines existing after applying the hunk.
+    fn new<'a>(&'a self, data: &'a [u8]) -> impl Iterator<Item = &'a [u8]> + 'a {
+        self.lines
+            .iter()
+            .filter(|(kind, _)| *kind != Line::Remove)
+            .map(|(_, r)| &data[r.clone()])
+    }
+
+    // Return the number of leading and trailing context lines.
+    fn context(&self) -> (usize, usize) {
+        let is_context = |(kind, _): &&(Line, Range<usize>)| *kind == Line::Context;
+        let prefix = self.lines.iter().take_while(is_context).count();
+        let suffix = self.lines.iter().rev().take_while(is_context).count();
+        (prefix, suffix)
+    }
+}
+
+// Candidate hunk positions starting at the expected location and moving outwards.
+fn candidates(guess: usize, min: usize, max: usize) -> impl Iterator<Item = usize> {
+    let guess = guess.clamp(min, max);
+    (0..=max - min).flat_map(move |d| {
+        let after = Some(guess + d).filter(|&i| i <= max);
+        let before = guess.checked_sub(d).filter(|&i| d > 0 && i >= min);
+        after.into_iter().chain(before)
+    })
+}
+
+// Strip a given number of leading components from a patch file name.
+fn strip_path(name: &str, strip: usize) -> Option<PathBuf> {
+    let mut name = name;
+    for _ in 0..strip {
+        let (_, rest) = name.split_once('/')?;
+        name = rest.trim_start_matches('/');
+    }
+
+    // disallow absolute paths and parent directory traversal
+    let path = PathBuf::from(name);
+    let valid = path
+        .components()
+        .all(|c| matches!(c, Component::Normal(_) | Component::CurDir));
+    match valid && !name.is_empty() {
+        true => Some(path),
+        false => None,
+    }
+}
+
+// Parse a file name from a patch header line, returning None for /dev/null.
+fn parse_name(s: &[u8]) -> Option<Option<String>> {
+    let s = str::from_utf8(s).ok()?;
+    // quoted names aren't supported
+    if s.starts_with('"') {
+        return None;
+    }
+
+    match s.split(char::is_whitespace).next() {
+        None | Some("") => None,
+        Some("/dev/null") => Some(None),
+        Some(s) => Some(Some(s.to_string())),
+    }
+}
+
+// Parse a git diff header creating or removing an empty file, which lacks file name headers
+// and hunks. Returns None for unsupported headers and Some(None) for other diffs.
+fn git_empty_file(data: &[u8], lines: &[Range<usize>], start: usize) -> Option<Option<FilePatch>> {
+    let mut creates = None;
+    for r in &lines[start + 1..] {
+        let line = &data[r.clone()];
+        if line.starts_with(b"--- ") {
+            return Some(None);
+        } else if line.starts_with(b"diff --git ") {
+            break;
+        } else if line.starts_with(b"new file mode ") {
+            creates = Some(true);
+        } else if line.starts_with(b"deleted file mode ") {
+            creates = Some(false);
+        }
+    }
+    let creates = match creates {
+        Some(value) => value,
+        None => return Some(None),
+    };
+
+    // without file name headers, both names must match apart from their prefixes
+    let line = str::from_utf8(&data[lines[start].clone()]).ok()?;
+    let names = line.strip_prefix("diff --git ")?.trim_end_matches('\n');
+    let mid = names.len() / 2;
+    if names.starts_with('"') || !names.is_char_boundary(mid) {
+        return None;
+    }
+    let (old, new) = names.split_at(mid);
+    let new = new.strip_prefix(' ')?;
+    let unprefixed = |s: &str| s.split_once('/').map(|(_, s)| s);
+    if unprefixed(old)? != unprefixed(new)? {
+        return None;
+    }
+
+    let (old, new) = match creates {
+        true => (None, Some(new.to_string())),
+        false => (Some(old.to_string()), None),
+    };
+    Some(Some(FilePatch {
+        old,
+        new,
+        hunks: vec![],
+    }))
+}
+
+#[derive(Debug)]
+struct FilePatch {
+    old: Option<String>,
+    new: Option<String>,
+    hunks: Vec<Hunk>,
+}
+
+impl FilePatch {
+    /// Determine the file targeted by the patch.
+    ///
+    /// Matches the non-POSIX behavior of GNU patch, preferring the existing file with the
+    /// fewest path components, then the shortest basename, then the shortest path.
+    fn target<F: Fn(&Path) -> bool>(&self, strip: usize, exists: F) -> Option<PathBuf> {
+        let old = match &self.old {
+            Some(s) => Some(strip_path(s, strip)?),
+            None => None,
+        };
+        let new = match &self.new {
+            Some(s) => Some(strip_path(s, strip)?),
+            None => None,
+        };
+
+        match (old, new) {
+            (None, Some(p)) | (Some(p), None) => Some(p),
+            (Some(old), Some(new)) => {
+                let best = [&old, &new]
+                    .into_iter()
+                    .filter(|p| exists(p))
+                    .min_by_key(|p| {
+                        let basename = p.file_name().map(|s| s.len()).unwrap_or_default();
+                        (p.components().count(), basename, p.as_os_str().len())
+                    });
+                match best {
+                    Some(p) => Some(p.clone()),
+                    None if old == new => Some(old),
+                    None => None,
+                }
+            }
+            (None, None) => None,
+        }
+    }
+
+    /// Return true if the patch creates its target file.
+    fn creates(&self) -> bool {
+        self.new.is_some() && self.hunks.iter().all(|h| h.old_len == 0)
+    }
+
+    /// Apply hunks to file content, returning None if any hunk doesn't match exactly.
+    fn patch(&self, data: &[u8], content: &[u8]) -> Option<Vec<u8>> {
+        let lines: Vec<_> = content.split_inclusive(|&b| b == b'\n').collect();
+        let mut result = Vec::with_capacity(content.len());
+        let mut pos = 0;
+        let mut offset: isize = 0;
+
+        for hunk in &self.hunks {
+            let old = hunk.old(data);
+            // insertion-only hunks apply after their starting line
+            let expected = match old.is_empty() {
+                true => hunk.old_start,
+                false => hunk.old_start.saturating_sub(1),
+            };
+            let guess = (expected as isize + offset).max(0) as usize;
+            let max = lines.len().checked_sub(old.len())?;
+            if pos > max || (old.is_empty() && guess > max) {
+                return None;
+            }
+
+            // Hunks with less leading than trailing context must apply at the start of the
+            // file and vice versa at the end, as done by GNU patch.
+            let (prefix, suffix) = hunk.context();
+            let anchored = |i: usize| {
+                (prefix >= suffix || i == 0) && (suffix >= prefix || i + old.len() == lines.len())
+            };
+
+            let found = candidates(guess, pos, max)
+                .find(|&i| anchored(i) && lines[i..i + old.len()] == old[..])?;
+
+            for line in lines[pos..found].iter().copied().chain(hunk.new(data)) {
+                result.extend_from_slice(line);
+            }
+            pos = found + old.len();
+            offset = found as isize - expected as isize;
+        }
+
+        for line in &lines[pos..] {
+            result.extend_from_slice(line);
+        }
+
+        Some(result)
+    }
+}
+
+/// Unified diff supporting the subset of features commonly used by ebuild patches.
+#[derive(Debug)]
+pub(super) struct Patch {
+    data: Vec<u8>,
+    files: Vec<FilePatch>,
+}
+
+impl Patch {
+    /// Parse a unified diff, returning None if it uses unsupported features.
+    pub(super) fn parse(data: Vec<u8>) -> Option<Self> {
+        // line ranges including their newline
+        let mut lines = vec![];
+        let mut start = 0;
+        for line in data.split_inclusive(|&b| b == b'\n') {
+            lines.push(start..start + line.len());
+            start += line.len();
+        }
+
+        let starts_with = |i: usize, prefix: &[u8]| -> bool {
+            lines
+                .get(i)
+                .map(|r| data[r.clone()].starts_with(prefix))
+                .unwrap_or_default()
+        };
+
+        let mut files = vec![];
+        let mut i = 0;
+        while i < lines.len() {
+            let line = &data[lines[i].clone()];
+            if is_unsupported(line) {
+                return None;
+            }
+
+            if line.starts_with(b"diff --git ") {
+                if let Some(file) = git_empty_file(&data, &lines, i)? {
+                    files.push(file);
+                }
+            }
+
+            // skip lines that aren't part of a file header
+            if !(line.starts_with(b"--- ")
+                && starts_with(i + 1, b"+++ ")
+                && starts_with(i + 2, b"@@ "))
+            {
+                i += 1;
+                continue;
+            }
+
+            let old = parse_name(&line[4..])?;
+            let new = parse_name(&data[lines[i + 1].clone()][4..])?;
+            let mut hunks = vec![];
+            i += 2;
+            while starts_with(i, b"@@ ") {
+                let (hunk, next) = Hunk::parse(&data, &lines, i)?;
+                hunks.push(hunk);
+                i = next;
+            }
+            files.push(FilePatch { old, new, hunks });
+        }
+
+        match files.is_empty() {
+            true => None,
+            false => Some(Patch { data, files }),
+        }
+    }
+
+    /// Apply the patch to files under a given directory.
+    ///
+    /// Returns false if the patch doesn't apply cleanly without fuzz, in which case no files
+    /// are modified.
+    pub(super) fn apply<P: AsRef<Path>>(&self, dir: P, strip: usize) -> io::Result<bool> {
+        let dir = dir.as_ref();
+        // pending file changes where None signifies removal
+        let mut changes = IndexMap::<PathBuf, Option<Vec<u8>>>::new();
+
+        for file in &self.files {
+            let exists = |p: &Path| match changes.get(p) {
+                Some(data) => data.is_some(),
+                None => dir.join(p).exists(),
+            };
+            let target = match file.target(strip, exists) {
+                Some(p) => p,
+                None => return Ok(false),
+            };
+
+            let existing = match changes.get(&target) {
+                Some(data) => data.clone(),
+                None => match fs::read(dir.join(&target)) {
+                    Ok(data) => Some(data),
+                    Err(e) if e.kind() == ErrorKind::NotFound => None,
+                    Err(_) => return Ok(false),
+                },
+            };
+
+            let content = match (&file.old, existing) {
+                // file creation doesn't overwrite existing files
+                (None, Some(_)) => return Ok(false),
+                (_, Some(data)) => data,
+                (_, None) if file.creates() => vec![],
+                (_, None) => return Ok(false),
+            };
+
+            let result = match file.patch(&self.data, &content) {
+                Some(data) => data,
+                None => return Ok(false),
+            };
+
+            match &file.new {
+                None if !result.is_empty() => return Ok(false),
+                None => changes.insert(target, None),
+                Some(_) => changes.insert(target, Some(result)),
+            };
+        }
+
+        for (path, data) in changes {
+            let path = dir.join(path);
+            match data {
+                Some(data) => replace(&path, &data)?,
+                None => fs::remove_file(&path)?,
+            }
+        }
+
+        Ok(true)
+    }
+}
+
+// Atomically replace a file's content so failed writes never leave it truncated, keeping the
+// permissions of existing files while new files use the default mode.
+fn replace(path: &Path, data: &[u8]) -> io::Result<()> {
+    let dir = path.parent().unwrap_or_else(|| Path::new("."));
+    fs::create_dir_all(dir)?;
+    let mode = match fs::metadata(path) {
+        Ok(meta) => meta.permissions().mode(),
+        Err(e) if e.kind() == ErrorKind::NotFound => {
+            // builds are single-threaded so briefly resetting the umask doesn't race
+            let mask = umask(Mode::empty());
+            umask(mask);
+            0o666 & !mask.bits()
+        }
+        Err(e) => return Err(e),
+    };
+    let mut file = NamedTempFile::new_in(dir)?;
+    file.write_all(data)?;
+    file.as_file()
+        .set_permissions(fs::Permissions::from_mode(mode))?;
+    file.persist(path).map_err(|e| e.error)?;
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use indoc::indoc;
+    use tempfile::tempdir;
+
+    use super::*;
+
+    fn apply(dir: &Path, patch: &str) -> bool {
+        let patch = Patch::parse(patch.as_bytes().to_vec()).unwrap();
+        patch.apply(dir, 1).unwrap()
+    }
+
+    #[test]
+    fn options() {
+        assert_eq!(strip_level(&["-p1", "-f", "-g0", "--no-backup-if-mismatch"]), Some(1));
+        assert_eq!(strip_level(&["-p1", "-f", "-p2"]), Some(2));
+        assert_eq!(strip_level(&["--strip=3"]), Some(3));
+        // strip level is required
+        assert_eq!(strip_level(&["-f"]), None);
+        // unsupported options
+        assert_eq!(strip_level(&["-p1", "-R"]), None);
+        assert_eq!(strip_level(&["-p1", "-F3"]), None);
+        assert_eq!(strip_level(&["-p1", "-g1"]), None);
+    }
+
+    #[test]
+    fn unsupported() {
+        for data in [
+            // no diff
+            "",
+            "text\n",
+            // context diff
+            indoc! {"
+                *** a/file.txt
+                --- b/file.txt
+                ***************
+                *** 1 ****
+                ! 1
+                --- 1 ----
+                ! 2
+            "},
+            // git rename
+            indoc! {"
+                diff --git a/a.txt b/b.txt
+                similarity index 100%
+                rename from a.txt
+                rename to b.txt
+            "},
+            // executable file creation
+            indoc! {"
+                diff --git a/file.sh b/file.sh
+                new file mode 100755
+                --- /dev/null
+                +++ b/file.sh
+                @@ -0,0 +1 @@
+                +true
+            "},
+            // quoted name
+            indoc! {r#"
+                --- "a/file.txt"
+                +++ "b/file.txt"
+                @@ -1 +1 @@
+                -1
+                +2
+            "#},
+            // truncated hunk
+            indoc! {"
+                --- a/file.txt
+                +++ b/file.txt
+                @@ -1,2 +1,2 @@
+                -1
+                +2
+            "},
+        ] {
+            assert!(Patch::parse(data.as_bytes().to_vec()).is_none(), "parsed: {data}");
+        }
+    }
+
+    #[test]
+    fn permissions() {
+        let dir = tempdir().unwrap();
+        let path = dir.path().join("file.sh");
+        fs::write(&path, "1\n").unwrap();
+        fs::set_permissions(&path, fs::Permissions::from_mode(0o750)).unwrap();
+        let patch = indoc! {"
+            --- a/file.sh
+            +++ b/file.sh
+            @@ -1 +1 @@
+            -1
+            +2
+            --- /dev/null
+            +++ b/new.txt
+            @@ -0,0 +1 @@
+            +1
+        "};
+        assert!(apply(dir.path(), patch));
+        assert_eq!(fs::read_to_string(&path).unwrap(), "2\n");
+
+        // replaced files keep their permissions while new files use the default mode
+        let mode = |p: &Path| fs::metadata(p).unwrap().permissions().mode() & 0o777;
+        assert_eq!(mode(&path), 0o750);
+        let default = dir.path().join("default");
+        fs::write(&default, "").unwrap();
+        assert_eq!(mode(&dir.path().join("new.txt")), mode(&default));
+
+        // no temporary files are left behind
+        let mut names: Vec<_> = fs::read_dir(dir.path())
+            .unwrap()
+            .map(|e| e.unwrap().file_name())
+            .collect();
+        names.sort();
+        assert_eq!(names, ["default", "file.sh", "new.txt"]);
+    }
+
+    #[test]
+    fn offset() {
+        let dir = tempdir().unwrap();
+        let path = dir.path().join("file.txt");
+        fs::write(&path, "0\n0\n1\n2\n3\n4\n5\n6\n7\n8\n9\n").unwrap();
+        let patch = indoc! {"
+            commit message
+            --- a/file.txt
+            +++ b/file.txt
+            @@ -1,3 +1,3 @@
+             1
+            -2
+            +b
+             3
+            @@ -6,3 +6,4 @@
+             6
+             7
+            +7.5
+             8
+        "};
+        assert!(apply(dir.path(), patch));
+        let data = fs::read_to_string(&path).unwrap();
+        assert_eq!(data, "0\n0\n1\nb\n3\n4\n5\n6\n7\n7.5\n8\n9\n");
+    }
+
+    #[test]
+    fn mismatch() {
+        let dir = tempdir().unwrap();
+        let (a, b) = (dir.path().join("a.txt"), dir.path().join("b.txt"));
+        fs::write(&a, "1\n").unwrap();
+        fs::write(&b, "1\n").unwrap();
+        let patch = indoc! {"
+            --- a/a.txt
+            +++ b/a.txt
+            @@ -1 +1 @@
+            -1
+            +2
+            --- a/b.txt
+            +++ b/b.txt
+            @@ -1 +1 @@
+            -2
+            +3
+        "};
+        assert!(!apply(dir.path(), patch));
+        // files are left untouched on failure
+        assert_eq!(fs::read_to_string(&a).unwrap(), "1\n");
+        assert_eq!(fs::read_to_string(&b).unwrap(), "1\n");
+
+        // hunks with less leading context must match at the start of the file
+        fs::write(&a, "0\n1\n2\n").unwrap();
+        let patch = indoc! {"
+            --- a/a.txt
+            +++ b/a.txt
+            @@ -1,2 +1,2 @@
+            -1
+            +b
+             2
+        "};
+        assert!(!apply(dir.path(), patch));
+    }
+
+    #[test]
+    fn no_newline() {
+        let dir = tempdir().unwrap();
+        let path = dir.path().join("file.txt");
+        fs::write(&path, "1\n2").unwrap();
+        let patch = indoc! {r"
+            --- a/file.txt
+            +++ b/file.txt
+            @@ -1,2 +1,2 @@
+             1
+            -2
+            \ No newline at end of file
+            +3
+        "};
+        assert!(apply(dir.path(), patch));
+        assert_eq!(fs::read_to_string(&path).unwrap(), "1\n3\n");
+    }
+
+    #[test]
+    fn create_and_remove() {
+        let dir = tempdir().unwrap();
+        let (old, new) = (dir.path().join("old.txt"), dir.path().join("sub/new.txt"));
+        fs::write(&old, "1\n").unwrap();
+        let patch = indoc! {"
+            --- a/old.txt
+            +++ /dev/null
+            @@ -1 +0,0 @@
+            -1
+            --- /dev/null
+            +++ b/sub/new.txt
+            @@ -0,0 +1,2 @@
+            +1
+            +2
+        "};
+        assert!(apply(dir.path(), patch));
+        assert!(!old.exists());
+        assert_eq!(fs::read_to_string(&new).unwrap(), "1\n2\n");
+
+        // existing files aren't overwritten
+        let patch = indoc! {"
+            --- /dev/null
+            +++ b/sub/new.txt
+            @@ -0,0 +1 @@
+            +3
+        "};
+        assert!(!apply(dir.path(), patch));
+        assert_eq!(fs::read_to_string(&new).unwrap(), "1\n2\n");
+    }
+
+    #[test]
+    fn git_empty_files() {
+        let dir = tempdir().unwrap();
+        let (empty, file) = (dir.path().join("sub/empty"), dir.path().join("file.txt"));
+        fs::write(&file, "1\n").unwrap();
+        let create = indoc! {"
+            diff --git a/sub/empty b/sub/empty
+            new file mode 100644
+            index 0000000..e69de29
+            diff --git a/file.txt b/file.txt
+            index d00491f..0cfbf08 100644
+            --- a/file.txt
+            +++ b/file.txt
+            @@ -1 +1 @@
+            -1
+            +2
+        "};
+        assert!(apply(dir.path(), create));
+        assert_eq!(fs::read_to_string(&empty).unwrap(), "");
+        assert_eq!(fs::read_to_string(&file).unwrap(), "2\n");
+
+        // existing files aren't overwritten
+        assert!(!apply(dir.path(), create));
+
+        let remove = indoc! {"
+            diff --git a/sub/empty b/sub/empty
+            deleted file mode 100644
+            index e69de29..0000000
+        "};
+        assert!(apply(dir.path(), remove));
+        assert!(!empty.exists());
+
+        // missing and non-empty files can't be removed
+        assert!(!apply(dir.path(), remove));
+        fs::write(&empty, "1\n").unwrap();
+        assert!(!apply(dir.path(), remove));
+        assert!(empty.exists());
+
+        // mismatched names are unsupported
+        let data = "diff --git a/x b/y\nnew file mode 100644\n";
+        assert!(Patch::parse(data.as_bytes().to_vec()).is_none());
+    }
+}
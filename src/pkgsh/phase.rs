@@ -36,6 +36,9 @@ fn emake_install() -> Result<ExecStatus> {
     Ok(ExecStatus::Success)
 }
 
+/// Total number of phases.
+pub(crate) const PHASE_COUNT: usize = 15;
+
 #[derive(AsRefStr, Display, Debug, Copy, Clone)]
 #[strum(serialize_all = "snake_case")]
 pub(crate) enum Phase {
@@ -93,6 +96,28 @@ impl Phase {
         }
     }
 
+    /// Return the dense index of the phase, less than [`PHASE_COUNT`].
+    pub(crate) fn index(&self) -> usize {
+        use Phase::*;
+        match self {
+            PkgSetup(_) => 0,
+            PkgConfig(_) => 1,
+            PkgInfo(_) => 2,
+            PkgNofetch(_) => 3,
+            PkgPrerm(_) => 4,
+            PkgPostrm(_) => 5,
+            PkgPreinst(_) => 6,
+            PkgPostinst(_) => 7,
+            PkgPretend(_) => 8,
+            SrcUnpack(_) => 9,
+            SrcPrepare(_) => 10,
+            SrcConfigure(_) => 11,
+            SrcCompile(_) => 12,
+            SrcTest(_) => 13,
+            SrcInstall(_) => 14,
+        }
+    }
+
     /// Return the phase function name, e.g. src_compile.
     pub(crate) fn name(&self) -> &str {
         self.as_ref()
@@ -0,0 +1,413 @@
+use std::cell::RefCell;
+use std::collections::HashMap;
+use std::env;
+use std::ffi::OsStr;
+use std::fs;
+use std::process;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::time::{Duration, Instant};
+
+use camino::{Utf8Path, Utf8PathBuf};
+use once_cell::sync::Lazy;
+use serde::{de, Deserialize, Deserializer, Serialize};
+use tempfile::TempDir;
+use tracing::warn;
+
+use super::builtins::ALL_BUILTINS;
+
+/// Environment variable enabling sourcing profiling for the entire process.
+pub const PROFILE_ENV: &str = "PKGCRAFT_PROFILE";
+
+static ENABLED: Lazy<AtomicBool> =
+    Lazy::new(|| AtomicBool::new(env_enabled(env::var_os(PROFILE_ENV).as_deref())));
+
+thread_local! {
+    static PROFILE: RefCell<Profile> = RefCell::new(Profile::default());
+}
+
+// Determine if an environment variable value enables profiling, any value except empty
+// strings and "0" does.
+fn env_enabled(value: Option<&OsStr>) -> bool {
+    value.map_or(false, |s| !s.is_empty() && s != "0")
+}
+
+/// Enable or disable sourcing profiling, overriding the setting from `PKGCRAFT_PROFILE`.
+pub fn enable(value: bool) {
+    ENABLED.store(value, Ordering::Relaxed);
+}
+
+#[inline]
+fn enabled() -> bool {
+    ENABLED.load(Ordering::Relaxed)
+}
+
+/// Return the report for all profiled data on the current thread, clearing it.
+pub fn report() -> Report {
+    PROFILE.with(|p| p.take().report())
+}
+
+/// Merge a report into the profiled data on the current thread.
+pub fn merge(report: Report) {
+    PROFILE.with(|p| p.borrow_mut().merge(report))
+}
+
+/// Collector for the reports of forked worker processes.
+///
+/// Workers save their reports to a temporary dir before exiting which are merged into the
+/// parent's profile once all workers are done. Workers killed before exiting lose their data.
+#[derive(Debug)]
+pub(crate) struct Workers(Option<TempDir>);
+
+impl Workers {
+    /// Create a collector, reports are only collected if profiling is enabled.
+    pub(crate) fn new() -> Self {
+        let dir = match enabled() {
+            true => tempfile::tempdir()
+                .map_err(|e| warn!("failed creating profiling dir: {e}"))
+                .ok(),
+            false => None,
+        };
+        Self(dir)
+    }
+
+    /// Clear the profiled data inherited from the parent, run by workers after forking.
+    pub(crate) fn start(&self) {
+        if self.0.is_some() {
+            PROFILE.with(|p| p.take());
+        }
+    }
+
+    /// Save the worker's report, run by workers before exiting.
+    pub(crate) fn finish(&self) {
+        if let Some(dir) = &self.0 {
+            let path = dir.path().join(format!("{}.json", process::id()));
+            if let Err(e) = fs::write(&path, report().to_json()) {
+                warn!("failed saving profile report: {path:?}: {e}");
+            }
+        }
+    }
+
+    /// Merge all saved worker reports into the profile of the current thread.
+    pub(crate) fn merge(self) {
+        let dir = match &self.0 {
+            Some(dir) => dir,
+            None => return,
+        };
+        let entries = match fs::read_dir(dir.path()) {
+            Ok(entries) => entries,
+            Err(e) => {
+                warn!("failed reading profile reports: {e}");
+                return;
+            }
+        };
+        for path in entries.filter_map(|e| e.ok()).map(|e| e.path()) {
+            let report = fs::read_to_string(&path)
+                .map_err(|e| e.to_string())
+                .and_then(|s| serde_json::from_str(&s).map_err(|e| e.to_string()));
+            match report {
+                Ok(report) => merge(report),
+                Err(e) => warn!("invalid profile report: {path:?}: {e}"),
+            }
+        }
+    }
+}
+
+#[derive(Debug, Default)]
+struct EbuildData {
+    path: Utf8PathBuf,
+    time: Duration,
+    eclass_time: Duration,
+    builtin_calls: u64,
+}
+
+#[derive(Debug, Default)]
+struct EclassData {
+    count: u64,
+    time: Duration,
+}
+
+#[derive(Debug, Default)]
+struct Profile {
+    ebuilds: Vec<EbuildData>,
+    eclasses: HashMap<String, EclassData>,
+    builtins: HashMap<&'static str, u64>,
+    // currently sourcing ebuild
+    current: Option<EbuildData>,
+    // depth of nested eclass inherits
+    eclass_depth: usize,
+}
+
+impl Profile {
+    fn report(self) -> Report {
+        let mut ebuilds: Vec<_> = self
+            .ebuilds
+            .into_iter()
+            .map(|e| EbuildReport {
+                path: e.path,
+                time: e.time.as_secs_f64(),
+                eclass_time: e.eclass_time.as_secs_f64(),
+                builtin_calls: e.builtin_calls,
+            })
+            .collect();
+        ebuilds.sort_by(|a, b| b.time.total_cmp(&a.time));
+
+        let mut eclasses: Vec<_> = self
+            .eclasses
+            .into_iter()
+            .map(|(name, e)| EclassReport {
+                name,
+                count: e.count,
+                time: e.time.as_secs_f64(),
+            })
+            .collect();
+        eclasses.sort_by(|a, b| b.time.total_cmp(&a.time));
+
+        let mut builtins: Vec<_> = self
+            .builtins
+            .into_iter()
+            .map(|(name, calls)| BuiltinReport { name, calls })
+            .collect();
+        builtins.sort_by(|a, b| b.calls.cmp(&a.calls).then(a.name.cmp(b.name)));
+
+        Report {
+            ebuilds,
+            eclasses,
+            builtins,
+        }
+    }
+
+    fn merge(&mut self, report: Report) {
+        self.ebuilds
+            .extend(report.ebuilds.into_iter().map(|e| EbuildData {
+                path: e.path,
+                time: Duration::from_secs_f64(e.time),
+                eclass_time: Duration::from_secs_f64(e.eclass_time),
+                builtin_calls: e.builtin_calls,
+            }));
+        for e in report.eclasses {
+            let data = self.eclasses.entry(e.name).or_default();
+            data.count += e.count;
+            data.time += Duration::from_secs_f64(e.time);
+        }
+        for b in report.builtins {
+            *self.builtins.entry(b.name).or_default() += b.calls;
+        }
+    }
+}
+
+/// Profiling span for sourcing an ebuild, recorded when dropped.
+pub(crate) struct EbuildSpan(Instant);
+
+impl Drop for EbuildSpan {
+    fn drop(&mut self) {
+        let elapsed = self.0.elapsed();
+        PROFILE.with(|p| {
+            let mut p = p.borrow_mut();
+            if let Some(mut data) = p.current.take() {
+                data.time = elapsed;
+                p.ebuilds.push(data);
+            }
+        })
+    }
+}
+
+/// Start profiling the sourcing of an ebuild, if enabled.
+#[inline]
+pub(crate) fn ebuild(path: &Utf8Path) -> Option<EbuildSpan> {
+    if !enabled() {
+        return None;
+    }
+    PROFILE.with(|p| {
+        p.borrow_mut().current = Some(EbuildData {
+            path: path.to_path_buf(),
+            ..Default::default()
+        })
+    });
+    Some(EbuildSpan(Instant::now()))
+}
+
+/// Profiling span for sourcing an eclass, recorded when dropped.
+pub(crate) struct EclassSpan {
+    name: String,
+    start: Instant,
+}
+
+impl Drop for EclassSpan {
+    fn drop(&mut self) {
+        let elapsed = self.start.elapsed();
+        PROFILE.with(|p| {
+            let mut p = p.borrow_mut();
+            p.eclass_depth -= 1;
+            // nested inherits are included in the time of their top-level eclass
+            if p.eclass_depth == 0 {
+                if let Some(data) = p.current.as_mut() {
+                    data.eclass_time += elapsed;
+                }
+            }
+            let data = p
+                .eclasses
+                .entry(std::mem::take(&mut self.name))
+                .or_default();
+            data.count += 1;
+            data.time += elapsed;
+        })
+    }
+}
+
+/// Start profiling the sourcing of an eclass, if enabled.
+#[inline]
+pub(crate) fn eclass(name: &str) -> Option<EclassSpan> {
+    if !enabled() {
+        return None;
+    }
+    PROFILE.with(|p| p.borrow_mut().eclass_depth += 1);
+    Some(EclassSpan {
+        name: name.to_string(),
+        start: Instant::now(),
+    })
+}
+
+/// Record a builtin call, if enabled.
+#[inline]
+pub(crate) fn builtin(name: &'static str) {
+    if enabled() {
+        PROFILE.with(|p| {
+            let mut p = p.borrow_mut();
+            *p.builtins.entry(name).or_default() += 1;
+            if let Some(data) = p.current.as_mut() {
+                data.builtin_calls += 1;
+            }
+        })
+    }
+}
+
+/// Sourcing statistics for an ebuild, times are in seconds.
+#[derive(Debug, Serialize, Deserialize)]
+pub struct EbuildReport {
+    pub path: Utf8PathBuf,
+    pub time: f64,
+    pub eclass_time: f64,
+    pub builtin_calls: u64,
+}
+
+/// Cumulative sourcing statistics for an eclass, including nested inherits.
+#[derive(Debug, Serialize, Deserialize)]
+pub struct EclassReport {
+    pub name: String,
+    pub count: u64,
+    pub time: f64,
+}
+
+#[derive(Debug, Serialize, Deserialize)]
+pub struct BuiltinReport {
+    #[serde(deserialize_with = "builtin_name")]
+    pub name: &'static str,
+    pub calls: u64,
+}
+
+// Deserialize a builtin name, mapping it to its registered name.
+fn builtin_name<'de, D: Deserializer<'de>>(deserializer: D) -> Result<&'static str, D::Error> {
+    let name = String::deserialize(deserializer)?;
+    ALL_BUILTINS
+        .get_key_value(name.as_str())
+        .map(|(name, _)| *name)
+        .ok_or_else(|| de::Error::custom(format!("unknown builtin: {name}")))
+}
+
+/// Aggregated sourcing profile with ebuilds ordered slowest first, eclasses by cumulative time,
+/// and builtins by call count.
+#[derive(Debug, Serialize, Deserialize)]
+pub struct Report {
+    pub ebuilds: Vec<EbuildReport>,
+    pub eclasses: Vec<EclassReport>,
+    pub builtins: Vec<BuiltinReport>,
+}
+
+impl Report {
+    /// Serialize the report to JSON.
+    pub fn to_json(&self) -> String {
+        serde_json::to_string_pretty(self).expect("failed serializing profile report")
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::config::Config;
+    use crate::pkg::ebuild::Pkg;
+    use crate::pkgsh::BUILD_DATA;
+
+    use super::*;
+
+    #[test]
+    fn report() {
+        let mut config = Config::new("pkgcraft", "", false).unwrap();
+        let (t, repo) = config.temp_repo("test", 0).unwrap();
+        t.create_eclass("e1", "has a a b\n").unwrap();
+        t.create_eclass("e2", "inherit e1\nhas a a b\n").unwrap();
+        let data = indoc::indoc! {r#"
+            inherit e2
+            DESCRIPTION="testing profiling"
+            SLOT=0
+            has a a b
+        "#};
+        let path = t.create_ebuild_raw("cat/pkg-1", data).unwrap();
+
+        BUILD_DATA.with(|d| d.borrow_mut().repo = repo.clone());
+        enable(true);
+        Pkg::new(&path, &repo).unwrap();
+        enable(false);
+        let report = super::report();
+
+        assert_eq!(report.ebuilds.len(), 1);
+        let ebuild = &report.ebuilds[0];
+        assert_eq!(ebuild.path, path);
+        assert!(ebuild.eclass_time <= ebuild.time);
+        assert_eq!(ebuild.builtin_calls, 5);
+
+        let names: Vec<_> = report.eclasses.iter().map(|e| e.name.as_str()).collect();
+        // nested eclass time is included in the inheriting eclass
+        assert_eq!(names, ["e2", "e1"]);
+        assert!(report.eclasses.iter().all(|e| e.count == 1));
+
+        let builtins: Vec<_> = report.builtins.iter().map(|b| (b.name, b.calls)).collect();
+        assert_eq!(builtins, [("has", 3), ("inherit", 2)]);
+
+        let json: serde_json::Value = serde_json::from_str(&report.to_json()).unwrap();
+        assert_eq!(json["eclasses"][0]["name"], "e2");
+
+        // profiling data was cleared and isn't collected when disabled
+        Pkg::new(&path, &repo).unwrap();
+        assert!(super::report().ebuilds.is_empty());
+    }
+
+    #[test]
+    fn merge() {
+        let json = indoc::indoc! {r#"
+            {
+                "ebuilds": [{"path": "/a", "time": 2.0, "eclass_time": 1.0, "builtin_calls": 1}],
+                "eclasses": [{"name": "e1", "count": 1, "time": 1.0}],
+                "builtins": [{"name": "has", "calls": 1}]
+            }
+        "#};
+        for _ in 0..2 {
+            super::merge(serde_json::from_str(json).unwrap());
+        }
+        let report = super::report();
+        assert_eq!(report.ebuilds.len(), 2);
+        assert_eq!(report.eclasses[0].count, 2);
+        assert_eq!(report.builtins[0].calls, 2);
+
+        // unknown builtins are rejected
+        let json = r#"{"ebuilds": [], "eclasses": [], "builtins": [{"name": "x", "calls": 1}]}"#;
+        assert!(serde_json::from_str::<Report>(json).is_err());
+    }
+
+    #[test]
+    fn env() {
+        assert!(!env_enabled(None));
+        assert!(!env_enabled(Some(OsStr::new(""))));
+        assert!(!env_enabled(Some(OsStr::new("0"))));
+        assert!(env_enabled(Some(OsStr::new("1"))));
+        assert!(env_enabled(Some(OsStr::new("yes"))));
+    }
+}
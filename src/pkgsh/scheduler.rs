@@ -0,0 +1,715 @@
+use std::fs::{self, File};
+use std::io::{self, Read, Write};
+use std::os::unix::io::{AsRawFd, FromRawFd, RawFd};
+use std::panic::{self, AssertUnwindSafe};
+use std::sync::Arc;
+use std::{env, process, thread};
+
+use camino::{Utf8Path, Utf8PathBuf};
+use nix::fcntl::OFlag;
+use nix::poll::{poll, PollFd, PollFlags};
+use nix::sys::resource::{setrlimit, Resource};
+use nix::sys::wait::{waitpid, WaitStatus};
+use nix::unistd::{close, fork, pipe2, ForkResult, Pid};
+use scallop::variables::{bind, string_value};
+use strum::{Display, EnumIter, EnumString, IntoEnumIterator};
+
+use super::jobserver::{self, Token};
+use super::log::BuildLog;
+use super::profile;
+use super::{run_phase, source_ebuild, BuildData, BUILD_DATA};
+use crate::eapi::Eapi;
+use crate::pkg::{ebuild::Pkg, Env::*, Package, PackageEnv};
+use crate::repo::ebuild::Repo;
+use crate::Error;
+
+/// Build stages run for each package, in order.
+#[derive(
+    Display, EnumIter, EnumString, Debug, Copy, Clone, PartialEq, Eq, PartialOrd, Ord, Hash,
+)]
+#[strum(serialize_all = "snake_case")]
+pub enum Stage {
+    Unpack,
+    Compile,
+    Install,
+}
+
+impl Stage {
+    /// Return the phases run during the stage.
+    fn phases(&self, test: bool) -> &'static [&'static str] {
+        match self {
+            Stage::Unpack => &["pkg_pretend", "pkg_setup", "src_unpack", "src_prepare"],
+            Stage::Compile if test => &["src_configure", "src_compile", "src_test"],
+            Stage::Compile => &["src_configure", "src_compile"],
+            Stage::Install => &["src_install", "pkg_preinst", "pkg_postinst"],
+        }
+    }
+}
+
+/// Result of a package build.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub enum BuildStatus {
+    Success,
+    Failed(Stage, String),
+    /// Build skipped due to a failed dependency.
+    Skipped,
+}
+
+#[derive(Debug)]
+struct Node {
+    path: Utf8PathBuf,
+    deps: Vec<usize>,
+}
+
+/// Directed acyclic graph of package builds.
+#[derive(Debug, Default)]
+pub struct BuildGraph {
+    nodes: Vec<Node>,
+}
+
+impl BuildGraph {
+    /// Add an ebuild build depending on previously added builds, returning its index.
+    pub fn add<P: AsRef<Utf8Path>>(&mut self, path: P, deps: &[usize]) -> usize {
+        let idx = self.nodes.len();
+        // dependencies must already exist, guaranteeing the graph stays acyclic
+        assert!(deps.iter().all(|&i| i < idx), "invalid build dependencies: {deps:?}");
+        self.nodes.push(Node {
+            path: path.as_ref().to_path_buf(),
+            deps: deps.to_vec(),
+        });
+        idx
+    }
+
+    pub fn len(&self) -> usize {
+        self.nodes.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.nodes.is_empty()
+    }
+}
+
+/// Resource limits applied to build worker processes.
+#[derive(Debug, Default, Clone, Copy)]
+pub struct Limits {
+    /// Maximum address space size in bytes.
+    pub memory: Option<u64>,
+    /// Maximum CPU time in seconds.
+    pub cpu_time: Option<u64>,
+}
+
+impl Limits {
+    fn apply(&self) -> nix::Result<()> {
+        if let Some(size) = self.memory {
+            setrlimit(Resource::RLIMIT_AS, Some(size), Some(size))?;
+        }
+        if let Some(secs) = self.cpu_time {
+            setrlimit(Resource::RLIMIT_CPU, Some(secs), Some(secs))?;
+        }
+        Ok(())
+    }
+}
+
+// A running build worker process.
+#[derive(Debug)]
+struct Worker {
+    idx: usize,
+    pid: Pid,
+    // pipe receiving completed stages and errors, closed when the worker exits
+    pipe: File,
+    output: Vec<u8>,
+    // jobserver token held while running
+    _token: Option<Token<'static>>,
+}
+
+impl Worker {
+    // Determine the build status from the worker's output and exit status.
+    //
+    // Workers write each completed stage terminated by a NUL byte, followed by an error message
+    // on failure.
+    fn status(self) -> BuildStatus {
+        let output = String::from_utf8_lossy(&self.output);
+        let mut records = output.split('\0');
+        let msg = records.next_back().unwrap_or_default().to_string();
+        let stage = records
+            .last()
+            .and_then(|s| s.parse::<Stage>().ok())
+            .map(|s| Stage::iter().find(|x| *x > s))
+            .unwrap_or_else(|| Stage::iter().next());
+        match (exit_status(self.pid, msg), stage) {
+            (Ok(_), None) => BuildStatus::Success,
+            (Ok(_), Some(stage)) => {
+                BuildStatus::Failed(stage, format!("worker exited before {stage} stage"))
+            }
+            (Err(e), stage) => BuildStatus::Failed(stage.unwrap_or(Stage::Install), e),
+        }
+    }
+}
+
+/// Concurrent package build scheduler.
+///
+/// Each package is built by a separate worker process with its own build state, running all
+/// its stages in the same sourced ebuild environment so variables and functions set by earlier
+/// phases persist. Builds for independent packages run concurrently while packages only start
+/// once all their dependencies are installed.
+///
+/// Workers are forked from the calling process without spawning any threads of its own. Since
+/// forked workers only inherit the forking thread, locks held by other threads at the time, e.g.
+/// allocator or stdio locks, would never be released in the workers. Running builds therefore
+/// requires a single-threaded process.
+#[derive(Debug)]
+pub struct Scheduler {
+    repo: Arc<Repo>,
+    builddir: Utf8PathBuf,
+    jobs: usize,
+    limits: Limits,
+    test: bool,
+    compress_logs: bool,
+}
+
+impl Scheduler {
+    pub fn new<P: AsRef<Utf8Path>>(repo: Arc<Repo>, builddir: P) -> Self {
+        let jobs = thread::available_parallelism()
+            .map(|n| n.get())
+            .unwrap_or(1);
+        Scheduler {
+            repo,
+            builddir: builddir.as_ref().to_path_buf(),
+            jobs,
+            limits: Limits::default(),
+            test: false,
+            compress_logs: false,
+        }
+    }
+
+    /// Set the maximum number of concurrently running worker processes.
+    pub fn jobs(mut self, jobs: usize) -> Self {
+        self.jobs = jobs.max(1);
+        self
+    }
+
+    /// Set the resource limits for worker processes.
+    pub fn limits(mut self, limits: Limits) -> Self {
+        self.limits = limits;
+        self
+    }
+
+    /// Enable running src_test.
+    pub fn test(mut self, test: bool) -> Self {
+        self.test = test;
+        self
+    }
+
+    /// Compress build logs using zstd.
+    pub fn compress_logs(mut self, compress: bool) -> Self {
+        self.compress_logs = compress;
+        self
+    }
+
+    /// Run all builds in a graph, returning their statuses in graph order.
+    ///
+    /// Returns an error without starting any builds when called from a multithreaded process.
+    pub fn run(&self, graph: &BuildGraph) -> crate::Result<Vec<BuildStatus>> {
+        // process thread counts are only verifiable where procfs is available
+        if let Ok(threads) = fs::read_dir("/proc/self/task").map(|d| d.count()) {
+            if threads > 1 {
+                return Err(Error::IO(format!(
+                    "build scheduler requires a single-threaded process: {threads} threads running"
+                )));
+            }
+        }
+
+        let mut statuses: Vec<Option<BuildStatus>> = vec![None; graph.len()];
+        let mut started = vec![false; graph.len()];
+        let mut workers: Vec<Worker> = vec![];
+
+        // Worker processes and their `make` jobs share the jobserver so total parallelism is
+        // capped, the first worker uses the implicit job slot.
+        let jobserver = jobserver::init(self.jobs).ok();
+        let profiles = profile::Workers::new();
+
+        loop {
+            // whether a ready build is waiting on a jobserver token
+            let mut blocked = false;
+
+            // skip builds with failed dependencies, dependencies always precede their dependents
+            for (i, node) in graph.nodes.iter().enumerate() {
+                let failed = node.deps.iter().any(|&d| {
+                    matches!(statuses[d], Some(BuildStatus::Failed(..) | BuildStatus::Skipped))
+                });
+                if failed && !started[i] {
+                    started[i] = true;
+                    statuses[i] = Some(BuildStatus::Skipped);
+                }
+            }
+
+            // start builds with all their dependencies installed, in graph order
+            while workers.len() < self.jobs {
+                let next = (0..graph.len()).find(|&i| {
+                    !started[i]
+                        && graph.nodes[i]
+                            .deps
+                            .iter()
+                            .all(|&d| statuses[d] == Some(BuildStatus::Success))
+                });
+                let i = match next {
+                    Some(i) => i,
+                    None => break,
+                };
+                // Tokens are taken without blocking so running workers are still serviced,
+                // their output would otherwise fill the pipes and stall the builds holding the
+                // tokens being waited on.
+                let token = match jobserver {
+                    Some(jobserver) if !workers.is_empty() => match jobserver.try_acquire() {
+                        Some(token) => Some(token),
+                        None => {
+                            blocked = true;
+                            break;
+                        }
+                    },
+                    _ => None,
+                };
+                started[i] = true;
+                match self.fork_worker(&graph.nodes[i].path, &profiles) {
+                    Ok((pid, pipe)) => workers.push(Worker {
+                        idx: i,
+                        pid,
+                        pipe,
+                        output: vec![],
+                        _token: token,
+                    }),
+                    Err(e) => {
+                        let stage = Stage::iter().next().unwrap();
+                        let msg = format!("failed starting worker: {e}");
+                        statuses[i] = Some(BuildStatus::Failed(stage, msg));
+                    }
+                }
+            }
+
+            if workers.is_empty() {
+                if statuses.iter().all(|s| s.is_some()) {
+                    break;
+                }
+                continue;
+            }
+
+            let token_fd = jobserver.filter(|_| blocked).map(|j| j.as_raw_fd());
+            for worker in self.wait_any(&mut workers, token_fd) {
+                let idx = worker.idx;
+                statuses[idx] = Some(worker.status());
+            }
+        }
+
+        profiles.merge();
+        Ok(statuses
+            .into_iter()
+            .map(|s| s.unwrap_or(BuildStatus::Skipped))
+            .collect())
+    }
+
+    // Wait for output from running workers or a jobserver token to become available, returning
+    // the workers that exited.
+    fn wait_any(&self, workers: &mut Vec<Worker>, token_fd: Option<RawFd>) -> Vec<Worker> {
+        let mut fds: Vec<_> = workers
+            .iter()
+            .map(|w| PollFd::new(w.pipe.as_raw_fd(), PollFlags::POLLIN))
+            .chain(token_fd.map(|fd| PollFd::new(fd, PollFlags::POLLIN)))
+            .collect();
+        match poll(&mut fds, -1) {
+            Ok(_) => (),
+            Err(nix::errno::Errno::EINTR) => return vec![],
+            Err(e) => panic!("failed polling build workers: {e}"),
+        }
+
+        // the jobserver descriptor only wakes the run loop to retry acquiring a token
+        let ready: Vec<_> = fds[..workers.len()]
+            .iter()
+            .map(|fd| fd.revents().map(|r| !r.is_empty()).unwrap_or_default())
+            .collect();
+        let mut exited = vec![];
+        let mut buf = [0; 4096];
+        for (i, ready) in ready.into_iter().enumerate().rev() {
+            if !ready {
+                continue;
+            }
+            let worker = &mut workers[i];
+            match worker.pipe.read(&mut buf) {
+                Ok(0) => exited.push(workers.remove(i)),
+                Ok(n) => worker.output.extend_from_slice(&buf[..n]),
+                Err(e) if e.kind() == io::ErrorKind::Interrupted => (),
+                Err(_) => exited.push(workers.remove(i)),
+            }
+        }
+        exited
+    }
+
+    // Fork a worker process building a package, returning its pid and output pipe.
+    fn fork_worker(
+        &self,
+        path: &Utf8Path,
+        profiles: &profile::Workers,
+    ) -> nix::Result<(Pid, File)> {
+        let (r, w) = pipe2(OFlag::O_CLOEXEC)?;
+        // flush buffered output so it isn't duplicated in the worker
+        io::stdout().flush().ok();
+        match unsafe { fork() } {
+            Ok(ForkResult::Parent { child }) => {
+                close(w)?;
+                Ok((child, unsafe { File::from_raw_fd(r) }))
+            }
+            Ok(ForkResult::Child) => {
+                close(r).ok();
+                let output = unsafe { File::from_raw_fd(w) };
+                profiles.start();
+                let status = self.worker(path, output);
+                profiles.finish();
+                process::exit(status)
+            }
+            Err(e) => {
+                close(r).ok();
+                close(w).ok();
+                Err(e)
+            }
+        }
+    }
+
+    // Build a package inside a worker process, returning its exit status.
+    fn worker(&self, path: &Utf8Path, mut output: File) -> i32 {
+        let result = panic::catch_unwind(AssertUnwindSafe(|| {
+            self.limits
+                .apply()
+                .map_err(|e| Error::IO(format!("failed applying limits: {e}")))?;
+            self.build(path, &mut output)
+        }));
+
+        match result {
+            Ok(Ok(_)) => 0,
+            Ok(Err(e)) => {
+                write!(output, "{e}").ok();
+                1
+            }
+            Err(_) => {
+                write!(output, "worker panicked").ok();
+                101
+            }
+        }
+    }
+
+    /// Build a package in the current process, reporting completed stages to a given output.
+    fn build(&self, path: &Utf8Path, output: &mut File) -> crate::Result<()> {
+        let pkg = Pkg::new(path, &self.repo)?;
+
+        // reset build state
+        scallop::Shell::reset();
+        BUILD_DATA.with(|d| d.replace(BuildData::new()));
+
+        let builddir = self.builddir.join(pkg.atom().category()).join(pkg.env(PF));
+        let workdir = builddir.join("work");
+        let tempdir = builddir.join("temp");
+        let image = builddir.join("image");
+        for dir in [&workdir, &tempdir, &image] {
+            fs::create_dir_all(dir)
+                .map_err(|e| Error::IO(format!("failed creating build dir: {dir}: {e}")))?;
+        }
+
+        // log all build output
+        let log_path = match self.compress_logs {
+            true => tempdir.join("build.log.zst"),
+            false => tempdir.join("build.log"),
+        };
+        let log = BuildLog::new(&log_path, self.compress_logs)
+            .map_err(|e| Error::IO(format!("failed creating build log: {log_path}: {e}")))?;
+        BUILD_DATA.with(|d| d.borrow_mut().log = Some(log));
+
+        let result = self.run_stages(&pkg, path, &builddir, output);
+
+        // close the log so all output is written before the worker exits
+        if let Some(log) = BUILD_DATA.with(|d| d.borrow_mut().log.take()) {
+            log.close()
+                .map_err(|e| Error::IO(format!("failed writing build log: {log_path}: {e}")))?;
+        }
+        result
+    }
+
+    // Run all build stages for a package using a given package build dir.
+    fn run_stages(
+        &self,
+        pkg: &Pkg,
+        path: &Utf8Path,
+        builddir: &Utf8Path,
+        output: &mut File,
+    ) -> crate::Result<()> {
+        let eapi = pkg.eapi();
+        let workdir = builddir.join("work");
+        let vars = [
+            ("WORKDIR", workdir.to_string()),
+            ("S", workdir.join(pkg.env(P)).to_string()),
+            ("T", builddir.join("temp").to_string()),
+            ("D", builddir.join("image").to_string()),
+            ("ED", builddir.join("image").to_string()),
+            ("EPREFIX", "".to_string()),
+        ];
+        for (var, val) in &vars {
+            bind(var, val, None, None)?;
+        }
+        BUILD_DATA.with(|d| {
+            let mut d = d.borrow_mut();
+            d.eapi = eapi;
+            d.repo = self.repo.clone();
+            d.env
+                .extend(vars.iter().map(|(k, v)| (k.to_string(), v.clone())));
+        });
+        pkg.export_env()?;
+        source_ebuild(path)?;
+
+        for stage in Stage::iter() {
+            for phase in self.phases(eapi, stage) {
+                // the source dir may be changed or created by earlier phases
+                let srcdir = string_value("S").map(Utf8PathBuf::from);
+                let dir = match (phase.name(), &srcdir) {
+                    ("src_unpack", _) => &workdir,
+                    (_, Some(s)) if s.exists() => s,
+                    _ => &workdir,
+                };
+                env::set_current_dir(dir)
+                    .map_err(|e| Error::IO(format!("failed changing dir: {dir}: {e}")))?;
+                run_phase(phase)?;
+            }
+            write!(output, "{stage}\0")
+                .map_err(|e| Error::IO(format!("failed reporting build progress: {e}")))?;
+        }
+
+        Ok(())
+    }
+
+    // Return the phases supported by an EAPI for a build stage.
+    fn phases(&self, eapi: &'static Eapi, stage: Stage) -> Vec<super::phase::Phase> {
+        stage
+            .phases(self.test)
+            .iter()
+            .filter_map(|name| eapi.phases().iter().find(|p| p.name() == *name))
+            .copied()
+            .collect()
+    }
+}
+
+/// Wait for a worker process to exit, returning its error on failure.
+pub(crate) fn wait(pid: Pid, mut errors: File) -> Result<(), String> {
+    let mut msg = String::new();
+    errors.read_to_string(&mut msg).ok();
+    exit_status(pid, msg)
+}
+
+// Reap an exited worker process, returning its error message on failure.
+fn exit_status(pid: Pid, msg: String) -> Result<(), String> {
+    match waitpid(pid, None) {
+        Ok(WaitStatus::Exited(_, 0)) => Ok(()),
+        Ok(WaitStatus::Exited(_, code)) if msg.is_empty() => {
+            Err(format!("worker exited with status {code}"))
+        }
+        Ok(WaitStatus::Signaled(_, signal, _)) => Err(format!("worker killed by {signal}")),
+        Ok(_) if !msg.is_empty() => Err(msg),
+        Ok(status) => Err(format!("worker failed: {status:?}")),
+        Err(e) => Err(format!("failed waiting for worker: {e}")),
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use indoc::formatdoc;
+    use tempfile::tempdir;
+
+    use crate::config::Config;
+    use crate::test::in_subprocess;
+
+    use super::*;
+
+    // Create an ebuild logging its phases to a given file.
+    fn ebuild(log: &Utf8Path, compile: &str) -> String {
+        formatdoc! {r#"
+            EAPI=8
+            DESCRIPTION="testing build scheduling"
+            SLOT=0
+            S=${{WORKDIR}}
+            log() {{ echo "${{CATEGORY}}/${{PN}} ${{EBUILD_PHASE}}" >> {log}; }}
+            pkg_pretend() {{ log; }}
+            src_unpack() {{ log; }}
+            src_compile() {{ log; {compile} }}
+            src_install() {{ log; }}
+        "#}
+    }
+
+    fn entries(log: &Utf8Path) -> Vec<String> {
+        let data = fs::read_to_string(log).unwrap_or_default();
+        data.lines().map(|s| s.to_string()).collect()
+    }
+
+    fn failed(status: &BuildStatus, msg: &str) -> bool {
+        matches!(status, BuildStatus::Failed(Stage::Compile, e) if e.contains(msg))
+    }
+
+    fn position(entries: &[String], entry: &str) -> usize {
+        entries.iter().position(|s| s == entry).unwrap()
+    }
+
+    #[test]
+    fn run() {
+        in_subprocess(concat!(module_path!(), "::run"), || {
+            let mut config = Config::new("pkgcraft", "", false).unwrap();
+            let (t, repo) = config.temp_repo("test", 0).unwrap();
+            let dir = tempdir().unwrap();
+            let dir = Utf8Path::from_path(dir.path()).unwrap();
+            let log = dir.join("log");
+
+            let mut graph = BuildGraph::default();
+            let a = graph.add(t.create_ebuild_raw("cat/a-1", &ebuild(&log, "")).unwrap(), &[]);
+            let b = graph.add(t.create_ebuild_raw("cat/b-1", &ebuild(&log, "")).unwrap(), &[]);
+            let c = graph.add(t.create_ebuild_raw("cat/c-1", &ebuild(&log, "")).unwrap(), &[a, b]);
+            assert_eq!(graph.len(), 3);
+
+            let scheduler = Scheduler::new(repo, dir.join("build")).jobs(4);
+            let statuses = scheduler.run(&graph).unwrap();
+            assert_eq!(
+                statuses,
+                [BuildStatus::Success, BuildStatus::Success, BuildStatus::Success]
+            );
+
+            // all phases run once
+            let entries = entries(&log);
+            assert_eq!(entries.len(), 12);
+
+            // dependents start after their dependencies are installed
+            let pretend = position(&entries, "cat/c pretend");
+            assert!(position(&entries, "cat/a install") < pretend);
+            assert!(position(&entries, "cat/b install") < pretend);
+            assert!(position(&entries, "cat/c install") > position(&entries, "cat/c unpack"));
+
+            // build dirs are per-package
+            assert!(dir.join("build/cat/a-1/work").exists());
+            assert!(dir.join("build/cat/c-1/image").exists());
+
+            // build logs contain markers for all phases
+            let data = fs::read_to_string(dir.join("build/cat/a-1/temp/build.log")).unwrap();
+            let markers: Vec<_> = data.lines().filter(|s| s.starts_with(">>> ")).collect();
+            let phases = [
+                "pkg_pretend",
+                "pkg_setup",
+                "src_unpack",
+                "src_prepare",
+                "src_configure",
+                "src_compile",
+                "src_install",
+                "pkg_preinst",
+                "pkg_postinst",
+            ];
+            let expected: Vec<_> = phases.iter().map(|s| format!(">>> {s}")).collect();
+            assert_eq!(markers, expected);
+        });
+    }
+
+    #[test]
+    fn environment() {
+        in_subprocess(concat!(module_path!(), "::environment"), || {
+            let mut config = Config::new("pkgcraft", "", false).unwrap();
+            let (t, repo) = config.temp_repo("test", 0).unwrap();
+            let dir = tempdir().unwrap();
+            let dir = Utf8Path::from_path(dir.path()).unwrap();
+            let log = dir.join("log");
+
+            // variables and functions defined by earlier phases persist across stages
+            let data = formatdoc! {r#"
+                EAPI=8
+                DESCRIPTION="testing build environment"
+                SLOT=0
+                S=${{WORKDIR}}
+                pkg_setup() {{ SETUP=1; }}
+                src_unpack() {{ UNPACKED=${{SETUP}}; }}
+                src_prepare() {{ default; prepared() {{ echo prepared; }}; }}
+                src_compile() {{ COMPILED=$(prepared); }}
+                src_install() {{ echo "${{UNPACKED}} ${{COMPILED}}" >> {log}; }}
+            "#};
+            let mut graph = BuildGraph::default();
+            graph.add(t.create_ebuild_raw("cat/a-1", &data).unwrap(), &[]);
+            let statuses = Scheduler::new(repo, dir.join("build")).run(&graph).unwrap();
+            assert_eq!(statuses, [BuildStatus::Success]);
+            assert_eq!(entries(&log), ["1 prepared"]);
+        });
+    }
+
+    #[test]
+    fn failure() {
+        in_subprocess(concat!(module_path!(), "::failure"), || {
+            let mut config = Config::new("pkgcraft", "", false).unwrap();
+            let (t, repo) = config.temp_repo("test", 0).unwrap();
+            let dir = tempdir().unwrap();
+            let dir = Utf8Path::from_path(dir.path()).unwrap();
+            let log = dir.join("log");
+
+            let mut graph = BuildGraph::default();
+            let fail = ebuild(&log, "die compile failed;");
+            let a = graph.add(t.create_ebuild_raw("cat/a-1", &fail).unwrap(), &[]);
+            let b = graph.add(t.create_ebuild_raw("cat/b-1", &ebuild(&log, "")).unwrap(), &[a]);
+            let c = graph.add(t.create_ebuild_raw("cat/c-1", &ebuild(&log, "")).unwrap(), &[b]);
+            let d = graph.add(t.create_ebuild_raw("cat/d-1", &ebuild(&log, "")).unwrap(), &[]);
+
+            let scheduler = Scheduler::new(repo, dir.join("build")).jobs(2);
+            let statuses = scheduler.run(&graph).unwrap();
+            assert!(failed(&statuses[a], "compile failed"));
+            assert_eq!(statuses[b], BuildStatus::Skipped);
+            assert_eq!(statuses[c], BuildStatus::Skipped);
+            assert_eq!(statuses[d], BuildStatus::Success);
+
+            // skipped builds never start unpacking
+            let entries = entries(&log);
+            assert!(!entries
+                .iter()
+                .any(|s| s == "cat/b unpack" || s == "cat/c unpack"));
+        });
+    }
+
+    #[test]
+    fn limits() {
+        in_subprocess(concat!(module_path!(), "::limits"), || {
+            let mut config = Config::new("pkgcraft", "", false).unwrap();
+            let (t, repo) = config.temp_repo("test", 0).unwrap();
+            let dir = tempdir().unwrap();
+            let dir = Utf8Path::from_path(dir.path()).unwrap();
+            let log = dir.join("log");
+
+            // CPU time limits kill runaway builds
+            let mut graph = BuildGraph::default();
+            let data = ebuild(&log, "while :; do :; done");
+            graph.add(t.create_ebuild_raw("cat/a-1", &data).unwrap(), &[]);
+            let limits = Limits {
+                cpu_time: Some(1),
+                ..Default::default()
+            };
+            let scheduler = Scheduler::new(repo, dir.join("build")).limits(limits);
+            let statuses = scheduler.run(&graph).unwrap();
+            assert!(failed(&statuses[0], "killed"));
+        });
+    }
+
+    #[test]
+    fn threads() {
+        in_subprocess(concat!(module_path!(), "::threads"), || {
+            let mut config = Config::new("pkgcraft", "", false).unwrap();
+            let (t, repo) = config.temp_repo("test", 0).unwrap();
+            let dir = tempdir().unwrap();
+            let dir = Utf8Path::from_path(dir.path()).unwrap();
+            let log = dir.join("log");
+            let mut graph = BuildGraph::default();
+            graph.add(t.create_ebuild_raw("cat/a-1", &ebuild(&log, "")).unwrap(), &[]);
+            let scheduler = Scheduler::new(repo, dir.join("build"));
+
+            // builds aren't started while other threads are running
+            let (tx, rx) = crossbeam_channel::bounded::<()>(0);
+            let handle = thread::spawn(move || rx.recv().ok());
+            let err = scheduler.run(&graph).unwrap_err().to_string();
+            assert!(err.contains("single-threaded"), "{err}");
+            assert!(entries(&log).is_empty());
+            drop(tx);
+            handle.join().unwrap();
+        });
+    }
+}
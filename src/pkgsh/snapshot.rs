@@ -0,0 +1,278 @@
+use std::cell::RefCell;
+use std::collections::{HashMap, HashSet};
+use std::ffi::CString;
+use std::fs::File;
+use std::io::{Read, Seek, SeekFrom};
+use std::os::unix::io::{AsRawFd, FromRawFd};
+
+use itertools::Itertools;
+use nix::sys::memfd::{memfd_create, MemFdCreateFlag};
+use once_cell::sync::{Lazy, OnceCell};
+use scallop::variables::string_value;
+use scallop::{source, Error, Result};
+
+static SNAPSHOT: OnceCell<Snapshot> = OnceCell::new();
+
+/// Restore the shell to the snapshot taken on first use, removing all variables and functions
+/// created afterwards and resetting the values of altered variables.
+pub(super) fn restore() -> Result<()> {
+    SNAPSHOT.get_or_try_init(Snapshot::new)?.restore()
+}
+
+// Variables bash updates dynamically that shouldn't be reset.
+const DYNAMIC_VARS: &[&str] = &[
+    "_",
+    "EPOCHREALTIME",
+    "EPOCHSECONDS",
+    "FUNCNAME",
+    "HISTCMD",
+    "LINENO",
+    "OLDPWD",
+    "PIPESTATUS",
+    "PWD",
+    "RANDOM",
+    "SECONDS",
+    "SRANDOM",
+];
+
+// Prefix expansions listing the names of all variables.
+static VAR_NAMES: Lazy<String> = Lazy::new(|| {
+    ('a'..='z')
+        .chain('A'..='Z')
+        .chain(['_'])
+        .map(|c| format!(r#""${{!{c}@}}""#))
+        .join(" ")
+});
+
+// Shell command writing function names and definitions followed by NUL-separated variable
+// declarations.
+//
+// Function names are listed via `declare -F`, definitions via `declare -f`, and declarations
+// via `declare -p`, all of which run inside the shell without forking.
+static SNAPSHOT_CMD: Lazy<String> = Lazy::new(|| {
+    let var = "__PKGCRAFT_SNAPSHOT_VAR";
+    format!(
+        "declare -F; printf '\\0'; declare -f; printf '\\0'; \
+        for {var} in {}; do declare -p \"${var}\"; printf '\\0'; done; \
+        unset -v {var}",
+        *VAR_NAMES
+    )
+});
+
+// Shell command writing function names followed by a NUL and the names of all variables.
+static NAMES_CMD: Lazy<String> =
+    Lazy::new(|| format!("declare -F; printf '\\0'; printf '%s\\n' {}", *VAR_NAMES));
+
+thread_local! {
+    // in-memory file the shell writes listings to
+    static OUTPUT: RefCell<Option<File>> = RefCell::new(None);
+}
+
+// Run a listing command in the shell, returning its output.
+fn list(cmd: &str) -> Result<String> {
+    let err = |e: &dyn std::fmt::Display| Error::Base(format!("failed listing shell state: {e}"));
+    OUTPUT.with(|output| {
+        let mut output = output.borrow_mut();
+        if output.is_none() {
+            let name = CString::new("pkgcraft-snapshot").unwrap();
+            let fd = memfd_create(&name, MemFdCreateFlag::MFD_CLOEXEC).map_err(|e| err(&e))?;
+            *output = Some(unsafe { File::from_raw_fd(fd) });
+        }
+        let file = output.as_mut().unwrap();
+
+        file.set_len(0).map_err(|e| err(&e))?;
+        file.seek(SeekFrom::Start(0)).map_err(|e| err(&e))?;
+        let fd = file.as_raw_fd();
+        source::string(format!("{{ {cmd}; }} >&{fd}"))?;
+
+        let mut data = String::new();
+        file.seek(SeekFrom::Start(0)).map_err(|e| err(&e))?;
+        file.read_to_string(&mut data).map_err(|e| err(&e))?;
+        Ok(data)
+    })
+}
+
+/// Variable declaration captured via `declare -p`.
+#[derive(Debug, PartialEq, Eq)]
+struct Declaration {
+    flags: String,
+    data: String,
+    // scalar value used to detect altered variables without redeclaring them
+    value: Option<String>,
+}
+
+impl Declaration {
+    /// Parse a `declare -p` line, returning the variable name and its declaration.
+    fn parse(data: &str) -> Option<(&str, Self)> {
+        let (flags, decl) = data.strip_prefix("declare ")?.split_once(' ')?;
+        let name = decl.split('=').next()?.trim_end();
+        let decl = Declaration {
+            flags: flags.trim_start_matches('-').to_string(),
+            data: data.trim_end().to_string(),
+            value: None,
+        };
+        Some((name, decl))
+    }
+
+    /// Determine if the declaration can be restored, readonly and bash-managed variables
+    /// are skipped.
+    fn restorable(&self, name: &str) -> bool {
+        !self.flags.contains('r') && !name.starts_with("BASH") && !DYNAMIC_VARS.contains(&name)
+    }
+
+    /// Determine if a variable still matches the declared state.
+    ///
+    /// Only scalar values are compared, arrays are always considered altered.
+    fn unchanged(&self, name: &str) -> bool {
+        !self.flags.contains(&['a', 'A'][..]) && string_value(name) == self.value
+    }
+
+    /// Return the command resetting a variable to the declared state.
+    fn restore(&self, name: &str) -> String {
+        // unsetting a nameref directly would unset its target
+        let unset = if self.flags.contains('n') { "-n" } else { "-v" };
+        // declarations are made global since restoring may be run from a function context
+        let declare = self.data.replacen("declare ", "declare -g ", 1);
+        format!("unset {unset} {name}; {declare}")
+    }
+}
+
+/// Functions and declarations of the variables defined in the shell.
+#[derive(Debug, Default)]
+struct Snapshot {
+    variables: HashMap<String, Declaration>,
+    functions: HashSet<String>,
+    // function definitions sourced to restore redefined functions
+    definitions: String,
+}
+
+impl Snapshot {
+    /// Capture the currently defined variables and functions.
+    fn new() -> Result<Self> {
+        let data = list(&SNAPSHOT_CMD)?;
+        let mut snapshot = Snapshot::default();
+        let mut records = data.split('\0');
+        snapshot.functions = function_names(records.next().unwrap_or_default());
+        snapshot.definitions = records.next().unwrap_or_default().trim().to_string();
+
+        for record in records {
+            if let Some((name, mut decl)) = Declaration::parse(record) {
+                decl.value = string_value(name);
+                snapshot.variables.insert(name.into(), decl);
+            }
+        }
+
+        Ok(snapshot)
+    }
+
+    /// Remove all variables and functions missing from the snapshot and reset variables and
+    /// functions altered since it was taken.
+    ///
+    /// Only names are listed from the shell and scalar values are compared in-process, so
+    /// declarations are only generated for the variables that are reset. Attribute changes to
+    /// scalar variables, e.g. exporting them, aren't reset.
+    fn restore(&self) -> Result<()> {
+        let data = list(&NAMES_CMD)?;
+        let (functions, variables) = data.split_once('\0').unwrap_or_default();
+        let variables: HashSet<_> = variables.lines().filter(|s| !s.is_empty()).collect();
+        let added_variables = variables
+            .iter()
+            .filter(|s| !self.variables.contains_key(**s))
+            .join(" ");
+        let added_functions = function_names(functions)
+            .into_iter()
+            .filter(|s| !self.functions.contains(s))
+            .join(" ");
+
+        // readonly variables can't be unset or reset, so errors are ignored
+        let mut cmds = vec![];
+        if !added_variables.is_empty() {
+            cmds.push(format!("unset -v {added_variables} 2>/dev/null"));
+        }
+        if !added_functions.is_empty() {
+            cmds.push(format!("unset -f {added_functions}"));
+        }
+        // functions are redefined in case they were overridden
+        if !self.definitions.is_empty() {
+            cmds.push(self.definitions.clone());
+        }
+        for (name, decl) in &self.variables {
+            if decl.restorable(name) && !(variables.contains(name.as_str()) && decl.unchanged(name))
+            {
+                cmds.push(format!("{{ {}; }} 2>/dev/null", decl.restore(name)));
+            }
+        }
+
+        if !cmds.is_empty() {
+            source::string(format!("{}; :", cmds.join("\n")))?;
+        }
+        Ok(())
+    }
+}
+
+// Parse function names from `declare -F` output using the form `declare -f[x] name`.
+fn function_names(data: &str) -> HashSet<String> {
+    data.lines()
+        .filter_map(|line| line.split_whitespace().nth(2))
+        .map(|s| s.to_string())
+        .collect()
+}
+
+#[cfg(test)]
+mod tests {
+    use scallop::functions;
+    use scallop::variables::{bind, string_value};
+
+    use super::*;
+
+    #[test]
+    fn restore() {
+        bind("SNAPSHOT_EXISTING", "1", None, None).unwrap();
+        source::string("SNAPSHOT_ARRAY=(a 'b c'); SNAPSHOT_UNSET=1").unwrap();
+        source::string("snapshot_existing() { SNAPSHOT_FUNC=1; }").unwrap();
+        let snapshot = Snapshot::new().unwrap();
+        assert!(snapshot.variables.contains_key("SNAPSHOT_EXISTING"));
+
+        source::string("SNAPSHOT_VAR=1; snapshot_func() { :; }; SNAPSHOT_EXISTING=$'2\\n3'")
+            .unwrap();
+        source::string("snapshot_existing() { SNAPSHOT_FUNC=2; }").unwrap();
+        source::string("SNAPSHOT_ARRAY=d; unset SNAPSHOT_UNSET").unwrap();
+        assert!(functions::find("snapshot_func").is_some());
+        snapshot.restore().unwrap();
+        assert!(string_value("SNAPSHOT_VAR").is_none());
+        assert!(functions::find("snapshot_func").is_none());
+
+        // redefined functions are restored
+        source::string("snapshot_existing").unwrap();
+        assert_eq!(string_value("SNAPSHOT_FUNC").unwrap(), "1");
+        source::string("unset SNAPSHOT_FUNC").unwrap();
+
+        // altered and removed variables are reset
+        assert_eq!(string_value("SNAPSHOT_EXISTING").unwrap(), "1");
+        assert_eq!(string_value("SNAPSHOT_UNSET").unwrap(), "1");
+        source::string(r#"[[ ${#SNAPSHOT_ARRAY[@]} == 2 && ${SNAPSHOT_ARRAY[1]} == "b c" ]]"#)
+            .unwrap();
+
+        let current = Snapshot::new().unwrap();
+        assert!(current.functions.is_subset(&snapshot.functions));
+        assert!(!current.variables.contains_key("__PKGCRAFT_SNAPSHOT_VAR"));
+        assert_eq!(current.variables["SNAPSHOT_EXISTING"], snapshot.variables["SNAPSHOT_EXISTING"]);
+    }
+
+    #[test]
+    fn parse_declaration() {
+        let (name, decl) = Declaration::parse("declare -ax ARRAY=([0]=\"a\")\n").unwrap();
+        assert_eq!(name, "ARRAY");
+        assert_eq!(decl.flags, "ax");
+        assert_eq!(decl.restore(name), r#"unset -v ARRAY; declare -g -ax ARRAY=([0]="a")"#);
+
+        let (name, decl) = Declaration::parse("declare -- EMPTY").unwrap();
+        assert_eq!(name, "EMPTY");
+        assert_eq!(decl.flags, "");
+
+        let (name, decl) = Declaration::parse("declare -n REF=\"EMPTY\"").unwrap();
+        assert_eq!(name, "REF");
+        assert!(decl.restore(name).starts_with("unset -n REF;"));
+        assert!(Declaration::parse("").is_none());
+    }
+}
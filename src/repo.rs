@@ -1,14 +1,19 @@
 use std::fmt;
+use std::fs::File;
+use std::ops::Range;
+use std::str::{self, Utf8Error};
 use std::sync::Arc;
+use std::{slice, thread};
 
 use camino::{Utf8Path, Utf8PathBuf};
 use enum_as_inner::EnumAsInner;
-use indexmap::{IndexMap, IndexSet};
+use indexmap::IndexSet;
+use memmap2::Mmap;
 use once_cell::sync::Lazy;
 use strum::{EnumIter, IntoEnumIterator, IntoStaticStr};
 use tracing::warn;
 
-use crate::config::RepoConfig;
+use crate::config::{self, RepoConfig};
 use crate::pkg::{Package, Pkg};
 use crate::restrict::{Restrict, Restriction};
 use crate::{atom, Error};
@@ -16,35 +21,129 @@ use crate::{atom, Error};
 pub mod ebuild;
 pub(crate) mod empty;
 pub(crate) mod fake;
+pub mod vdb;
 
-type VersionMap = IndexMap<String, IndexSet<String>>;
-type PkgMap = IndexMap<String, VersionMap>;
+// Minimum file size for parsing package cache entries in parallel.
+const PARALLEL_PARSE_SIZE: usize = 64 * 1024;
 
 #[derive(Debug, Default, PartialEq, Eq)]
 struct PkgCache {
-    pkgmap: PkgMap,
-    atoms: IndexSet<atom::Atom>,
+    // sorted, unique atoms
+    atoms: Vec<atom::Atom>,
+    // sorted categories with the ranges of their packages
+    categories: Vec<String>,
+    category_pkgs: Vec<Range<usize>>,
+    // sorted packages per category with the ranges of their atoms
+    packages: Vec<String>,
+    package_atoms: Vec<Range<usize>>,
 }
 
 impl PkgCache {
-    fn categories(&self) -> Vec<String> {
-        self.pkgmap.clone().into_keys().collect()
+    /// Create a package cache from a file of CPVs, one per line.
+    ///
+    /// The file is memory mapped and large files are split at line boundaries so chunks can be
+    /// parsed concurrently before all atoms are sorted at once.
+    fn from_path(path: &Utf8Path) -> crate::Result<Self> {
+        let err = |e: std::io::Error| Error::RepoInit(format!("{path}: {e}"));
+        let file = File::open(path).map_err(err)?;
+        let meta = file.metadata().map_err(err)?;
+        if !meta.is_file() {
+            return Err(Error::RepoInit(format!("{path}: not a file")));
+        }
+        // mapping empty files fails on some platforms
+        if meta.len() == 0 {
+            return Ok(PkgCache::default());
+        }
+        // SAFETY: fake repo files aren't expected to be modified while being loaded
+        let data = Arc::new(unsafe { Mmap::map(&file) }.map_err(err)?);
+        let utf8_err = |e: Utf8Error| Error::RepoInit(format!("{path}: {e}"));
+
+        if data.len() < PARALLEL_PARSE_SIZE {
+            let s = str::from_utf8(&data).map_err(utf8_err)?;
+            return Ok(PkgCache::from_atoms(parse_cpvs(s.lines())));
+        }
+
+        let jobs = thread::available_parallelism()
+            .map(|n| n.get())
+            .unwrap_or(1);
+        let handles: Vec<_> = line_chunks(&data, jobs)
+            .into_iter()
+            .map(|range| {
+                let data = data.clone();
+                thread::spawn(move || -> Result<Vec<atom::Atom>, Utf8Error> {
+                    let s = str::from_utf8(&data[range])?;
+                    Ok(parse_cpvs(s.lines()))
+                })
+            })
+            .collect();
+
+        let mut atoms = vec![];
+        for handle in handles {
+            match handle.join() {
+                Ok(result) => atoms.extend(result.map_err(utf8_err)?),
+                Err(_) => return Err(Error::RepoInit(format!("{path}: parsing thread panicked"))),
+            }
+        }
+
+        Ok(PkgCache::from_atoms(atoms))
     }
 
-    fn packages<S: AsRef<str>>(&self, cat: S) -> Vec<String> {
-        match self.pkgmap.get(cat.as_ref()) {
-            Some(pkgs) => pkgs.clone().into_keys().collect(),
-            None => vec![],
+    /// Create a package cache from unsorted atoms, sorting them once and indexing the results.
+    fn from_atoms(mut atoms: Vec<atom::Atom>) -> Self {
+        // stable sort so the first of any equal atoms is kept
+        atoms.sort();
+        atoms.dedup();
+
+        // atoms are sorted so new categories and packages are always appended
+        let mut cache = PkgCache::default();
+        for (i, a) in atoms.iter().enumerate() {
+            let new_cat = cache.categories.last().map(|s| s.as_str()) != Some(a.category());
+            if new_cat {
+                let idx = cache.packages.len();
+                cache.categories.push(a.category().into());
+                cache.category_pkgs.push(idx..idx);
+            }
+            if new_cat || cache.packages.last().map(|s| s.as_str()) != Some(a.package()) {
+                cache.packages.push(a.package().into());
+                cache.package_atoms.push(i..i);
+                cache.category_pkgs.last_mut().unwrap().end += 1;
+            }
+            cache.package_atoms.last_mut().unwrap().end += 1;
         }
+
+        PkgCache { atoms, ..cache }
     }
 
-    fn versions<S: AsRef<str>>(&self, cat: S, pkg: S) -> Vec<String> {
-        match self.pkgmap.get(cat.as_ref()) {
-            Some(pkgs) => match pkgs.get(pkg.as_ref()) {
-                Some(vers) => vers.clone().into_iter().collect(),
-                None => vec![],
-            },
-            None => vec![],
+    fn category_index(&self, cat: &str) -> Option<usize> {
+        self.categories
+            .binary_search_by(|c| c.as_str().cmp(cat))
+            .ok()
+    }
+
+    fn package_index(&self, cat: &str, pkg: &str) -> Option<usize> {
+        let range = self.category_pkgs[self.category_index(cat)?].clone();
+        self.packages[range.clone()]
+            .binary_search_by(|p| p.as_str().cmp(pkg))
+            .ok()
+            .map(|i| range.start + i)
+    }
+
+    fn categories(&self) -> &[String] {
+        &self.categories
+    }
+
+    fn packages(&self, cat: &str) -> &[String] {
+        match self.category_index(cat) {
+            Some(i) => &self.packages[self.category_pkgs[i].clone()],
+            None => &[],
+        }
+    }
+
+    /// Return the sorted atoms for a package, providing its versions.
+    fn versions(&self, cat: &str, pkg: &str) -> &[atom::Atom] {
+        match self.package_index(cat, pkg) {
+            Some(i) => &self.atoms[self.package_atoms[i].clone()],
+            None => &[],
         }
     }
 
@@ -57,6 +156,38 @@ impl PkgCache {
     }
 }
 
+// Parse CPV strings into atoms, skipping invalid entries.
+fn parse_cpvs<'a, I: IntoIterator<Item = &'a str>>(iter: I) -> Vec<atom::Atom> {
+    iter.into_iter()
+        .filter_map(|s| match atom::cpv_uncached(s) {
+            Ok(a) => Some(a),
+            Err(e) => {
+                warn!("{e}");
+                None
+            }
+        })
+        .collect()
+}
+
+// Split data into roughly equal ranges ending at line boundaries.
+fn line_chunks(data: &[u8], count: usize) -> Vec<Range<usize>> {
+    let size = data.len() / count.max(1) + 1;
+    let mut chunks = vec![];
+    let mut start = 0;
+    while start < data.len() {
+        let end = match data[(start + size).min(data.len())..]
+            .iter()
+            .position(|&b| b == b'\n')
+        {
+            Some(i) => start + size + i + 1,
+            None => data.len(),
+        };
+        chunks.push(start..end);
+        start = end;
+    }
+    chunks
+}
+
 impl<'a> IntoIterator for &'a PkgCache {
     type Item = &'a atom::Atom;
     type IntoIter = PkgCacheIter<'a>;
@@ -70,7 +201,7 @@ impl<'a> IntoIterator for &'a PkgCache {
 
 #[derive(Debug)]
 pub struct PkgCacheIter<'a> {
-    iter: indexmap::set::Iter<'a, atom::Atom>,
+    iter: slice::Iter<'a, atom::Atom>,
 }
 
 impl<'a> Iterator for PkgCacheIter<'a> {
@@ -83,44 +214,129 @@ impl<'a> Iterator for PkgCacheIter<'a> {
 
 impl<'a> FromIterator<&'a str> for PkgCache {
     fn from_iter<I: IntoIterator<Item = &'a str>>(iter: I) -> Self {
-        let mut pkgmap = PkgMap::new();
-        let mut atoms = IndexSet::<atom::Atom>::new();
-        for s in iter {
-            match atom::cpv(s) {
-                Ok(a) => {
-                    atoms.insert(a);
-                }
-                Err(e) => warn!("{e}"),
-            }
+        PkgCache::from_atoms(parse_cpvs(iter))
+    }
+}
+
+/// Snapshot of category, package, or version names listed by a repo.
+///
+/// Snapshots either borrow from repo-owned storage or share ownership of a cached listing, so
+/// they stay unchanged when the repo refreshes its listings.
+#[derive(Debug, Clone)]
+pub struct Names<'a>(Source<'a>);
+
+#[derive(Debug, Clone)]
+enum Source<'a> {
+    Strings(&'a [String]),
+    Versions(&'a [atom::Atom]),
+    Shared(Arc<Vec<String>>),
+}
+
+impl<'a> Names<'a> {
+    fn new(names: &'a [String]) -> Self {
+        Names(Source::Strings(names))
+    }
+
+    // List the version strings for a package's atoms.
+    fn versions(atoms: &'a [atom::Atom]) -> Self {
+        Names(Source::Versions(atoms))
+    }
+
+    // List names owned by a shared, cached listing.
+    fn shared(names: Arc<Vec<String>>) -> Self {
+        Names(Source::Shared(names))
+    }
+
+    /// Iterate over the listed names.
+    pub fn iter(&self) -> ListIter<'_> {
+        match &self.0 {
+            Source::Strings(names) => ListIter(Iter::Strings(names.iter())),
+            Source::Versions(atoms) => ListIter(Iter::Versions(atoms.iter())),
+            Source::Shared(names) => ListIter(Iter::Strings(names.iter())),
         }
+    }
 
-        atoms.sort();
+    pub fn len(&self) -> usize {
+        match &self.0 {
+            Source::Strings(names) => names.len(),
+            Source::Versions(atoms) => atoms.len(),
+            Source::Shared(names) => names.len(),
+        }
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+}
+
+impl<'a> IntoIterator for &'a Names<'_> {
+    type Item = &'a str;
+    type IntoIter = ListIter<'a>;
+
+    fn into_iter(self) -> Self::IntoIter {
+        self.iter()
+    }
+}
 
-        for a in &atoms {
-            pkgmap
-                .entry(a.category().into())
-                .or_insert_with(VersionMap::new)
-                .entry(a.package().into())
-                .or_insert_with(IndexSet::new)
-                .insert(a.version().unwrap().into());
+/// Borrowing iterator over the names in a [`Names`] snapshot.
+#[derive(Debug, Clone)]
+pub struct ListIter<'a>(Iter<'a>);
+
+#[derive(Debug, Clone)]
+enum Iter<'a> {
+    Strings(slice::Iter<'a, String>),
+    Versions(slice::Iter<'a, atom::Atom>),
+}
+
+// Return the version string for an atom, cpvs always include versions.
+fn version_str(a: &atom::Atom) -> &str {
+    a.version().map(|v| v.as_str()).unwrap_or_default()
+}
+
+impl<'a> Iterator for ListIter<'a> {
+    type Item = &'a str;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        match &mut self.0 {
+            Iter::Strings(iter) => iter.next().map(|s| s.as_str()),
+            Iter::Versions(iter) => iter.next().map(version_str),
         }
+    }
+
+    fn size_hint(&self) -> (usize, Option<usize>) {
+        match &self.0 {
+            Iter::Strings(iter) => iter.size_hint(),
+            Iter::Versions(iter) => iter.size_hint(),
+        }
+    }
+}
 
-        PkgCache { pkgmap, atoms }
+impl DoubleEndedIterator for ListIter<'_> {
+    fn next_back(&mut self) -> Option<Self::Item> {
+        match &mut self.0 {
+            Iter::Strings(iter) => iter.next_back().map(|s| s.as_str()),
+            Iter::Versions(iter) => iter.next_back().map(version_str),
+        }
     }
 }
 
+impl ExactSizeIterator for ListIter<'_> {}
+
 #[allow(clippy::large_enum_variant)]
 #[derive(IntoStaticStr, EnumIter, EnumAsInner, Debug, Clone)]
 #[strum(serialize_all = "snake_case")]
 pub enum Repo {
     Ebuild(Arc<ebuild::Repo>),
     Fake(Arc<fake::Repo>),
+    Vdb(Arc<vdb::Repo>),
     Unsynced(Arc<empty::Repo>),
 }
 
 impl From<ebuild::Repo> for Repo {
     fn from(repo: ebuild::Repo) -> Self {
-        Self::Ebuild(Arc::new(repo))
+        let repo = Arc::new(repo);
+        repo.set_shared();
+        Self::Ebuild(repo)
     }
 }
 
@@ -130,6 +346,12 @@ impl From<fake::Repo> for Repo {
     }
 }
 
+impl From<vdb::Repo> for Repo {
+    fn from(repo: vdb::Repo) -> Self {
+        Self::Vdb(Arc::new(repo))
+    }
+}
+
 impl From<empty::Repo> for Repo {
     fn from(repo: empty::Repo) -> Self {
         Self::Unsynced(Arc::new(repo))
@@ -149,7 +371,12 @@ impl Repo {
     }
 
     /// Try to load a repo from a given path.
-    pub(crate) fn from_path<P, S>(id: S, priority: i32, path: P) -> crate::Result<Self>
+    pub(crate) fn from_path<P, S>(
+        id: S,
+        priority: i32,
+        path: P,
+        cache_dir: Option<&Utf8Path>,
+    ) -> crate::Result<Self>
     where
         P: AsRef<Utf8Path>,
         S: AsRef<str>,
@@ -158,8 +385,11 @@ impl Repo {
         let id = id.as_ref();
 
         for format in SUPPORTED_FORMATS.iter() {
-            if let Ok(repo) = Self::from_format(id, priority, path, format) {
-                return Ok(repo);
+            match Self::from_format(id, priority, path, format, cache_dir) {
+                // vdb layouts are generic so they're only detected with installed packages
+                Ok(Self::Vdb(_)) if !vdb::detect(path) => (),
+                Ok(repo) => return Ok(repo),
+                Err(_) => (),
             }
         }
 
@@ -169,24 +399,27 @@ impl Repo {
         })
     }
 
-    /// Try to load a certain repo type from a given path.
+    /// Try to load a certain repo type from a given path, storing any repo caches in the
+    /// given cache dir.
     pub(crate) fn from_format(
         id: &str,
         priority: i32,
         path: &Utf8Path,
         format: &str,
+        cache_dir: Option<&Utf8Path>,
     ) -> crate::Result<Self> {
         match format {
             "ebuild" => Ok(ebuild::Repo::from_path(id, priority, path)?.into()),
             "fake" => Ok(fake::Repo::from_path(id, priority, path)?.into()),
+            "vdb" => Ok(vdb::Repo::from_path(id, priority, path, cache_dir)?.into()),
             "config" => Ok(empty::Repo::from_path(id, priority, path)?.into()),
             _ => Err(Error::RepoInit(format!("{id} repo: unknown format: {format}"))),
         }
     }
 
-    pub(super) fn finalize(&self) -> crate::Result<()> {
+    pub(super) fn finalize(&self, repos: &config::repo::Config) -> crate::Result<()> {
         match self {
-            Self::Ebuild(repo) => repo.finalize(),
+            Self::Ebuild(repo) => repo.finalize(repos),
             _ => Ok(()),
         }
     }
@@ -195,6 +428,7 @@ impl Repo {
         match self {
             Self::Ebuild(repo) => repo.repo_config(),
             Self::Fake(repo) => repo.repo_config(),
+            Self::Vdb(repo) => repo.repo_config(),
             Self::Unsynced(repo) => repo.repo_config(),
         }
     }
@@ -207,6 +441,7 @@ impl Repo {
         match self {
             Self::Ebuild(repo) => RestrictPkgIter::Ebuild(repo.iter_restrict(val), self),
             Self::Fake(repo) => RestrictPkgIter::Fake(repo.iter_restrict(val), self),
+            Self::Vdb(repo) => RestrictPkgIter::Vdb(repo.iter_restrict(val), self),
             _ => RestrictPkgIter::Empty,
         }
     }
@@ -217,6 +452,7 @@ impl Repo {
 pub enum PkgIter<'a> {
     Ebuild(ebuild::PkgIter<'a>, &'a Repo),
     Fake(fake::PkgIter<'a>, &'a Repo),
+    Vdb(vdb::PkgIter<'a>, &'a Repo),
     Empty,
 }
 
@@ -228,6 +464,7 @@ impl<'a> IntoIterator for &'a Repo {
         match self {
             Repo::Ebuild(repo) => PkgIter::Ebuild(repo.into_iter(), self),
             Repo::Fake(repo) => PkgIter::Fake(repo.into_iter(), self),
+            Repo::Vdb(repo) => PkgIter::Vdb(repo.into_iter(), self),
             _ => PkgIter::Empty,
         }
     }
@@ -240,6 +477,7 @@ impl<'a> Iterator for PkgIter<'a> {
         match self {
             Self::Ebuild(iter, repo) => iter.next().map(|p| Pkg::Ebuild(p, repo)),
             Self::Fake(iter, repo) => iter.next().map(|p| Pkg::Fake(p, repo)),
+            Self::Vdb(iter, repo) => iter.next().map(|p| Pkg::Vdb(p, repo)),
             Self::Empty => None,
         }
     }
@@ -250,6 +488,7 @@ impl<'a> Iterator for PkgIter<'a> {
 pub enum RestrictPkgIter<'a> {
     Ebuild(ebuild::RestrictPkgIter<'a>, &'a Repo),
     Fake(fake::RestrictPkgIter<'a>, &'a Repo),
+    Vdb(vdb::RestrictPkgIter<'a>, &'a Repo),
     Empty,
 }
 
@@ -260,6 +499,7 @@ impl<'a> Iterator for RestrictPkgIter<'a> {
         match self {
             Self::Ebuild(iter, repo) => iter.next().map(|p| Pkg::Ebuild(p, repo)),
             Self::Fake(iter, repo) => iter.next().map(|p| Pkg::Fake(p, repo)),
+            Self::Vdb(iter, repo) => iter.next().map(|p| Pkg::Vdb(p, repo)),
             Self::Empty => None,
         }
     }
@@ -277,6 +517,12 @@ pub trait Repository: fmt::Debug + fmt::Display + PartialEq + Eq + PartialOrd +
     fn categories(&self) -> Vec<String>;
     fn packages(&self, cat: &str) -> Vec<String>;
     fn versions(&self, cat: &str, pkg: &str) -> Vec<String>;
+    /// Return a snapshot of the repo's categories without copying them.
+    fn category_names(&self) -> Names<'_>;
+    /// Return a snapshot of a category's packages without copying them.
+    fn package_names(&self, cat: &str) -> Names<'_>;
+    /// Return a snapshot of a package's versions without copying them.
+    fn version_names(&self, cat: &str, pkg: &str) -> Names<'_>;
     fn id(&self) -> &str;
     fn priority(&self) -> i32;
     fn path(&self) -> &Utf8Path;
@@ -295,6 +541,15 @@ where
     fn versions(&self, cat: &str, pkg: &str) -> Vec<String> {
         (*self).versions(cat, pkg)
     }
+    fn category_names(&self) -> Names<'_> {
+        (*self).category_names()
+    }
+    fn package_names(&self, cat: &str) -> Names<'_> {
+        (*self).package_names(cat)
+    }
+    fn version_names(&self, cat: &str, pkg: &str) -> Names<'_> {
+        (*self).version_names(cat, pkg)
+    }
     fn id(&self) -> &str {
         (*self).id()
     }
@@ -323,6 +578,7 @@ impl fmt::Display for Repo {
         match self {
             Self::Ebuild(repo) => write!(f, "{}", repo),
             Self::Fake(repo) => write!(f, "{}", repo),
+            Self::Vdb(repo) => write!(f, "{}", repo),
             Self::Unsynced(repo) => write!(f, "{}", repo),
         }
     }
@@ -333,6 +589,7 @@ impl Repository for Repo {
         match self {
             Self::Ebuild(repo) => repo.categories(),
             Self::Fake(repo) => repo.categories(),
+            Self::Vdb(repo) => repo.categories(),
             Self::Unsynced(repo) => repo.categories(),
         }
     }
@@ -341,6 +598,7 @@ impl Repository for Repo {
         match self {
             Self::Ebuild(repo) => repo.packages(cat),
             Self::Fake(repo) => repo.packages(cat),
+            Self::Vdb(repo) => repo.packages(cat),
             Self::Unsynced(repo) => repo.packages(cat),
         }
     }
@@ -349,14 +607,43 @@ impl Repository for Repo {
         match self {
             Self::Ebuild(repo) => repo.versions(cat, pkg),
             Self::Fake(repo) => repo.versions(cat, pkg),
+            Self::Vdb(repo) => repo.versions(cat, pkg),
             Self::Unsynced(repo) => repo.versions(cat, pkg),
         }
     }
 
+    fn category_names(&self) -> Names<'_> {
+        match self {
+            Self::Ebuild(repo) => repo.category_names(),
+            Self::Fake(repo) => repo.category_names(),
+            Self::Vdb(repo) => repo.category_names(),
+            Self::Unsynced(repo) => repo.category_names(),
+        }
+    }
+
+    fn package_names(&self, cat: &str) -> Names<'_> {
+        match self {
+            Self::Ebuild(repo) => repo.package_names(cat),
+            Self::Fake(repo) => repo.package_names(cat),
+            Self::Vdb(repo) => repo.package_names(cat),
+            Self::Unsynced(repo) => repo.package_names(cat),
+        }
+    }
+
+    fn version_names(&self, cat: &str, pkg: &str) -> Names<'_> {
+        match self {
+            Self::Ebuild(repo) => repo.version_names(cat, pkg),
+            Self::Fake(repo) => repo.version_names(cat, pkg),
+            Self::Vdb(repo) => repo.version_names(cat, pkg),
+            Self::Unsynced(repo) => repo.version_names(cat, pkg),
+        }
+    }
+
     fn id(&self) -> &str {
         match self {
             Self::Ebuild(repo) => repo.id(),
             Self::Fake(repo) => repo.id(),
+            Self::Vdb(repo) => repo.id(),
             Self::Unsynced(repo) => repo.id(),
         }
     }
@@ -365,6 +652,7 @@ impl Repository for Repo {
         match self {
             Self::Ebuild(repo) => repo.priority(),
             Self::Fake(repo) => repo.priority(),
+            Self::Vdb(repo) => repo.priority(),
             Self::Unsynced(repo) => repo.priority(),
         }
     }
@@ -373,6 +661,7 @@ impl Repository for Repo {
         match self {
             Self::Ebuild(repo) => repo.path(),
             Self::Fake(repo) => repo.path(),
+            Self::Vdb(repo) => repo.path(),
             Self::Unsynced(repo) => repo.path(),
         }
     }
@@ -381,6 +670,7 @@ impl Repository for Repo {
         match self {
             Self::Ebuild(repo) => repo.sync(),
             Self::Fake(repo) => repo.sync(),
+            Self::Vdb(repo) => repo.sync(),
             Self::Unsynced(repo) => repo.sync(),
         }
     }
@@ -389,6 +679,7 @@ impl Repository for Repo {
         match self {
             Self::Ebuild(repo) => repo.len(),
             Self::Fake(repo) => repo.len(),
+            Self::Vdb(repo) => repo.len(),
             Self::Unsynced(repo) => repo.len(),
         }
     }
@@ -397,12 +688,21 @@ impl Repository for Repo {
         match self {
             Self::Ebuild(repo) => repo.is_empty(),
             Self::Fake(repo) => repo.is_empty(),
+            Self::Vdb(repo) => repo.is_empty(),
             Self::Unsynced(repo) => repo.is_empty(),
         }
     }
 }
 
 macro_rules! make_repo_traits {
+    ($($x:ty),+) => {$(
+        $crate::repo::make_repo_cmp!($x);
+        $crate::repo::make_contains_atom!($x [atom::Atom, &atom::Atom]);
+    )+};
+}
+pub(self) use make_repo_traits;
+
+macro_rules! make_repo_cmp {
     ($($x:ty),+) => {$(
         impl PartialEq for $x {
             fn eq(&self, other: &Self) -> bool {
@@ -430,11 +730,9 @@ macro_rules! make_repo_traits {
                 self.id().cmp(other.id())
             }
         }
-
-        $crate::repo::make_contains_atom!($x [atom::Atom, &atom::Atom]);
     )+};
 }
-pub(self) use make_repo_traits;
+pub(self) use make_repo_cmp;
 
 macro_rules! make_contains_atom {
     ($x:ty [$($y:ty),+]) => {$(
@@ -458,6 +756,7 @@ impl<T: AsRef<Utf8Path>> Contains<T> for Repo {
         match self {
             Self::Ebuild(repo) => repo.contains(path),
             Self::Fake(repo) => repo.contains(path),
+            Self::Vdb(repo) => repo.contains(path),
             Self::Unsynced(repo) => repo.contains(path),
         }
     }
@@ -466,6 +765,7 @@ impl<T: AsRef<Utf8Path>> Contains<T> for Repo {
 #[cfg(test)]
 mod tests {
     use std::collections::HashSet;
+    use std::fs;
 
     use super::*;
     use crate::repo::{ebuild, fake};
@@ -487,4 +787,59 @@ mod tests {
         let repos: HashSet<_> = HashSet::from([&e_repo, &f_repo]);
         assert_eq!(repos.len(), 1);
     }
+
+    #[test]
+    fn test_line_chunks() {
+        let data = b"a\nbb\nccc\ndddd\n";
+        for count in 0..=data.len() + 1 {
+            let chunks = line_chunks(data, count);
+            // chunks are contiguous and end at line boundaries
+            assert_eq!(chunks.first().unwrap().start, 0);
+            assert_eq!(chunks.last().unwrap().end, data.len());
+            assert!(chunks.windows(2).all(|w| w[0].end == w[1].start));
+            assert!(chunks.iter().all(|r| data[r.end - 1] == b'\n'));
+        }
+        assert!(line_chunks(b"", 4).is_empty());
+    }
+
+    #[test]
+    fn test_pkg_cache_from_path() {
+        let dir = tempfile::tempdir().unwrap();
+        let path = Utf8Path::from_path(dir.path()).unwrap().join("fake");
+
+        // empty
+        fs::write(&path, "").unwrap();
+        assert!(PkgCache::from_path(&path).unwrap().is_empty());
+
+        // large enough to be parsed in parallel, unsorted with duplicates and invalid entries
+        let mut cpvs = vec![];
+        for cat in (0..20).rev() {
+            for pkg in 0..200 {
+                for ver in [2, 1, 10] {
+                    cpvs.push(format!("cat{cat}/pkg{pkg}-{ver}"));
+                }
+            }
+        }
+        cpvs.push("cat0/pkg0-1".to_string());
+        cpvs.push("invalid".to_string());
+        let data = cpvs.join("\n");
+        assert!(data.len() > PARALLEL_PARSE_SIZE);
+        fs::write(&path, &data).unwrap();
+
+        let cache = PkgCache::from_path(&path).unwrap();
+        assert_eq!(cache, PkgCache::from_iter(data.lines()));
+        assert_eq!(cache.len(), 20 * 200 * 3);
+        assert_eq!(cache.categories().len(), 20);
+        assert_eq!(cache.categories()[..3], ["cat0", "cat1", "cat10"]);
+        assert_eq!(cache.packages("cat5").len(), 200);
+        assert!(cache.packages("cat20").is_empty());
+        assert!(Names::versions(cache.versions("cat5", "pkg7"))
+            .iter()
+            .eq(["1", "2", "10"]));
+        assert!(cache.versions("cat5", "pkg200").is_empty());
+        assert!(cache.atoms.windows(2).all(|w| w[0] < w[1]));
+
+        // nonexistent
+        assert!(PkgCache::from_path(&path.with_file_name("nonexistent")).is_err());
+    }
 }
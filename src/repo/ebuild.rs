@@ -1,33 +1,35 @@
 use std::collections::{HashMap, HashSet};
-use std::iter::Flatten;
 use std::path::{Path, PathBuf};
-use std::sync::{Arc, Weak};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::{Arc, RwLock, Weak};
+use std::time::SystemTime;
 use std::{env, fmt, fs, io, thread};
 
 #[cfg(test)]
 use std::io::Write;
 
+use arc_swap::ArcSwapOption;
 use camino::{Utf8Path, Utf8PathBuf};
 use crossbeam_channel::{bounded, Receiver, RecvError, Sender};
-use indexmap::IndexSet;
+use indexmap::{IndexMap, IndexSet};
 use ini::Ini;
+use md5::{Digest, Md5};
 use once_cell::sync::{Lazy, OnceCell};
-use regex::Regex;
 use tempfile::TempDir;
 use tracing::warn;
-use walkdir::WalkDir;
 
-use super::{make_repo_traits, Contains, Repository};
+use super::{make_repo_traits, Contains, Names, Repository};
 use crate::config::{self, RepoConfig};
-use crate::files::{has_ext, is_dir, is_file, is_hidden, sorted_dir_list};
+use crate::files::scan::{self, Dir};
 use crate::macros::build_from_paths;
 use crate::metadata::ebuild::{Manifest, XmlMetadata};
 use crate::pkg::Package;
 use crate::restrict::{Restrict, Restriction};
+use crate::sync::Changes;
 use crate::{atom, eapi, pkg, repo, Error};
 
-static EBUILD_RE: Lazy<Regex> =
-    Lazy::new(|| Regex::new(r"^(?P<cat>[^/]+)/(?P<pkg>[^/]+)/(?P<p>[^/]+).ebuild$").unwrap());
+mod regen;
+
 const DEFAULT_SECTION: Option<String> = None;
 static FAKE_CATEGORIES: Lazy<HashSet<&'static str>> = Lazy::new(|| {
     ["eclass", "profiles", "metadata", "licenses"]
@@ -225,6 +227,74 @@ where
     }
 }
 
+/// Return the MD5 digest of a file.
+pub(crate) fn digest(path: &Utf8Path) -> io::Result<String> {
+    let data = fs::read(path)?;
+    Ok(format!("{:x}", Md5::digest(&data)))
+}
+
+/// An eclass available to a repo.
+#[derive(Debug)]
+pub(crate) struct Eclass {
+    path: Utf8PathBuf,
+    mtime: Option<SystemTime>,
+    digest: OnceCell<Option<String>>,
+}
+
+impl Eclass {
+    fn new(path: Utf8PathBuf) -> Self {
+        let mtime = fs::metadata(&path).and_then(|m| m.modified()).ok();
+        Eclass {
+            path,
+            mtime,
+            digest: OnceCell::new(),
+        }
+    }
+
+    /// Return the eclass file path.
+    pub(crate) fn path(&self) -> &Utf8Path {
+        &self.path
+    }
+
+    /// Return the eclass file's mtime from when the eclass table was built.
+    pub(crate) fn mtime(&self) -> Option<SystemTime> {
+        self.mtime
+    }
+
+    /// Return the MD5 digest of the eclass, computed on first use.
+    pub(crate) fn digest(&self) -> Option<&str> {
+        self.digest
+            .get_or_init(|| match digest(&self.path) {
+                Ok(digest) => Some(digest),
+                Err(e) => {
+                    warn!("failed reading eclass: {:?}: {e}", self.path);
+                    None
+                }
+            })
+            .as_deref()
+    }
+}
+
+// Listed names along with lazily populated entries for the next listing level.
+#[derive(Debug, Default)]
+struct Listing<T> {
+    names: Arc<Vec<String>>,
+    entries: HashMap<String, T>,
+}
+
+impl<T: Default> Listing<T> {
+    fn new(names: Vec<String>) -> Self {
+        let entries = names.iter().map(|s| (s.clone(), T::default())).collect();
+        Self {
+            names: Arc::new(names),
+            entries,
+        }
+    }
+}
+
+// Cached package listings for a category, with cached versions for each package.
+type CategoryListing = OnceCell<Listing<OnceCell<Arc<Vec<String>>>>>;
+
 #[derive(Default)]
 pub struct Repo {
     id: String,
@@ -235,8 +305,14 @@ pub struct Repo {
     name: String,
     masters: OnceCell<Vec<Weak<Repo>>>,
     trees: OnceCell<Vec<Weak<Repo>>>,
+    // eclass table, dropped when eclasses are modified
+    eclasses: RwLock<Option<Arc<IndexMap<String, Eclass>>>>,
     xml_cache: OnceCell<Cache<XmlMetadata>>,
     manifest_cache: OnceCell<Cache<Manifest>>,
+    // cached listing, name snapshots share ownership of its names so it can be replaced
+    listing: ArcSwapOption<Listing<CategoryListing>>,
+    // shared reference set when the repo is wrapped for use in a config
+    shared: OnceCell<Weak<Repo>>,
 }
 
 impl fmt::Debug for Repo {
@@ -306,30 +382,21 @@ impl Repo {
         })
     }
 
-    pub(super) fn finalize(&self) -> crate::Result<()> {
-        let config = config::Config::current();
+    // Resolve master repos against the owning config, falling back to external repos.
+    fn resolve_masters(&self, repos: &config::repo::Config) -> crate::Result<Vec<Weak<Repo>>> {
         let mut nonexistent = vec![];
         let mut masters = vec![];
 
         for id in self.config.iter("masters") {
             // match against configured repos, falling back to external repos
-            match config
-                .repos
-                .get(id)
-                .or_else(|| config.repos.externals.get(id))
-            {
+            match repos.open(id).or_else(|| repos.externals.get(id)) {
                 Some(repo::Repo::Ebuild(r)) => masters.push(Arc::downgrade(r)),
                 _ => nonexistent.push(id),
             }
         }
 
         match nonexistent.is_empty() {
-            true => {
-                if self.masters.set(masters).is_err() {
-                    panic!("masters already set: {}", self.id());
-                }
-                Ok(())
-            }
+            true => Ok(masters),
             false => {
                 let repos = nonexistent.join(", ");
                 Err(Error::InvalidRepo {
@@ -340,6 +407,23 @@ impl Repo {
         }
     }
 
+    /// Resolve the repo's masters against its owning config.
+    pub(super) fn finalize(&self, repos: &config::repo::Config) -> crate::Result<()> {
+        self.masters
+            .get_or_try_init(|| self.resolve_masters(repos))?;
+        Ok(())
+    }
+
+    /// Register the shared reference wrapping the repo.
+    pub(super) fn set_shared(self: &Arc<Self>) {
+        self.shared.set(Arc::downgrade(self)).ok();
+    }
+
+    /// Return the shared reference wrapping the repo if one exists.
+    fn shared(&self) -> Option<Arc<Repo>> {
+        self.shared.get().and_then(|r| r.upgrade())
+    }
+
     pub(super) fn repo_config(&self) -> &RepoConfig {
         &self.repo_config
     }
@@ -348,10 +432,13 @@ impl Repo {
         &self.config
     }
 
+    /// Return the repo's masters.
+    ///
+    /// Panics if the repo wasn't finalized, which configs do before returning their repos.
     pub fn masters(&self) -> Vec<Arc<Repo>> {
         self.masters
             .get()
-            .expect("finalize() uncalled")
+            .unwrap_or_else(|| panic!("unfinalized repo: {}", self.id()))
             .iter()
             .map(|p| p.upgrade().expect("unconfigured repo"))
             .collect()
@@ -360,11 +447,10 @@ impl Repo {
     pub fn trees(&self) -> Vec<Arc<Repo>> {
         self.trees
             .get_or_init(|| {
-                let config = config::Config::current();
                 let mut trees = self.masters();
-                match config.repos.get(self.id()) {
-                    Some(repo::Repo::Ebuild(r)) => trees.push(r.clone()),
-                    _ => panic!("unconfigured repo: {}", self.id()),
+                match self.shared() {
+                    Some(r) => trees.push(r),
+                    None => panic!("unconfigured repo: {}", self.id()),
                 }
                 trees.iter().map(Arc::downgrade).collect()
             })
@@ -373,29 +459,127 @@ impl Repo {
             .collect()
     }
 
-    pub fn category_dirs(&self) -> Vec<String> {
-        // filter out non-category dirs
-        let filter =
-            |e: &walkdir::DirEntry| -> bool { is_dir(e) && !is_hidden(e) && !is_fake_category(e) };
-        let cats = sorted_dir_list(self.path())
-            .into_iter()
-            .filter_entry(filter);
-        let mut v = vec![];
-        for entry in cats {
-            let entry = match entry {
-                Ok(e) => e,
+    /// Return the mapping of eclass names to eclasses available to the repo.
+    ///
+    /// The table is built on first use from the eclass dirs of all the repo's trees in order, so
+    /// eclasses in later trees override those in their masters. It's kept until eclass changes
+    /// are synced or [`Repo::reload_eclasses`] is called.
+    pub(crate) fn eclasses(&self) -> Arc<IndexMap<String, Eclass>> {
+        if let Some(eclasses) = self.eclasses.read().unwrap().as_ref() {
+            return eclasses.clone();
+        }
+        let mut cached = self.eclasses.write().unwrap();
+        cached
+            .get_or_insert_with(|| Arc::new(self.load_eclasses()))
+            .clone()
+    }
+
+    /// Drop the eclass table so it's rebuilt on next use, e.g. after eclasses were modified.
+    pub(crate) fn reload_eclasses(&self) {
+        *self.eclasses.write().unwrap() = None;
+    }
+
+    /// Drop cached listings and eclass tables affected by sync changes, dropping both when the
+    /// changes are unknown.
+    pub(crate) fn refresh(&self, changes: Option<&Changes>) {
+        // changed packages may have been added or removed
+        if changes.map_or(true, |c| !c.pkgs.is_empty()) {
+            self.reset_listing();
+        }
+        if changes.map_or(true, |c| !c.eclasses.is_empty()) {
+            self.reload_eclasses();
+        }
+    }
+
+    /// Regenerate missing or outdated md5-cache entries after a sync, limiting checks to the
+    /// given changes when they're known.
+    ///
+    /// When the changes are unknown, e.g. for initial clones, a synced md5-cache is used as-is
+    /// instead of checking every ebuild in the tree.
+    pub(crate) fn regen_metadata(self: &Arc<Self>, changes: Option<&Changes>) -> crate::Result<()> {
+        match changes {
+            Some(c) if c.is_empty() => return Ok(()),
+            None if self.path().join(regen::CACHE_DIR).is_dir() => return Ok(()),
+            _ => (),
+        }
+        let jobs = thread::available_parallelism()
+            .map(|n| n.get())
+            .unwrap_or(1);
+        regen::regen(self, &regen::stale(self, changes), jobs)
+    }
+
+    fn load_eclasses(&self) -> IndexMap<String, Eclass> {
+        let mut eclasses = IndexMap::new();
+        for repo in self.trees() {
+            let dir = repo.path().join("eclass");
+            let entries = match fs::read_dir(&dir) {
+                Ok(entries) => entries,
                 Err(e) => {
-                    warn!("error walking {:?}: {e}", self.path());
+                    if e.kind() != io::ErrorKind::NotFound {
+                        warn!("{}: failed reading eclass dir: {e}", repo.id());
+                    }
                     continue;
                 }
             };
-            let path = entry.path();
-            match entry.file_name().to_str() {
-                Some(s) => match atom::parse::category(s) {
-                    Ok(cat) => v.push(cat.into()),
-                    Err(e) => warn!("{e}: {path:?}"),
-                },
-                None => warn!("non-unicode path: {path:?}"),
+            let mut paths: Vec<_> = entries
+                .filter_map(|e| e.ok())
+                .filter_map(|e| Utf8PathBuf::from_path_buf(e.path()).ok())
+                .filter(|p| p.extension() == Some("eclass"))
+                .collect();
+            paths.sort();
+            for path in paths {
+                let name = path.file_stem().unwrap_or_default().to_string();
+                eclasses.insert(name, Eclass::new(path));
+            }
+        }
+        eclasses
+    }
+
+    // Return the cached category listing, created on first use.
+    fn listing(&self) -> Arc<Listing<CategoryListing>> {
+        if let Some(listing) = self.listing.load_full() {
+            return listing;
+        }
+        // concurrent first uses keep whichever listing was stored first
+        let listing = Arc::new(Listing::new(self.categories()));
+        let prev = self
+            .listing
+            .compare_and_swap(&None::<Arc<_>>, Some(listing.clone()));
+        match &*prev {
+            Some(prev) => prev.clone(),
+            None => listing,
+        }
+    }
+
+    /// Replace the cached listing so it reflects added or removed packages. Existing name
+    /// snapshots are unaffected and the old listing is dropped along with the last of them.
+    pub(crate) fn reset_listing(&self) {
+        if self.listing.load().is_some() {
+            self.listing
+                .store(Some(Arc::new(Listing::new(self.categories()))));
+        }
+    }
+
+    // Return the cached package listing for a category, created on first use.
+    fn pkg_listing<'a>(
+        &self,
+        listing: &'a Listing<CategoryListing>,
+        cat: &str,
+    ) -> Option<&'a Listing<OnceCell<Arc<Vec<String>>>>> {
+        let listing = listing.entries.get(cat)?;
+        Some(listing.get_or_init(|| Listing::new(self.packages(cat))))
+    }
+
+    pub fn category_dirs(&self) -> Vec<String> {
+        let mut v = vec![];
+        for entry in dir_entries(self.path()) {
+            // filter out non-category dirs
+            if !entry.is_dir() || entry.is_hidden() || FAKE_CATEGORIES.contains(entry.name()) {
+                continue;
+            }
+            match atom::parse::category(entry.name()) {
+                Ok(_) => v.push(entry.into_name()),
+                Err(e) => warn!("{e}: {:?}", self.path().join(entry.name())),
             }
         }
         v
@@ -411,27 +595,38 @@ impl Repo {
 
     /// Convert an ebuild path inside the repo into an Atom.
     pub(crate) fn atom_from_path(&self, path: &Utf8Path) -> crate::Result<atom::Atom> {
+        let relpath = path.strip_prefix(self.path()).map_err(|_| {
+            let err = format!("missing repo prefix: {:?}", self.path());
+            Error::InvalidValue(format!("invalid ebuild path: {path:?}: {err}"))
+        })?;
+        let mut components = relpath.iter();
+        match (components.next(), components.next(), components.next(), components.next()) {
+            (Some(cat), Some(pkg), Some(file), None) => {
+                self.atom_from_components(path, cat, pkg, file)
+            }
+            _ => Err(Error::InvalidValue(format!("invalid ebuild path: {path:?}: unmatched file"))),
+        }
+    }
+
+    /// Convert the category, package directory, and file names of an ebuild into an Atom.
+    fn atom_from_components(
+        &self,
+        path: &Utf8Path,
+        cat: &str,
+        pkg: &str,
+        file: &str,
+    ) -> crate::Result<atom::Atom> {
         let err = |s: &str| -> Error {
             Error::InvalidValue(format!("invalid ebuild path: {path:?}: {s}"))
         };
-        path.strip_prefix(self.path())
-            .map_err(|_| err(&format!("missing repo prefix: {:?}", self.path())))
-            .and_then(|p| {
-                EBUILD_RE
-                    .captures(p.as_str())
-                    .ok_or_else(|| err("unmatched file"))
-            })
-            .and_then(|m| {
-                let cat = m.name("cat").unwrap().as_str();
-                let pkg = m.name("pkg").unwrap().as_str();
-                let p = m.name("p").unwrap().as_str();
-                atom::cpv(&format!("{cat}/{p}"))
-                    .map_err(|_| err("invalid CPV"))
-                    .and_then(|a| match a.package() == pkg {
-                        true => Ok(a),
-                        false => Err(err("mismatched package dir")),
-                    })
-            })
+        let p = file
+            .strip_suffix(".ebuild")
+            .ok_or_else(|| err("unmatched file"))?;
+        let ver = p
+            .strip_prefix(pkg)
+            .and_then(|s| s.strip_prefix('-'))
+            .ok_or_else(|| err("mismatched package dir"))?;
+        atom::cpv_from_parts(cat, pkg, ver).map_err(|_| err("invalid CPV"))
     }
 
     fn xml_cache(&self) -> &Cache<XmlMetadata> {
@@ -498,12 +693,17 @@ impl fmt::Display for Repo {
     }
 }
 
-fn is_fake_category(entry: &walkdir::DirEntry) -> bool {
-    entry
-        .file_name()
-        .to_str()
-        .map(|s| FAKE_CATEGORIES.contains(s))
-        .unwrap_or(false)
+// Return the sorted entries of a directory, logging failures other than it not existing.
+fn dir_entries(path: &Utf8Path) -> Vec<scan::Entry> {
+    match Dir::open(path).and_then(|d| d.entries()) {
+        Ok(entries) => entries,
+        Err(e) => {
+            if e.kind() != io::ErrorKind::NotFound {
+                warn!("error walking {path:?}: {e}");
+            }
+            vec![]
+        }
+    }
 }
 
 impl Repository for Repo {
@@ -523,62 +723,68 @@ impl Repository for Repo {
 
     fn packages(&self, cat: &str) -> Vec<String> {
         let path = self.path().join(cat.strip_prefix('/').unwrap_or(cat));
-        let filter = |e: &walkdir::DirEntry| -> bool { is_dir(e) && !is_hidden(e) };
-        let pkgs = sorted_dir_list(&path).into_iter().filter_entry(filter);
         let mut v = vec![];
-        for entry in pkgs {
-            let entry = match entry {
-                Ok(e) => e,
-                Err(e) => {
-                    warn!("error walking {:?}: {e}", &path);
-                    continue;
-                }
-            };
-            let path = entry.path();
-            match entry.file_name().to_str() {
-                Some(s) => match atom::parse::package(s) {
-                    Ok(pn) => v.push(pn.into()),
-                    Err(e) => warn!("{e}: {path:?}"),
-                },
-                None => warn!("non-unicode path: {path:?}"),
+        for entry in dir_entries(&path) {
+            if !entry.is_dir() || entry.is_hidden() {
+                continue;
+            }
+            match atom::parse::package(entry.name()) {
+                Ok(_) => v.push(entry.into_name()),
+                Err(e) => warn!("{e}: {:?}", path.join(entry.name())),
             }
         }
         v
     }
 
     fn versions(&self, cat: &str, pkg: &str) -> Vec<String> {
-        let path = build_from_paths!(
-            self.path(),
-            cat.strip_prefix('/').unwrap_or(cat),
-            pkg.strip_prefix('/').unwrap_or(pkg)
-        );
-        let ebuilds = sorted_dir_list(&path).into_iter().filter_entry(is_ebuild);
+        let pkg = pkg.strip_prefix('/').unwrap_or(pkg);
+        let path = build_from_paths!(self.path(), cat.strip_prefix('/').unwrap_or(cat), pkg);
         let mut v = vec![];
-        for entry in ebuilds {
-            let entry = match entry {
-                Ok(e) => e,
-                Err(e) => {
-                    warn!("error walking {:?}: {e}", &path);
-                    continue;
-                }
-            };
-            let path = entry.path();
-            let pn = path.parent().unwrap().file_name().unwrap().to_str();
-            let pf = path.file_stem().unwrap().to_str();
-            match (pn, pf) {
-                (Some(pn), Some(pf)) => match pn == &pf[..pn.len()] {
-                    true => match atom::parse::version(&pf[pn.len() + 1..]) {
-                        Ok(ver) => v.push(format!("{ver}")),
-                        Err(e) => warn!("{e}: {path:?}"),
-                    },
-                    false => warn!("unmatched ebuild: {path:?}"),
+        for entry in dir_entries(&path).into_iter().filter(is_ebuild) {
+            let ver = entry
+                .name()
+                .strip_suffix(".ebuild")
+                .and_then(|s| s.strip_prefix(pkg))
+                .and_then(|s| s.strip_prefix('-'));
+            match ver {
+                Some(ver) => match atom::parse::version(ver) {
+                    Ok(ver) => v.push(format!("{ver}")),
+                    Err(e) => warn!("{e}: {:?}", path.join(entry.name())),
                 },
-                _ => warn!("non-unicode path: {path:?}"),
+                None => warn!("unmatched ebuild: {:?}", path.join(entry.name())),
             }
         }
         v
     }
 
+    // Names are listed from a cache populated on first use that is only refreshed when
+    // metadata is regenerated, e.g. after syncs, while the Vec-returning methods always read
+    // the filesystem.
+    fn category_names(&self) -> Names<'_> {
+        Names::shared(self.listing().names.clone())
+    }
+
+    fn package_names(&self, cat: &str) -> Names<'_> {
+        match self.pkg_listing(&self.listing(), cat) {
+            Some(listing) => Names::shared(listing.names.clone()),
+            None => Names::new(&[]),
+        }
+    }
+
+    fn version_names(&self, cat: &str, pkg: &str) -> Names<'_> {
+        let listing = self.listing();
+        match self
+            .pkg_listing(&listing, cat)
+            .and_then(|l| l.entries.get(pkg))
+        {
+            Some(versions) => {
+                let versions = versions.get_or_init(|| Arc::new(self.versions(cat, pkg)));
+                Names::shared(versions.clone())
+            }
+            None => Names::new(&[]),
+        }
+    }
+
     fn id(&self) -> &str {
         &self.id
     }
@@ -591,8 +797,11 @@ impl Repository for Repo {
         &self.repo_config.location
     }
 
+    // Metadata isn't regenerated, see config::repo::Config::sync_with() for that.
     fn sync(&self) -> crate::Result<()> {
-        self.repo_config.sync()
+        let changes = self.repo_config.sync()?;
+        self.refresh(changes.as_ref());
+        Ok(())
     }
 
     fn len(&self) -> usize {
@@ -619,8 +828,171 @@ impl<T: AsRef<Utf8Path>> Contains<T> for Repo {
     }
 }
 
-fn is_ebuild(e: &walkdir::DirEntry) -> bool {
-    is_file(e) && !is_hidden(e) && has_ext(e, "ebuild")
+fn is_ebuild(e: &scan::Entry) -> bool {
+    e.is_file() && !e.is_hidden() && e.name().ends_with(".ebuild")
+}
+
+// Return the ebuilds for a category's packages, ordered by package and file name.
+fn category_ebuilds(repo: &Dir, cat: &str) -> Vec<Utf8PathBuf> {
+    let mut ebuilds = vec![];
+    let cat_dir = match repo.open_at(cat) {
+        Ok(dir) => dir,
+        Err(e) => {
+            if e.kind() != io::ErrorKind::NotFound {
+                warn!("error walking {:?}: {e}", repo.path().join(cat));
+            }
+            return ebuilds;
+        }
+    };
+    let pkgs = cat_dir.entries().unwrap_or_else(|e| {
+        warn!("error walking {:?}: {e}", cat_dir.path());
+        vec![]
+    });
+    for pkg in pkgs.iter().filter(|e| e.is_dir() && !e.is_hidden()) {
+        let entries = cat_dir.open_at(pkg.name()).and_then(|d| d.entries());
+        match entries {
+            Ok(entries) => {
+                let pkg_path = cat_dir.path().join(pkg.name());
+                ebuilds.extend(
+                    entries
+                        .iter()
+                        .filter(|e| is_ebuild(e))
+                        .map(|e| pkg_path.join(e.name())),
+                );
+            }
+            Err(e) => warn!("error walking {:?}: {e}", cat_dir.path().join(pkg.name())),
+        }
+    }
+    ebuilds
+}
+
+// Source of scanned category ebuilds.
+#[derive(Debug)]
+enum Source {
+    // categories scanned on demand by the iterating thread
+    Serial(Dir, Vec<String>),
+    // categories scanned by worker threads, buffering results received out of order
+    Parallel {
+        path: Utf8PathBuf,
+        receiver: Receiver<(usize, Vec<Utf8PathBuf>)>,
+        pending: HashMap<usize, Vec<Utf8PathBuf>>,
+    },
+}
+
+/// Iterator over the ebuild paths of the given categories in category order.
+///
+/// Categories are scanned by worker threads in the background with each category's ebuilds
+/// streamed as soon as it's done, so iteration doesn't wait on a full repo scan and dropping
+/// the iterator stops the scan.
+#[derive(Debug)]
+struct Ebuilds {
+    source: Option<Source>,
+    // number of categories and the index of the next one to yield
+    len: usize,
+    next: usize,
+    current: std::vec::IntoIter<Utf8PathBuf>,
+}
+
+impl Ebuilds {
+    fn new(path: &Utf8Path, categories: Vec<String>) -> Self {
+        let len = categories.len();
+        let source = match Dir::open(path) {
+            Ok(dir) => Some(Ebuilds::spawn(dir, categories)),
+            Err(e) => {
+                warn!("error walking {path:?}: {e}");
+                None
+            }
+        };
+        Ebuilds {
+            source,
+            len,
+            next: 0,
+            current: vec![].into_iter(),
+        }
+    }
+
+    // Start worker threads scanning categories if there are enough to warrant it.
+    fn spawn(repo: Dir, categories: Vec<String>) -> Source {
+        let jobs = thread::available_parallelism()
+            .map(|n| n.get())
+            .unwrap_or(1)
+            .min(categories.len());
+        if jobs <= 1 {
+            return Source::Serial(repo, categories);
+        }
+
+        // workers claim categories in order so results mostly arrive in order as well
+        let path = repo.path().to_path_buf();
+        let (repo, categories) = (Arc::new(repo), Arc::new(categories));
+        let claimed = Arc::new(AtomicUsize::new(0));
+        let (sender, receiver) = bounded(jobs);
+        for _ in 0..jobs {
+            let (repo, categories) = (repo.clone(), categories.clone());
+            let (claimed, sender) = (claimed.clone(), sender.clone());
+            thread::spawn(move || loop {
+                let idx = claimed.fetch_add(1, Ordering::Relaxed);
+                let cat = match categories.get(idx) {
+                    Some(cat) => cat,
+                    None => break,
+                };
+                // stop scanning once the iterator is dropped
+                if sender.send((idx, category_ebuilds(&repo, cat))).is_err() {
+                    break;
+                }
+            });
+        }
+        Source::Parallel {
+            path,
+            receiver,
+            pending: HashMap::new(),
+        }
+    }
+
+    // Return the ebuilds for the next category.
+    fn next_category(&mut self) -> Option<Vec<Utf8PathBuf>> {
+        if self.next >= self.len {
+            return None;
+        }
+        let idx = self.next;
+        self.next += 1;
+
+        let ebuilds = match self.source.as_mut()? {
+            Source::Serial(repo, categories) => category_ebuilds(repo, &categories[idx]),
+            Source::Parallel {
+                path,
+                receiver,
+                pending,
+            } => loop {
+                if let Some(ebuilds) = pending.remove(&idx) {
+                    break ebuilds;
+                }
+                match receiver.recv() {
+                    Ok((i, ebuilds)) => {
+                        pending.insert(i, ebuilds);
+                    }
+                    // all workers exited without sending the category
+                    Err(RecvError) => {
+                        warn!("error walking {path:?}: scanning thread panicked");
+                        break vec![];
+                    }
+                }
+            },
+        };
+        Some(ebuilds)
+    }
+}
+
+impl Iterator for Ebuilds {
+    type Item = Utf8PathBuf;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        loop {
+            if let Some(path) = self.current.next() {
+                return Some(path);
+            }
+            self.current = self.next_category()?.into_iter();
+        }
+    }
 }
 
 impl<'a> IntoIterator for &'a Repo {
@@ -628,20 +1000,8 @@ impl<'a> IntoIterator for &'a Repo {
     type IntoIter = PkgIter<'a>;
 
     fn into_iter(self) -> Self::IntoIter {
-        #[allow(clippy::needless_collect)]
-        let ebuilds: Vec<WalkDir> = self
-            .categories()
-            .iter()
-            .map(|d| {
-                WalkDir::new(self.path().join(d))
-                    .sort_by_file_name()
-                    .min_depth(2)
-                    .max_depth(2)
-            })
-            .collect();
-
         PkgIter {
-            iter: ebuilds.into_iter().flatten(),
+            iter: Ebuilds::new(self.path(), self.categories()),
             repo: self,
         }
     }
@@ -649,7 +1009,7 @@ impl<'a> IntoIterator for &'a Repo {
 
 #[derive(Debug)]
 pub struct PkgIter<'a> {
-    iter: Flatten<std::vec::IntoIter<WalkDir>>,
+    iter: Ebuilds,
     repo: &'a Repo,
 }
 
@@ -657,21 +1017,24 @@ impl<'a> Iterator for PkgIter<'a> {
     type Item = pkg::ebuild::Pkg<'a>;
 
     fn next(&mut self) -> Option<Self::Item> {
-        loop {
-            match self.iter.next() {
-                Some(Ok(e)) => {
-                    if is_ebuild(&e) {
-                        let path: &Utf8Path = e.path().try_into().unwrap();
-                        match pkg::ebuild::Pkg::new(path, self.repo) {
-                            Ok(p) => return Some(p),
-                            Err(e) => warn!("{} repo: invalid pkg: {path:?}: {e}", self.repo.id),
-                        }
-                    }
-                }
-                Some(Err(e)) => warn!("{}: failed walking repo: {e}", self.repo.id),
-                None => return None,
+        for path in &mut self.iter {
+            // the scanner already split the category and package dirs from the path
+            let pkg_dir = path.parent().unwrap();
+            let result = self
+                .repo
+                .atom_from_components(
+                    &path,
+                    pkg_dir.parent().unwrap().file_name().unwrap(),
+                    pkg_dir.file_name().unwrap(),
+                    path.file_name().unwrap(),
+                )
+                .and_then(|atom| pkg::ebuild::Pkg::with_atom(&path, atom, self.repo));
+            match result {
+                Ok(p) => return Some(p),
+                Err(e) => warn!("{} repo: invalid pkg: {path:?}: {e}", self.repo.id),
             }
         }
+        None
     }
 }
 
@@ -935,6 +1298,12 @@ mod tests {
         fs::create_dir(repo.path().join("a-cat")).unwrap();
         fs::create_dir(repo.path().join("z-cat")).unwrap();
         assert_eq!(repo.categories(), ["a-cat", "cat", "z-cat"]);
+
+        // hidden, fake, and non-dir entries are ignored while symlinked dirs are followed
+        fs::create_dir(repo.path().join(".hidden")).unwrap();
+        fs::File::create(repo.path().join("file")).unwrap();
+        std::os::unix::fs::symlink("cat", repo.path().join("b-cat")).unwrap();
+        assert_eq!(repo.categories(), ["a-cat", "b-cat", "cat", "z-cat"]);
     }
 
     #[test]
@@ -978,6 +1347,40 @@ mod tests {
         assert_eq!(repo.versions("a-cat", "pkg10a"), ["0-r0"]);
     }
 
+    #[test]
+    fn test_listing() {
+        let mut config = Config::new("pkgcraft", "", false).unwrap();
+        let (t, repo) = config.temp_repo("test", 0).unwrap();
+        t.create_ebuild("cat2/pkg-1", []).unwrap();
+        t.create_ebuild("cat1/pkg-b-1", []).unwrap();
+        t.create_ebuild("cat1/pkg-a-2", []).unwrap();
+        t.create_ebuild("cat1/pkg-a-1", []).unwrap();
+
+        assert!(repo.category_names().iter().eq(["cat1", "cat2"]));
+        assert!(repo.package_names("cat1").iter().eq(["pkg-a", "pkg-b"]));
+        assert!(repo.version_names("cat1", "pkg-a").iter().eq(["1", "2"]));
+        assert!(repo.package_names("cat3").is_empty());
+        assert!(repo.version_names("cat1", "pkg-c").is_empty());
+
+        // listings are refreshed after package changes are synced
+        let names = repo.version_names("cat1", "pkg-a");
+        t.create_ebuild("cat1/pkg-a-3", []).unwrap();
+        t.create_ebuild("cat3/pkg-1", []).unwrap();
+        let changes: Changes = ["cat1/pkg-a/pkg-a-3.ebuild", "cat3/pkg/pkg-1.ebuild"]
+            .into_iter()
+            .collect();
+        repo.refresh(Some(&changes));
+        assert!(repo.category_names().iter().eq(repo.categories()));
+        assert!(repo.package_names("cat3").iter().eq(repo.packages("cat3")));
+        assert!(repo
+            .version_names("cat1", "pkg-a")
+            .iter()
+            .eq(repo.versions("cat1", "pkg-a")));
+
+        // while existing snapshots are unchanged
+        assert!(names.iter().eq(["1", "2"]));
+    }
+
     #[test]
     fn test_contains() {
         let mut config = Config::new("pkgcraft", "", false).unwrap();
@@ -1056,6 +1459,78 @@ mod tests {
             assert_eq!(pkg.map(|p| format!("{}", p.atom())), Some(cpv.to_string()));
         }
         assert!(iter.next().is_none());
+
+        // categories scanned across threads are returned in order
+        let mut cpvs = vec!["cat1/pkg-1".to_string(), "cat2/pkg-1".to_string()];
+        for i in 0..50 {
+            let cpv = format!("x{i:02}/pkg-1");
+            t.create_ebuild(&cpv, []).unwrap();
+            cpvs.push(cpv);
+        }
+        // hidden package dirs are skipped
+        fs::create_dir_all(t.path.join("x00/.pkg")).unwrap();
+        fs::File::create(t.path.join("x00/.pkg/.pkg-1.ebuild")).unwrap();
+        let atoms: Vec<_> = repo.iter().map(|p| p.atom().to_string()).collect();
+        assert_eq!(atoms, cpvs);
+
+        // partially consumed iterators stop their scan when dropped
+        let atoms: Vec<_> = repo.iter().take(3).map(|p| p.atom().to_string()).collect();
+        assert_eq!(atoms, cpvs[..3]);
+    }
+
+    #[test]
+    fn test_atom_from_path() {
+        let mut config = Config::new("pkgcraft", "", false).unwrap();
+        let (t, repo) = config.temp_repo("test", 0).unwrap();
+        let path = t.path.join("cat/pkg/pkg-1.2-r3.ebuild");
+        let atom = repo.atom_from_path(&path).unwrap();
+        assert_eq!(atom, atom::cpv("cat/pkg-1.2-r3").unwrap());
+        assert_eq!(atom.version().unwrap().as_str(), "1.2-r3");
+
+        for (path, err) in [
+            ("/cat/pkg/pkg-1.ebuild", "missing repo prefix"),
+            ("cat/pkg-1.ebuild", "unmatched file"),
+            ("cat/pkg/pkg-1.ebuild/a", "unmatched file"),
+            ("cat/pkg/pkg-1", "unmatched file"),
+            ("cat/pkg/pkg2-1.ebuild", "mismatched package dir"),
+            ("cat/pkg/pkg-a.ebuild", "invalid CPV"),
+            ("-cat/pkg/pkg-1.ebuild", "invalid CPV"),
+        ] {
+            let path = match path.starts_with('/') {
+                true => Utf8PathBuf::from(path),
+                false => t.path.join(path),
+            };
+            let r = repo.atom_from_path(&path);
+            assert!(r.unwrap_err().to_string().contains(err), "failed for path: {path}");
+        }
+    }
+
+    #[test]
+    fn test_eclasses() {
+        let mut config = Config::new("pkgcraft", "", false).unwrap();
+        let (t, repo) = config.temp_repo("test", 0).unwrap();
+        let e1 = t.create_eclass("e1", "# e1\n").unwrap();
+        t.create_eclass("e2", "# e2\n").unwrap();
+        fs::write(t.path.join("eclass/README"), "").unwrap();
+
+        let eclasses = repo.eclasses();
+        assert_eq!(eclasses.keys().collect::<Vec<_>>(), ["e1", "e2"]);
+        let eclass = eclasses.get("e1").unwrap();
+        assert_eq!(eclass.path(), &e1);
+        assert_eq!(eclass.mtime(), fs::metadata(&e1).unwrap().modified().ok());
+        let digest = format!("{:x}", Md5::digest(b"# e1\n"));
+        assert_eq!(eclass.digest(), Some(digest.as_str()));
+
+        // the table is kept until it's reloaded
+        fs::write(&e1, "# modified e1\n").unwrap();
+        t.create_eclass("e3", "# e3\n").unwrap();
+        assert_eq!(repo.eclasses().keys().collect::<Vec<_>>(), ["e1", "e2"]);
+        assert_eq!(repo.eclasses().get("e1").unwrap().digest(), Some(digest.as_str()));
+        repo.reload_eclasses();
+        let eclasses = repo.eclasses();
+        assert_eq!(eclasses.keys().collect::<Vec<_>>(), ["e1", "e2", "e3"]);
+        let digest = format!("{:x}", Md5::digest(b"# modified e1\n"));
+        assert_eq!(eclasses.get("e1").unwrap().digest(), Some(digest.as_str()));
     }
 
     #[test]
@@ -0,0 +1,302 @@
+use std::fs::{self, File};
+use std::io::{self, Write};
+use std::os::unix::io::FromRawFd;
+use std::panic::{self, AssertUnwindSafe};
+use std::sync::Arc;
+use std::{process, thread};
+
+use camino::{Utf8Path, Utf8PathBuf};
+use indexmap::IndexSet;
+use nix::fcntl::OFlag;
+use nix::unistd::{close, fork, pipe2, ForkResult, Pid};
+use tracing::warn;
+use walkdir::WalkDir;
+
+use super::Repo;
+use crate::macros::build_from_paths;
+use crate::pkg::ebuild::Pkg;
+use crate::pkgsh::{profile, scheduler::wait, BUILD_DATA};
+use crate::repo::Repository;
+use crate::sync::Changes;
+use crate::{atom, Error};
+
+pub(super) const CACHE_DIR: &str = "metadata/md5-cache";
+
+// Return the ebuild paths for a package.
+fn pkg_ebuilds(repo: &Repo, cat: &str, pkg: &str) -> Vec<Utf8PathBuf> {
+    repo.versions(cat, pkg)
+        .into_iter()
+        .map(|ver| build_from_paths!(repo.path(), cat, pkg, format!("{pkg}-{ver}.ebuild")))
+        .collect()
+}
+
+// Return all md5-cache entries in `cat/pf` form.
+fn cache_entries(repo: &Repo) -> Vec<String> {
+    let dir = repo.path().join(CACHE_DIR);
+    WalkDir::new(&dir)
+        .sort_by_file_name()
+        .min_depth(2)
+        .max_depth(2)
+        .into_iter()
+        .filter_map(|e| e.ok())
+        .filter(|e| e.file_type().is_file())
+        .filter_map(|e| {
+            let path = e.path().strip_prefix(&dir).ok()?;
+            path.to_str().map(|s| s.to_string())
+        })
+        .collect()
+}
+
+// Determine if an md5-cache entry inherits any of the given eclasses.
+fn inherits_any(repo: &Repo, entry: &str, eclasses: &IndexSet<String>) -> bool {
+    let path = build_from_paths!(repo.path(), CACHE_DIR, entry);
+    let data = fs::read_to_string(path).unwrap_or_default();
+    data.lines()
+        .find_map(|l| l.strip_prefix("_eclasses_="))
+        .map(|s| s.split('\t').step_by(2).any(|name| eclasses.contains(name)))
+        .unwrap_or_default()
+}
+
+/// Return the ebuilds with missing or outdated md5-cache entries, removing entries for ebuilds
+/// that no longer exist.
+///
+/// When the changes from a sync are known, only ebuilds in modified packages, cache entries
+/// inheriting modified eclasses, and modified cache entries are checked.
+pub(super) fn stale(repo: &Repo, changes: Option<&Changes>) -> Vec<Utf8PathBuf> {
+    let mut ebuilds = IndexSet::new();
+    match changes {
+        None => {
+            for cat in repo.categories() {
+                for pkg in repo.packages(&cat) {
+                    ebuilds.extend(pkg_ebuilds(repo, &cat, &pkg));
+                }
+            }
+        }
+        Some(changes) => {
+            for cpn in &changes.pkgs {
+                if let Some((cat, pkg)) = cpn.split_once('/') {
+                    ebuilds.extend(pkg_ebuilds(repo, cat, pkg));
+                }
+            }
+        }
+    }
+
+    for entry in cache_entries(repo) {
+        let atom = match atom::cpv(&entry) {
+            Ok(atom) => atom,
+            Err(_) => {
+                warn!("{}: invalid metadata cache entry: {entry}", repo.id());
+                continue;
+            }
+        };
+
+        if let Some(changes) = changes {
+            let cpn = format!("{}/{}", atom.category(), atom.package());
+            let changed = changes.pkgs.contains(&cpn)
+                || changes.other.contains(&format!("{CACHE_DIR}/{entry}"))
+                || (!changes.eclasses.is_empty() && inherits_any(repo, &entry, &changes.eclasses));
+            if !changed {
+                continue;
+            }
+        }
+
+        let pf = entry.split_once('/').map(|(_, pf)| pf).unwrap_or_default();
+        let path =
+            build_from_paths!(repo.path(), atom.category(), atom.package(), format!("{pf}.ebuild"));
+        if path.exists() {
+            ebuilds.insert(path);
+        } else {
+            let cache_path = build_from_paths!(repo.path(), CACHE_DIR, &entry);
+            if let Err(e) = fs::remove_file(&cache_path) {
+                warn!("{}: failed removing metadata cache entry: {entry}: {e}", repo.id());
+            }
+        }
+    }
+
+    ebuilds
+        .into_iter()
+        .filter(|path| !Pkg::cache_valid(path, repo))
+        .collect()
+}
+
+/// Regenerate md5-cache entries for the given ebuilds using a pool of worker processes.
+///
+/// Each worker sources an interleaved subset of the ebuilds so package state can't leak
+/// between workers and a crashing ebuild only affects its own worker.
+///
+/// Workers require a shared repo reference for their build state.
+pub(super) fn regen(repo: &Arc<Repo>, ebuilds: &[Utf8PathBuf], jobs: usize) -> crate::Result<()> {
+    if ebuilds.is_empty() {
+        return Ok(());
+    }
+
+    let jobs = jobs.clamp(1, ebuilds.len());
+    let mut failed = vec![];
+    let mut workers = vec![];
+    let profiles = profile::Workers::new();
+    // all workers are forked before any threads are spawned to wait on them
+    for i in 0..jobs {
+        let chunk: Vec<_> = ebuilds.iter().skip(i).step_by(jobs).collect();
+        match fork_worker(repo, &chunk, &profiles) {
+            Ok(worker) => workers.push(worker),
+            Err(e) => failed.push(format!("failed starting worker: {e}")),
+        }
+    }
+
+    // read worker pipes concurrently so workers don't block on full pipes
+    let handles: Vec<_> = workers
+        .into_iter()
+        .map(|(pid, errors)| thread::spawn(move || wait(pid, errors)))
+        .collect();
+    for handle in handles {
+        match handle.join() {
+            Ok(Ok(_)) => (),
+            Ok(Err(e)) => failed.extend(e.lines().map(|s| s.to_string())),
+            Err(_) => failed.push("worker thread panicked".to_string()),
+        }
+    }
+    profiles.merge();
+
+    match failed.is_empty() {
+        true => Ok(()),
+        false => {
+            let errors = failed.join("\n\t");
+            Err(Error::IO(format!("failed regenerating metadata:\n\t{errors}")))
+        }
+    }
+}
+
+// Fork a worker process regenerating cache entries, returning its pid and error pipe.
+fn fork_worker(
+    repo: &Arc<Repo>,
+    ebuilds: &[&Utf8PathBuf],
+    profiles: &profile::Workers,
+) -> nix::Result<(Pid, File)> {
+    let (r, w) = pipe2(OFlag::O_CLOEXEC)?;
+    // flush buffered output so it isn't duplicated in the worker
+    io::stdout().flush().ok();
+    match unsafe { fork() } {
+        Ok(ForkResult::Parent { child }) => {
+            close(w)?;
+            Ok((child, unsafe { File::from_raw_fd(r) }))
+        }
+        Ok(ForkResult::Child) => {
+            close(r).ok();
+            let errors = unsafe { File::from_raw_fd(w) };
+            profiles.start();
+            let status = worker(repo, ebuilds, errors);
+            profiles.finish();
+            process::exit(status)
+        }
+        Err(e) => {
+            close(r).ok();
+            close(w).ok();
+            Err(e)
+        }
+    }
+}
+
+// Regenerate cache entries inside a worker process, returning its exit status.
+fn worker(repo: &Arc<Repo>, ebuilds: &[&Utf8PathBuf], mut errors: File) -> i32 {
+    let result = panic::catch_unwind(AssertUnwindSafe(|| {
+        BUILD_DATA.with(|d| d.borrow_mut().repo = repo.clone());
+        ebuilds
+            .iter()
+            .filter_map(|path| regen_pkg(repo, path).err())
+            .collect::<Vec<_>>()
+    }));
+
+    match result {
+        Ok(failed) if failed.is_empty() => 0,
+        Ok(failed) => {
+            write!(errors, "{}", failed.join("\n")).ok();
+            1
+        }
+        Err(_) => {
+            write!(errors, "worker panicked").ok();
+            101
+        }
+    }
+}
+
+// Regenerate a package's cache entry, returning its error message on failure.
+fn regen_pkg(repo: &Repo, path: &Utf8Path) -> Result<(), String> {
+    Pkg::regen(path, repo).map_err(|e| format!("{path}: {e}"))
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::config::Config;
+    use crate::test::in_subprocess;
+
+    use super::*;
+
+    #[test]
+    fn test_regen() {
+        // workers are forked so the test runs in a single-threaded process
+        in_subprocess(concat!(module_path!(), "::test_regen"), || {
+            let mut config = Config::new("pkgcraft", "", false).unwrap();
+            let (t, repo) = config.temp_repo("test", 0).unwrap();
+            let eclass = t.create_eclass("e1", "# stub eclass\n").unwrap();
+            let data1 = indoc::indoc! {r#"
+                inherit e1
+                DESCRIPTION="testing metadata regen"
+                SLOT=0
+            "#};
+            let path1 = t.create_ebuild_raw("cat/pkg-1", data1).unwrap();
+            let data = indoc::indoc! {r#"
+                DESCRIPTION="testing metadata regen"
+                SLOT=0
+            "#};
+            let path2 = t.create_ebuild_raw("cat/pkg-2", data).unwrap();
+            let path3 = t.create_ebuild_raw("cat/a-1", data).unwrap();
+            let cache_dir = t.path.join(CACHE_DIR).join("cat");
+
+            // all entries are initially missing
+            assert_eq!(stale(&repo, None), [path3.clone(), path1.clone(), path2.clone()]);
+            regen(&repo, &stale(&repo, None), 2).unwrap();
+            assert!(stale(&repo, None).is_empty());
+            let entry = fs::read_to_string(cache_dir.join("pkg-1")).unwrap();
+            assert!(entry.starts_with("DESCRIPTION=testing metadata regen\n"));
+            assert!(entry.contains("\n_eclasses_=e1\t"));
+
+            // unmodified packages aren't checked
+            let changes: Changes = ["cat/a/a-1.ebuild"].into_iter().collect();
+            fs::write(&path1, data1.replace("testing", "modified")).unwrap();
+            assert!(stale(&repo, Some(&changes)).is_empty());
+            let changes: Changes = ["cat/pkg/pkg-1.ebuild"].into_iter().collect();
+            assert_eq!(stale(&repo, Some(&changes)), [path1.clone()]);
+            regen(&repo, &[path1.clone()], 1).unwrap();
+            assert!(stale(&repo, None).is_empty());
+
+            // modified eclasses invalidate the entries inheriting them
+            fs::write(&eclass, "# modified eclass\n").unwrap();
+            repo.reload_eclasses();
+            let changes: Changes = ["eclass/e1.eclass"].into_iter().collect();
+            assert_eq!(stale(&repo, Some(&changes)), [path1.clone()]);
+            regen(&repo, &[path1.clone()], 1).unwrap();
+            assert!(stale(&repo, None).is_empty());
+
+            // entries for removed ebuilds are removed
+            fs::remove_file(&path2).unwrap();
+            let changes: Changes = ["cat/pkg/pkg-2.ebuild"].into_iter().collect();
+            assert!(stale(&repo, Some(&changes)).is_empty());
+            assert!(!cache_dir.join("pkg-2").exists());
+            assert!(cache_dir.join("pkg-1").exists());
+
+            // sourcing failures are reported per ebuild
+            fs::write(&path3, "EAPI=8\nSLOT=0\n").unwrap();
+            let r = regen(&repo, &[path3.clone()], 1);
+            let err = r.unwrap_err().to_string();
+            assert!(err.contains(&format!("{path3}: missing required values")), "{err}");
+
+            // synced caches are used as-is when sync changes are unknown
+            fs::remove_file(cache_dir.join("pkg-1")).unwrap();
+            repo.regen_metadata(None).unwrap();
+            assert!(!cache_dir.join("pkg-1").exists());
+            let changes: Changes = ["cat/pkg/pkg-1.ebuild"].into_iter().collect();
+            repo.regen_metadata(Some(&changes)).unwrap();
+            assert!(cache_dir.join("pkg-1").exists());
+        });
+    }
+}
@@ -2,7 +2,7 @@ use std::{fmt, iter};
 
 use camino::Utf8Path;
 
-use super::{make_repo_traits, Repository};
+use super::{make_repo_traits, Names, Repository};
 use crate::config::RepoConfig;
 use crate::pkg::Package;
 use crate::restrict::{Restrict, Restriction};
@@ -73,6 +73,18 @@ impl Repository for Repo {
         vec![]
     }
 
+    fn category_names(&self) -> Names<'_> {
+        Names::new(&[])
+    }
+
+    fn package_names(&self, _cat: &str) -> Names<'_> {
+        Names::new(&[])
+    }
+
+    fn version_names(&self, _cat: &str, _pkg: &str) -> Names<'_> {
+        Names::new(&[])
+    }
+
     fn id(&self) -> &str {
         &self.id
     }
@@ -86,7 +98,8 @@ impl Repository for Repo {
     }
 
     fn sync(&self) -> crate::Result<()> {
-        self.repo_config.sync()
+        self.repo_config.sync()?;
+        Ok(())
     }
 
     fn len(&self) -> usize {
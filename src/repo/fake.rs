@@ -1,13 +1,12 @@
 use std::fmt;
-use std::fs;
 
 use camino::{Utf8Path, Utf8PathBuf};
 
-use super::{make_repo_traits, Repository};
+use super::{make_repo_traits, Names, Repository};
 use crate::config::RepoConfig;
 use crate::pkg::Package;
 use crate::restrict::{Restrict, Restriction};
-use crate::{atom, pkg, repo, Error};
+use crate::{pkg, repo};
 
 #[derive(Debug, Default)]
 pub struct Repo {
@@ -43,7 +42,7 @@ impl Repo {
         path: P,
     ) -> crate::Result<Self> {
         let path = path.as_ref();
-        let data = fs::read_to_string(path).map_err(|e| Error::RepoInit(e.to_string()))?;
+        let pkgs = repo::PkgCache::from_path(path)?;
         let repo_config = RepoConfig {
             location: Utf8PathBuf::from(path),
             priority,
@@ -52,7 +51,7 @@ impl Repo {
         Ok(Repo {
             id: id.to_string(),
             repo_config,
-            pkgs: repo::PkgCache::from_iter(data.lines()),
+            pkgs,
         })
     }
 
@@ -80,15 +79,30 @@ impl fmt::Display for Repo {
 
 impl Repository for Repo {
     fn categories(&self) -> Vec<String> {
-        self.pkgs.categories()
+        self.pkgs.categories().to_vec()
     }
 
     fn packages(&self, cat: &str) -> Vec<String> {
-        self.pkgs.packages(cat)
+        self.pkgs.packages(cat).to_vec()
     }
 
     fn versions(&self, cat: &str, pkg: &str) -> Vec<String> {
-        self.pkgs.versions(cat, pkg)
+        self.version_names(cat, pkg)
+            .iter()
+            .map(|s| s.to_string())
+            .collect()
+    }
+
+    fn category_names(&self) -> Names<'_> {
+        Names::new(self.pkgs.categories())
+    }
+
+    fn package_names(&self, cat: &str) -> Names<'_> {
+        Names::new(self.pkgs.packages(cat))
+    }
+
+    fn version_names(&self, cat: &str, pkg: &str) -> Names<'_> {
+        Names::versions(self.pkgs.versions(cat, pkg))
     }
 
     fn id(&self) -> &str {
@@ -104,7 +118,8 @@ impl Repository for Repo {
     }
 
     fn sync(&self) -> crate::Result<()> {
-        self.repo_config.sync()
+        self.repo_config.sync()?;
+        Ok(())
     }
 
     fn len(&self) -> usize {
@@ -194,7 +209,8 @@ mod tests {
         assert!(repo.categories().is_empty());
         // existing pkgs
         repo = Repo::new("fake", 0, ["cat1/pkg-a-1", "cat1/pkg-b-2", "cat2/pkg-c-3"]).unwrap();
-        assert_eq!(repo.categories(), ["cat1", "cat2"])
+        assert_eq!(repo.categories(), ["cat1", "cat2"]);
+        assert!(repo.category_names().iter().eq(["cat1", "cat2"]));
     }
 
     #[test]
@@ -208,6 +224,8 @@ mod tests {
         assert!(repo.packages("cat").is_empty());
         assert_eq!(repo.packages("cat1"), ["pkg-a", "pkg-b"]);
         assert_eq!(repo.packages("cat2"), ["pkg-c"]);
+        assert!(repo.package_names("cat1").iter().eq(["pkg-a", "pkg-b"]));
+        assert_eq!(repo.package_names("cat").iter().count(), 0);
     }
 
     #[test]
@@ -221,6 +239,8 @@ mod tests {
         assert!(repo.versions("cat", "pkg").is_empty());
         assert_eq!(repo.versions("cat1", "pkg-a"), ["1"]);
         assert_eq!(repo.versions("cat2", "pkg-b"), ["1", "2"]);
+        assert!(repo.version_names("cat2", "pkg-b").iter().eq(["1", "2"]));
+        assert_eq!(repo.version_names("cat2", "pkg").iter().count(), 0);
     }
 
     #[test]
@@ -0,0 +1,924 @@
+use std::collections::HashSet;
+use std::fs::{self, File};
+use std::io::{self, BufReader, Write};
+use std::ops::Range;
+use std::time::SystemTime;
+use std::{fmt, iter, slice};
+
+use camino::{Utf8Path, Utf8PathBuf};
+use filetime::FileTime;
+use indexmap::IndexMap;
+use once_cell::sync::OnceCell;
+use serde::{Deserialize, Serialize};
+use tempfile::NamedTempFile;
+use tracing::warn;
+
+use super::{make_repo_cmp, Names, Repository};
+use crate::config::RepoConfig;
+use crate::restrict::{Restrict, Restriction};
+use crate::{atom, eapi, pkg, repo, Error};
+
+// Bump when the cached index format changes so older caches are regenerated.
+const CACHE_VERSION: u32 = 3;
+
+/// Metadata for an installed package stored in the repo index.
+#[derive(Debug)]
+pub(crate) struct Entry {
+    eapi: &'static eapi::Eapi,
+    slot: String,
+    use_flags: String,
+    keywords: String,
+    // package directory name, used to look up its CONTENTS
+    pf: String,
+}
+
+impl Entry {
+    pub(crate) fn eapi(&self) -> &'static eapi::Eapi {
+        self.eapi
+    }
+
+    pub(crate) fn slot(&self) -> &str {
+        &self.slot
+    }
+
+    pub(crate) fn use_flags(&self) -> &str {
+        &self.use_flags
+    }
+
+    pub(crate) fn keywords(&self) -> &str {
+        &self.keywords
+    }
+}
+
+/// Serialized form of an installed package's metadata.
+#[derive(Debug, Default, Serialize, Deserialize)]
+struct CachedPkg {
+    pf: String,
+    eapi: String,
+    slot: String,
+    use_flags: String,
+    keywords: String,
+}
+
+impl CachedPkg {
+    // Read the metadata for an installed package from its vdb directory.
+    fn read(dir: &Utf8Path, pf: &str) -> Self {
+        let read = |name: &str| -> String {
+            match fs::read_to_string(dir.join(name)) {
+                Ok(data) => data.trim().to_string(),
+                Err(_) => Default::default(),
+            }
+        };
+
+        CachedPkg {
+            pf: pf.to_string(),
+            eapi: read("EAPI"),
+            slot: read("SLOT"),
+            use_flags: read("USE"),
+            keywords: read("KEYWORDS"),
+        }
+    }
+}
+
+/// Serialized form of a category's installed packages.
+#[derive(Debug, Serialize, Deserialize)]
+struct CachedCategory {
+    mtime: SystemTime,
+    pkgs: Vec<CachedPkg>,
+}
+
+/// Serialized vdb index, categories are revalidated against their directory mtimes on load.
+#[derive(Debug, Default, Serialize, Deserialize)]
+struct Cache {
+    version: u32,
+    location: Utf8PathBuf,
+    categories: IndexMap<String, CachedCategory>,
+}
+
+impl Cache {
+    // Load a cached index, returning None if it's missing, invalid, or outdated.
+    fn load(path: &Utf8Path) -> Option<Self> {
+        let file = File::open(path).ok()?;
+        let cache: Cache = serde_json::from_reader(BufReader::new(file)).ok()?;
+        match cache.version == CACHE_VERSION {
+            true => Some(cache),
+            false => None,
+        }
+    }
+
+    // Atomically write the cached index to the given path.
+    fn write(&self, path: &Utf8Path) -> crate::Result<()> {
+        let err = |e: std::io::Error| Error::IO(format!("failed writing vdb cache: {path}: {e}"));
+        let dir = path.parent().unwrap_or_else(|| Utf8Path::new("."));
+        fs::create_dir_all(dir).map_err(err)?;
+        let mut file = NamedTempFile::new_in(dir).map_err(err)?;
+        let data = serde_json::to_vec(self)
+            .map_err(|e| Error::IO(format!("failed serializing vdb cache: {e}")))?;
+        file.write_all(&data).map_err(err)?;
+        file.persist(path).map_err(|e| err(e.error))?;
+        Ok(())
+    }
+}
+
+/// Installed file paths for all packages, stored in a single buffer addressed by offsets.
+///
+/// The buffer uses the line-based layout of its cache file: `C <cat> <secs> <nsecs>` lines start
+/// categories with their directory mtimes, `P <pf>` lines start packages, and all other lines
+/// are the absolute paths installed by the preceding package. Since CONTENTS files make up most
+/// of a vdb, they're indexed separately from the package metadata and only loaded on demand.
+#[derive(Debug, Default)]
+struct Contents {
+    data: String,
+    // category mtimes and data ranges including their header lines
+    categories: IndexMap<String, (FileTime, Range<usize>)>,
+    // path data ranges for each package keyed by `cat/pf`, indices are used as package ids
+    pkgs: IndexMap<String, Range<usize>>,
+    // path ranges with their package ids, sorted by path for owner lookups
+    paths: Vec<(Range<usize>, usize)>,
+}
+
+impl Contents {
+    /// Load the contents for a vdb, reusing cached categories with unchanged directory mtimes
+    /// and updating the cache file when anything changed.
+    fn load(path: &Utf8Path, cache_path: Option<&Utf8Path>) -> Self {
+        let (cached, mut modified) = match cache_path.and_then(|p| Contents::read(p, path)) {
+            Some(cached) => (cached, false),
+            None => (Contents::default(), true),
+        };
+
+        let mut data = String::new();
+        let mut reused = 0;
+        for (name, mtime) in category_dirs(path) {
+            let mtime = FileTime::from_system_time(mtime);
+            match cached.categories.get(&name) {
+                Some((m, range)) if *m == mtime => {
+                    data.push_str(&cached.data[range.clone()]);
+                    reused += 1;
+                }
+                _ => {
+                    modified = true;
+                    read_category_contents(path, &name, mtime, &mut data);
+                }
+            }
+        }
+
+        // removed categories
+        modified |= reused != cached.categories.len();
+        if !modified {
+            return cached;
+        }
+
+        if let Some(cache_path) = cache_path {
+            if let Err(e) = Contents::write(cache_path, path, &data) {
+                warn!("{e}");
+            }
+        }
+
+        Contents::parse(data).unwrap_or_else(|| {
+            warn!("invalid vdb contents: {path}");
+            Default::default()
+        })
+    }
+
+    // Read cached contents, returning None if they're missing, invalid, or outdated.
+    fn read(path: &Utf8Path, location: &Utf8Path) -> Option<Self> {
+        let data = fs::read_to_string(path).ok()?;
+        let mut lines = data.splitn(3, '\n');
+        let version = lines
+            .next()?
+            .strip_prefix("version ")?
+            .parse::<u32>()
+            .ok()?;
+        let cached_location = lines.next()?.strip_prefix("location ")?;
+        match version == CACHE_VERSION && cached_location == location {
+            true => Contents::parse(lines.next().unwrap_or_default().to_string()),
+            false => None,
+        }
+    }
+
+    // Atomically write contents data to the given cache path.
+    fn write(path: &Utf8Path, location: &Utf8Path, data: &str) -> crate::Result<()> {
+        let err = |e: std::io::Error| Error::IO(format!("failed writing vdb cache: {path}: {e}"));
+        let dir = path.parent().unwrap_or_else(|| Utf8Path::new("."));
+        fs::create_dir_all(dir).map_err(err)?;
+        let mut file = NamedTempFile::new_in(dir).map_err(err)?;
+        write!(file, "version {CACHE_VERSION}\nlocation {location}\n{data}").map_err(err)?;
+        file.persist(path).map_err(|e| err(e.error))?;
+        Ok(())
+    }
+
+    // Index contents data, returning None if it's malformed.
+    fn parse(data: String) -> Option<Self> {
+        let mut categories = IndexMap::new();
+        let mut pkgs = IndexMap::new();
+        let mut paths = vec![];
+        // current category and package
+        let mut cat: Option<(String, FileTime, usize)> = None;
+        let mut pkg: Option<(String, usize)> = None;
+
+        let mut pos = 0;
+        for line in data.split_inclusive('\n') {
+            let start = pos;
+            pos += line.len();
+            let line = line.trim_end_matches('\n');
+            if line.starts_with('/') {
+                // paths must follow a package
+                pkg.as_ref()?;
+                paths.push((start..start + line.len(), pkgs.len()));
+                continue;
+            }
+
+            // close the current package and category ranges
+            if let Some((key, pkg_start)) = pkg.take() {
+                pkgs.insert(key, pkg_start..start);
+            }
+            if let Some(s) = line.strip_prefix("P ") {
+                let (name, ..) = cat.as_ref()?;
+                pkg = Some((format!("{name}/{s}"), pos));
+                continue;
+            }
+            if let Some((name, mtime, cat_start)) = cat.take() {
+                categories.insert(name, (mtime, cat_start..start));
+            }
+            let mut fields = line.strip_prefix("C ")?.rsplitn(3, ' ');
+            let nsecs = fields.next()?.parse().ok()?;
+            let secs = fields.next()?.parse().ok()?;
+            let name = fields.next()?.to_string();
+            cat = Some((name, FileTime::from_unix_time(secs, nsecs), start));
+        }
+
+        if let Some((key, pkg_start)) = pkg {
+            pkgs.insert(key, pkg_start..data.len());
+        }
+        if let Some((name, mtime, cat_start)) = cat {
+            categories.insert(name, (mtime, cat_start..data.len()));
+        }
+
+        paths.sort_by(|(r1, _), (r2, _)| data[r1.clone()].cmp(&data[r2.clone()]));
+        Some(Contents {
+            data,
+            categories,
+            pkgs,
+            paths,
+        })
+    }
+
+    /// Return the installed file paths for a package.
+    fn get(&self, cat: &str, pf: &str) -> Vec<String> {
+        match self.pkgs.get(&format!("{cat}/{pf}")) {
+            Some(r) => self.data[r.clone()]
+                .lines()
+                .map(|s| s.to_string())
+                .collect(),
+            None => vec![],
+        }
+    }
+
+    /// Return the `(cat, pf)` pairs of the packages owning a given file path.
+    fn owners<'a>(&'a self, path: &str) -> impl Iterator<Item = (&'a str, &'a str)> + 'a {
+        let data = &self.data;
+        let idx = self.paths.partition_point(|(r, _)| &data[r.clone()] < path);
+        let path = path.to_string();
+        self.paths[idx..]
+            .iter()
+            .take_while(move |(r, _)| data[r.clone()] == path)
+            .filter_map(move |(_, id)| self.pkgs.get_index(*id))
+            .filter_map(|(key, _)| key.split_once('/'))
+    }
+}
+
+// Append the contents block for a category, skipping in-progress merges.
+fn read_category_contents(path: &Utf8Path, cat: &str, mtime: FileTime, data: &mut String) {
+    data.push_str(&format!("C {cat} {} {}\n", mtime.unix_seconds(), mtime.nanoseconds()));
+    let dir = path.join(cat);
+    for pf in pkg_dirs(&dir) {
+        data.push_str(&format!("P {pf}\n"));
+        let path = dir.join(&pf).join("CONTENTS");
+        match fs::read_to_string(&path) {
+            Ok(contents) => {
+                for p in parse_contents(&contents)
+                    .iter()
+                    .filter(|p| p.starts_with('/'))
+                {
+                    data.push_str(p);
+                    data.push('\n');
+                }
+            }
+            Err(e) if e.kind() == io::ErrorKind::NotFound => (),
+            Err(e) => warn!("failed reading vdb contents: {path}: {e}"),
+        }
+    }
+}
+
+// Parse the file paths from CONTENTS data.
+fn parse_contents(data: &str) -> Vec<String> {
+    let mut paths = vec![];
+    for line in data.lines() {
+        // paths can contain spaces so trailing fields are split from the right
+        let path = match line.split_once(' ') {
+            Some(("obj", s)) => s.rsplitn(3, ' ').nth(2),
+            Some(("sym", s)) => s.split_once(" -> ").map(|(path, _)| path),
+            Some(("dir" | "dev" | "fif", s)) => Some(s),
+            _ => None,
+        };
+        if let Some(path) = path {
+            paths.push(path.to_string());
+        }
+    }
+    paths
+}
+
+// Return the sorted names and modification times of a vdb's category directories.
+fn category_dirs(path: &Utf8Path) -> Vec<(String, SystemTime)> {
+    let mut dirs: Vec<_> = match fs::read_dir(path) {
+        Ok(entries) => entries
+            .filter_map(|e| e.ok())
+            .filter_map(|e| {
+                let name = e.file_name().to_str()?.to_string();
+                let meta = e.metadata().ok().filter(|m| m.is_dir())?;
+                match name.starts_with('.') {
+                    true => None,
+                    false => Some((name, meta.modified().ok()?)),
+                }
+            })
+            .collect(),
+        Err(e) => {
+            warn!("failed reading vdb: {path}: {e}");
+            vec![]
+        }
+    };
+    dirs.sort();
+    dirs
+}
+
+/// Determine if a path contains installed packages, i.e. any `*/*/CONTENTS` files.
+///
+/// Empty vdbs aren't detected and require an explicitly configured format instead.
+pub(super) fn detect(path: &Utf8Path) -> bool {
+    category_dirs(path)
+        .iter()
+        .any(|(cat, _)| match fs::read_dir(path.join(cat)) {
+            Ok(entries) => entries
+                .filter_map(|e| e.ok())
+                .any(|e| e.path().join("CONTENTS").is_file()),
+            Err(_) => false,
+        })
+}
+
+// Return the sorted package directory names for a category, skipping in-progress merges.
+fn pkg_dirs(dir: &Utf8Path) -> Vec<String> {
+    let mut pkgs: Vec<_> = match fs::read_dir(dir) {
+        Ok(entries) => entries
+            .filter_map(|e| e.ok())
+            .filter(|e| e.file_type().map(|t| t.is_dir()).unwrap_or_default())
+            .filter_map(|e| e.file_name().to_str().map(|s| s.to_string()))
+            .filter(|pf| !pf.starts_with(['.', '-']) && !pf.contains('\n'))
+            .collect(),
+        Err(e) => {
+            warn!("failed reading vdb category: {dir}: {e}");
+            vec![]
+        }
+    };
+    pkgs.sort();
+    pkgs
+}
+
+// Read the installed packages for a category.
+fn read_category(path: &Utf8Path, cat: &str) -> Vec<CachedPkg> {
+    let dir = path.join(cat);
+    pkg_dirs(&dir)
+        .iter()
+        .map(|pf| CachedPkg::read(&dir.join(pf), pf))
+        .collect()
+}
+
+/// Compact index of installed packages.
+#[derive(Debug, Default)]
+struct Index {
+    pkgs: repo::PkgCache,
+    // package metadata stored in parallel to the sorted atoms
+    entries: Vec<Entry>,
+}
+
+impl Index {
+    /// Load the index for a vdb, reusing cached categories with unchanged directory mtimes and
+    /// updating the cache file when anything changed.
+    fn load(path: &Utf8Path, cache_path: Option<&Utf8Path>) -> Self {
+        let mut cache = cache_path
+            .and_then(Cache::load)
+            .filter(|c| c.location == path)
+            .unwrap_or_default();
+        let mut categories = IndexMap::new();
+        // missing or discarded caches are always rewritten
+        let mut modified = cache.location != path;
+
+        // category mtimes are read before their packages so concurrent changes invalidate them
+        for (name, mtime) in category_dirs(path) {
+            let category = match cache.categories.remove(&name) {
+                Some(c) if c.mtime == mtime => c,
+                _ => {
+                    modified = true;
+                    let pkgs = read_category(path, &name);
+                    CachedCategory { mtime, pkgs }
+                }
+            };
+            categories.insert(name, category);
+        }
+
+        // removed categories
+        modified |= !cache.categories.is_empty();
+
+        let cache = Cache {
+            version: CACHE_VERSION,
+            location: path.to_path_buf(),
+            categories,
+        };
+
+        if let (true, Some(cache_path)) = (modified, cache_path) {
+            if let Err(e) = cache.write(cache_path) {
+                warn!("{e}");
+            }
+        }
+
+        Index::from(cache)
+    }
+}
+
+impl From<Cache> for Index {
+    fn from(cache: Cache) -> Self {
+        let mut pkgs = vec![];
+        for (cat, category) in cache.categories {
+            for pkg in category.pkgs {
+                let cpv = format!("{cat}/{}", pkg.pf);
+                let atom = match atom::cpv_uncached(&cpv) {
+                    Ok(a) => a,
+                    Err(e) => {
+                        warn!("invalid vdb entry: {e}");
+                        continue;
+                    }
+                };
+                // packages lacking an EAPI file predate EAPI tracking
+                let eapi = match pkg.eapi.as_str() {
+                    "" => &*eapi::EAPI0,
+                    s => match eapi::get_eapi(s) {
+                        Ok(eapi) => eapi,
+                        Err(e) => {
+                            warn!("invalid vdb entry: {cpv}: {e}");
+                            continue;
+                        }
+                    },
+                };
+                let entry = Entry {
+                    eapi,
+                    slot: pkg.slot,
+                    use_flags: pkg.use_flags,
+                    keywords: pkg.keywords,
+                    pf: pkg.pf,
+                };
+                pkgs.push((atom, entry));
+            }
+        }
+
+        // sort and deduplicate entries so they stay aligned with the package cache atoms
+        pkgs.sort_by(|(a1, _), (a2, _)| a1.cmp(a2));
+        pkgs.dedup_by(|(a1, _), (a2, _)| a1 == a2);
+        let (atoms, entries): (Vec<_>, Vec<_>) = pkgs.into_iter().unzip();
+
+        Index {
+            pkgs: repo::PkgCache::from_atoms(atoms),
+            entries,
+        }
+    }
+}
+
+#[derive(Debug, Default)]
+pub struct Repo {
+    id: String,
+    repo_config: RepoConfig,
+    cache_path: Option<Utf8PathBuf>,
+    index: OnceCell<Index>,
+    contents: OnceCell<Contents>,
+}
+
+make_repo_cmp!(Repo);
+
+impl Repo {
+    pub(super) fn from_path<P: AsRef<Utf8Path>>(
+        id: &str,
+        priority: i32,
+        path: P,
+        cache_dir: Option<&Utf8Path>,
+    ) -> crate::Result<Self> {
+        let path = path.as_ref();
+        let invalid_repo = |error: &str| -> Error {
+            Error::InvalidRepo {
+                path: Utf8PathBuf::from(path),
+                error: error.to_string(),
+            }
+        };
+
+        // vdbs only contain category directories
+        let entries = fs::read_dir(path).map_err(|_| invalid_repo("not a directory"))?;
+        for entry in entries.filter_map(|e| e.ok()) {
+            let is_dir = entry.file_type().map(|t| t.is_dir()).unwrap_or_default();
+            let hidden = entry
+                .file_name()
+                .to_str()
+                .map_or(false, |s| s.starts_with('.'));
+            if !is_dir && !hidden {
+                return Err(invalid_repo("invalid vdb layout"));
+            }
+        }
+
+        // cache the index alongside other config-specific cache files when available
+        let cache_path = cache_dir.map(|dir| dir.join("vdb").join(id));
+
+        let repo_config = RepoConfig {
+            location: Utf8PathBuf::from(path),
+            priority,
+            ..Default::default()
+        };
+
+        Ok(Repo {
+            id: id.to_string(),
+            repo_config,
+            cache_path,
+            index: OnceCell::new(),
+            contents: OnceCell::new(),
+        })
+    }
+
+    pub(super) fn repo_config(&self) -> &RepoConfig {
+        &self.repo_config
+    }
+
+    /// Return the repo index, loading it on first access.
+    fn index(&self) -> &Index {
+        self.index
+            .get_or_init(|| Index::load(self.path(), self.cache_path.as_deref()))
+    }
+
+    /// Return the CONTENTS index, loading it on first access.
+    fn contents_index(&self) -> &Contents {
+        self.contents.get_or_init(|| {
+            let cache_path = self
+                .cache_path
+                .as_ref()
+                .map(|p| Utf8PathBuf::from(format!("{p}.contents")));
+            Contents::load(self.path(), cache_path.as_deref())
+        })
+    }
+
+    /// Return the installed file paths for a package.
+    pub(crate) fn contents(&self, atom: &atom::Atom, entry: &Entry) -> Vec<String> {
+        self.contents_index().get(atom.category(), &entry.pf)
+    }
+
+    /// Return the installed packages owning a given file path.
+    pub fn owners<P: AsRef<Utf8Path>>(&self, path: P) -> impl Iterator<Item = pkg::vdb::Pkg> {
+        let owners: HashSet<_> = self
+            .contents_index()
+            .owners(path.as_ref().as_str())
+            .collect();
+        let index = self.index();
+        index
+            .pkgs
+            .into_iter()
+            .zip(index.entries.iter())
+            .filter(move |(a, e)| owners.contains(&(a.category(), e.pf.as_str())))
+            .map(move |(a, e)| pkg::vdb::Pkg::new(a, e, self))
+    }
+
+    pub fn iter(&self) -> PkgIter {
+        self.into_iter()
+    }
+
+    pub fn iter_restrict<T: Into<Restrict>>(&self, val: T) -> RestrictPkgIter {
+        RestrictPkgIter {
+            iter: self.into_iter(),
+            restrict: val.into(),
+        }
+    }
+}
+
+impl fmt::Display for Repo {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        write!(f, "{}: vdb repo", self.id)
+    }
+}
+
+impl Repository for Repo {
+    fn categories(&self) -> Vec<String> {
+        self.index().pkgs.categories().to_vec()
+    }
+
+    fn packages(&self, cat: &str) -> Vec<String> {
+        self.index().pkgs.packages(cat).to_vec()
+    }
+
+    fn versions(&self, cat: &str, pkg: &str) -> Vec<String> {
+        self.version_names(cat, pkg)
+            .iter()
+            .map(|s| s.to_string())
+            .collect()
+    }
+
+    fn category_names(&self) -> Names<'_> {
+        Names::new(self.index().pkgs.categories())
+    }
+
+    fn package_names(&self, cat: &str) -> Names<'_> {
+        Names::new(self.index().pkgs.packages(cat))
+    }
+
+    fn version_names(&self, cat: &str, pkg: &str) -> Names<'_> {
+        Names::versions(self.index().pkgs.versions(cat, pkg))
+    }
+
+    fn id(&self) -> &str {
+        &self.id
+    }
+
+    fn priority(&self) -> i32 {
+        self.repo_config.priority
+    }
+
+    fn path(&self) -> &Utf8Path {
+        &self.repo_config.location
+    }
+
+    fn sync(&self) -> crate::Result<()> {
+        self.repo_config.sync()?;
+        Ok(())
+    }
+
+    fn len(&self) -> usize {
+        self.index().pkgs.len()
+    }
+
+    fn is_empty(&self) -> bool {
+        self.index().pkgs.is_empty()
+    }
+}
+
+impl<T: AsRef<Utf8Path>> repo::Contains<T> for Repo {
+    fn contains(&self, _path: T) -> bool {
+        false
+    }
+}
+
+// atoms are only matched against the indexed versions of their package
+impl repo::Contains<&atom::Atom> for Repo {
+    fn contains(&self, atom: &atom::Atom) -> bool {
+        let r: Restrict = atom.into();
+        self.index()
+            .pkgs
+            .versions(atom.category(), atom.package())
+            .iter()
+            .any(|a| r.matches(a))
+    }
+}
+
+impl repo::Contains<atom::Atom> for Repo {
+    fn contains(&self, atom: atom::Atom) -> bool {
+        self.contains(&atom)
+    }
+}
+
+impl<'a> IntoIterator for &'a Repo {
+    type Item = pkg::vdb::Pkg<'a>;
+    type IntoIter = PkgIter<'a>;
+
+    fn into_iter(self) -> Self::IntoIter {
+        let index = self.index();
+        PkgIter {
+            iter: index.pkgs.into_iter().zip(index.entries.iter()),
+            repo: self,
+        }
+    }
+}
+
+#[derive(Debug)]
+pub struct PkgIter<'a> {
+    iter: iter::Zip<repo::PkgCacheIter<'a>, slice::Iter<'a, Entry>>,
+    repo: &'a Repo,
+}
+
+impl<'a> Iterator for PkgIter<'a> {
+    type Item = pkg::vdb::Pkg<'a>;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        self.iter
+            .next()
+            .map(|(a, e)| pkg::vdb::Pkg::new(a, e, self.repo))
+    }
+}
+
+#[derive(Debug)]
+pub struct RestrictPkgIter<'a> {
+    iter: PkgIter<'a>,
+    restrict: Restrict,
+}
+
+impl<'a> Iterator for RestrictPkgIter<'a> {
+    type Item = pkg::vdb::Pkg<'a>;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        let restrict = &self.restrict;
+        self.iter.find(|p| restrict.matches(p))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::str::FromStr;
+
+    use filetime::FileTime;
+
+    use crate::pkg::Package;
+    use crate::repo::Contains;
+
+    use super::*;
+
+    // Create an installed package entry in a vdb.
+    fn install(vdb: &Utf8Path, cpv: &str, files: &[(&str, &str)]) {
+        let dir = vdb.join(cpv);
+        fs::create_dir_all(&dir).unwrap();
+        for (name, data) in files {
+            fs::write(dir.join(name), data).unwrap();
+        }
+    }
+
+    #[test]
+    fn test_parse_contents() {
+        let data = indoc::indoc! {"
+            dir /usr/bin
+            obj /usr/bin/a b 0123456789abcdef0123456789abcdef 1600000000
+            sym /usr/bin/c -> a 1600000000
+            fif /run/d
+            unknown /e
+        "};
+        assert_eq!(parse_contents(data), ["/usr/bin", "/usr/bin/a b", "/usr/bin/c", "/run/d"]);
+    }
+
+    #[test]
+    fn test_repo() {
+        let dir = tempfile::tempdir().unwrap();
+        let vdb = Utf8Path::from_path(dir.path()).unwrap();
+        install(
+            vdb,
+            "cat/pkg-1",
+            &[
+                ("EAPI", "8\n"),
+                ("SLOT", "0/1\n"),
+                ("USE", "a b\n"),
+                ("KEYWORDS", "amd64 ~arm64\n"),
+                ("CONTENTS", "dir /usr\nobj /usr/bin/pkg 0123 1600000000\n"),
+            ],
+        );
+        install(vdb, "cat/pkg-2", &[("SLOT", "2\n")]);
+        install(vdb, "cat/a-1", &[("SLOT", "0\n")]);
+        install(vdb, "cat/-MERGING-b-1", &[]);
+
+        let repo = Repo::from_path("vdb", 0, vdb, None).unwrap();
+        assert_eq!(repo.categories(), ["cat"]);
+        assert_eq!(repo.packages("cat"), ["a", "pkg"]);
+        assert_eq!(repo.versions("cat", "pkg"), ["1", "2"]);
+        assert_eq!(repo.len(), 3);
+
+        // metadata
+        let pkgs: Vec<_> = repo.iter().collect();
+        let pkg = &pkgs[1];
+        assert_eq!(pkg.atom().to_string(), "cat/pkg-1");
+        assert_eq!(pkg.eapi(), &*eapi::EAPI8);
+        assert_eq!((pkg.slot(), pkg.subslot()), ("0", "1"));
+        assert!(pkg.use_flags().eq(["a", "b"]));
+        assert!(pkg.keywords().eq(["amd64", "~arm64"]));
+        assert_eq!(pkg.contents(), ["/usr", "/usr/bin/pkg"]);
+        assert_eq!(pkgs[2].eapi(), &*eapi::EAPI0);
+        assert!(pkgs[2].contents().is_empty());
+
+        // atom containment
+        assert!(repo.contains(atom::cpv("cat/pkg-2").unwrap()));
+        assert!(repo.contains(&atom::Atom::from_str(">=cat/pkg-2").unwrap()));
+        assert!(!repo.contains(&atom::Atom::from_str(">cat/pkg-2").unwrap()));
+        assert!(!repo.contains(atom::cpv("cat/b-1").unwrap()));
+
+        // file owners
+        let owners: Vec<_> = repo.owners("/usr/bin/pkg").map(|p| p.to_string()).collect();
+        assert_eq!(owners, ["cat/pkg-1::vdb"]);
+        assert_eq!(repo.owners("/usr/bin/a").count(), 0);
+
+        // format detection requires installed packages
+        let r = repo::Repo::from_path("vdb", 0, vdb, None).unwrap();
+        assert!(r.as_vdb().is_some());
+        let empty = tempfile::tempdir().unwrap();
+        let empty = Utf8Path::from_path(empty.path()).unwrap();
+        fs::create_dir(empty.join("cat")).unwrap();
+        let r = repo::Repo::from_path("vdb", 0, empty, None).unwrap();
+        assert!(r.as_vdb().is_none());
+        assert!(repo::Repo::from_format("vdb", 0, empty, "vdb", None).is_ok());
+
+        // invalid layouts
+        fs::write(vdb.join("file"), "").unwrap();
+        assert!(Repo::from_path("vdb", 0, vdb, None).is_err());
+        assert!(Repo::from_path("vdb", 0, vdb.join("file"), None).is_err());
+    }
+
+    #[test]
+    fn test_cache() {
+        let dir = tempfile::tempdir().unwrap();
+        let path = Utf8Path::from_path(dir.path()).unwrap();
+        let (vdb, cache_path) = (path.join("vdb"), path.join("cache"));
+        install(&vdb, "cat1/a-1", &[("SLOT", "0\n")]);
+        install(&vdb, "cat2/b-1", &[("SLOT", "0\n")]);
+
+        let index = Index::load(&vdb, Some(&cache_path));
+        assert_eq!(index.pkgs.len(), 2);
+        let cache = Cache::load(&cache_path).unwrap();
+        assert_eq!(cache.categories.len(), 2);
+
+        // unchanged categories are loaded from the cache
+        let mut cache = cache;
+        cache.categories.get_index_mut(0).unwrap().1.pkgs[0].slot = "cached".to_string();
+        cache.write(&cache_path).unwrap();
+        let index = Index::load(&vdb, Some(&cache_path));
+        assert_eq!(index.entries[0].slot(), "cached");
+
+        // categories with changed mtimes are reread
+        let mtime = SystemTime::UNIX_EPOCH;
+        filetime::set_file_mtime(vdb.join("cat1"), FileTime::from_system_time(mtime)).unwrap();
+        install(&vdb, "cat2/b-2", &[("SLOT", "0\n")]);
+        let index = Index::load(&vdb, Some(&cache_path));
+        assert_eq!(index.entries[0].slot(), "0");
+        assert_eq!(index.pkgs.versions("cat2", "b").len(), 2);
+        let cache = Cache::load(&cache_path).unwrap();
+        assert_eq!(cache.categories.get("cat1").unwrap().mtime, mtime);
+
+        // caches for other locations are ignored
+        let other = path.join("other");
+        fs::create_dir(&other).unwrap();
+        let index = Index::load(&other, Some(&cache_path));
+        assert!(index.pkgs.is_empty());
+        assert!(Cache::load(&cache_path).unwrap().categories.is_empty());
+        Index::load(&vdb, Some(&cache_path));
+
+        // removed categories are dropped
+        fs::remove_dir_all(vdb.join("cat2")).unwrap();
+        let index = Index::load(&vdb, Some(&cache_path));
+        assert_eq!(index.pkgs.categories(), ["cat1"]);
+        assert_eq!(Cache::load(&cache_path).unwrap().categories.len(), 1);
+
+        // invalid caches are ignored
+        fs::write(&cache_path, "invalid").unwrap();
+        assert!(Cache::load(&cache_path).is_none());
+        assert_eq!(Index::load(&vdb, Some(&cache_path)).pkgs.len(), 1);
+    }
+
+    #[test]
+    fn test_contents() {
+        let dir = tempfile::tempdir().unwrap();
+        let path = Utf8Path::from_path(dir.path()).unwrap();
+        let (vdb, cache_path) = (path.join("vdb"), path.join("cache.contents"));
+        install(&vdb, "cat1/a-1", &[("CONTENTS", "dir /usr\nobj /usr/bin/a 0123 1600000000\n")]);
+        install(&vdb, "cat2/b-1", &[("CONTENTS", "dir /usr\nsym /usr/bin/b -> a 1600000000\n")]);
+
+        let contents = Contents::load(&vdb, Some(&cache_path));
+        assert_eq!(contents.get("cat1", "a-1"), ["/usr", "/usr/bin/a"]);
+        let owners: Vec<_> = contents.owners("/usr").collect();
+        assert_eq!(owners, [("cat1", "a-1"), ("cat2", "b-1")]);
+        let owners: Vec<_> = contents.owners("/usr/bin/b").collect();
+        assert_eq!(owners, [("cat2", "b-1")]);
+        assert_eq!(contents.owners("/usr/bin").count(), 0);
+
+        // unchanged categories are loaded from the cache
+        let data = "obj /usr/bin/changed 0123 1600000000\n";
+        fs::write(vdb.join("cat1/a-1/CONTENTS"), data).unwrap();
+        let contents = Contents::load(&vdb, Some(&cache_path));
+        assert_eq!(contents.get("cat1", "a-1"), ["/usr", "/usr/bin/a"]);
+
+        // categories with changed mtimes are reread
+        filetime::set_file_mtime(vdb.join("cat1"), FileTime::zero()).unwrap();
+        let contents = Contents::load(&vdb, Some(&cache_path));
+        assert_eq!(contents.get("cat1", "a-1"), ["/usr/bin/changed"]);
+        assert_eq!(contents.get("cat2", "b-1"), ["/usr", "/usr/bin/b"]);
+
+        // removed categories are dropped
+        fs::remove_dir_all(vdb.join("cat2")).unwrap();
+        let contents = Contents::load(&vdb, Some(&cache_path));
+        assert!(contents.get("cat2", "b-1").is_empty());
+        assert_eq!(contents.owners("/usr").count(), 0);
+        let cached = Contents::read(&cache_path, &vdb).unwrap();
+        assert_eq!(cached.categories.keys().collect::<Vec<_>>(), ["cat1"]);
+
+        // malformed data
+        assert!(Contents::parse("/usr\n".to_string()).is_none());
+        assert!(Contents::parse("C cat 0 0\n/usr\n".to_string()).is_none());
+        assert!(Contents::parse("invalid\n".to_string()).is_none());
+
+        // invalid caches are ignored
+        fs::write(&cache_path, "invalid").unwrap();
+        let contents = Contents::load(&vdb, Some(&cache_path));
+        assert_eq!(contents.get("cat1", "a-1"), ["/usr/bin/changed"]);
+    }
+}
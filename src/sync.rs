@@ -2,9 +2,16 @@ use std::fmt;
 use std::fs;
 use std::path::Path;
 use std::str::FromStr;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::Arc;
+use std::time::Duration;
 
 use async_trait::async_trait;
+use futures::{stream, StreamExt};
+use indexmap::IndexSet;
 use serde_with::{DeserializeFromStr, SerializeDisplay};
+use tokio::runtime::Runtime;
+use tokio::sync::Notify;
 
 use crate::Error;
 
@@ -35,16 +42,130 @@ impl fmt::Display for Syncer {
     }
 }
 
+// top-level repo directories that aren't categories
+const NON_CATEGORY_DIRS: &[&str] = &["eclass", "licenses", "metadata", "profiles", "scripts"];
+
+/// Repo paths modified by a sync.
+#[derive(Debug, Default, Clone, PartialEq, Eq)]
+pub(crate) struct Changes {
+    /// package directories in `cat/pkg` form
+    pub(crate) pkgs: IndexSet<String>,
+    /// eclass names
+    pub(crate) eclasses: IndexSet<String>,
+    /// all other paths relative to the repo root
+    pub(crate) other: IndexSet<String>,
+}
+
+impl Changes {
+    /// Add a modified file path relative to the repo root.
+    pub(crate) fn insert(&mut self, path: &str) {
+        let parts: Vec<_> = path.split('/').collect();
+        match parts[..] {
+            ["eclass", file] if file.ends_with(".eclass") => {
+                let name = file.strip_suffix(".eclass").unwrap();
+                self.eclasses.insert(name.to_string());
+            }
+            [cat, pkg, _, ..] if !cat.starts_with('.') && !NON_CATEGORY_DIRS.contains(&cat) => {
+                self.pkgs.insert(format!("{cat}/{pkg}"));
+            }
+            _ => {
+                self.other.insert(path.to_string());
+            }
+        }
+    }
+
+    pub(crate) fn is_empty(&self) -> bool {
+        self.pkgs.is_empty() && self.eclasses.is_empty() && self.other.is_empty()
+    }
+}
+
+impl<S: AsRef<str>> FromIterator<S> for Changes {
+    fn from_iter<I: IntoIterator<Item = S>>(iter: I) -> Self {
+        let mut changes = Changes::default();
+        for path in iter {
+            changes.insert(path.as_ref());
+        }
+        changes
+    }
+}
+
+#[derive(Debug, Default)]
+struct CancelState {
+    cancelled: AtomicBool,
+    notify: Notify,
+}
+
+/// Cancellation signal for running syncs, observable from both async and blocking code.
+#[derive(Debug, Default, Clone)]
+pub(crate) struct Cancel(Arc<CancelState>);
+
+// only the syncers behind optional features check for cancellation
+#[cfg_attr(not(all(feature = "git", feature = "https")), allow(dead_code))]
+impl Cancel {
+    /// Signal all syncs using this to stop.
+    pub(crate) fn cancel(&self) {
+        self.0.cancelled.store(true, Ordering::Release);
+        self.0.notify.notify_waiters();
+    }
+
+    pub(crate) fn is_cancelled(&self) -> bool {
+        self.0.cancelled.load(Ordering::Acquire)
+    }
+
+    /// Wait until cancelled.
+    pub(crate) async fn cancelled(&self) {
+        // register for notification before checking the flag to avoid missing a cancel
+        let notified = self.0.notify.notified();
+        if !self.is_cancelled() {
+            notified.await;
+        }
+    }
+
+    /// Return the error for cancelled syncs.
+    pub(crate) fn error() -> Error {
+        Error::RepoSync("sync cancelled".to_string())
+    }
+
+    /// Return an error if cancelled.
+    pub(crate) fn check(&self) -> crate::Result<()> {
+        match self.is_cancelled() {
+            true => Err(Self::error()),
+            false => Ok(()),
+        }
+    }
+}
+
 #[async_trait]
 pub(self) trait Syncable {
     fn uri_to_syncer(uri: &str) -> crate::Result<Syncer>;
-    async fn sync<P: AsRef<Path> + Send>(&self, path: P) -> crate::Result<()>;
+    /// Sync a repo to the given path, returning the modified paths when they can be determined.
+    ///
+    /// Syncs stop as soon as possible once cancelled, without leaving background work running.
+    async fn sync<P: AsRef<Path> + Send>(
+        &self,
+        path: P,
+        cancel: &Cancel,
+    ) -> crate::Result<Option<Changes>>;
 }
 
 impl Syncer {
-    pub(crate) fn sync<P: AsRef<Path>>(&self, path: P) -> crate::Result<()> {
-        let path = path.as_ref();
+    /// Limit the fetched history to the given number of commits for syncers supporting it.
+    #[cfg_attr(not(feature = "git"), allow(unused_variables))]
+    pub(crate) fn depth(self, depth: Option<u32>) -> Self {
+        match self {
+            #[cfg(feature = "git")]
+            Syncer::Git(repo) => Syncer::Git(git::Repo { depth, ..repo }),
+            syncer => syncer,
+        }
+    }
+
+    /// Sync a repo, returning the modified paths when they can be determined, e.g. None is
+    /// returned for initial clones or full replacements.
+    pub(crate) fn sync<P: AsRef<Path>>(&self, path: P) -> crate::Result<Option<Changes>> {
+        runtime()?.block_on(self.sync_async(path.as_ref(), &Cancel::default()))
+    }
 
+    async fn sync_async(&self, path: &Path, cancel: &Cancel) -> crate::Result<Option<Changes>> {
         // make sure repos dir exists
         let repos_dir = path.parent().unwrap();
         if !repos_dir.exists() {
@@ -55,14 +176,72 @@ impl Syncer {
 
         match self {
             #[cfg(feature = "git")]
-            Syncer::Git(repo) => futures::executor::block_on(repo.sync(path)),
+            Syncer::Git(repo) => {
+                // git operations block so they're run on a dedicated thread
+                let (repo, path, cancel) = (repo.clone(), path.to_path_buf(), cancel.clone());
+                tokio::task::spawn_blocking(move || {
+                    futures::executor::block_on(repo.sync(path, &cancel))
+                })
+                .await
+                .map_err(|e| Error::RepoSync(format!("failed running git sync: {e}")))?
+            }
             #[cfg(feature = "https")]
-            Syncer::TarHttps(repo) => futures::executor::block_on(repo.sync(path)),
-            Syncer::Local(_) => Ok(()),
+            Syncer::TarHttps(repo) => repo.sync(path, cancel).await,
+            Syncer::Local(_) => Ok(Some(Changes::default())),
         }
     }
 }
 
+fn runtime() -> crate::Result<Runtime> {
+    tokio::runtime::Builder::new_multi_thread()
+        .enable_all()
+        .build()
+        .map_err(|e| Error::RepoSync(format!("failed creating async runtime: {e}")))
+}
+
+// Maximum time timed out syncs are given to stop after being cancelled.
+const CANCEL_TIMEOUT: Duration = Duration::from_secs(5);
+
+/// Sync repos concurrently on a shared runtime, running at most `jobs` syncs at once and failing
+/// those that don't finish within `timeout`.
+///
+/// Timed out syncs are cancelled and waited on for up to `timeout` again, capped at five
+/// seconds. Git syncs stop at their next transfer progress update. Syncs that don't stop in
+/// time, e.g. git stalled while connecting or negotiating, are detached and left to finish in
+/// the background.
+///
+/// Results are returned in the same order as the given repos.
+pub(crate) fn sync_all<'a, I>(
+    repos: I,
+    jobs: usize,
+    timeout: Duration,
+) -> crate::Result<Vec<crate::Result<Option<Changes>>>>
+where
+    I: IntoIterator<Item = (&'a Syncer, &'a Path)>,
+{
+    let rt = runtime()?;
+    let syncs = repos.into_iter().map(|(syncer, path)| async move {
+        let cancel = Cancel::default();
+        let sync = syncer.sync_async(path, &cancel);
+        tokio::pin!(sync);
+        match tokio::time::timeout(timeout, &mut sync).await {
+            Ok(result) => result,
+            Err(_) => {
+                cancel.cancel();
+                let msg = format!("syncing {path:?} after {timeout:?}");
+                match tokio::time::timeout(timeout.min(CANCEL_TIMEOUT), sync).await {
+                    Ok(_) => Err(Error::Timeout(msg)),
+                    Err(_) => Err(Error::Timeout(format!("{msg}, detached unresponsive sync"))),
+                }
+            }
+        }
+    });
+    let results = rt.block_on(stream::iter(syncs).buffered(jobs.max(1)).collect());
+    // dropping the runtime would otherwise block on detached syncs
+    rt.shutdown_background();
+    Ok(results)
+}
+
 impl FromStr for Syncer {
     type Err = Error;
 
@@ -90,3 +269,105 @@ impl FromStr for Syncer {
         }
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[cfg(all(feature = "git", feature = "https"))]
+    #[test]
+    fn sync_all() {
+        let dir = tempfile::tempdir().unwrap();
+
+        // git repo
+        let origin_path = dir.path().join("origin");
+        let origin = git2::Repository::init(&origin_path).unwrap();
+        git::tests::commit(&origin, &[("profiles/repo_name", Some("git\n"))]);
+        let git_repo = Syncer::Git(git::Repo {
+            uri: origin_path.to_str().unwrap().to_string(),
+            depth: None,
+        });
+
+        // tar+https repo
+        let server = tar::tests::Server::default();
+        let tar_repo = Syncer::TarHttps(tar::tests::repo(server.start()));
+        server.publish(&[("profiles/repo_name", "tar\n")], false);
+
+        // server that never responds
+        let listener = std::net::TcpListener::bind("127.0.0.1:0").unwrap();
+        let url = format!("http://{}/repo.tar.gz", listener.local_addr().unwrap());
+        let stalled_repo = Syncer::TarHttps(tar::tests::repo(url));
+
+        let repos_dir = dir.path().join("repos");
+        let paths: Vec<_> = ["git", "tar", "stalled"]
+            .iter()
+            .map(|s| repos_dir.join(s))
+            .collect();
+        let repos = [&git_repo, &tar_repo, &stalled_repo]
+            .into_iter()
+            .zip(paths.iter().map(|p| p.as_path()));
+        let results = super::sync_all(repos, 2, Duration::from_secs(1)).unwrap();
+
+        assert!(matches!(results[0], Ok(None)));
+        let data = fs::read_to_string(paths[0].join("profiles/repo_name")).unwrap();
+        assert_eq!(data, "git\n");
+        assert!(matches!(results[1], Ok(None)));
+        let data = fs::read_to_string(paths[1].join("profiles/repo_name")).unwrap();
+        assert_eq!(data, "tar\n");
+        assert!(matches!(results[2], Err(Error::Timeout(_))));
+        assert!(!paths[2].exists());
+    }
+
+    #[cfg(feature = "git")]
+    #[test]
+    fn sync_all_stalled_git() {
+        let dir = tempfile::tempdir().unwrap();
+
+        // server that accepts connections but never responds
+        let listener = std::net::TcpListener::bind("127.0.0.1:0").unwrap();
+        let uri = format!("git://{}/repo.git", listener.local_addr().unwrap());
+        let repo = Syncer::Git(git::Repo { uri, depth: None });
+
+        // the stalled sync can't notice cancellation so it's detached
+        let path = dir.path().join("repos/stalled");
+        let start = std::time::Instant::now();
+        let results = super::sync_all([(&repo, path.as_path())], 1, Duration::from_secs(1));
+        let results = results.unwrap();
+        assert!(start.elapsed() < Duration::from_secs(5));
+        let err = results[0].as_ref().unwrap_err().to_string();
+        assert!(err.contains("detached unresponsive sync"), "{err}");
+    }
+
+    #[test]
+    fn changes() {
+        let changes: Changes = [
+            "cat/pkg/pkg-1.ebuild",
+            "cat/pkg/files/a.patch",
+            "cat/pkg/Manifest",
+            "cat/metadata.xml",
+            "eclass/e1.eclass",
+            "eclass/tests/e1.sh",
+            "eclass/README",
+            "profiles/base/package.use",
+            "metadata/md5-cache/cat/pkg-1",
+            ".github/workflows/ci.yml",
+        ]
+        .into_iter()
+        .collect();
+        assert_eq!(changes.pkgs.iter().collect::<Vec<_>>(), ["cat/pkg"]);
+        assert_eq!(changes.eclasses.iter().collect::<Vec<_>>(), ["e1"]);
+        assert_eq!(
+            changes.other.iter().collect::<Vec<_>>(),
+            [
+                "cat/metadata.xml",
+                "eclass/tests/e1.sh",
+                "eclass/README",
+                "profiles/base/package.use",
+                "metadata/md5-cache/cat/pkg-1",
+                ".github/workflows/ci.yml",
+            ]
+        );
+        assert!(!changes.is_empty());
+        assert!(Changes::default().is_empty());
+    }
+}
@@ -6,7 +6,7 @@ use once_cell::sync::Lazy;
 use regex::Regex;
 use serde::{Deserialize, Serialize};
 
-use crate::sync::{Syncable, Syncer};
+use crate::sync::{Cancel, Changes, Syncable, Syncer};
 use crate::Error;
 
 static HANDLED_URI_RE: Lazy<Regex> = Lazy::new(|| Regex::new(r"^(https|git)://.+\.git$").unwrap());
@@ -14,6 +14,8 @@ static HANDLED_URI_RE: Lazy<Regex> = Lazy::new(|| Regex::new(r"^(https|git)://.+
 #[derive(Debug, Clone, PartialEq, Eq, Deserialize, Serialize)]
 pub(crate) struct Repo {
     pub(crate) uri: String,
+    // number of commits to fetch, fetching the full history if unset
+    pub(crate) depth: Option<u32>,
 }
 
 #[async_trait]
@@ -22,12 +24,17 @@ impl Syncable for Repo {
         match HANDLED_URI_RE.is_match(uri) {
             true => Ok(Syncer::Git(Repo {
                 uri: uri.to_string(),
+                depth: None,
             })),
             false => Err(Error::RepoInit(format!("invalid git repo: {uri:?}"))),
         }
     }
 
-    async fn sync<P: AsRef<Path> + Send>(&self, path: P) -> crate::Result<()> {
+    async fn sync<P: AsRef<Path> + Send>(
+        &self,
+        path: P,
+        cancel: &Cancel,
+    ) -> crate::Result<Option<Changes>> {
         let path = path.as_ref();
         if path.exists() {
             let repo = git2::Repository::open(&path).map_err(|e| {
@@ -39,27 +46,66 @@ impl Syncable for Repo {
             let branch = head
                 .shorthand()
                 .ok_or_else(|| Error::RepoSync("not on a git branch".to_string()))?;
+            let old_tree = head.peel_to_tree().map_err(|e| {
+                Error::RepoSync(format!("failed getting git HEAD tree: {}", e.message()))
+            })?;
             let mut remote = repo
                 .find_remote("origin")
                 .map_err(|e| Error::RepoSync(format!("invalid remote origin: {}", e.message())))?;
-            let fetch_commit = do_fetch(&repo, &[branch], &mut remote)
+            let fetch_commit = do_fetch(&repo, &[branch], &mut remote, self.depth, cancel)
                 .map_err(|e| Error::RepoSync(format!("failed fetching: {}", e.message())))?;
-            do_merge(&repo, branch, fetch_commit)
-                .map_err(|e| Error::RepoSync(format!("failed merging: {}", e.message())))?;
+            match self.depth {
+                // shallow histories lack merge bases so fetched commits are checked out directly
+                Some(_) => repo
+                    .find_reference(&format!("refs/heads/{branch}"))
+                    .and_then(|mut r| fast_forward(&repo, &mut r, &fetch_commit)),
+                None => do_merge(&repo, branch, fetch_commit),
+            }
+            .map_err(|e| Error::RepoSync(format!("failed merging: {}", e.message())))?;
+
+            let changes = repo
+                .head()
+                .and_then(|r| r.peel_to_tree())
+                .and_then(|new_tree| diff_trees(&repo, &old_tree, &new_tree))
+                .map_err(|e| Error::RepoSync(format!("failed diffing: {}", e.message())))?;
+            Ok(Some(changes))
         } else {
-            do_clone(&self.uri, path).map_err(|e| {
+            do_clone(&self.uri, path, self.depth, cancel).map_err(|e| {
                 Error::RepoSync(format!("failed cloning git repo: {}", e.message()))
             })?;
+            Ok(None)
         }
-        Ok(())
     }
 }
 
-fn do_clone<P: AsRef<Path>>(url: &str, path: P) -> Result<git2::Repository, git2::Error> {
+/// Determine the paths modified between two trees.
+fn diff_trees(
+    repo: &git2::Repository,
+    old: &git2::Tree,
+    new: &git2::Tree,
+) -> Result<Changes, git2::Error> {
+    let diff = repo.diff_tree_to_tree(Some(old), Some(new), None)?;
+    let mut changes = Changes::default();
+    for delta in diff.deltas() {
+        for file in [delta.old_file(), delta.new_file()] {
+            if let Some(path) = file.path().and_then(|p| p.to_str()) {
+                changes.insert(path);
+            }
+        }
+    }
+    Ok(changes)
+}
+
+fn do_clone<P: AsRef<Path>>(
+    url: &str,
+    path: P,
+    depth: Option<u32>,
+    cancel: &Cancel,
+) -> Result<git2::Repository, git2::Error> {
     let path = path.as_ref();
     let mut cb = git2::RemoteCallbacks::new();
 
-    // show transfer progress
+    // show transfer progress, returning false aborts the transfer when cancelled
     cb.transfer_progress(|stats| {
         if stats.received_objects() == stats.total_objects() {
             print!("Resolving deltas {}/{}\r", stats.indexed_deltas(), stats.total_deltas());
@@ -73,11 +119,15 @@ fn do_clone<P: AsRef<Path>>(url: &str, path: P) -> Result<git2::Repository, git2
             );
         }
         io::stdout().flush().unwrap();
-        true
+        !cancel.is_cancelled()
     });
+    cb.sideband_progress(|_| !cancel.is_cancelled());
 
     let mut fo = git2::FetchOptions::new();
     fo.remote_callbacks(cb);
+    if let Some(depth) = depth {
+        fo.depth(depth as i32);
+    }
 
     let mut builder = git2::build::RepoBuilder::new();
     builder.fetch_options(fo);
@@ -90,10 +140,12 @@ fn do_fetch<'a>(
     repo: &'a git2::Repository,
     refs: &[&str],
     remote: &'a mut git2::Remote,
+    depth: Option<u32>,
+    cancel: &Cancel,
 ) -> Result<git2::AnnotatedCommit<'a>, git2::Error> {
     let mut cb = git2::RemoteCallbacks::new();
 
-    // show transfer progress
+    // show transfer progress, returning false aborts the transfer when cancelled
     cb.transfer_progress(|stats| {
         if stats.received_objects() == stats.total_objects() {
             print!("Resolving deltas {}/{}\r", stats.indexed_deltas(), stats.total_deltas());
@@ -107,14 +159,24 @@ fn do_fetch<'a>(
             );
         }
         io::stdout().flush().unwrap();
-        true
+        !cancel.is_cancelled()
     });
+    cb.sideband_progress(|_| !cancel.is_cancelled());
 
     let mut fo = git2::FetchOptions::new();
     fo.remote_callbacks(cb);
-    // Always fetch all tags.
-    // Perform a download and also update tips
-    fo.download_tags(git2::AutotagOption::All);
+    match depth {
+        // skip tags for shallow fetches since they pull in additional history
+        Some(depth) => {
+            fo.depth(depth as i32);
+            fo.download_tags(git2::AutotagOption::None);
+        }
+        // Always fetch all tags.
+        // Perform a download and also update tips
+        None => {
+            fo.download_tags(git2::AutotagOption::All);
+        }
+    }
     println!("Fetching {} for repo", remote.name().unwrap());
     remote.fetch(refs, Some(&mut fo), None)?;
 
@@ -248,3 +310,154 @@ fn do_merge<'a>(
     }
     Ok(())
 }
+
+#[cfg(test)]
+pub(super) mod tests {
+    use std::fs;
+
+    use super::*;
+
+    // Commit file changes to a repo, removing files without content.
+    pub(crate) fn commit(repo: &git2::Repository, files: &[(&str, Option<&str>)]) {
+        let workdir = repo.workdir().unwrap();
+        let mut index = repo.index().unwrap();
+        for (path, data) in files {
+            let file_path = workdir.join(path);
+            match data {
+                Some(data) => {
+                    fs::create_dir_all(file_path.parent().unwrap()).unwrap();
+                    fs::write(&file_path, data).unwrap();
+                    index.add_path(Path::new(path)).unwrap();
+                }
+                None => {
+                    fs::remove_file(&file_path).unwrap();
+                    index.remove_path(Path::new(path)).unwrap();
+                }
+            }
+        }
+        index.write().unwrap();
+        let tree = repo.find_tree(index.write_tree().unwrap()).unwrap();
+        let sig = git2::Signature::now("test", "test@test.com").unwrap();
+        let parent = repo.head().ok().map(|r| r.peel_to_commit().unwrap());
+        let parents: Vec<_> = parent.iter().collect();
+        repo.commit(Some("HEAD"), &sig, &sig, "update", &tree, &parents)
+            .unwrap();
+    }
+
+    #[test]
+    fn sync() {
+        let dir = tempfile::tempdir().unwrap();
+        let origin_path = dir.path().join("origin");
+        let origin = git2::Repository::init(&origin_path).unwrap();
+        commit(
+            &origin,
+            &[
+                ("profiles/repo_name", Some("test\n")),
+                ("cat/a/a-1.ebuild", Some("SLOT=0\n")),
+                ("cat/b/b-1.ebuild", Some("SLOT=0\n")),
+                ("eclass/e1.eclass", Some("# e1\n")),
+            ],
+        );
+        let syncer = Syncer::Git(Repo {
+            uri: origin_path.to_str().unwrap().to_string(),
+            depth: None,
+        });
+        let path = dir.path().join("repos/test");
+
+        // initial clones don't track changes
+        assert!(syncer.sync(&path).unwrap().is_none());
+        assert!(path.join("cat/a/a-1.ebuild").exists());
+
+        // nothing changed
+        assert!(syncer.sync(&path).unwrap().unwrap().is_empty());
+
+        // update, add, and remove files
+        commit(
+            &origin,
+            &[
+                ("cat/a/a-1.ebuild", Some("SLOT=1\n")),
+                ("cat/b/b-1.ebuild", None),
+                ("cat/c/c-1.ebuild", Some("SLOT=0\n")),
+                ("eclass/e1.eclass", Some("# updated\n")),
+                ("profiles/categories", Some("cat\n")),
+            ],
+        );
+        let changes = syncer.sync(&path).unwrap().unwrap();
+        assert_eq!(changes.pkgs.iter().collect::<Vec<_>>(), ["cat/a", "cat/b", "cat/c"]);
+        assert_eq!(changes.eclasses.iter().collect::<Vec<_>>(), ["e1"]);
+        assert_eq!(changes.other.iter().collect::<Vec<_>>(), ["profiles/categories"]);
+        assert_eq!(fs::read_to_string(path.join("cat/a/a-1.ebuild")).unwrap(), "SLOT=1\n");
+        assert!(!path.join("cat/b/b-1.ebuild").exists());
+    }
+    // Git daemon serving the repos under a directory, libgit2 doesn't support shallow fetches
+    // from local paths.
+    struct Daemon {
+        child: std::process::Child,
+        port: u16,
+    }
+
+    impl Daemon {
+        fn new(base: &Path) -> Self {
+            let port = std::net::TcpListener::bind("127.0.0.1:0")
+                .and_then(|l| l.local_addr())
+                .unwrap()
+                .port();
+            let child = std::process::Command::new("git")
+                .arg("daemon")
+                .args(["--reuseaddr", "--export-all", "--listen=127.0.0.1"])
+                .arg(format!("--port={port}"))
+                .arg(format!("--base-path={}", base.display()))
+                .arg(base)
+                .spawn()
+                .unwrap();
+            let daemon = Daemon { child, port };
+
+            // wait for the daemon to start listening
+            for _ in 0..100 {
+                if std::net::TcpStream::connect(("127.0.0.1", port)).is_ok() {
+                    return daemon;
+                }
+                std::thread::sleep(std::time::Duration::from_millis(50));
+            }
+            panic!("git daemon failed to start");
+        }
+    }
+
+    impl Drop for Daemon {
+        fn drop(&mut self) {
+            self.child.kill().ok();
+            self.child.wait().ok();
+        }
+    }
+
+    #[test]
+    fn shallow_sync() {
+        let dir = tempfile::tempdir().unwrap();
+        let origin = git2::Repository::init(dir.path().join("origin")).unwrap();
+        for data in ["SLOT=0\n", "SLOT=1\n", "SLOT=2\n"] {
+            commit(&origin, &[("cat/a/a-1.ebuild", Some(data))]);
+        }
+        let daemon = Daemon::new(dir.path());
+        let syncer = Syncer::Git(Repo {
+            uri: format!("git://127.0.0.1:{}/origin", daemon.port),
+            depth: Some(1),
+        });
+        let path = dir.path().join("repos/test");
+
+        // only the latest commit is cloned
+        assert!(syncer.sync(&path).unwrap().is_none());
+        let repo = git2::Repository::open(&path).unwrap();
+        assert!(repo.is_shallow());
+        let mut walk = repo.revwalk().unwrap();
+        walk.push_head().unwrap();
+        assert_eq!(walk.count(), 1);
+        assert_eq!(fs::read_to_string(path.join("cat/a/a-1.ebuild")).unwrap(), "SLOT=2\n");
+
+        // updates are fetched shallowly and checked out
+        commit(&origin, &[("cat/b/b-1.ebuild", Some("SLOT=0\n"))]);
+        let changes = syncer.sync(&path).unwrap().unwrap();
+        assert_eq!(changes.pkgs.iter().collect::<Vec<_>>(), ["cat/b"]);
+        assert!(path.join("cat/b/b-1.ebuild").exists());
+        assert!(git2::Repository::open(&path).unwrap().is_shallow());
+    }
+}
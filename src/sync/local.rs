@@ -3,7 +3,7 @@ use std::path::{Path, PathBuf};
 use async_trait::async_trait;
 use serde::{Deserialize, Serialize};
 
-use crate::sync::{Syncable, Syncer};
+use crate::sync::{Cancel, Changes, Syncable, Syncer};
 use crate::Error;
 
 #[derive(Debug, Clone, PartialEq, Eq, Deserialize, Serialize)]
@@ -23,7 +23,11 @@ impl Syncable for Repo {
         }
     }
 
-    async fn sync<P: AsRef<Path> + Send>(&self, _path: P) -> crate::Result<()> {
-        Ok(())
+    async fn sync<P: AsRef<Path> + Send>(
+        &self,
+        _path: P,
+        _cancel: &Cancel,
+    ) -> crate::Result<Option<Changes>> {
+        Ok(Some(Changes::default()))
     }
 }
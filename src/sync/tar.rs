@@ -1,25 +1,273 @@
-use std::fs;
-use std::io::Write;
-use std::path::{Path, PathBuf};
-use std::process::{Command, Stdio};
+use std::ffi::OsStr;
+use std::fs::{self, File};
+use std::io::{self, Read};
+use std::os::unix::ffi::OsStrExt;
+use std::os::unix::fs::PermissionsExt;
+use std::os::unix::io::AsRawFd;
+use std::path::{Component, Path, PathBuf};
 use std::time::Duration;
 
 use async_trait::async_trait;
+use crossbeam_channel::{bounded, Sender};
 use flate2::read::GzDecoder;
 use futures::StreamExt;
+use nix::sys::stat::futimens;
+use nix::sys::time::{TimeSpec, TimeValLike};
 use once_cell::sync::Lazy;
 use regex::Regex;
-use reqwest::header::{HeaderMap, HeaderValue, ETAG};
+use reqwest::header::{HeaderMap, HeaderValue, ETAG, IF_NONE_MATCH};
+use reqwest::StatusCode;
 use serde::{Deserialize, Serialize};
-use tar::Archive;
+use tar::{Archive, Entry};
 use tempfile::Builder;
+use tokio::sync::mpsc;
+use tokio::task::JoinHandle;
+use tracing::warn;
 
-use crate::sync::{Syncable, Syncer};
+use crate::sync::{Cancel, Changes, Syncable, Syncer};
 use crate::Error;
 
+mod manifest;
+use manifest::{digest, DigestWriter, Manifest, Record};
+
 static HANDLED_URI_RE: Lazy<Regex> =
     Lazy::new(|| Regex::new(r"^tar\+(?P<url>https://.+)$").unwrap());
 
+// number of chunks buffered between pipeline stages
+const QUEUE_SIZE: usize = 32;
+// size of decompressed chunks passed to the extractor
+const CHUNK_SIZE: usize = 128 * 1024;
+// number of concurrent file downloads for incremental updates
+const FETCH_JOBS: usize = 16;
+// manifest of the currently synced files and its ETag
+const MANIFEST: &str = ".manifest";
+const MANIFEST_ETAG: &str = ".manifest.etag";
+
+/// Reader over a sequence of data chunks pulled from a channel.
+struct ChunkReader<T, F> {
+    recv: F,
+    chunk: Option<T>,
+    pos: usize,
+}
+
+impl<T, F> ChunkReader<T, F>
+where
+    T: AsRef<[u8]>,
+    F: FnMut() -> Option<T>,
+{
+    fn new(recv: F) -> Self {
+        Self {
+            recv,
+            chunk: None,
+            pos: 0,
+        }
+    }
+}
+
+impl<T, F> Read for ChunkReader<T, F>
+where
+    T: AsRef<[u8]>,
+    F: FnMut() -> Option<T>,
+{
+    fn read(&mut self, buf: &mut [u8]) -> io::Result<usize> {
+        loop {
+            if let Some(chunk) = &self.chunk {
+                let data = &chunk.as_ref()[self.pos..];
+                if !data.is_empty() {
+                    let len = data.len().min(buf.len());
+                    buf[..len].copy_from_slice(&data[..len]);
+                    self.pos += len;
+                    return Ok(len);
+                }
+            }
+
+            // pull the next chunk, a closed channel signals the end of the stream
+            match (self.recv)() {
+                Some(chunk) => {
+                    self.chunk = Some(chunk);
+                    self.pos = 0;
+                }
+                None => return Ok(0),
+            }
+        }
+    }
+}
+
+/// Decompress gzipped data from a reader, passing the output along in chunks.
+fn decompress<R: Read>(reader: R, tx: Sender<Vec<u8>>) -> crate::Result<()> {
+    let mut decoder = GzDecoder::new(reader);
+    loop {
+        let mut chunk = vec![0; CHUNK_SIZE];
+        let len = decoder
+            .read(&mut chunk)
+            .map_err(|e| Error::RepoSync(format!("failed decompressing archive: {e}")))?;
+        if len == 0 {
+            return Ok(());
+        }
+        chunk.truncate(len);
+        // the extractor hung up so its error takes precedence
+        if tx.send(chunk).is_err() {
+            return Ok(());
+        }
+    }
+}
+
+/// Unpack a regular file entry, returning the digest of its data computed while writing it.
+fn unpack_file<R: Read>(entry: &mut Entry<R>, dest: &Path) -> io::Result<String> {
+    let header = entry.header();
+    let (mode, mtime) = (header.mode()? & 0o777, header.mtime()?);
+
+    // replace existing paths instead of writing through symlinks
+    match fs::remove_file(dest) {
+        Err(e) if e.kind() != io::ErrorKind::NotFound => return Err(e),
+        _ => (),
+    }
+    let mut writer = DigestWriter::new(File::create(dest)?);
+    io::copy(entry, &mut writer)?;
+    let (file, digest) = writer.finish();
+
+    file.set_permissions(fs::Permissions::from_mode(mode))?;
+    let mtime = TimeSpec::seconds(mtime as i64);
+    futimens(file.as_raw_fd(), &mtime, &mtime)?;
+    Ok(digest)
+}
+
+/// Verify that no existing ancestor of a path below a root directory is a symlink, so writing
+/// to the path can't be redirected outside the root.
+fn verify_parents(root: &Path, path: &Path) -> io::Result<()> {
+    let rel_path = path.strip_prefix(root).map_err(|_| {
+        io::Error::new(io::ErrorKind::InvalidInput, format!("path outside root: {path:?}"))
+    })?;
+    let mut parent = root.to_path_buf();
+    for component in rel_path.parent().into_iter().flat_map(|p| p.components()) {
+        parent.push(component);
+        match fs::symlink_metadata(&parent) {
+            Ok(meta) if meta.file_type().is_symlink() => {
+                let msg = format!("symlinked parent dir: {parent:?}");
+                return Err(io::Error::new(io::ErrorKind::InvalidInput, msg));
+            }
+            Ok(_) => (),
+            // the remaining parents are created as regular dirs
+            Err(e) if e.kind() == io::ErrorKind::NotFound => break,
+            Err(e) => return Err(e),
+        }
+    }
+    Ok(())
+}
+
+/// Unpack a tar archive from a reader, dropping the first directory component of all paths.
+///
+/// Returns the manifest for all unpacked regular files and symlinks.
+fn extract<R: Read>(reader: R, dir: &Path, cancel: &Cancel) -> crate::Result<Manifest> {
+    let mut manifest = Manifest::default();
+    let mut archive = Archive::new(reader);
+    let entries = archive
+        .entries()
+        .map_err(|e| Error::RepoSync(format!("failed unpacking archive: {e}")))?;
+
+    for entry in entries {
+        cancel.check()?;
+        let mut entry =
+            entry.map_err(|e| Error::RepoSync(format!("failed unpacking archive: {e}")))?;
+        let path = entry
+            .path()
+            .map_err(|e| Error::RepoSync(format!("failed unpacking archive: {e}")))?
+            .into_owned();
+
+        // skip the top-level directory and paths that would escape the target directory
+        let stripped_path: PathBuf = path.components().skip(1).collect();
+        if stripped_path.as_os_str().is_empty()
+            || stripped_path
+                .components()
+                .any(|c| !matches!(c, Component::Normal(_)))
+        {
+            continue;
+        }
+
+        // hard link targets aren't resolved relative to the target directory
+        let entry_type = entry.header().entry_type();
+        if entry_type.is_hard_link() {
+            warn!("skipping unsupported hard link: {path:?}");
+            continue;
+        }
+
+        // earlier symlink entries can't redirect later entries outside the target directory
+        let dest = dir.join(&stripped_path);
+        let err = |e| Error::RepoSync(format!("failed unpacking {path:?}: {e}"));
+        verify_parents(dir, &dest).map_err(err)?;
+        if let Some(parent) = dest.parent() {
+            fs::create_dir_all(parent).map_err(err)?;
+        }
+
+        // regular files are hashed as they're written to avoid reading them back
+        let record = if entry_type.is_file() {
+            let perms = entry.header().mode().map_err(err)?;
+            let digest = unpack_file(&mut entry, &dest).map_err(err)?;
+            Some(Record::file(digest, perms))
+        } else {
+            let target = match entry_type.is_symlink() {
+                true => entry.link_name_bytes().map(|s| s.into_owned()),
+                false => None,
+            };
+            entry.unpack(&dest).map_err(err)?;
+            target.map(|s| Record::symlink(&s))
+        };
+
+        if let (Some(record), Some(rel_path)) = (record, stripped_path.to_str()) {
+            manifest.insert(rel_path, record);
+        }
+    }
+
+    Ok(manifest)
+}
+
+/// Wait for a blocking pipeline task, converting panics into errors.
+async fn join<T>(handle: JoinHandle<crate::Result<T>>) -> crate::Result<T> {
+    handle
+        .await
+        .unwrap_or_else(|_| Err(Error::RepoSync("archive unpacking task failed".to_string())))
+}
+
+/// Stage fetched data as a regular file or symlink with the mode from its manifest record.
+fn stage(path: &Path, data: &[u8], record: &Record) -> io::Result<()> {
+    if record.is_symlink() {
+        std::os::unix::fs::symlink(OsStr::from_bytes(data), path)
+    } else {
+        fs::write(path, data)?;
+        fs::set_permissions(path, fs::Permissions::from_mode(record.perms()))
+    }
+}
+
+/// Create request headers for a conditional request using a cached ETag.
+fn etag_headers(path: &Path) -> HeaderMap {
+    let mut headers = HeaderMap::new();
+    if let Ok(previous_etag) = fs::read_to_string(path) {
+        if let Ok(value) = HeaderValue::from_str(&previous_etag) {
+            headers.insert(IF_NONE_MATCH, value);
+        }
+    }
+    headers
+}
+
+/// Cache the ETag from response headers if it exists.
+fn write_etag(path: &Path, headers: &HeaderMap) -> crate::Result<()> {
+    // TODO: store this in cache instead of repo file
+    if let Some(etag) = headers.get(ETAG) {
+        fs::write(path, etag.as_bytes())
+            .map_err(|e| Error::RepoSync(format!("failed writing etag {path:?}: {e}")))?;
+    }
+    Ok(())
+}
+
+/// Remove empty parent directories of a path up to the given root.
+fn prune_dirs(root: &Path, path: &Path) {
+    for dir in path.ancestors().skip(1) {
+        if dir == root || fs::remove_dir(dir).is_err() {
+            break;
+        }
+    }
+}
+
 #[derive(Debug, Clone, PartialEq, Eq, Deserialize, Serialize)]
 pub(crate) struct Repo {
     pub(crate) uri: String,
@@ -38,55 +286,203 @@ impl Syncable for Repo {
         }
     }
 
-    async fn sync<P: AsRef<Path> + Send>(&self, path: P) -> crate::Result<()> {
+    async fn sync<P: AsRef<Path> + Send>(
+        &self,
+        path: P,
+        cancel: &Cancel,
+    ) -> crate::Result<Option<Changes>> {
         let path = path.as_ref();
+
+        // update incrementally if a manifest from a previous sync exists
+        if let Some(manifest) = Manifest::load(&path.join(MANIFEST)) {
+            // incremental updates don't spawn any tasks so they're stopped by dropping them
+            let result = tokio::select! {
+                result = self.sync_incremental(path, manifest) => result,
+                _ = cancel.cancelled() => return Err(Cancel::error()),
+            };
+            match result {
+                Ok(Some(changes)) => return Ok(Some(changes)),
+                Ok(None) => (),
+                Err(e) => {
+                    warn!("{}: incremental sync failed, falling back to full sync: {e}", self.uri)
+                }
+            }
+        }
+
+        self.sync_full(path, cancel).await
+    }
+}
+
+impl Repo {
+    /// Update a repo from the file manifest published alongside the tarball at `{url}.manifest`,
+    /// fetching only new or modified files from the unpacked snapshot at `{url}.files/`.
+    ///
+    /// Symlinks are published as files containing their targets. Unchanged files are left
+    /// untouched and all fetched files are verified and staged with their modes before any are
+    /// moved into place. Returns None when incremental updates aren't possible or worthwhile.
+    async fn sync_incremental(
+        &self,
+        path: &Path,
+        local: Manifest,
+    ) -> crate::Result<Option<Changes>> {
         let repos_dir = path.parent().unwrap();
         let repo_name = path.file_name().unwrap().to_str().unwrap();
+        let client = reqwest::Client::new();
+        let etag_path = path.join(MANIFEST_ETAG);
 
-        // use cached ETag to check if update exists
-        let etag_path = path.join(".etag");
-        let mut req_headers = HeaderMap::new();
-        if let Ok(previous_etag) = fs::read_to_string(&etag_path) {
-            if let Ok(value) = HeaderValue::from_str(&previous_etag) {
-                req_headers.insert("If-None-Match", value);
+        let resp = client
+            .get(format!("{}.manifest", self.url))
+            .headers(etag_headers(&etag_path))
+            .timeout(Duration::from_secs(5))
+            .send()
+            .await
+            .map_err(|e| Error::RepoSync(e.to_string()))?;
+
+        // manifests aren't published for the repo
+        if resp.status() == StatusCode::NOT_FOUND {
+            return Ok(None);
+        }
+        let resp = resp
+            .error_for_status()
+            .map_err(|e| Error::RepoSync(e.to_string()))?;
+
+        // content is unchanged
+        if resp.status() == StatusCode::NOT_MODIFIED {
+            return Ok(Some(Changes::default()));
+        }
+
+        let resp_headers = resp.headers().clone();
+        let data = resp
+            .text()
+            .await
+            .map_err(|e| Error::RepoSync(format!("failed downloading manifest: {e}")))?;
+        let remote = Manifest::parse(&data)?;
+        let changes = local.changes(&remote);
+
+        // fetching most of the repo file by file is slower than a full sync
+        if changes.updated.len() > remote.len() / 2 {
+            return Ok(None);
+        }
+
+        // download and verify modified files into a staging directory
+        let staging = Builder::new()
+            .suffix(&format!(".{repo_name}.staging"))
+            .tempdir_in(&repos_dir)
+            .map_err(|e| Error::RepoSync(e.to_string()))?;
+        let base_url = reqwest::Url::parse(&format!("{}.files/", self.url))
+            .map_err(|e| Error::RepoSync(format!("invalid url: {e}")))?;
+        let fetches = changes.updated.iter().enumerate().map(|(i, rel_path)| {
+            let mut url = base_url.clone();
+            url.path_segments_mut()
+                .unwrap()
+                .pop_if_empty()
+                .extend(rel_path.split('/'));
+            let staged_path = staging.path().join(i.to_string());
+            let record = remote.get(rel_path).unwrap();
+            let client = &client;
+            async move {
+                let err = |e| Error::RepoSync(format!("failed downloading {rel_path:?}: {e}"));
+                let data = client
+                    .get(url)
+                    .timeout(Duration::from_secs(30))
+                    .send()
+                    .await
+                    .and_then(|r| r.error_for_status())
+                    .map_err(err)?
+                    .bytes()
+                    .await
+                    .map_err(err)?;
+                if digest(&data) != record.digest {
+                    return Err(Error::RepoSync(format!("digest mismatch: {rel_path:?}")));
+                }
+                stage(&staged_path, &data, record)
+                    .map_err(|e| Error::RepoSync(format!("failed staging {rel_path:?}: {e}")))?;
+                Ok((*rel_path, staged_path))
+            }
+        });
+        let staged: Vec<_> = futures::stream::iter(fetches)
+            .buffer_unordered(FETCH_JOBS)
+            .collect::<Vec<_>>()
+            .await
+            .into_iter()
+            .collect::<crate::Result<_>>()?;
+
+        let modified: Changes = changes.updated.iter().chain(&changes.removed).collect();
+
+        // symlinked parent dirs could otherwise redirect updates and removals outside the repo
+        for rel_path in changes.updated.iter().chain(&changes.removed) {
+            let dest = path.join(rel_path);
+            verify_parents(path, &dest)
+                .map_err(|e| Error::RepoSync(format!("failed updating {dest:?}: {e}")))?;
+        }
+
+        // Drop the manifest while files are replaced so interrupted or failed updates fall back
+        // to a full sync, the old manifest could otherwise hide files reverted remotely.
+        let manifest_path = path.join(MANIFEST);
+        match fs::remove_file(&manifest_path) {
+            Err(e) if e.kind() != io::ErrorKind::NotFound => {
+                return Err(Error::RepoSync(format!("failed removing {manifest_path:?}: {e}")));
+            }
+            _ => (),
+        }
+
+        // atomically replace files with their verified versions
+        for (rel_path, staged_path) in staged {
+            let dest = path.join(rel_path);
+            fs::create_dir_all(dest.parent().unwrap())
+                .and_then(|_| fs::rename(&staged_path, &dest))
+                .map_err(|e| Error::RepoSync(format!("failed updating {dest:?}: {e}")))?;
+        }
+
+        for rel_path in changes.removed {
+            let dest = path.join(rel_path);
+            match fs::remove_file(&dest) {
+                Err(e) if e.kind() != io::ErrorKind::NotFound => {
+                    return Err(Error::RepoSync(format!("failed removing {dest:?}: {e}")));
+                }
+                _ => prune_dirs(path, &dest),
             }
         }
 
-        let resp = reqwest::Client::new()
+        // the manifest is written last once the tree matches it
+        remote.write(&manifest_path)?;
+        write_etag(&etag_path, &resp_headers)?;
+        Ok(Some(modified))
+    }
+
+    /// Replace a repo with the unpacked contents of its tarball.
+    ///
+    /// Cancellation stops the download and unpacking, waiting for the blocking unpacking tasks
+    /// to exit.
+    async fn sync_full(&self, path: &Path, cancel: &Cancel) -> crate::Result<Option<Changes>> {
+        let repos_dir = path.parent().unwrap();
+        let repo_name = path.file_name().unwrap().to_str().unwrap();
+
+        // use cached ETag to check if update exists
+        let etag_path = path.join(".etag");
+        let request = reqwest::Client::new()
             .get(&self.url)
-            .headers(req_headers)
+            .headers(etag_headers(&etag_path))
             .timeout(Duration::from_secs(5))
-            .send()
-            .await
+            .send();
+        let resp = tokio::select! {
+            resp = request => resp,
+            _ = cancel.cancelled() => return Err(Cancel::error()),
+        };
+        let resp = resp
             .map_err(|e| Error::RepoSync(e.to_string()))?
             .error_for_status()
             .map_err(|e| Error::RepoSync(e.to_string()))?;
 
         // content is unchanged
-        if resp.status().as_u16() == 304 {
-            return Ok(());
+        if resp.status() == StatusCode::NOT_MODIFIED {
+            return Ok(Some(Changes::default()));
         }
 
         // Clone headers used to later extract ETAG data since streaming the response body consumes
         // the response object.
         let resp_headers = &resp.headers().clone();
 
-        // create tempfile
-        let mut temp_file = Builder::new()
-            .suffix(&format!(".{repo_name}.tar.gz"))
-            .tempfile_in(&repos_dir)
-            .map_err(|e| Error::RepoSync(e.to_string()))?;
-
-        // download tarball to tempfile
-        let mut stream = resp.bytes_stream();
-        while let Some(item) = stream.next().await {
-            let chunk =
-                item.map_err(|e| Error::RepoSync(format!("failed downloading repo: {e}")))?;
-            temp_file
-                .write(&chunk)
-                .map_err(|e| Error::RepoSync(format!("failed writing repo: {e}")))?;
-        }
-
         // unpack repo data to tempdir
         let tmp_dir = Builder::new()
             .suffix(&format!(".{repo_name}.update"))
@@ -97,48 +493,52 @@ impl Syncable for Repo {
             .tempdir_in(&repos_dir)
             .map_err(|e| Error::RepoSync(e.to_string()))?;
 
-        // try unpacking via tar first since it's a lot faster for large repos
-        let tar_unpack = Command::new("tar")
-            .args(&[
-                "--extract",
-                "--gzip",
-                "-f",
-                temp_file.path().to_str().unwrap(),
-                "--strip-components=1",
-                "--no-same-owner",
-                "-C",
-                tmp_dir.path().to_str().unwrap(),
-            ])
-            .stderr(Stdio::null())
-            .status();
-
-        // fallback to built-in support on tar failure
-        if tar_unpack.is_err() || !tar_unpack.unwrap().success() {
-            let tar_file =
-                fs::File::open(temp_file.path()).map_err(|e| Error::RepoSync(e.to_string()))?;
-            // TODO: run decompression in a separate thread
-            let mut archive = Archive::new(GzDecoder::new(tar_file));
-            archive
-                .entries()
-                .map_err(|e| Error::RepoSync(e.to_string()))?
-                .filter_map(|e| e.ok())
-                .map(|mut entry| -> crate::Result<PathBuf> {
-                    // drop first directory component in archive paths
-                    let stripped_path: PathBuf = entry
-                        .path()
-                        .map_err(|e| Error::RepoSync(format!("failed unpacking archive: {e}")))
-                        .iter()
-                        .skip(1)
-                        .collect();
-                    entry
-                        .unpack(&tmp_dir.path().join(&stripped_path))
-                        .map_err(|e| Error::RepoSync(format!("failed unpacking archive: {e}")))?;
-                    Ok(stripped_path)
-                })
-                .filter_map(|e| e.ok())
-                .for_each(drop);
+        // Pipeline the download, decompression, and extraction stages using bounded channels so
+        // all three overlap without buffering the tarball.
+        let (download_tx, mut download_rx) = mpsc::channel(QUEUE_SIZE);
+        let (decompress_tx, decompress_rx) = bounded(QUEUE_SIZE);
+        let decompressor = tokio::task::spawn_blocking(move || {
+            decompress(ChunkReader::new(|| download_rx.blocking_recv()), decompress_tx)
+        });
+        let (dir, extract_cancel) = (tmp_dir.path().to_path_buf(), cancel.clone());
+        let extractor = tokio::task::spawn_blocking(move || {
+            extract(ChunkReader::new(|| decompress_rx.recv().ok()), &dir, &extract_cancel)
+        });
+
+        let mut stream = resp.bytes_stream();
+        let mut download = Ok(());
+        loop {
+            let item = tokio::select! {
+                item = stream.next() => item,
+                _ = cancel.cancelled() => {
+                    download = Err(Cancel::error());
+                    break;
+                }
+            };
+            match item {
+                None => break,
+                // stop downloading if the pipeline hung up due to an unpacking failure
+                Some(Ok(chunk)) => {
+                    if download_tx.send(chunk).await.is_err() {
+                        break;
+                    }
+                }
+                Some(Err(e)) => {
+                    download = Err(Error::RepoSync(format!("failed downloading repo: {e}")));
+                    break;
+                }
+            }
         }
 
+        // signal the end of the stream and wait for unpacking to finish
+        drop(download_tx);
+        let decompressed = join(decompressor).await;
+        let extracted = join(extractor).await;
+        let manifest = download.and(decompressed).and(extracted)?;
+
+        // record the unpacked files to enable incremental updates
+        manifest.write(&tmp_dir.path().join(MANIFEST))?;
+
         // move old repo out of the way if it exists and replace with unpacked repo
         if path.exists() {
             fs::rename(&path, &tmp_dir_old).map_err(|e| {
@@ -149,13 +549,416 @@ impl Syncable for Repo {
             Error::RepoSync(format!("failed moving repo {tmp_dir:?} -> {path:?}: {e}"))
         })?;
 
-        // TODO: store this in cache instead of repo file
         // update cached ETag value
-        if let Some(etag) = resp_headers.get(ETAG) {
-            fs::write(&etag_path, etag.as_bytes())
-                .map_err(|e| Error::RepoSync(format!("failed writing etag {etag_path:?}: {e}")))?;
+        write_etag(&etag_path, resp_headers)?;
+        Ok(None)
+    }
+}
+
+#[cfg(test)]
+pub(super) mod tests {
+    use std::collections::HashMap;
+    use std::io::{BufRead, BufReader, Write};
+    use std::net::TcpListener;
+    use std::os::unix::fs::MetadataExt;
+    use std::sync::{Arc, Mutex};
+    use std::thread;
+
+    use flate2::write::GzEncoder;
+    use flate2::Compression;
+
+    use super::*;
+
+    // Create a gzipped tarball with all paths under a top-level directory.
+    fn tarball(files: &[(&str, &str)]) -> Vec<u8> {
+        let encoder = GzEncoder::new(vec![], Compression::default());
+        let mut builder = tar::Builder::new(encoder);
+        for (path, data) in files {
+            let mut header = tar::Header::new_gnu();
+            header.set_size(data.len() as u64);
+            header.set_mode(0o644);
+            header.set_cksum();
+            builder
+                .append_data(&mut header, format!("repo-snapshot/{path}"), data.as_bytes())
+                .unwrap();
+        }
+        builder.into_inner().unwrap().finish().unwrap()
+    }
+
+    // Create a manifest for the given files.
+    fn manifest(files: &[(&str, &str)]) -> Vec<u8> {
+        files
+            .iter()
+            .map(|(path, data)| format!("{}  {path}\n", digest(data.as_bytes())))
+            .collect::<String>()
+            .into_bytes()
+    }
+
+    // HTTP server serving files by path, using content digests for ETags.
+    #[derive(Default, Clone)]
+    pub(crate) struct Server {
+        files: Arc<Mutex<HashMap<String, Vec<u8>>>>,
+        requests: Arc<Mutex<Vec<String>>>,
+    }
+
+    impl Server {
+        pub(crate) fn start(&self) -> String {
+            let listener = TcpListener::bind("127.0.0.1:0").unwrap();
+            let addr = listener.local_addr().unwrap();
+            let server = self.clone();
+            thread::spawn(move || {
+                for stream in listener.incoming() {
+                    server.respond(stream.unwrap());
+                }
+            });
+            format!("http://{addr}/repo.tar.gz")
+        }
+
+        fn respond(&self, mut stream: std::net::TcpStream) {
+            let mut lines = BufReader::new(&stream).lines().map(|s| s.unwrap());
+            let request = lines.next().unwrap();
+            let path = request.split(' ').nth(1).unwrap().to_string();
+            let headers: Vec<_> = lines.take_while(|s| !s.is_empty()).collect();
+            self.requests.lock().unwrap().push(path.clone());
+
+            match self.files.lock().unwrap().get(&path) {
+                None => write!(stream, "HTTP/1.1 404 Not Found\r\nConnection: close\r\n\r\n"),
+                Some(body) => {
+                    let etag = format!("\"{}\"", digest(body));
+                    let cached = format!("if-none-match: {etag}");
+                    if headers.iter().any(|s| s.to_lowercase() == cached) {
+                        write!(stream, "HTTP/1.1 304 Not Modified\r\nConnection: close\r\n\r\n")
+                    } else {
+                        write!(
+                            stream,
+                            "HTTP/1.1 200 OK\r\nContent-Length: {}\r\nETag: {etag}\r\n\
+                            Connection: close\r\n\r\n",
+                            body.len()
+                        )
+                        .and_then(|_| stream.write_all(body))
+                    }
+                }
+            }
+            .unwrap();
+        }
+
+        fn set<T: Into<Vec<u8>>>(&self, path: &str, data: T) {
+            self.files
+                .lock()
+                .unwrap()
+                .insert(path.to_string(), data.into());
+        }
+
+        // Publish a repo snapshot, optionally including its manifest and unpacked files.
+        pub(crate) fn publish(&self, files: &[(&str, &str)], incremental: bool) {
+            self.files.lock().unwrap().clear();
+            self.set("/repo.tar.gz", tarball(files));
+            if incremental {
+                self.set("/repo.tar.gz.manifest", manifest(files));
+                for (path, data) in files {
+                    self.set(&format!("/repo.tar.gz.files/{path}"), *data);
+                }
+            }
+        }
+
+        fn requests(&self) -> Vec<String> {
+            std::mem::take(&mut self.requests.lock().unwrap())
+        }
+    }
+
+    pub(crate) fn repo(url: String) -> Repo {
+        Repo {
+            uri: format!("tar+{url}"),
+            url,
         }
+    }
+
+    fn inode(path: &Path) -> u64 {
+        fs::metadata(path).unwrap().ino()
+    }
+
+    #[tokio::test]
+    async fn sync() {
+        let dir = tempfile::tempdir().unwrap();
+        let path = dir.path().join("repo");
+        fs::create_dir(&path).unwrap();
+        fs::write(path.join("stale"), "").unwrap();
+
+        // large enough content to span many chunks at each pipeline stage
+        let ebuild: String = (0..100_000).map(|i| format!("# line {i}\n")).collect();
+        let files = [("profiles/repo_name", "test\n"), ("cat/pkg/pkg-1.ebuild", ebuild.as_str())];
+        let server = Server::default();
+        let repo = repo(server.start());
+        server.publish(&files, false);
+
+        repo.sync(&path, &Cancel::default()).await.unwrap();
+        assert!(!path.join("stale").exists());
+        assert_eq!(fs::read_to_string(path.join("profiles/repo_name")).unwrap(), "test\n");
+        assert_eq!(fs::read_to_string(path.join("cat/pkg/pkg-1.ebuild")).unwrap(), ebuild);
+        let etag = format!("\"{}\"", digest(&tarball(&files)));
+        assert_eq!(fs::read_to_string(path.join(".etag")).unwrap(), etag);
+        let data = fs::read(path.join(MANIFEST)).unwrap();
+        assert_eq!(data, manifest(&files));
+
+        // unchanged content is skipped
+        fs::write(path.join("local"), "").unwrap();
+        repo.sync(&path, &Cancel::default()).await.unwrap();
+        assert!(path.join("local").exists());
+
+        // temporary directories are removed
+        let entries: Vec<_> = fs::read_dir(dir.path()).unwrap().collect();
+        assert_eq!(entries.len(), 1);
+    }
+
+    #[test]
+    fn extract_symlink_escape() {
+        let dir = tempfile::tempdir().unwrap();
+        let (path, outside) = (dir.path().join("repo"), dir.path().join("outside"));
+        fs::create_dir(&path).unwrap();
+        fs::create_dir(&outside).unwrap();
+
+        // symlinked dir pointing outside the repo followed by a file under it
+        let mut builder = tar::Builder::new(vec![]);
+        let mut header = tar::Header::new_gnu();
+        header.set_entry_type(tar::EntryType::Symlink);
+        header.set_link_name(&outside).unwrap();
+        header.set_size(0);
+        header.set_mode(0o777);
+        builder
+            .append_data(&mut header, "repo-snapshot/escape", io::empty())
+            .unwrap();
+        let mut header = tar::Header::new_gnu();
+        header.set_size(4);
+        header.set_mode(0o644);
+        builder
+            .append_data(&mut header, "repo-snapshot/escape/file", "data".as_bytes())
+            .unwrap();
+        let data = builder.into_inner().unwrap();
+
+        let r = extract(data.as_slice(), &path, &Cancel::default());
+        assert!(matches!(r, Err(Error::RepoSync(_))));
+        assert!(!outside.join("file").exists());
+    }
+
+    #[tokio::test]
+    async fn sync_invalid() {
+        let dir = tempfile::tempdir().unwrap();
+        let path = dir.path().join("repo");
+        fs::create_dir(&path).unwrap();
+        fs::write(path.join("existing"), "").unwrap();
+        let server = Server::default();
+        let repo = repo(server.start());
+
+        // truncated archives fail and leave the existing repo untouched
+        let mut data = tarball(&[("profiles/repo_name", "test\n")]);
+        data.truncate(data.len() / 2);
+        server.set("/repo.tar.gz", data);
+        let r = repo.sync(&path, &Cancel::default()).await;
+        assert!(matches!(r, Err(Error::RepoSync(_))));
+        assert!(path.join("existing").exists());
+
+        // non-gzip data fails
+        server.set("/repo.tar.gz", "not a tarball");
+        let r = repo.sync(&path, &Cancel::default()).await;
+        assert!(matches!(r, Err(Error::RepoSync(_))));
+        assert!(path.join("existing").exists());
+    }
+
+    #[tokio::test]
+    async fn sync_cancel() {
+        let dir = tempfile::tempdir().unwrap();
+        let path = dir.path().join("repo");
+
+        // server that never responds
+        let listener = TcpListener::bind("127.0.0.1:0").unwrap();
+        let repo = repo(format!("http://{}/repo.tar.gz", listener.local_addr().unwrap()));
+
+        // stalled syncs stop when cancelled
+        let cancel = Cancel::default();
+        let canceller = cancel.clone();
+        tokio::spawn(async move {
+            tokio::time::sleep(Duration::from_millis(100)).await;
+            canceller.cancel();
+        });
+        let r = repo.sync(&path, &cancel).await;
+        assert!(matches!(r, Err(Error::RepoSync(_))));
+        assert!(cancel.is_cancelled());
+        assert_eq!(fs::read_dir(dir.path()).unwrap().count(), 0);
+
+        // already cancelled syncs fail immediately
+        let r = repo.sync(&path, &cancel).await;
+        assert!(matches!(r, Err(Error::RepoSync(_))));
+    }
+
+    #[tokio::test]
+    async fn sync_incremental() {
+        let dir = tempfile::tempdir().unwrap();
+        let path = dir.path().join("repo");
+        let server = Server::default();
+        let repo = repo(server.start());
+
+        let ebuilds: Vec<_> = (0..10).map(|i| format!("cat/pkg/pkg-{i}.ebuild")).collect();
+        let mut files: Vec<_> = ebuilds.iter().map(|s| (s.as_str(), "SLOT=0\n")).collect();
+        files.push(("profiles/repo_name", "test\n"));
+        files.push(("cat/old/old-1.ebuild", "SLOT=0\n"));
+        server.publish(&files, true);
+
+        // initial sync unpacks the tarball
+        assert!(repo
+            .sync(&path, &Cancel::default())
+            .await
+            .unwrap()
+            .is_none());
+        assert_eq!(server.requests(), ["/repo.tar.gz"]);
+        let unchanged = path.join("profiles/repo_name");
+        let ino = inode(&unchanged);
+
+        // update, add, and remove files
+        files[0].1 = "SLOT=1\n";
+        files.pop();
+        files.push(("cat/new/new-1.ebuild", "SLOT=0\n"));
+        server.publish(&files, true);
+
+        // only changed files are fetched
+        let changes = repo.sync(&path, &Cancel::default()).await.unwrap().unwrap();
+        let pkgs: Vec<_> = changes.pkgs.iter().collect();
+        assert_eq!(pkgs, ["cat/pkg", "cat/new", "cat/old"]);
+        let mut requests = server.requests();
+        requests.sort();
+        assert_eq!(
+            requests,
+            [
+                "/repo.tar.gz.files/cat/new/new-1.ebuild",
+                "/repo.tar.gz.files/cat/pkg/pkg-0.ebuild",
+                "/repo.tar.gz.manifest",
+            ]
+        );
+        assert_eq!(fs::read_to_string(path.join(files[0].0)).unwrap(), "SLOT=1\n");
+        assert!(path.join("cat/new/new-1.ebuild").exists());
+        assert!(!path.join("cat/old").exists());
+        assert_eq!(inode(&unchanged), ino);
+        assert_eq!(fs::read(path.join(MANIFEST)).unwrap(), manifest(&files));
+
+        // unchanged manifests are skipped
+        assert!(repo
+            .sync(&path, &Cancel::default())
+            .await
+            .unwrap()
+            .unwrap()
+            .is_empty());
+        assert_eq!(server.requests(), ["/repo.tar.gz.manifest"]);
+
+        // digest mismatches fall back to a full sync
+        files[1].1 = "SLOT=1\n";
+        server.publish(&files, true);
+        server.set(&format!("/repo.tar.gz.files/{}", files[1].0), "corrupted");
+        repo.sync(&path, &Cancel::default()).await.unwrap();
+        assert!(server.requests().contains(&"/repo.tar.gz".to_string()));
+        assert_eq!(fs::read_to_string(path.join(files[1].0)).unwrap(), "SLOT=1\n");
+        assert_ne!(inode(&unchanged), ino);
+
+        // missing manifests fall back to a full sync
+        files[2].1 = "SLOT=1\n";
+        server.publish(&files, false);
+        repo.sync(&path, &Cancel::default()).await.unwrap();
+        assert_eq!(server.requests(), ["/repo.tar.gz.manifest", "/repo.tar.gz"]);
+        assert_eq!(fs::read_to_string(path.join(files[2].0)).unwrap(), "SLOT=1\n");
+
+        // updates through symlinked parent dirs fall back to a full sync
+        let outside = dir.path().join("outside");
+        fs::create_dir(&outside).unwrap();
+        fs::write(outside.join("pkg-0.ebuild"), "outside\n").unwrap();
+        fs::remove_dir_all(path.join("cat/pkg")).unwrap();
+        std::os::unix::fs::symlink(&outside, path.join("cat/pkg")).unwrap();
+        files[0].1 = "SLOT=2\n";
+        server.publish(&files, true);
+        repo.sync(&path, &Cancel::default()).await.unwrap();
+        assert!(server.requests().contains(&"/repo.tar.gz".to_string()));
+        assert_eq!(fs::read_to_string(outside.join("pkg-0.ebuild")).unwrap(), "outside\n");
+        assert_eq!(fs::read_to_string(path.join(files[0].0)).unwrap(), "SLOT=2\n");
+        fs::remove_dir_all(&outside).unwrap();
+
+        // temporary directories are removed
+        let entries: Vec<_> = fs::read_dir(dir.path()).unwrap().collect();
+        assert_eq!(entries.len(), 1);
+    }
+
+    #[tokio::test]
+    async fn sync_metadata() {
+        let dir = tempfile::tempdir().unwrap();
+        let path = dir.path().join("repo");
+        let server = Server::default();
+        let repo = repo(server.start());
+
+        // Publish files with their modes, symlink data is the target.
+        let publish = |files: &[(&str, u32, &str)]| {
+            let encoder = GzEncoder::new(vec![], Compression::default());
+            let mut builder = tar::Builder::new(encoder);
+            let mut manifest = String::new();
+            for &(rel_path, mode, data) in files {
+                let mut header = tar::Header::new_gnu();
+                match mode {
+                    0o120000 => {
+                        header.set_entry_type(tar::EntryType::Symlink);
+                        header.set_link_name(data).unwrap();
+                        header.set_size(0);
+                        header.set_mode(0o777);
+                    }
+                    _ => {
+                        header.set_size(data.len() as u64);
+                        header.set_mode(mode & 0o777);
+                    }
+                }
+                let entry_data = if mode == 0o120000 { "" } else { data };
+                builder
+                    .append_data(
+                        &mut header,
+                        format!("repo-snapshot/{rel_path}"),
+                        entry_data.as_bytes(),
+                    )
+                    .unwrap();
+                manifest.push_str(&format!("{} {mode:06o} {rel_path}\n", digest(data.as_bytes())));
+                server.set(&format!("/repo.tar.gz.files/{rel_path}"), data);
+            }
+            server.set("/repo.tar.gz", builder.into_inner().unwrap().finish().unwrap());
+            server.set("/repo.tar.gz.manifest", manifest);
+        };
+        let mode = |p: &str| fs::metadata(path.join(p)).unwrap().permissions().mode() & 0o777;
+
+        let ebuilds: Vec<_> = (0..10).map(|i| format!("cat/pkg/pkg-{i}.ebuild")).collect();
+        let mut files: Vec<_> = ebuilds.iter().map(|s| (s.as_str(), 0o100644, "")).collect();
+        files.push(("profiles/repo_name", 0o100644, "test\n"));
+        files.push(("scripts/run", 0o100755, "v1"));
+        files.push(("link", 0o120000, "profiles/repo_name"));
+        publish(&files);
+
+        // full syncs record modes and symlinks
+        assert!(repo
+            .sync(&path, &Cancel::default())
+            .await
+            .unwrap()
+            .is_none());
+        assert_eq!(mode("scripts/run"), 0o755);
+        assert_eq!(fs::read_link(path.join("link")).unwrap(), Path::new("profiles/repo_name"));
+        let manifest = fs::read_to_string(path.join(MANIFEST)).unwrap();
+        assert!(manifest.contains(" 100755 scripts/run\n"));
+        assert!(manifest.contains(" 120000 link\n"));
+        server.requests();
 
-        Ok(())
+        // incremental updates apply modes and symlink types
+        files[0].1 = 0o100755;
+        files[11].2 = "v2";
+        files[12].2 = "scripts/run";
+        publish(&files);
+        let changes = repo.sync(&path, &Cancel::default()).await.unwrap().unwrap();
+        assert_eq!(changes.other.iter().collect::<Vec<_>>(), ["scripts/run", "link"]);
+        assert_eq!(server.requests().len(), 4);
+        assert_eq!(mode(files[0].0), 0o755);
+        assert_eq!(mode("scripts/run"), 0o755);
+        assert_eq!(fs::read_to_string(path.join("scripts/run")).unwrap(), "v2");
+        assert_eq!(fs::read_link(path.join("link")).unwrap(), Path::new("scripts/run"));
+        let manifest = Manifest::load(&path.join(MANIFEST)).unwrap();
+        assert_eq!(manifest.len(), files.len());
+        assert_eq!(manifest.get("link"), Some(&Record::symlink(b"scripts/run")));
     }
 }
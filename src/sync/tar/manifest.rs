@@ -0,0 +1,275 @@
+use std::fs;
+use std::io::{self, Write};
+use std::path::{Component, Path};
+
+use indexmap::IndexMap;
+use sha2::{Digest, Sha256};
+use tempfile::NamedTempFile;
+
+use crate::Error;
+
+/// Return the hex-encoded SHA256 digest for the given data.
+pub(super) fn digest(data: &[u8]) -> String {
+    format!("{:x}", Sha256::digest(data))
+}
+
+/// Writer computing the digest of all data written through it.
+pub(super) struct DigestWriter<W> {
+    inner: W,
+    hasher: Sha256,
+}
+
+impl<W: Write> DigestWriter<W> {
+    pub(super) fn new(inner: W) -> Self {
+        Self {
+            inner,
+            hasher: Sha256::new(),
+        }
+    }
+
+    /// Return the inner writer and the hex-encoded digest of the written data.
+    pub(super) fn finish(self) -> (W, String) {
+        (self.inner, format!("{:x}", self.hasher.finalize()))
+    }
+}
+
+impl<W: Write> Write for DigestWriter<W> {
+    fn write(&mut self, buf: &[u8]) -> io::Result<usize> {
+        let n = self.inner.write(buf)?;
+        self.hasher.update(&buf[..n]);
+        Ok(n)
+    }
+
+    fn flush(&mut self) -> io::Result<()> {
+        self.inner.flush()
+    }
+}
+
+// file type bits of manifest modes, matching those used by `st_mode`
+const S_IFMT: u32 = 0o170000;
+const S_IFREG: u32 = 0o100000;
+const S_IFLNK: u32 = 0o120000;
+
+/// Mode of files listed without one, matching the plain `sha256sum` output format.
+const DEFAULT_MODE: u32 = S_IFREG | 0o644;
+
+/// Manifest record for a regular file or symlink, symlink digests cover their targets.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub(super) struct Record {
+    pub(super) digest: String,
+    mode: u32,
+}
+
+impl Record {
+    /// Create a record for a regular file using the given permission bits.
+    pub(super) fn file(digest: String, perms: u32) -> Self {
+        Self {
+            digest,
+            mode: S_IFREG | (perms & 0o777),
+        }
+    }
+
+    /// Create a record for a symlink with the given target.
+    pub(super) fn symlink(target: &[u8]) -> Self {
+        Self {
+            digest: digest(target),
+            mode: S_IFLNK,
+        }
+    }
+
+    pub(super) fn is_symlink(&self) -> bool {
+        self.mode & S_IFMT == S_IFLNK
+    }
+
+    /// Return the permission bits for regular files.
+    pub(super) fn perms(&self) -> u32 {
+        self.mode & 0o777
+    }
+}
+
+/// File digests and modes for a repo snapshot.
+///
+/// Regular files with mode 0644 use the `sha256sum` output format while other entries include
+/// their octal mode between the digest and path, e.g. `100755` for executables or `120000` for
+/// symlinks.
+#[derive(Debug, Default, PartialEq, Eq)]
+pub(super) struct Manifest(IndexMap<String, Record>);
+
+/// Files differing between two manifests.
+#[derive(Debug, Default, PartialEq, Eq)]
+pub(super) struct Changes<'a> {
+    pub(super) updated: Vec<&'a str>,
+    pub(super) removed: Vec<&'a str>,
+}
+
+impl Manifest {
+    /// Parse a manifest, rejecting absolute paths or those that escape the repo.
+    pub(super) fn parse(data: &str) -> crate::Result<Self> {
+        let mut manifest = Manifest::default();
+        for (i, line) in data.lines().enumerate().filter(|(_, s)| !s.is_empty()) {
+            let err = || Error::RepoSync(format!("invalid manifest line {}: {line:?}", i + 1));
+            let (digest, rest) = line.split_once(' ').ok_or_else(err)?;
+            // paths are separated by a space and either a text or binary mode indicator, or
+            // an explicit file mode
+            let (mode, path) = match rest.strip_prefix(|c: char| c == ' ' || c == '*') {
+                Some(path) => (DEFAULT_MODE, path),
+                None => {
+                    let (mode, path) = rest.split_once(' ').ok_or_else(err)?;
+                    if mode.len() != 6 {
+                        return Err(err());
+                    }
+                    let mode = u32::from_str_radix(mode, 8).map_err(|_| err())?;
+                    if ![S_IFREG, S_IFLNK].contains(&(mode & S_IFMT)) {
+                        return Err(err());
+                    }
+                    (mode, path)
+                }
+            };
+            if digest.len() != 64 || !digest.bytes().all(|b| b.is_ascii_hexdigit()) {
+                return Err(err());
+            }
+            if path.is_empty()
+                || !Path::new(path)
+                    .components()
+                    .all(|c| matches!(c, Component::Normal(_)))
+            {
+                return Err(err());
+            }
+            let digest = digest.to_ascii_lowercase();
+            manifest.insert(path, Record { digest, mode });
+        }
+        Ok(manifest)
+    }
+
+    /// Load a previously written manifest, returning None if it's missing or invalid.
+    pub(super) fn load(path: &Path) -> Option<Self> {
+        let data = fs::read_to_string(path).ok()?;
+        Manifest::parse(&data).ok()
+    }
+
+    /// Atomically write the manifest to the given path.
+    pub(super) fn write(&self, path: &Path) -> crate::Result<()> {
+        let err = |e| Error::RepoSync(format!("failed writing manifest {path:?}: {e}"));
+        let dir = path.parent().unwrap();
+        let mut file = NamedTempFile::new_in(dir).map_err(err)?;
+        let mut data = String::new();
+        for (path, Record { digest, mode }) in &self.0 {
+            match *mode {
+                DEFAULT_MODE => data.push_str(&format!("{digest}  {path}\n")),
+                mode => data.push_str(&format!("{digest} {mode:06o} {path}\n")),
+            }
+        }
+        file.write_all(data.as_bytes()).map_err(err)?;
+        file.persist(path).map_err(|e| err(e.error))?;
+        Ok(())
+    }
+
+    pub(super) fn insert(&mut self, path: &str, record: Record) {
+        self.0.insert(path.to_string(), record);
+    }
+
+    pub(super) fn get(&self, path: &str) -> Option<&Record> {
+        self.0.get(path)
+    }
+
+    pub(super) fn len(&self) -> usize {
+        self.0.len()
+    }
+
+    /// Determine the files that are new or modified in, or removed from, the given manifest.
+    pub(super) fn changes<'a>(&'a self, other: &'a Manifest) -> Changes<'a> {
+        let updated = other
+            .0
+            .iter()
+            .filter(|(path, record)| self.0.get(*path) != Some(record))
+            .map(|(path, _)| path.as_str())
+            .collect();
+        let removed = self
+            .0
+            .keys()
+            .filter(|path| !other.0.contains_key(*path))
+            .map(|path| path.as_str())
+            .collect();
+        Changes { updated, removed }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn parse() {
+        let d1 = digest(b"1");
+        let d2 = digest(b"2");
+
+        // valid
+        let m = Manifest::parse(&format!("{d1}  a/b\n{d2} *c d\n\n")).unwrap();
+        assert_eq!(m.len(), 2);
+        assert_eq!(m.get("a/b"), Some(&Record::file(d1.clone(), 0o644)));
+        assert_eq!(m.get("c d").map(|r| r.digest.as_str()), Some(d2.as_str()));
+        assert_eq!(Manifest::parse("").unwrap(), Manifest::default());
+
+        // explicit modes
+        let m = Manifest::parse(&format!("{d1} 100755 bin/a b\n{d2} 120000 link\n")).unwrap();
+        let exe = m.get("bin/a b").unwrap();
+        assert!(!exe.is_symlink() && exe.perms() == 0o755);
+        assert_eq!(m.get("link"), Some(&Record::symlink(b"2")));
+
+        // invalid
+        for s in [
+            "a".to_string(),
+            format!("{d1} a"),
+            format!("{d1}  "),
+            format!("{d1}  /a"),
+            format!("{d1}  ../a"),
+            format!("{d1}  ./a"),
+            "abc  a".to_string(),
+            format!("{}  a", "z".repeat(64)),
+            format!("{d1} 644 a"),
+            format!("{d1} 100758 a"),
+            format!("{d1} 040755 a"),
+            format!("{d1} 100644 "),
+        ] {
+            assert!(Manifest::parse(&s).is_err(), "{s:?} didn't fail");
+        }
+    }
+
+    #[test]
+    fn changes() {
+        let (d1, d2) = (digest(b"1"), digest(b"2"));
+        let old = Manifest::parse(&format!("{d1}  a\n{d1}  b\n{d1}  c\n")).unwrap();
+        let new = Manifest::parse(&format!("{d1}  a\n{d2}  b\n{d1}  d\n")).unwrap();
+        let changes = old.changes(&new);
+        assert_eq!(changes.updated, ["b", "d"]);
+        assert_eq!(changes.removed, ["c"]);
+        assert_eq!(new.changes(&new), Changes::default());
+
+        // mode changes are updates
+        let exe = Manifest::parse(&format!("{d1} 100755 a\n{d2}  b\n{d1}  d\n")).unwrap();
+        assert_eq!(new.changes(&exe).updated, ["a"]);
+    }
+
+    #[test]
+    fn digest_writer() {
+        let mut writer = DigestWriter::new(vec![]);
+        writer.write_all(b"1").unwrap();
+        writer.write_all(b"2").unwrap();
+        let (data, digest) = writer.finish();
+        assert_eq!(data, b"12");
+        assert_eq!(digest, super::digest(b"12"));
+    }
+
+    #[test]
+    fn write() {
+        let dir = tempfile::tempdir().unwrap();
+        let path = dir.path().join("manifest");
+        let (d1, d2) = (digest(b"1"), digest(b"2"));
+        let data = format!("{d1}  a/b\n{d1} 100755 c\n{d2} 120000 d\n");
+        let manifest = Manifest::parse(&data).unwrap();
+        manifest.write(&path).unwrap();
+        assert_eq!(fs::read_to_string(&path).unwrap(), data);
+        assert_eq!(Manifest::load(&path).unwrap(), manifest);
+        assert!(Manifest::load(&dir.path().join("nonexistent")).is_none());
+    }
+}
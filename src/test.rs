@@ -1,6 +1,7 @@
 #![cfg(test)]
-use std::fs;
+use std::process::Command;
 use std::str::FromStr;
+use std::{env, fs};
 
 use camino::Utf8PathBuf;
 use itertools::Itertools;
@@ -142,3 +143,33 @@ where
 
     a == b
 }
+
+// Environment variable marking test binaries run by `in_subprocess()`.
+const SUBPROCESS_ENV: &str = "PKGCRAFT_TEST_SUBPROCESS";
+
+/// Run a test function in a separate single-threaded process, isolating any process-wide state
+/// it alters from concurrently running tests.
+///
+/// The test binary is reexecuted running only the given test, e.g.
+/// `concat!(module_path!(), "::name")`, on its main thread. Unlike forking the multithreaded
+/// test harness, this allows the function to safely fork processes itself.
+pub(crate) fn in_subprocess<F: FnOnce()>(test: &str, func: F) {
+    if env::var_os(SUBPROCESS_ENV).is_some() {
+        return func();
+    }
+
+    // test names are relative to the crate root
+    let name = test.split_once("::").map_or(test, |(_, name)| name);
+    let output = Command::new(env::current_exe().unwrap())
+        .args([name, "--exact", "--test-threads=1"])
+        .env(SUBPROCESS_ENV, "1")
+        .output()
+        .unwrap();
+    let stdout = String::from_utf8_lossy(&output.stdout);
+    let stderr = String::from_utf8_lossy(&output.stderr);
+    assert!(
+        output.status.success() && stdout.contains("1 passed"),
+        "{name} failed in subprocess: {}\n{stdout}{stderr}",
+        output.status
+    );
+}